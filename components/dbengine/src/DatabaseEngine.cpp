@@ -104,6 +104,17 @@
 // Also note that page cache and page size can be specified on a 
 // per db basis with keys like
 //  songbird.dbengine.main@library.songbirdnest.com.cacheSize
+//
+// readerCount enables write-ahead logging for a database and opens that
+// many additional read only connections. Queries made only of SELECT
+// statements are then executed on an idle reader while the writer has
+// nothing queued, so they don't wait behind it. Readers see the last committed
+// state of the database, so this is off (0) unless enabled on a per db
+// basis, e.g.
+//  songbird.dbengine.main@library.songbirdnest.com.readerCount
+//
+// collationKeyCacheSize is the number of library_collate keys each
+// connection keeps around, 0 to collate every comparison from scratch.
 
 #define PREF_BRANCH_BASE                      "songbird.dbengine."
 #define PREF_DB_PAGE_SIZE                     "pageSize"
@@ -111,6 +122,8 @@
 #define PREF_DB_PREALLOCCACHE_SIZE            "preAllocCacheSize"
 #define PREF_DB_PREALLOCSCRATCH_SIZE          "preAllocScratchSize"
 #define PREF_DB_SOFT_LIMIT                    "softHeapLimit"
+#define PREF_DB_READER_COUNT                  "readerCount"
+#define PREF_COLLATION_KEY_CACHE_SIZE         "collationKeyCacheSize"
 
 // These constants come from sbLocalDatabaseLibraryLoader.cpp
 // Do not change these constants unless you are changing them in 
@@ -136,11 +149,18 @@
 #define DEFAULT_PAGE_SIZE             16384
 #define DEFAULT_CACHE_SIZE            16000
 
+// no reader connections unless asked for
+#define DEFAULT_READER_COUNT          0
+#define MAX_READER_COUNT              8
+
 // pre-allocated for caching
 #define DEFAULT_PREALLOCCACHE_SIZE    0
 // pre-allocated for scratch memory
 #define DEFAULT_PREALLOCSCRATCH_SIZE  0
 
+// a few MB of collation keys per connection
+#define DEFAULT_COLLATION_KEY_CACHE_SIZE  10000
+
 #define SQLITE_MAX_RETRIES            666
 #define MAX_BUSY_RETRY_CLOSE_DB       10
 
@@ -957,6 +977,7 @@ CDatabaseEngine::CDatabaseEngine()
 , m_AddedIdleObserver(PR_FALSE)
 , m_pPageSpace(nsnull)
 , m_pScratchSpace(nsnull)
+, m_CollationKeyCacheSize(DEFAULT_COLLATION_KEY_CACHE_SIZE)
 #ifdef XP_MACOSX
 , m_Collator(nsnull)
 #endif
@@ -1073,6 +1094,17 @@ NS_IMETHODIMP CDatabaseEngine::Init()
   setlocale(LC_COLLATE, mCollationLocale.get());
 #endif
 
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_GetService(NS_PREFSERVICE_CONTRACTID, &rv);
+  if (NS_SUCCEEDED(rv)) {
+    PRInt32 keyCacheSize;
+    rv = prefBranch->GetIntPref(PREF_BRANCH_BASE PREF_COLLATION_KEY_CACHE_SIZE,
+                                &keyCacheSize);
+    if (NS_SUCCEEDED(rv) && keyCacheSize >= 0) {
+      m_CollationKeyCacheSize = keyCacheSize;
+    }
+  }
+
   m_pThreadPool = do_CreateInstance("@mozilla.org/thread-pool;1", &rv);
   NS_ENSURE_SUCCESS(rv, rv);
 
@@ -1318,7 +1350,8 @@ nsresult CDatabaseEngine::InitMemoryConstraints()
 //-----------------------------------------------------------------------------
 nsresult CDatabaseEngine::GetDBPrefs(const nsAString &dbGUID,
                                      PRInt32 *cacheSize, 
-                                     PRInt32 *pageSize)
+                                     PRInt32 *pageSize,
+                                     PRInt32 *readerCount)
 {
   nsresult rv = NS_OK;
   
@@ -1339,6 +1372,11 @@ nsresult CDatabaseEngine::GetDBPrefs(const nsAString &dbGUID,
     NS_WARNING("DBEngine failed to get page size pref. Using default.");
     *pageSize = DEFAULT_PAGE_SIZE; 
   }
+
+  if (NS_FAILED(rv) || NS_FAILED(prefBranch->GetIntPref(PREF_DB_READER_COUNT,
+                                                        readerCount))) {
+    *readerCount = DEFAULT_READER_COUNT;
+  }
   
   // Now try for values that are specific to this database guid
   // e.g. songbird.dbengine.main@library.songbirdnest.com.cacheSize
@@ -1349,6 +1387,14 @@ nsresult CDatabaseEngine::GetDBPrefs(const nsAString &dbGUID,
           getter_AddRefs(prefBranch)))) {
     prefBranch->GetIntPref(PREF_DB_CACHE_SIZE, cacheSize);
     prefBranch->GetIntPref(PREF_DB_PAGE_SIZE, pageSize);    
+    prefBranch->GetIntPref(PREF_DB_READER_COUNT, readerCount);
+  }
+
+  if (*readerCount < 0) {
+    *readerCount = 0;
+  }
+  else if (*readerCount > MAX_READER_COUNT) {
+    *readerCount = MAX_READER_COUNT;
   }
 
   return rv;
@@ -1357,7 +1403,8 @@ nsresult CDatabaseEngine::GetDBPrefs(const nsAString &dbGUID,
 //-----------------------------------------------------------------------------
 nsresult CDatabaseEngine::OpenDB(const nsAString &dbGUID,
                                  CDatabaseQuery *pQuery,
-                                 sqlite3 ** ppHandle)
+                                 sqlite3 ** ppHandle,
+                                 PRBool aReadOnly /* = PR_FALSE */)
 {
   sqlite3 *pHandle = nsnull;
 
@@ -1375,7 +1422,16 @@ nsresult CDatabaseEngine::OpenDB(const nsAString &dbGUID,
     }
   }
  
-  PRInt32 ret = sqlite3_open(NS_ConvertUTF16toUTF8(strFilename).get(), &pHandle);
+  PRInt32 ret = SQLITE_OK;
+  if (aReadOnly) {
+    ret = sqlite3_open_v2(NS_ConvertUTF16toUTF8(strFilename).get(), 
+                          &pHandle,
+                          SQLITE_OPEN_READONLY,
+                          nsnull);
+  }
+  else {
+    ret = sqlite3_open(NS_ConvertUTF16toUTF8(strFilename).get(), &pHandle);
+  }
   NS_ASSERTION(ret == SQLITE_OK, "Failed to open database: sqlite_open failed!");
   NS_ENSURE_TRUE(ret == SQLITE_OK, NS_ERROR_UNEXPECTED);
   
@@ -1404,6 +1460,7 @@ nsresult CDatabaseEngine::OpenDB(const nsAString &dbGUID,
   NS_ENSURE_TRUE(ret == SQLITE_OK, NS_ERROR_UNEXPECTED);
 
   collationBuffers *collationBuffersEntry = new collationBuffers();
+  collationBuffersEntry->keyCache.setMaxEntries(m_CollationKeyCacheSize);
 
   {
     nsAutoMonitor mon(m_CollationBuffersMapMonitor);
@@ -1437,14 +1494,16 @@ nsresult CDatabaseEngine::OpenDB(const nsAString &dbGUID,
 
   PRInt32 pageSize = DEFAULT_PAGE_SIZE;
   PRInt32 cacheSize = DEFAULT_CACHE_SIZE;
+  PRInt32 readerCount = DEFAULT_READER_COUNT;
   
-  if (NS_FAILED(GetDBPrefs(dbGUID, &cacheSize, &pageSize))) {
+  if (NS_FAILED(GetDBPrefs(dbGUID, &cacheSize, &pageSize, &readerCount))) {
     NS_WARNING("DBEngine failed to get memory prefs. Using default.");
   }
 
   nsCString query;
   
-  {
+  // The page size can only be set by the connection creating the database.
+  if (!aReadOnly) {
     char *strErr = nsnull;
     query = NS_LITERAL_CSTRING("PRAGMA page_size = ");
     query.AppendInt(pageSize);
@@ -1467,7 +1526,7 @@ nsresult CDatabaseEngine::OpenDB(const nsAString &dbGUID,
   }
 
 #if defined(USE_SQLITE_FULL_DISK_CACHING)
-  {
+  if (!aReadOnly) {
     char *strErr = nsnull;
     sqlite3_exec(pHandle, "PRAGMA synchronous = 0", nsnull, nsnull, &strErr);
     if(strErr) {
@@ -1538,6 +1597,35 @@ nsresult CDatabaseEngine::CloseDB(sqlite3 *pHandle)
   return NS_OK;
 } //CloseDB
 
+//-----------------------------------------------------------------------------
+nsresult CDatabaseEngine::EnableWriteAheadLog(sqlite3 *pHandle, 
+                                              PRBool *aEnabled)
+{
+  NS_ENSURE_ARG_POINTER(pHandle);
+  NS_ENSURE_ARG_POINTER(aEnabled);
+
+  *aEnabled = PR_FALSE;
+
+  sqlite3_stmt *pStmt = nsnull;
+  PRInt32 ret = sqlite3_prepare_v2(pHandle,
+                                   "PRAGMA journal_mode = WAL",
+                                   -1,
+                                   &pStmt,
+                                   nsnull);
+  NS_ENSURE_TRUE(ret == SQLITE_OK, NS_ERROR_FAILURE);
+
+  // The pragma returns the journal mode that is actually in effect, which
+  // is left untouched by versions of sqlite that don't know about WAL.
+  if (sqlite3_step(pStmt) == SQLITE_ROW) {
+    const char *mode = (const char *)sqlite3_column_text(pStmt, 0);
+    *aEnabled = (mode && !strnicmp(mode, "wal", 3)) ? PR_TRUE : PR_FALSE;
+  }
+
+  sqlite3_finalize(pStmt);
+
+  return NS_OK;
+} //EnableWriteAheadLog
+
 //-----------------------------------------------------------------------------
 NS_IMETHODIMP CDatabaseEngine::CloseDatabase(const nsAString &aDatabaseGUID) 
 {
@@ -1549,9 +1637,17 @@ NS_IMETHODIMP CDatabaseEngine::CloseDatabase(const nsAString &aDatabaseGUID)
     nsresult rv = pQueue->PrepareForShutdown();
     NS_ENSURE_SUCCESS(rv, rv);
 
+    PRInt32 readerCount = pQueue->m_Readers.Length();
+
     rv = pQueue->Shutdown();
     NS_ENSURE_SUCCESS(rv, rv);
 
+    // Give back the threads the readers were using.
+    if(readerCount) {
+      rv = AdjustThreadLimit(-readerCount);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
     m_QueuePool.Remove(aDatabaseGUID);
   }
 
@@ -1596,6 +1692,17 @@ PRInt32 CDatabaseEngine::SubmitQueryPrivate(CDatabaseQuery *pQuery)
   nsRefPtr<QueryProcessorQueue> pQueue = GetQueueByQuery(pQuery, PR_TRUE);
   NS_ENSURE_TRUE(pQueue, 1);
 
+  // Queries that only read can run on one of the reader connections, but
+  // only once the writer is done. Readers only see committed writes, a read
+  // sent there while writes are still queued would miss them.
+  if(pQueue->m_Readers.Length() && pQuery->IsReadOnly() &&
+     pQueue->IsIdle()) {
+    nsRefPtr<QueryProcessorQueue> pReader = GetReaderQueue(pQueue);
+    if(pReader) {
+      pQueue = pReader;
+    }
+  }
+
   nsresult rv = pQueue->PushQueryToQueue(pQuery);
   NS_ENSURE_SUCCESS(rv, 1);
 
@@ -1748,6 +1855,16 @@ already_AddRefed<QueryProcessorQueue> CDatabaseEngine::CreateQueueFromQuery(CDat
   rv = pQueue->Init(this, strGUID, pHandle);
   NS_ENSURE_SUCCESS(rv, nsnull);
 
+  PRInt32 pageSize = DEFAULT_PAGE_SIZE;
+  PRInt32 cacheSize = DEFAULT_CACHE_SIZE;
+  PRInt32 readerCount = DEFAULT_READER_COUNT;
+
+  rv = GetDBPrefs(strGUID, &cacheSize, &pageSize, &readerCount);
+  if(NS_SUCCEEDED(rv) && readerCount > 0) {
+    rv = CreateReaderQueues(pQueue, pQuery, readerCount);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Failed to open reader connections.");
+  }
+
   PRBool success = m_QueuePool.Put(strGUID, pQueue);
   NS_ENSURE_TRUE(success, nsnull);
 
@@ -1757,6 +1874,103 @@ already_AddRefed<QueryProcessorQueue> CDatabaseEngine::CreateQueueFromQuery(CDat
   return p;
 }
 
+//-----------------------------------------------------------------------------
+nsresult CDatabaseEngine::CreateReaderQueues(QueryProcessorQueue *aWriterQueue,
+                                             CDatabaseQuery *pQuery,
+                                             PRInt32 aReaderCount)
+{
+  NS_ENSURE_ARG_POINTER(aWriterQueue);
+  NS_ENSURE_ARG_POINTER(pQuery);
+
+  PRBool walEnabled = PR_FALSE;
+  nsresult rv = EnableWriteAheadLog(aWriterQueue->m_pHandle, &walEnabled);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if(!walEnabled) {
+    NS_WARNING("Write-ahead logging not available, not opening readers.");
+    return NS_OK;
+  }
+
+  for(PRInt32 current = 0; current < aReaderCount; current++) {
+    sqlite3 *pHandle = nsnull;
+    rv = OpenDB(aWriterQueue->m_GUID, pQuery, &pHandle, PR_TRUE);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsRefPtr<QueryProcessorQueue> pReader(new QueryProcessorQueue());
+    if(!pReader) {
+      CloseDB(pHandle);
+      return NS_ERROR_OUT_OF_MEMORY;
+    }
+
+    rv = pReader->Init(this, aWriterQueue->m_GUID, pHandle);
+    if(NS_FAILED(rv)) {
+      CloseDB(pHandle);
+      return rv;
+    }
+
+    nsRefPtr<QueryProcessorQueue> *p = 
+      aWriterQueue->m_Readers.AppendElement(pReader);
+    NS_ENSURE_TRUE(p, NS_ERROR_OUT_OF_MEMORY);
+
+    // Readers need threads of their own, don't let them starve the writers.
+    // CloseDatabase gives the thread back.
+    rv = AdjustThreadLimit(1);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+//-----------------------------------------------------------------------------
+nsresult CDatabaseEngine::AdjustThreadLimit(PRInt32 aDelta)
+{
+  nsAutoMonitor mon(m_pThreadMonitor);
+
+  PRUint32 threadLimit = 0;
+  nsresult rv = m_pThreadPool->GetThreadLimit(&threadLimit);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ASSERTION(aDelta >= 0 || threadLimit > (PRUint32)-aDelta,
+               "Giving back more threads than were added");
+
+  rv = m_pThreadPool->SetThreadLimit(threadLimit + aDelta);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+//-----------------------------------------------------------------------------
+already_AddRefed<QueryProcessorQueue> 
+CDatabaseEngine::GetReaderQueue(QueryProcessorQueue *aWriterQueue)
+{
+  NS_ENSURE_TRUE(aWriterQueue, nsnull);
+
+  nsAutoMonitor mon(m_pThreadMonitor);
+
+  QueryProcessorQueue *pReader = nsnull;
+  PRUint32 leastQueued = PR_UINT32_MAX;
+
+  PRUint32 length = aWriterQueue->m_Readers.Length();
+  for(PRUint32 current = 0; current < length; current++) {
+    QueryProcessorQueue *pCandidate = aWriterQueue->m_Readers[current];
+    if(pCandidate->IsIdle()) {
+      pReader = pCandidate;
+      break;
+    }
+
+    PRUint32 queueSize = 0;
+    pCandidate->GetQueueSize(queueSize);
+    if(queueSize < leastQueued) {
+      leastQueued = queueSize;
+      pReader = pCandidate;
+    }
+  }
+
+  NS_IF_ADDREF(pReader);
+
+  return pReader;
+}
+
 nsresult
 CDatabaseEngine::MarkDatabaseForPotentialDeletion(const nsAString &aDatabaseGUID,
                                                   CDatabaseQuery *pQuery)
@@ -2150,10 +2364,22 @@ CDatabaseEngine::RunAnalyze()
       return;
     }
 
-    for(PRUint32 currentQuery = 0; currentQuery < nQueryCount && !pQuery->m_IsAborting; ++currentQuery)
+    // With a row callback the result only ever holds the current row.
+    nsCOMPtr<sbIDatabaseRowCallback> rowCallback;
+    pQuery->GetRowCallback(getter_AddRefs(rowCallback));
+    PRBool rowCallbackFailed = PR_FALSE;
+
+    nsAutoString dbName;
+    pQuery->GetDatabaseGUID(dbName);
+
+    // Takes over each statement's parameters in turn, so they are bound
+    // without being copied
+    bindParameterArray_t parameters;
+
+    for(PRUint32 currentQuery = 0;
+        currentQuery < nQueryCount && !pQuery->m_IsAborting && !rowCallbackFailed;
+        ++currentQuery)
     {
-      nsAutoPtr<bindParameterArray_t> pParameters;
-      
       int retDB = 0; // sqlite return code.
       
       nsCOMPtr<sbIDatabasePreparedStatement> preparedStatement;
@@ -2180,10 +2406,7 @@ CDatabaseEngine::RunAnalyze()
       pQuery->m_CurrentQuery = currentQuery;
       PR_Unlock(pQuery->m_pLock);
 
-      pParameters = pQuery->PopQueryParameters();
-
-      nsAutoString dbName;
-      pQuery->GetDatabaseGUID(dbName);
+      pQuery->PopQueryParameters(parameters);
 
       BEGIN_PERFORMANCE_LOG(strQuery, dbName);
 
@@ -2193,8 +2416,8 @@ CDatabaseEngine::RunAnalyze()
 
       // If we have parameters for this query, bind them
       PRUint32 i = 0; // we need the index as well to know where to bind our values.
-      bindParameterArray_t::const_iterator const end = pParameters->end();
-      for (bindParameterArray_t::const_iterator paramIter = pParameters->begin();
+      bindParameterArray_t::const_iterator const end = parameters.end();
+      for (bindParameterArray_t::const_iterator paramIter = parameters.begin();
            paramIter != end;
            ++paramIter, ++i) {
         const CQueryParameter& p = *paramIter;
@@ -2276,12 +2499,8 @@ CDatabaseEngine::RunAnalyze()
               databaseResult->SetColumnNames(vColumnNames);
             }
 
-            std::vector<nsString> vCellValues;
-            vCellValues.reserve(nCount);
-
             TRACE("DBE: Result row %d:", totalRows);
 
-            int k = 0;
             // If this is a rolling limit query, increment the rolling
             // sum by the value of the  specified column index.
             if (rollingLimit > 0) {
@@ -2293,27 +2512,28 @@ CDatabaseEngine::RunAnalyze()
             // limit query, or if this is a rolling limit query and the
             // rolling sum has met or exceeded the limit
             if (rollingLimit == 0 || rollingSum >= rollingLimit) {
-              for(; k < nCount; k++)
-              {
-                const char *p = (const char *)sqlite3_column_text(pStmt, k);
-                nsString strCellValue;
-                if (p) {
-                  strCellValue = NS_ConvertUTF8toUTF16(p);
-                }
-                else {
-                  strCellValue.SetIsVoid(PR_TRUE);
-                }
-
-                vCellValues.push_back(strCellValue);
-                TRACE("Column %d: '%s' ", k,
-                  NS_ConvertUTF16toUTF8(strCellValue).get());
-              }
+              // The result copies the cells straight out of the statement,
+              // conversion to UTF-16 only happens when a cell is read.
               totalRows++;
 
-              databaseResult->AddRow(vCellValues);
+              if (rowCallback) {
+                databaseResult->ClearRows();
+                databaseResult->AddRow(pStmt);
+
+                rv = rowCallback->OnRow(databaseResult);
+                if (NS_FAILED(rv)) {
+                  LOG("DBE: Row callback failed, aborting query.");
+                  pQuery->SetLastError(SQLITE_ABORT);
+                  rowCallbackFailed = PR_TRUE;
+                  finishEarly = PR_TRUE;
+                }
+              }
+              else {
+                databaseResult->AddRow(pStmt);
+              }
 
               // If this is a rolling limit query, we're done
-              if (rollingLimit > 0) {
+              if (rollingLimit > 0 && !rowCallbackFailed) {
                 pQuery->SetRollingLimitResult(rollingRowCount);
                 pQuery->SetLastError(SQLITE_OK);
                 TRACE("Rolling limit query complete, %d rows", totalRows);
@@ -2362,6 +2582,10 @@ CDatabaseEngine::RunAnalyze()
             !pQuery->m_IsAborting &&
             !finishEarly);
 
+      if (rowCallback) {
+        databaseResult->ClearRows();
+      }
+
       pQuery->SetResultObject(databaseResult);
 
       // Quoth the sqlite wiki:
@@ -2566,6 +2790,88 @@ NS_IMETHODIMP CDatabaseEngine::SetLocaleCollationEnabled(PRBool aEnabled)
   return NS_OK;
 }
 
+NS_IMETHODIMP CDatabaseEngine::Collate(const nsAString &aString1,
+                                       const nsAString &aString2,
+                                       PRInt32 *_retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  // go through the same path sqlite uses for utf8 databases so that the
+  // result is always consistent with the library_collate ordering.
+  NS_ConvertUTF16toUTF8 a(aString1);
+  NS_ConvertUTF16toUTF8 b(aString2);
+
+  collationBuffers cBuffers;
+  *_retval = library_collate_func_utf8(&cBuffers,
+                                       a.Length(),
+                                       a.BeginReading(),
+                                       b.Length(),
+                                       b.BeginReading());
+  return NS_OK;
+}
+
+PRBool CDatabaseEngine::MakeCollationKey(const NATIVE_CHAR_TYPE *aStr,
+                                         PRUint32 aLength,
+                                         collationKeyCache::key_t &aKey) {
+#ifdef XP_MACOSX
+
+  if (!m_Collator)
+    return PR_FALSE;
+
+  // keys are usually a few values per character, grow the buffer if the
+  // collator says it is too small
+  ItemCount keySize = aLength * 4 + 16;
+  for (int attempt = 0; attempt < 4; attempt++) {
+    aKey.resize(keySize);
+    ItemCount actualSize;
+    OSStatus err = ::UCGetCollationKey(m_Collator,
+                                       aStr,
+                                       aLength,
+                                       keySize,
+                                       &actualSize,
+                                       &aKey[0]);
+    if (err == noErr) {
+      aKey.resize(actualSize);
+      return PR_TRUE;
+    }
+    if (err != kCollateBufferTooSmall)
+      return PR_FALSE;
+    keySize *= 4;
+  }
+  return PR_FALSE;
+
+#else
+
+  // by definition, comparing the transformed strings with wcscmp gives the
+  // same result as comparing the originals with wcscoll
+  size_t keySize = wcsxfrm(NULL, (const wchar_t *)aStr, 0);
+  if (keySize >= (size_t)PR_INT32_MAX)
+    return PR_FALSE;
+  aKey.resize(keySize + 1);
+  wcsxfrm(&aKey[0], (const wchar_t *)aStr, keySize + 1);
+  aKey.resize(keySize);
+  return PR_TRUE;
+
+#endif
+}
+
+const collationKeyCache::key_t *
+CDatabaseEngine::GetCollationKey(collationBuffers *aCollationBuffers,
+                                 const NATIVE_CHAR_TYPE *aStr) {
+  collationKeyCache &cache = aCollationBuffers->keyCache;
+  PRUint32 length = native_wcslen(aStr);
+
+  const collationKeyCache::key_t *key = cache.lookup(aStr, length);
+  if (key)
+    return key;
+
+  collationKeyCache::key_t newKey;
+  if (!MakeCollationKey(aStr, length, newKey))
+    return nsnull;
+
+  return cache.insert(aStr, length, newKey);
+}
+
 PRInt32 CDatabaseEngine::CollateForCurrentLocale(collationBuffers *aCollationBuffers, 
                                                  const NATIVE_CHAR_TYPE *aStr1, 
                                                  const NATIVE_CHAR_TYPE *aStr2) {
@@ -2575,6 +2881,32 @@ PRInt32 CDatabaseEngine::CollateForCurrentLocale(collationBuffers *aCollationBuf
 
   PRInt32 retval;
 
+  // compare the cached collation keys of the two strings if we can, this
+  // gives the same result as collating the strings themselves
+  if (aCollationBuffers->keyCache.enabled()) {
+    aCollationBuffers->keyCache.trim();
+    const collationKeyCache::key_t *key1 =
+      GetCollationKey(aCollationBuffers, aStr1);
+    const collationKeyCache::key_t *key2 =
+      key1 ? GetCollationKey(aCollationBuffers, aStr2) : nsnull;
+    if (key1 && key2) {
+#ifdef XP_MACOSX
+      Boolean equivalent;
+      SInt32 order;
+      OSStatus err = ::UCCompareCollationKeys(key1->empty() ? nsnull : &(*key1)[0],
+                                              key1->size(),
+                                              key2->empty() ? nsnull : &(*key2)[0],
+                                              key2->size(),
+                                              &equivalent,
+                                              &order);
+      if (err == noErr)
+        return order;
+#else
+      return key1->compare(*key2);
+#endif
+    }
+  }
+
   // apply the proper collation algorithm, depending on the user's locale.
   
   // note that it is impossible to use the proper sort for *all* languages at
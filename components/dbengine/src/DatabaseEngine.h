@@ -39,6 +39,8 @@
 #include <deque>
 #include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 #include "DatabaseQuery.h"
 #include "sbIDatabaseEngine.h"
@@ -87,6 +89,84 @@ class CDatabaseDumpProcessor;
 
 class collationBuffers;
 
+// Holds the collation key of the strings that have been handed to
+// CollateForCurrentLocale, so that a string which takes part in many
+// comparisons (as happens when sqlite sorts a result set or rebuilds an
+// index) is only run through the locale's collation tables once. After that,
+// collating two strings costs two lookups and a binary compare of their keys.
+// Keys depend on the collation locale, which is selected once for the
+// lifetime of the engine, so they never need to be invalidated.
+//
+// Each connection has its own cache, in its collationBuffers, so no locking
+// is needed. The cache is simply emptied when it gets full.
+class collationKeyCache {
+public:
+#ifdef XP_MACOSX
+  typedef std::vector<UCCollationValue> key_t;
+#else
+  typedef std::wstring key_t;
+#endif
+
+  collationKeyCache() :
+    mMaxEntries(0) {}
+
+  inline void setMaxEntries(PRUint32 aMaxEntries) {
+    mMaxEntries = aMaxEntries;
+    mEntries.clear();
+  }
+  inline PRBool enabled() {
+    return mMaxEntries > 0;
+  }
+  // Make room for the keys of an upcoming comparison. Keys returned by
+  // lookup and insert remain valid until the next call to trim.
+  inline void trim() {
+    if (mEntries.size() >= mMaxEntries)
+      mEntries.clear();
+  }
+  inline const key_t *lookup(const NATIVE_CHAR_TYPE *aStr, PRUint32 aLength) {
+    PRUint32 hash = hashString(aStr, aLength);
+    std::pair<entries_t::iterator, entries_t::iterator> range =
+      mEntries.equal_range(hash);
+    for (entries_t::iterator it = range.first; it != range.second; ++it) {
+      const std::vector<NATIVE_CHAR_TYPE> &str = it->second.str;
+      if (str.size() == aLength &&
+          (!aLength ||
+           !memcmp(&str[0], aStr, aLength * sizeof(NATIVE_CHAR_TYPE)))) {
+        return &it->second.key;
+      }
+    }
+    return nsnull;
+  }
+  // Takes the contents of aKey
+  inline const key_t *insert(const NATIVE_CHAR_TYPE *aStr,
+                             PRUint32 aLength,
+                             key_t &aKey) {
+    entries_t::iterator it =
+      mEntries.insert(std::make_pair(hashString(aStr, aLength), entry()));
+    it->second.str.assign(aStr, aStr + aLength);
+    it->second.key.swap(aKey);
+    return &it->second.key;
+  }
+private:
+  static inline PRUint32 hashString(const NATIVE_CHAR_TYPE *aStr,
+                                    PRUint32 aLength) {
+    // FNV-1a
+    PRUint32 hash = 2166136261U;
+    for (PRUint32 i = 0; i < aLength; i++) {
+      hash ^= (PRUint32)aStr[i];
+      hash *= 16777619U;
+    }
+    return hash;
+  }
+  struct entry {
+    std::vector<NATIVE_CHAR_TYPE> str;
+    key_t key;
+  };
+  typedef std::multimap<PRUint32, entry> entries_t;
+  entries_t mEntries;
+  PRUint32 mMaxEntries;
+};
+
 class CDatabaseEngine : public sbIDatabaseEngine,
                         public nsIObserver
 {
@@ -117,13 +197,35 @@ protected:
 
   nsresult OpenDB(const nsAString &dbGUID, 
                   CDatabaseQuery *pQuery,
-                  sqlite3 ** ppHandle);
+                  sqlite3 ** ppHandle,
+                  PRBool aReadOnly = PR_FALSE);
 
   nsresult CloseDB(sqlite3 *pHandle);
 
   already_AddRefed<QueryProcessorQueue> GetQueueByQuery(CDatabaseQuery *pQuery, PRBool bCreate = PR_FALSE);
   already_AddRefed<QueryProcessorQueue> CreateQueueFromQuery(CDatabaseQuery *pQuery);
 
+  /**
+   * Open the pool of read only connections for the database served by
+   * aWriterQueue. Does nothing if the database could not be switched to
+   * write-ahead logging, since readers would otherwise block on the writer.
+   */
+  nsresult CreateReaderQueues(QueryProcessorQueue *aWriterQueue,
+                              CDatabaseQuery *pQuery,
+                              PRInt32 aReaderCount);
+
+  /**
+   * Pick the reader queue of aWriterQueue that should execute the next read
+   * only query: the first idle one, or else the least busy one.
+   */
+  already_AddRefed<QueryProcessorQueue> GetReaderQueue(QueryProcessorQueue *aWriterQueue);
+
+  /**
+   * Raise or lower the thread pool's thread limit by aDelta, for the threads
+   * used by the reader queues of open databases.
+   */
+  nsresult AdjustThreadLimit(PRInt32 aDelta);
+
   PRInt32 SubmitQueryPrivate(CDatabaseQuery *pQuery);
 
   static void PR_CALLBACK QueryProcessor(CDatabaseEngine* pEngine,
@@ -142,7 +244,10 @@ private:
   
   nsresult GetDBPrefs(const nsAString &dbGUID,
                       PRInt32 *cacheSize, 
-                      PRInt32 *pageSize);
+                      PRInt32 *pageSize,
+                      PRInt32 *readerCount);
+
+  nsresult EnableWriteAheadLog(sqlite3 *pHandle, PRBool *aEnabled);
                       
   nsresult CreateDBStorePath();
   nsresult GetDBStorePath(const nsAString &dbGUID, CDatabaseQuery *pQuery, nsAString &strPath);
@@ -156,6 +261,11 @@ private:
   PRInt32 CollateForCurrentLocale(collationBuffers *aCollationBuffers,
                                   const NATIVE_CHAR_TYPE *aStr1,
                                   const NATIVE_CHAR_TYPE *aStr2);
+  PRBool MakeCollationKey(const NATIVE_CHAR_TYPE *aStr,
+                          PRUint32 aLength,
+                          collationKeyCache::key_t &aKey);
+  const collationKeyCache::key_t *GetCollationKey(collationBuffers *aCollationBuffers,
+                                                  const NATIVE_CHAR_TYPE *aStr);
 
   nsresult MarkDatabaseForPotentialDeletion(const nsAString &aDatabaseGUID, 
                                             CDatabaseQuery *pQuery);
@@ -207,6 +317,9 @@ private:
   void* m_pPageSpace;
   void* m_pScratchSpace;
 
+  // Number of collation keys each connection may cache, 0 to disable
+  PRUint32 m_CollationKeyCacheSize;
+
   nsCString mCollationLocale;
 #ifdef XP_MACOSX
   CollatorRef m_Collator;
@@ -360,12 +473,25 @@ public:
   nsresult PrepareForShutdown() {
     NS_ENSURE_TRUE(m_pEngine, NS_ERROR_NOT_INITIALIZED);
     m_Shutdown = PR_TRUE;
+
+    PRUint32 length = m_Readers.Length();
+    for(PRUint32 current = 0; current < length; current++) {
+      nsresult rv = m_Readers[current]->PrepareForShutdown();
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
     
     nsAutoMonitor mon(m_pQueueMonitor);
     return mon.NotifyAll();
   }
 
   nsresult Shutdown() {
+    PRUint32 length = m_Readers.Length();
+    for(PRUint32 current = 0; current < length; current++) {
+      nsresult rv = m_Readers[current]->Shutdown();
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    m_Readers.Clear();
+
     nsresult rv = ClearQueue();
     NS_ENSURE_SUCCESS(rv, rv);
 
@@ -376,6 +502,11 @@ public:
     return NS_OK;
   }
 
+  PRBool IsIdle() {
+    nsAutoMonitor mon(m_pQueueMonitor);
+    return !m_Running && !m_Queue.Length();
+  }
+
 protected:
   CDatabaseEngine* m_pEngine;
   nsCOMPtr<nsIEventTarget> m_pEventTarget;
@@ -392,6 +523,10 @@ protected:
   queryqueue_t  m_Queue;
 
   PRUint32      m_AnalyzeCount;
+
+  // Read only connections to the same database, only present on the writer
+  // queue of a database opened in write-ahead logging mode.
+  nsTArray<nsRefPtr<QueryProcessorQueue> > m_Readers;
 };
 
 // These classes are used for time-critical string copy during the collation
@@ -456,6 +591,7 @@ public:
   fastString encodingConversionBuffer2;
   fastString substringExtractionBuffer1;
   fastString substringExtractionBuffer2;
+  collationKeyCache keyCache;
 };
 
 #endif // __DATABASE_ENGINE_H__
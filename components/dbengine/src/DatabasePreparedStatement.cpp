@@ -30,6 +30,7 @@
 #include "DatabaseQuery.h"
 #include "DatabaseEngine.h"
 
+#include <nsAutoLock.h>
 #include <nsCOMPtr.h>
 #include <nsServiceManagerUtils.h>
 #include <nsComponentManagerUtils.h>
@@ -46,36 +47,48 @@
 NS_IMPL_THREADSAFE_ISUPPORTS1(CDatabasePreparedStatement, sbIDatabasePreparedStatement)
 
 CDatabasePreparedStatement::CDatabasePreparedStatement(const nsAString &sql) 
-  : mStatement(nsnull), mSql(sql)
+  : mLock(PR_NewLock()), mSql(sql), mIsReadOnly(PR_FALSE)
 {
+  NS_ASSERTION(mLock, "CDatabasePreparedStatement.mLock failed");
+
+  // Only statements that start with SELECT are considered to be read only.
+  // Anything else (including PRAGMA, BEGIN, etc.) must run on the writer.
+  const PRUnichar *sql = mSql.BeginReading();
+  PRUint32 length = mSql.Length();
+  PRUint32 offset = 0;
+  while (offset < length && 
+         (sql[offset] == ' ' || sql[offset] == '\t' || 
+          sql[offset] == '\r' || sql[offset] == '\n')) {
+    ++offset;
+  }
+  mIsReadOnly = StringBeginsWith(Substring(mSql, offset), 
+                                 NS_LITERAL_STRING("select"),
+                                 CaseInsensitiveCompare);
 }
 
 CDatabasePreparedStatement::~CDatabasePreparedStatement() 
 {
-  if (mStatement) {
-    // this should always be safe if mStatement is defined.
-    // if it does, it means we have a bad mStatement pointer. 
-    // error codes returned here are okay, since they either reiterate
-    // errors caused by bad statements being compiled, or indicate
-    // that the statement was aborted during execution.
-    // see: http://sqlite.org/c3ref/finalize.html
-    sqlite3_finalize(mStatement);
-    mStatement = nsnull;
+  // this should always be safe for every statement we have compiled.
+  // if it does, it means we have a bad statement pointer. 
+  // error codes returned here are okay, since they either reiterate
+  // errors caused by bad statements being compiled, or indicate
+  // that the statement was aborted during execution.
+  // see: http://sqlite.org/c3ref/finalize.html
+  statementMap_t::iterator it = mStatements.begin();
+  statementMap_t::iterator end = mStatements.end();
+  for (; it != end; ++it) {
+    sqlite3_finalize(it->second);
+  }
+  mStatements.clear();
+
+  if (mLock) {
+    PR_DestroyLock(mLock);
   }
 }
 
 NS_IMETHODIMP CDatabasePreparedStatement::GetQueryString(nsAString &_retval)
 {
-  if (mSql.Length() > 0) {
-    _retval = mSql;
-  }
-  else if (mStatement) {
-    const char* sql = sqlite3_sql(mStatement);
-    _retval = NS_ConvertUTF8toUTF16(sql);
-  }
-  else {
-    _retval = EmptyString();
-  }
+  _retval = mSql;
   return NS_OK;
 }
 
@@ -86,58 +99,61 @@ sqlite3_stmt* CDatabasePreparedStatement::GetStatement(sqlite3 *db)
     return nsnull;
   }
   
-  // either reset and return the existing statement, or compile it first and return that. 
-  if (mStatement) {
-    if (db != sqlite3_db_handle(mStatement)) {
-      NS_WARNING("GetStatement() called with a different DB than the one originally used compile it!.");
-      return nsnull;
-    }
+  nsAutoLock lock(mLock);
+
+  // either reset and return the existing statement for this database 
+  // connection, or compile it first and return that. 
+  statementMap_t::const_iterator found = mStatements.find(db);
+  if (found != mStatements.end()) {
+    sqlite3_stmt *statement = found->second;
     //Always reset the statement before sending it out for reuse.
     int retDB = 0;
-    retDB = sqlite3_reset(mStatement);
-    retDB = sqlite3_clear_bindings(mStatement);
+    retDB = sqlite3_reset(statement);
+    retDB = sqlite3_clear_bindings(statement);
+    return statement;
   }
-  else {
-    if (mSql.Length() == 0) {
-      NS_WARNING("GetStatement() called on a PreparedStatement with no SQL.");
-      return nsnull;
-    }
 
-    const char *pzTail = nsnull;
-    nsCString sqlStr = NS_ConvertUTF16toUTF8(mSql);
-    int retDB = sqlite3_prepare_v2(db, sqlStr.get(), sqlStr.Length(),
-                                   &mStatement, &pzTail);
-    if (retDB != SQLITE_OK) {
-      const char *szErr = sqlite3_errmsg(db);
-
-      nsString log;
-      log.AppendLiteral("SQLite compile step: \n");
-      log.Append(mSql);
-      log.AppendLiteral("\ncaused the error\n");
-      log.Append(NS_ConvertUTF8toUTF16(szErr));
-      log.AppendLiteral("\n");
-
-      nsresult rv;
-      nsCOMPtr<nsIConsoleService> consoleService = do_GetService("@mozilla.org/consoleservice;1", &rv);
-
-      nsCOMPtr<nsIScriptError> scriptError = do_CreateInstance(NS_SCRIPTERROR_CONTRACTID);
-      if (scriptError) {
-        nsresult rv = scriptError->Init(log.get(),
-                                        EmptyString().get(),
-                                        EmptyString().get(),
-                                        0, // No line number
-                                        0, // No column number
-                                        0, // An error message.
-                                        "DBEngine:StatementCompilation");
-        if (NS_SUCCEEDED(rv)) {
-          rv = consoleService->LogMessage(scriptError);
-        }
-      }
+  if (mSql.Length() == 0) {
+    NS_WARNING("GetStatement() called on a PreparedStatement with no SQL.");
+    return nsnull;
+  }
+
+  sqlite3_stmt *statement = nsnull;
+  const char *pzTail = nsnull;
+  nsCString sqlStr = NS_ConvertUTF16toUTF8(mSql);
+  int retDB = sqlite3_prepare_v2(db, sqlStr.get(), sqlStr.Length(),
+                                 &statement, &pzTail);
+  if (retDB != SQLITE_OK) {
+    const char *szErr = sqlite3_errmsg(db);
+
+    nsString log;
+    log.AppendLiteral("SQLite compile step: \n");
+    log.Append(mSql);
+    log.AppendLiteral("\ncaused the error\n");
+    log.Append(NS_ConvertUTF8toUTF16(szErr));
+    log.AppendLiteral("\n");
+
+    nsresult rv;
+    nsCOMPtr<nsIConsoleService> consoleService = do_GetService("@mozilla.org/consoleservice;1", &rv);
 
-      return nsnull;
+    nsCOMPtr<nsIScriptError> scriptError = do_CreateInstance(NS_SCRIPTERROR_CONTRACTID);
+    if (scriptError) {
+      nsresult rv = scriptError->Init(log.get(),
+                                      EmptyString().get(),
+                                      EmptyString().get(),
+                                      0, // No line number
+                                      0, // No column number
+                                      0, // An error message.
+                                      "DBEngine:StatementCompilation");
+      if (NS_SUCCEEDED(rv)) {
+        rv = consoleService->LogMessage(scriptError);
+      }
     }
-    // Henceforth, the sqlite_stmt will be responsible for holding onto the sql, not this object.
-    mSql = EmptyString();
+
+    return nsnull;
   }
-  return mStatement;
+
+  mStatements[db] = statement;
+
+  return statement;
 }
@@ -45,6 +45,8 @@
 #include <nsCOMPtr.h>
 #include <nsStringGlue.h>
 
+#include <map>
+
 #include "sbIDatabasePreparedStatement.h"
 
 // CLASSES ====================================================================
@@ -60,10 +62,23 @@ public:
   
   sqlite3_stmt* GetStatement(sqlite3 *db);
 
+  /**
+   * Returns true if the statement only reads from the database (ie: it is
+   * a SELECT). Read only statements may be executed on any of the reader
+   * connections of a database, see CDatabaseEngine::SubmitQueryPrivate.
+   */
+  PRBool IsReadOnly() const { return mIsReadOnly; }
+
 protected:
+  typedef std::map<sqlite3 *, sqlite3_stmt *> statementMap_t;
+
   CDatabaseQuery *mQuery;
-  sqlite3_stmt *mStatement;
+  // One compiled statement per database connection this statement has been
+  // executed on. Protected by mLock.
+  statementMap_t mStatements;
+  PRLock *mLock;
   nsString mSql;
+  PRBool mIsReadOnly;
 };
 
 #endif // __DATABASE_PREPAREDSTATEMENT_H__
@@ -342,6 +342,33 @@ nsresult CDatabaseQuery::PopQuery(sbIDatabasePreparedStatement **_retval)
   return rv;
 } //PopQuery
 
+//-----------------------------------------------------------------------------
+PRBool CDatabaseQuery::IsReadOnly()
+{
+  sbSimpleAutoLock lock(m_pLock);
+
+  if(m_DatabaseQueryList.empty()) {
+    return PR_FALSE;
+  }
+
+  std::deque< nsCOMPtr<sbIDatabasePreparedStatement> >::const_iterator it =
+    m_DatabaseQueryList.begin();
+  std::deque< nsCOMPtr<sbIDatabasePreparedStatement> >::const_iterator end =
+    m_DatabaseQueryList.end();
+
+  for(; it != end; ++it) {
+    // See CDatabaseEngine::QueryProcessor, all prepared statements are
+    // created by PrepareQuery so this cast is safe.
+    CDatabasePreparedStatement *preparedStatement =
+      static_cast<CDatabasePreparedStatement *>(it->get());
+    if(!preparedStatement->IsReadOnly()) {
+      return PR_FALSE;
+    }
+  }
+
+  return PR_TRUE;
+} //IsReadOnly
+
 //-----------------------------------------------------------------------------
 /* void ResetQuery (); */
 NS_IMETHODIMP CDatabaseQuery::ResetQuery()
@@ -369,6 +396,8 @@ NS_IMETHODIMP CDatabaseQuery::ResetQuery()
   m_RollingLimitColumnIndex = 0;
   m_RollingLimitResult = 0;
 
+  m_RowCallback = nsnull;
+
   return NS_OK;
 }
 
@@ -551,6 +580,24 @@ NS_IMETHODIMP CDatabaseQuery::SetRollingLimitResult(PRUint32 aRollingLimitResult
   return NS_OK;
 }
 
+NS_IMETHODIMP CDatabaseQuery::GetRowCallback(sbIDatabaseRowCallback **aRowCallback)
+{
+  NS_ENSURE_ARG_POINTER(aRowCallback);
+
+  sbSimpleAutoLock lock(m_pLock);
+  NS_IF_ADDREF(*aRowCallback = m_RowCallback);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP CDatabaseQuery::SetRowCallback(sbIDatabaseRowCallback *aRowCallback)
+{
+  sbSimpleAutoLock lock(m_pLock);
+  m_RowCallback = aRowCallback;
+
+  return NS_OK;
+}
+
 NS_IMETHODIMP CDatabaseQuery::BindUTF8StringParameter(PRUint32 aParamIndex,
                                                       const nsACString &aValue)
 {
@@ -673,17 +720,13 @@ bindParameterArray_t* CDatabaseQuery::GetQueryParameters(PRUint32 aQueryIndex)
   return retval;
 }
 
-bindParameterArray_t* CDatabaseQuery::PopQueryParameters()
+void CDatabaseQuery::PopQueryParameters(bindParameterArray_t& aParameters)
 {
-  bindParameterArray_t* retval = nsnull;
+  aParameters.clear();
   sbSimpleAutoLock lock(m_pLock);
 
   if(m_BindParameters.size()) {
-    retval = new bindParameterArray_t(m_BindParameters[0]);
+    aParameters.swap(m_BindParameters[0]);
     m_BindParameters.pop_front();
-  } else {
-    retval = new bindParameterArray_t;
   }
-
-  return retval;
 }
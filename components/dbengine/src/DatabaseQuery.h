@@ -147,8 +147,20 @@ protected:
   void SetResultObject(CDatabaseResult *aResultObject);
 
   nsresult PopQuery(sbIDatabasePreparedStatement **_retval);
+
+  /**
+   * Returns PR_TRUE if every statement queued on this query only reads
+   * from the database. Such queries may run on a reader connection.
+   */
+  PRBool IsReadOnly();
   bindParameterArray_t* GetQueryParameters(PRUint32 aQueryIndex);
-  bindParameterArray_t* PopQueryParameters();
+
+  /**
+   * Moves the parameters of the next statement into aParameters, without
+   * copying them. Statements queued by bulk inserts are run back to back so
+   * this is done once per row.
+   */
+  void PopQueryParameters(bindParameterArray_t& aParameters);
 
   PRLock *m_pLock;
 
@@ -175,6 +187,8 @@ protected:
   PRUint32 m_RollingLimitColumnIndex;
   PRUint32 m_RollingLimitResult;
 
+  nsCOMPtr<sbIDatabaseRowCallback> m_RowCallback;
+
   nsCOMPtr<sbIDatabaseEngine> mDatabaseEngine;
 
 private:
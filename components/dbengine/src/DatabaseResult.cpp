@@ -31,10 +31,13 @@
 
 #include "DatabaseResult.h"
 #include <prmem.h>
+#include <prprf.h>
 #include <nsMemory.h>
 
 #include <nsStringGlue.h>
 
+#include <sbStringUtils.h>
+
 #include <prlog.h>
 
 /*
@@ -64,6 +67,12 @@ void IfUnlock(PRLock *aLock)
   }
 }
 
+static inline
+PRUint64 CellKey(PRUint32 dbRow, PRUint32 dbCell)
+{
+  return (static_cast<PRUint64>(dbRow) << 32) | dbCell;
+}
+
 // CLASSES ====================================================================
 //=============================================================================
 // CDatabaseQuery Class
@@ -76,6 +85,7 @@ NS_IMPL_THREADSAFE_ISUPPORTS1(CDatabaseResult, sbIDatabaseResult)
 CDatabaseResult::CDatabaseResult(PRBool aRequiresLocking)
 : m_RequiresLocking(aRequiresLocking)
 , m_pLock(nsnull)
+, m_RowCount(0)
 {
 #ifdef PR_LOGGING
   if(!gDatabaseResultLog)
@@ -101,14 +111,9 @@ CDatabaseResult::~CDatabaseResult()
 NS_IMETHODIMP CDatabaseResult::GetColumnCount(PRUint32 *_retval)
 {
   NS_ENSURE_ARG_POINTER(_retval);
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    *_retval = m_ColumnNames.size();
-    IfUnlock(m_pLock);
-  }
-  else {
-    *_retval = m_ColumnNames.size();
-  }
+  IfLock(m_pLock);
+  *_retval = m_ColumnNames.size();
+  IfUnlock(m_pLock);
   return NS_OK;
 } //GetColumnCount
 
@@ -116,16 +121,11 @@ NS_IMETHODIMP CDatabaseResult::GetColumnCount(PRUint32 *_retval)
 /* wstring GetColumnName (in PRInt32 dbColumn); */
 NS_IMETHODIMP CDatabaseResult::GetColumnName(PRUint32 dbColumn, nsAString &_retval)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    if(dbColumn < m_ColumnNames.size()) {
-      _retval = m_ColumnNames[dbColumn];
-    }
-    IfUnlock(m_pLock);
-  }
-  else if(dbColumn < m_ColumnNames.size()) {
+  IfLock(m_pLock);
+  if(dbColumn < m_ColumnNames.size()) {
     _retval = m_ColumnNames[dbColumn];
   }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //GetColumnName
@@ -145,14 +145,9 @@ NS_IMETHODIMP CDatabaseResult::GetColumnIndex(const nsAString &aColumnName, PRUi
 NS_IMETHODIMP CDatabaseResult::GetRowCount(PRUint32 *_retval)
 {
   NS_ENSURE_ARG_POINTER(_retval);
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    *_retval = m_RowCells.size();
-    IfUnlock(m_pLock);
-  }
-  else {
-    *_retval = m_RowCells.size();
-  }
+  IfLock(m_pLock);
+  *_retval = m_RowCount;
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //GetRowCount
@@ -161,20 +156,49 @@ NS_IMETHODIMP CDatabaseResult::GetRowCount(PRUint32 *_retval)
 /* wstring GetRowCell (in PRInt32 dbRow, in PRInt32 dbCell); */
 NS_IMETHODIMP CDatabaseResult::GetRowCell(PRUint32 dbRow, PRUint32 dbCell, nsAString &_retval)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    if(dbRow < m_RowCells.size() && dbCell < m_RowCells[dbRow].size()) {
-      _retval = m_RowCells[dbRow][dbCell];
-    }
-    IfUnlock(m_pLock);
-  }
-  else if(dbRow < m_RowCells.size() && dbCell < m_RowCells[dbRow].size()) {
-    _retval = m_RowCells[dbRow][dbCell];
+  IfLock(m_pLock);
+  if(IsValidCell(dbRow, dbCell)) {
+    GetCell(dbRow, dbCell, _retval);
   }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //GetRowCell
 
+//-----------------------------------------------------------------------------
+/* long long GetRowCellAsInt64 (in PRInt32 dbRow, in PRInt32 dbCell); */
+NS_IMETHODIMP CDatabaseResult::GetRowCellAsInt64(PRUint32 dbRow, PRUint32 dbCell, PRInt64 *_retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv = NS_OK;
+
+  IfLock(m_pLock);
+  if(!IsValidCell(dbRow, dbCell)) {
+    rv = NS_ERROR_INVALID_ARG;
+  }
+  else {
+    const dbcolumn_t &column = m_Columns[dbCell];
+    switch(column.types[dbRow]) {
+      case CELL_INTEGER:
+        *_retval = column.values[dbRow];
+      break;
+
+      case CELL_TEXT:
+        if(PR_sscanf(&m_TextArena[column.values[dbRow]], "%lld", _retval) != 1) {
+          rv = NS_ERROR_NOT_AVAILABLE;
+        }
+      break;
+
+      default:
+        rv = NS_ERROR_NOT_AVAILABLE;
+    }
+  }
+  IfUnlock(m_pLock);
+
+  return rv;
+} //GetRowCellAsInt64
+
 //-----------------------------------------------------------------------------
 /* wstring GetRowCellByColumn (in PRInt32 dbRow, in wstring dbColumn); */
 NS_IMETHODIMP CDatabaseResult::GetRowCellByColumn(PRUint32 dbRow, const nsAString &dbColumn, nsAString &_retval)
@@ -187,22 +211,14 @@ NS_IMETHODIMP CDatabaseResult::GetRowCellByColumn(PRUint32 dbRow, const nsAStrin
 /* wstring GetColumnNamePtr (in PRInt32 dbColumn); */
 NS_IMETHODIMP CDatabaseResult::GetColumnNamePtr(PRUint32 dbColumn, PRUnichar **_retval)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    if(dbColumn < m_ColumnNames.size()) {
-      *_retval = const_cast<PRUnichar *>(m_ColumnNames[dbColumn].BeginReading());
-    }
-    else {
-      *_retval = nsnull;
-    }
-    IfUnlock(m_pLock);
-  }
-  else if(dbColumn < m_ColumnNames.size()) {
+  IfLock(m_pLock);
+  if(dbColumn < m_ColumnNames.size()) {
     *_retval = const_cast<PRUnichar *>(m_ColumnNames[dbColumn].BeginReading());
   }
   else {
     *_retval = nsnull;
   }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //GetColumnName
@@ -211,22 +227,14 @@ NS_IMETHODIMP CDatabaseResult::GetColumnNamePtr(PRUint32 dbColumn, PRUnichar **_
 /* wstring GetRowCellPtr (in PRInt32 dbRow, in PRInt32 dbCell); */
 NS_IMETHODIMP CDatabaseResult::GetRowCellPtr(PRUint32 dbRow, PRUint32 dbCell, PRUnichar **_retval)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    if(dbRow < m_RowCells.size() && dbCell < m_RowCells[dbRow].size()) {
-      *_retval = const_cast<PRUnichar *>(m_RowCells[dbRow][dbCell].BeginReading());
-    }
-    else {
-      *_retval = nsnull;
-    }
-    IfUnlock(m_pLock);
-  }
-  else if(dbRow < m_RowCells.size() && dbCell < m_RowCells[dbRow].size()) {
-    *_retval = const_cast<PRUnichar *>(m_RowCells[dbRow][dbCell].BeginReading());
+  IfLock(m_pLock);
+  if(IsValidCell(dbRow, dbCell)) {
+    *_retval = const_cast<PRUnichar *>(GetCellPtr(dbRow, dbCell));
   }
   else {
     *_retval = nsnull;
   }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //GetRowCell
@@ -242,60 +250,133 @@ NS_IMETHODIMP CDatabaseResult::GetRowCellByColumnPtr(PRUint32 dbRow, const nsASt
 //-----------------------------------------------------------------------------
 NS_IMETHODIMP CDatabaseResult::ClearResultSet()
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
+  IfLock(m_pLock);
 
-    m_ColumnNames.clear();
-    m_RowCells.clear();
-    m_ColumnResolveMap.clear();
+  // Swap with empty containers so the memory is actually released.
+  m_ColumnNames.clear();
+  dbcolumns_t().swap(m_Columns);
+  m_RowCount = 0;
+  dbtextarena_t().swap(m_TextArena);
+  m_ColumnResolveMap.clear();
+  m_ConvertedCells.clear();
 
-    IfUnlock(m_pLock);
-  }
-  else {
-    m_ColumnNames.clear();
-    m_RowCells.clear();
-    m_ColumnResolveMap.clear();
-  }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //ClearResultSet
 
+//-----------------------------------------------------------------------------
+void CDatabaseResult::ClearRows()
+{
+  IfLock(m_pLock);
+
+  dbcolumns_t::iterator it = m_Columns.begin();
+  dbcolumns_t::iterator end = m_Columns.end();
+  for(; it != end; ++it) {
+    it->types.clear();
+    it->values.clear();
+  }
+  m_RowCount = 0;
+  m_TextArena.clear();
+  m_ConvertedCells.clear();
+
+  IfUnlock(m_pLock);
+} //ClearRows
+
 //-----------------------------------------------------------------------------
 nsresult CDatabaseResult::AddRow(const std::vector<nsString> &vCellValues)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    m_RowCells.push_back(vCellValues);
-    IfUnlock(m_pLock);
+  IfLock(m_pLock);
+
+  EnsureColumnCount(vCellValues.size());
+
+  dbcolumns_t::iterator it = m_Columns.begin();
+  dbcolumns_t::iterator end = m_Columns.end();
+  for(; it != end; ++it) {
+    it->types.push_back(CELL_NULL);
+    it->values.push_back(0);
   }
-  else {
-    m_RowCells.push_back(vCellValues);
+
+  PRUint32 dbRow = m_RowCount++;
+  PRUint32 nSize = vCellValues.size();
+  for(PRUint32 i = 0; i < nSize; i++) {
+    SetCell(dbRow, i, vCellValues[i]);
   }
 
+  IfUnlock(m_pLock);
+
   return NS_OK;
 } //AddRow
 
 //-----------------------------------------------------------------------------
-nsresult CDatabaseResult::DeleteRow(PRUint32 dbRow)
+nsresult CDatabaseResult::AddRow(sqlite3_stmt *aStatement)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    if(dbRow < m_RowCells.size()) {
-      dbrowcells_t::iterator itRows = m_RowCells.begin();
-      itRows += dbRow;
-
-      if(itRows != m_RowCells.end())
-        m_RowCells.erase(itRows);
+  NS_ENSURE_ARG_POINTER(aStatement);
+
+  PRUint32 nCount = sqlite3_column_count(aStatement);
+
+  IfLock(m_pLock);
+
+  EnsureColumnCount(nCount);
+
+  PRUint32 nColumns = m_Columns.size();
+  for(PRUint32 i = 0; i < nColumns; i++) {
+    dbcolumn_t &column = m_Columns[i];
+
+    PRInt32 type = i < nCount ? sqlite3_column_type(aStatement, i) : SQLITE_NULL;
+    switch(type) {
+      case SQLITE_NULL:
+        column.types.push_back(CELL_NULL);
+        column.values.push_back(0);
+      break;
+
+      case SQLITE_INTEGER:
+        column.types.push_back(CELL_INTEGER);
+        column.values.push_back(sqlite3_column_int64(aStatement, i));
+      break;
+
+      default:
+      {
+        // Floats and blobs are kept as text, the way sqlite formats them.
+        const char *p = (const char *)sqlite3_column_text(aStatement, i);
+        if(p) {
+          column.types.push_back(CELL_TEXT);
+          column.values.push_back(
+            AppendText(p, sqlite3_column_bytes(aStatement, i)));
+        }
+        else {
+          column.types.push_back(CELL_NULL);
+          column.values.push_back(0);
+        }
+      }
     }
-    IfUnlock(m_pLock);
   }
-  else if(dbRow < m_RowCells.size()) {
-    dbrowcells_t::iterator itRows = m_RowCells.begin();
-    itRows += dbRow;
 
-    if(itRows != m_RowCells.end())
-      m_RowCells.erase(itRows);
+  m_RowCount++;
+
+  IfUnlock(m_pLock);
+
+  return NS_OK;
+} //AddRow
+
+//-----------------------------------------------------------------------------
+nsresult CDatabaseResult::DeleteRow(PRUint32 dbRow)
+{
+  IfLock(m_pLock);
+  if(dbRow < m_RowCount) {
+    dbcolumns_t::iterator it = m_Columns.begin();
+    dbcolumns_t::iterator end = m_Columns.end();
+    for(; it != end; ++it) {
+      it->types.erase(it->types.begin() + dbRow);
+      it->values.erase(it->values.begin() + dbRow);
+    }
+    m_RowCount--;
+
+    // Row indices have shifted, the text stays in the arena until the
+    // result set is cleared.
+    m_ConvertedCells.clear();
   }
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //DeleteRow
@@ -303,14 +384,10 @@ nsresult CDatabaseResult::DeleteRow(PRUint32 dbRow)
 //-----------------------------------------------------------------------------
 nsresult CDatabaseResult::SetColumnNames(const std::vector<nsString> &vColumnNames)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    m_ColumnNames = vColumnNames;
-    IfUnlock(m_pLock);
-  }
-  else {
-    m_ColumnNames = vColumnNames;
-  }
+  IfLock(m_pLock);
+  m_ColumnNames = vColumnNames;
+  EnsureColumnCount(m_ColumnNames.size());
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //SetColumnNames
@@ -318,14 +395,9 @@ nsresult CDatabaseResult::SetColumnNames(const std::vector<nsString> &vColumnNam
 //-----------------------------------------------------------------------------
 nsresult CDatabaseResult::SetColumnName(PRUint32 dbColumn, const nsString &strColumnName)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    m_ColumnNames[dbColumn] = strColumnName;
-    IfUnlock(m_pLock);
-  }
-  else {
-    m_ColumnNames[dbColumn] = strColumnName;
-  }
+  IfLock(m_pLock);
+  m_ColumnNames[dbColumn] = strColumnName;
+  IfUnlock(m_pLock);
 
   return NS_OK;
 } //SetColumnName
@@ -333,31 +405,40 @@ nsresult CDatabaseResult::SetColumnName(PRUint32 dbColumn, const nsString &strCo
 //-----------------------------------------------------------------------------
 nsresult CDatabaseResult::SetRowCell(PRUint32 dbRow, PRUint32 dbCell, const nsString &strCellValue)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    m_RowCells[dbRow][dbCell] = strCellValue;
-    IfUnlock(m_pLock);
+  nsresult rv = NS_OK;
+
+  IfLock(m_pLock);
+  if(IsValidCell(dbRow, dbCell)) {
+    SetCell(dbRow, dbCell, strCellValue);
   }
   else {
-    m_RowCells[dbRow][dbCell] = strCellValue;
+    rv = NS_ERROR_INVALID_ARG;
   }
+  IfUnlock(m_pLock);
 
-  return NS_OK;
+  return rv;
 } //SetRowCell
 
 //-----------------------------------------------------------------------------
 nsresult CDatabaseResult::SetRowCells(PRUint32 dbRow, const std::vector<nsString> &vCellValues)
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
-    m_RowCells[dbRow] = vCellValues;
-    IfUnlock(m_pLock);
+  nsresult rv = NS_OK;
+
+  IfLock(m_pLock);
+  if(dbRow < m_RowCount) {
+    EnsureColumnCount(vCellValues.size());
+
+    PRUint32 nSize = vCellValues.size();
+    for(PRUint32 i = 0; i < nSize; i++) {
+      SetCell(dbRow, i, vCellValues[i]);
+    }
   }
   else {
-    m_RowCells[dbRow] = vCellValues;
+    rv = NS_ERROR_INVALID_ARG;
   }
+  IfUnlock(m_pLock);
 
-  return NS_OK;
+  return rv;
 } //SetRowCells
 
 //-----------------------------------------------------------------------------
@@ -366,24 +447,15 @@ PRUint32 CDatabaseResult::GetColumnIndexFromName(const nsAString &strColumnName)
   RebuildColumnResolveMap();
   PRUint32 retval = (PRUint32)-1;
 
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
+  IfLock(m_pLock);
 
-    dbcolumnresolvemap_t::const_iterator itColumnIndex =
-      m_ColumnResolveMap.find(nsString(strColumnName));
+  dbcolumnresolvemap_t::const_iterator itColumnIndex =
+    m_ColumnResolveMap.find(nsString(strColumnName));
 
-    if(itColumnIndex != m_ColumnResolveMap.end())
-      retval = itColumnIndex->second;
+  if(itColumnIndex != m_ColumnResolveMap.end())
+    retval = itColumnIndex->second;
 
-    IfUnlock(m_pLock);
-  }
-  else {
-    dbcolumnresolvemap_t::const_iterator itColumnIndex =
-      m_ColumnResolveMap.find(nsString(strColumnName));
-
-    if(itColumnIndex != m_ColumnResolveMap.end())
-      retval = itColumnIndex->second;
-  }
+  IfUnlock(m_pLock);
 
   return retval;
 } //GetColumnIndexFromName
@@ -391,23 +463,10 @@ PRUint32 CDatabaseResult::GetColumnIndexFromName(const nsAString &strColumnName)
 //-----------------------------------------------------------------------------
 void CDatabaseResult::RebuildColumnResolveMap()
 {
-  if(NS_UNLIKELY(m_RequiresLocking)) {
-    IfLock(m_pLock);
+  IfLock(m_pLock);
 
-    if(m_ColumnNames.size() != m_ColumnResolveMap.size() ||
-       m_ColumnResolveMap.size() == 0) {
-      m_ColumnResolveMap.clear();
-
-      PRUint32 nSize =  m_ColumnNames.size();
-      for(PRUint32 i = 0; i < nSize; i++) {
-        m_ColumnResolveMap.insert(std::make_pair<nsString, PRUint32>(m_ColumnNames[i], i));
-      }
-    }
-    
-    IfUnlock(m_pLock);
-  }
-  else if(m_ColumnNames.size() != m_ColumnResolveMap.size() ||
-          m_ColumnResolveMap.size() == 0) {
+  if(m_ColumnNames.size() != m_ColumnResolveMap.size() ||
+     m_ColumnResolveMap.size() == 0) {
     m_ColumnResolveMap.clear();
 
     PRUint32 nSize =  m_ColumnNames.size();
@@ -415,4 +474,93 @@ void CDatabaseResult::RebuildColumnResolveMap()
       m_ColumnResolveMap.insert(std::make_pair<nsString, PRUint32>(m_ColumnNames[i], i));
     }
   }
+  
+  IfUnlock(m_pLock);
+}
+
+// The following helpers expect m_pLock to be held by the caller, if needed.
+
+//-----------------------------------------------------------------------------
+void CDatabaseResult::EnsureColumnCount(PRUint32 aColumnCount)
+{
+  while(m_Columns.size() < aColumnCount) {
+    m_Columns.push_back(dbcolumn_t());
+
+    dbcolumn_t &column = m_Columns.back();
+    column.types.resize(m_RowCount, CELL_NULL);
+    column.values.resize(m_RowCount, 0);
+  }
+}
+
+//-----------------------------------------------------------------------------
+PRInt64 CDatabaseResult::AppendText(const char *aText, PRUint32 aLength)
+{
+  PRInt64 offset = m_TextArena.size();
+
+  m_TextArena.insert(m_TextArena.end(), aText, aText + aLength);
+  m_TextArena.push_back('\0');
+
+  return offset;
+}
+
+//-----------------------------------------------------------------------------
+void CDatabaseResult::SetCell(PRUint32 dbRow, 
+                              PRUint32 dbCell, 
+                              const nsString &strCellValue)
+{
+  dbcolumn_t &column = m_Columns[dbCell];
+
+  if(strCellValue.IsVoid()) {
+    column.types[dbRow] = CELL_NULL;
+    column.values[dbRow] = 0;
+  }
+  else {
+    NS_ConvertUTF16toUTF8 text(strCellValue);
+    column.types[dbRow] = CELL_TEXT;
+    column.values[dbRow] = AppendText(text.BeginReading(), text.Length());
+  }
+
+  m_ConvertedCells.erase(CellKey(dbRow, dbCell));
+}
+
+//-----------------------------------------------------------------------------
+PRBool CDatabaseResult::IsValidCell(PRUint32 dbRow, PRUint32 dbCell)
+{
+  return dbRow < m_RowCount && dbCell < m_Columns.size();
+}
+
+//-----------------------------------------------------------------------------
+void CDatabaseResult::GetCell(PRUint32 dbRow, 
+                              PRUint32 dbCell, 
+                              nsAString &_retval)
+{
+  const dbcolumn_t &column = m_Columns[dbCell];
+
+  switch(column.types[dbRow]) {
+    case CELL_INTEGER:
+      _retval.Assign(sbAutoString(column.values[dbRow]));
+    break;
+
+    case CELL_TEXT:
+      CopyUTF8toUTF16(nsDependentCString(&m_TextArena[column.values[dbRow]]),
+                      _retval);
+    break;
+
+    default:
+      _retval.SetIsVoid(PR_TRUE);
+  }
+}
+
+//-----------------------------------------------------------------------------
+const PRUnichar* CDatabaseResult::GetCellPtr(PRUint32 dbRow, PRUint32 dbCell)
+{
+  PRUint64 key = CellKey(dbRow, dbCell);
+
+  dbconvertedcells_t::iterator found = m_ConvertedCells.find(key);
+  if(found == m_ConvertedCells.end()) {
+    found = m_ConvertedCells.insert(std::make_pair(key, nsString())).first;
+    GetCell(dbRow, dbCell, found->second);
+  }
+
+  return found->second.BeginReading();
 }
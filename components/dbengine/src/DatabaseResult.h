@@ -44,6 +44,8 @@
 #include <nscore.h>
 #include <nsStringGlue.h>
 
+#include <sqlite3.h>
+
 // DEFINES ====================================================================
 #define SONGBIRD_DATABASERESULT_CONTRACTID                \
   "@songbirdnest.com/Songbird/DatabaseResult;1"
@@ -57,6 +59,11 @@
   {0x9f, 0x2a, 0x8, 0xfd, 0xf6, 0x95, 0x97, 0xcf}         \
 }
 // CLASSES ====================================================================
+/**
+ * The result set is stored by column. Integer cells are kept as 64 bit 
+ * integers, text cells are kept as UTF-8 in a single arena shared by the
+ * whole result set. Cells are only converted to UTF-16 when asked for.
+ */
 class CDatabaseResult : public sbIDatabaseResult
 {
 friend class CDatabaseQuery;
@@ -69,8 +76,16 @@ public:
   NS_DECL_SBIDATABASERESULT
 
   nsresult AddRow(const std::vector<nsString> &vCellValues);
+  nsresult AddRow(sqlite3_stmt *aStatement);
   nsresult DeleteRow(PRUint32 dbRow);
 
+  /**
+   * Drops every row but keeps the column names and the storage already
+   * allocated, so a result used as a single row buffer does not reallocate
+   * for each row.
+   */
+  void ClearRows();
+
   nsresult SetColumnNames(const std::vector<nsString> &vColumnNames);
   nsresult SetColumnName(PRUint32 dbColumn, const nsString &strColumnName);
 
@@ -81,18 +96,45 @@ public:
   void RebuildColumnResolveMap();
 
 protected:
+  typedef enum {
+    CELL_NULL = 0,
+    CELL_INTEGER,
+    CELL_TEXT
+  } dbcelltype_t;
+
+  // For CELL_INTEGER cells, values holds the integer itself. For CELL_TEXT
+  // cells, values holds the offset of the nul terminated text in the arena.
+  struct dbcolumn_t {
+    std::vector<PRUint8> types;
+    std::vector<PRInt64> values;
+  };
+
   typedef std::vector<nsString> dbcolumnnames_t;
-  typedef std::deque< std::vector<nsString> > dbrowcells_t;
+  typedef std::vector<dbcolumn_t> dbcolumns_t;
+  typedef std::vector<char> dbtextarena_t;
   typedef std::map<nsString, PRUint32> dbcolumnresolvemap_t;
+  typedef std::map<PRUint64, nsString> dbconvertedcells_t;
+
+  void EnsureColumnCount(PRUint32 aColumnCount);
+  PRInt64 AppendText(const char *aText, PRUint32 aLength);
+  void SetCell(PRUint32 dbRow, PRUint32 dbCell, const nsString &strCellValue);
+  PRBool IsValidCell(PRUint32 dbRow, PRUint32 dbCell);
+  void GetCell(PRUint32 dbRow, PRUint32 dbCell, nsAString &_retval);
+  const PRUnichar* GetCellPtr(PRUint32 dbRow, PRUint32 dbCell);
   
   PRPackedBool m_RequiresLocking;
 
   PRLock *m_pLock;
 
   dbcolumnnames_t m_ColumnNames;
-  dbrowcells_t m_RowCells;
+  dbcolumns_t m_Columns;
+  PRUint32 m_RowCount;
+  dbtextarena_t m_TextArena;
   dbcolumnresolvemap_t m_ColumnResolveMap;
+
+  // UTF-16 copies of the cells handed out by GetRowCellPtr, which has to
+  // return a pointer that remains valid as long as the result set.
+  dbconvertedcells_t m_ConvertedCells;
 };
 
 #endif // __DATABASE_RESULT_H__
-
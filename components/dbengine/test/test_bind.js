@@ -152,6 +152,38 @@ function runTest () {
   dbq.bindInt64Parameter(3, -1);
   execAndAssertCount(dbq, 1);
 
+  // Integers are kept as integers in the result, and read back as text
+  dbq.resetQuery();
+  dbq.addQuery("select int32_column, int64_column, string_column, " +
+               "double_column, utf8_column from bind_test " + 
+               "where int64_column = ?");
+  dbq.bindInt64Parameter(0, 9876543210);
+  execAndAssertCount(dbq, 1);
+
+  var result = dbq.getResultObject();
+  assertEqual(result.getRowCellAsInt64(0, 0), 666);
+  assertEqual(result.getRowCellAsInt64(0, 1), 9876543210);
+  assertEqual(result.getRowCell(0, 0), "666");
+  assertEqual(result.getRowCell(0, 1), "9876543210");
+  assertEqual(result.getRowCell(0, 2), "bar");
+  assertEqual(result.getRowCell(0, 4), "foo");
+
+  try {
+    result.getRowCellAsInt64(0, 2);
+    fail("No exception thrown");
+  }
+  catch(e) {
+    assertEqual(e.result, Cr.NS_ERROR_NOT_AVAILABLE);
+  }
+
+  try {
+    result.getRowCellAsInt64(1, 0);
+    fail("No exception thrown");
+  }
+  catch(e) {
+    assertEqual(e.result, Cr.NS_ERROR_INVALID_ARG);
+  }
+
   // Test binding multiple queries
   dbq.resetQuery();
   dbq.addQuery("select * from bind_test where utf8_column = ?");
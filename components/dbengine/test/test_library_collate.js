@@ -0,0 +1,80 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2011 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that sorting with library_collate, which compares cached
+ *        collation keys, gives the same order as collating the strings
+ *        one pair at a time.
+ */
+
+var VALUES = [
+  "Zebra", "zebra", "apple", "Apple", "\u00e9clair", "eclair", "Eclair",
+  "track 10", "track 9", "track 1", "Track 2", "10 years", "9 lives",
+  "1.5 stars", "-3 degrees", "a+-5", "", "b", "B52", "b 52",
+  "stra\u00dfe", "strasse", "\u00c5ngstr\u00f6m", "angstrom", "z10a2",
+  "z10a10", "z9a20", "1e3 things", "1e things", "..", "+", "the end"
+];
+
+function runTest () {
+  var engine = Cc["@songbirdnest.com/Songbird/DatabaseEngine;1"]
+                 .getService(Ci.sbIDatabaseEngine);
+
+  var dbq = Cc["@songbirdnest.com/Songbird/DatabaseQuery;1"]
+              .createInstance(Ci.sbIDatabaseQuery);
+  dbq.setDatabaseGUID("test_library_collate");
+  dbq.addQuery("drop table if exists test_collate");
+  dbq.addQuery("create table test_collate (value text collate library_collate)");
+  dbq.addQuery("begin");
+  // Insert each value twice so the cache is hit as well as filled
+  for (var j = 0; j < 2; j++) {
+    for (var i = 0; i < VALUES.length; i++) {
+      dbq.addQuery("insert into test_collate values (?)");
+      dbq.bindStringParameter(0, VALUES[i]);
+    }
+  }
+  dbq.addQuery("commit");
+  dbq.addQuery("select value from test_collate order by value");
+  dbq.execute();
+  dbq.waitForCompletion();
+
+  var result = dbq.getResultObject();
+  assertEqual(result.getRowCount(), VALUES.length * 2);
+
+  for (var i = 1; i < result.getRowCount(); i++) {
+    var previous = result.getRowCell(i - 1, 0);
+    var current = result.getRowCell(i, 0);
+    if (engine.collate(previous, current) > 0) {
+      fail("'" + previous + "' sorted before '" + current + "'");
+    }
+  }
+
+  dbq.resetQuery();
+  dbq.addQuery("drop table test_collate");
+  dbq.execute();
+  dbq.waitForCompletion();
+
+  return Components.results.NS_OK;
+}
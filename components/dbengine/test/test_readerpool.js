@@ -0,0 +1,119 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2010 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that read only queries executed on the reader connections of
+ *        a database opened in write-ahead logging mode see the data written
+ *        through the writer connection.
+ */
+
+function runTest () {
+
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setIntPref("songbird.dbengine.test_readerpool.readerCount", 2);
+
+  var ios = Cc["@mozilla.org/network/io-service;1"]
+              .createInstance(Ci.nsIIOService);
+  
+  var dir = Cc["@mozilla.org/file/directory_service;1"]
+              .createInstance(Ci.nsIProperties);
+              
+  var testdir = dir.get("ProfD", Ci.nsIFile);
+  
+  var actualdir = testdir.clone();
+  actualdir.append("db_tests");
+  
+  if(!actualdir.exists())
+  {
+    try {
+      actualdir.create(Ci.nsIFile.DIRECTORY_TYPE, 0700);
+    } catch(e) {
+      //Some failures might be handled later. Some might be ignored.
+      throw e;
+    }
+  }
+  
+  var uri = ios.newFileURI(actualdir);
+
+  var dbq = newQuery(uri);
+  dbq.addQuery("drop table reader_test");
+  dbq.addQuery("create table reader_test (name text, value integer)");
+  dbq.addQuery("begin");
+  for (var i = 0; i < 100; i++) {
+    dbq.addQuery("insert into reader_test values (?, ?)");
+    dbq.bindStringParameter(0, "name " + i);
+    dbq.bindInt32Parameter(1, i);
+  }
+  dbq.addQuery("commit");
+  dbq.execute();
+  dbq.waitForCompletion();
+
+  // Fire off a bunch of async reads so more than one reader gets used
+  var queries = [];
+  for (var j = 0; j < 10; j++) {
+    var query = newQuery(uri);
+    query.setAsyncQuery(true);
+    query.addQuery("select * from reader_test where value >= ?");
+    query.bindInt32Parameter(0, j * 10);
+    query.execute();
+    queries.push(query);
+  }
+
+  for (var j = 0; j < queries.length; j++) {
+    queries[j].waitForCompletion();
+    assertEqual(queries[j].getLastError(), 0);
+    assertEqual(queries[j].getResultObject().getRowCount(), 100 - j * 10);
+  }
+
+  // A read following a write sees the write
+  dbq = newQuery(uri);
+  dbq.addQuery("delete from reader_test where value < 50");
+  dbq.execute();
+  dbq.waitForCompletion();
+
+  dbq = newQuery(uri);
+  dbq.addQuery("select count(*) from reader_test");
+  dbq.execute();
+  dbq.waitForCompletion();
+  assertEqual(dbq.getResultObject().getRowCell(0, 0), "50");
+
+  var dbe = Cc["@songbirdnest.com/Songbird/DatabaseEngine;1"]
+              .getService(Ci.sbIDatabaseEngine);
+  dbe.closeDatabase("test_readerpool");
+
+  prefs.clearUserPref("songbird.dbengine.test_readerpool.readerCount");
+
+  return Components.results.NS_OK;
+}
+
+function newQuery(aLocation) {
+  var dbq = Cc["@songbirdnest.com/Songbird/DatabaseQuery;1"]
+              .createInstance(Ci.sbIDatabaseQuery);
+  dbq.databaseLocation = aLocation;
+  dbq.setDatabaseGUID("test_readerpool");
+  return dbq;
+}
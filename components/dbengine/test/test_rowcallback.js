@@ -0,0 +1,129 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2010 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that a query with a row callback hands each row to the
+ *        callback instead of accumulating it in the result object.
+ */
+
+function runTest () {
+
+  var ios = Cc["@mozilla.org/network/io-service;1"]
+              .createInstance(Ci.nsIIOService);
+  
+  var dir = Cc["@mozilla.org/file/directory_service;1"]
+              .createInstance(Ci.nsIProperties);
+              
+  var testdir = dir.get("ProfD", Ci.nsIFile);
+  
+  var actualdir = testdir.clone();
+  actualdir.append("db_tests");
+  
+  if(!actualdir.exists())
+  {
+    try {
+      actualdir.create(Ci.nsIFile.DIRECTORY_TYPE, 0700);
+    } catch(e) {
+      //Some failures might be handled later. Some might be ignored.
+      throw e;
+    }
+  }
+  
+  var uri = ios.newFileURI(actualdir);
+
+  var dbq = newQuery(uri);
+  dbq.addQuery("drop table row_callback_test");
+  dbq.addQuery("create table row_callback_test (name text, value integer)");
+  dbq.addQuery("begin");
+  for (var i = 0; i < 100; i++) {
+    dbq.addQuery("insert into row_callback_test values (?, ?)");
+    dbq.bindStringParameter(0, "name " + i);
+    dbq.bindInt32Parameter(1, i);
+  }
+  dbq.addQuery("commit");
+  dbq.execute();
+  dbq.waitForCompletion();
+
+  // Every row shows up in the callback, one at a time
+  var rows = [];
+  dbq = newQuery(uri);
+  dbq.rowCallback = {
+    onRow: function(aRowResult) {
+      assertEqual(aRowResult.getRowCount(), 1);
+      assertEqual(aRowResult.getColumnCount(), 2);
+      rows.push([aRowResult.getRowCell(0, 0),
+                 aRowResult.getRowCellAsInt64(0, 1)]);
+    }
+  };
+  dbq.addQuery("select name, value from row_callback_test order by value");
+  assertEqual(dbq.execute(), 0);
+
+  assertEqual(rows.length, 100);
+  for (var i = 0; i < rows.length; i++) {
+    assertEqual(rows[i][0], "name " + i);
+    assertEqual(rows[i][1], i);
+  }
+
+  // The result object only holds the column names
+  var result = dbq.getResultObject();
+  assertEqual(result.getRowCount(), 0);
+  assertEqual(result.getColumnName(1), "value");
+
+  // Reset clears the callback
+  dbq.resetQuery();
+  assertEqual(dbq.rowCallback, null);
+  dbq.addQuery("select name, value from row_callback_test");
+  assertEqual(dbq.execute(), 0);
+  assertEqual(dbq.getResultObject().getRowCount(), 100);
+
+  // A failing callback stops the query
+  var count = 0;
+  dbq.resetQuery();
+  dbq.rowCallback = {
+    onRow: function(aRowResult) {
+      if (++count == 10) {
+        throw Components.results.NS_ERROR_ABORT;
+      }
+    }
+  };
+  dbq.addQuery("select name, value from row_callback_test");
+  assertEqual(dbq.execute(), 4 /* SQLITE_ABORT */);
+  assertEqual(count, 10);
+
+  var dbe = Cc["@songbirdnest.com/Songbird/DatabaseEngine;1"]
+              .getService(Ci.sbIDatabaseEngine);
+  dbe.closeDatabase("test_rowcallback");
+
+  return Components.results.NS_OK;
+}
+
+function newQuery(aLocation) {
+  var dbq = Cc["@songbirdnest.com/Songbird/DatabaseQuery;1"]
+              .createInstance(Ci.sbIDatabaseQuery);
+  dbq.databaseLocation = aLocation;
+  dbq.setDatabaseGUID("test_rowcallback");
+  return dbq;
+}
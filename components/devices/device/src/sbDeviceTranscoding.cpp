@@ -25,25 +25,31 @@
 #include "sbDeviceTranscoding.h"
 
 // Mozilla includes
+#include <nsAlgorithm.h>
 #include <nsArrayUtils.h>
 #include <nsComponentManagerUtils.h>
 #include <nsIFileURL.h>
 #include <nsIInputStream.h>
 #include <nsIIOService.h>
+#include <nsIMutableArray.h>
+#include <nsIPrefBranch.h>
 #include <nsIStringEnumerator.h>
 #include <nsISupportsPrimitives.h>
 #include <nsIWritablePropertyBag2.h>
 #include <nsIVariant.h>
 
 #include <nsServiceManagerUtils.h>
+#include <prsystem.h>
 
 // Songbird interfaces
 #include <sbIDeviceEvent.h>
+#include <sbIDeviceProperties.h>
 #include <sbIJobCancelable.h>
 #include <sbIMediacoreEventTarget.h>
 #include <sbIMediaFormatMutable.h>
 #include <sbIMediaInspector.h>
 #include <sbITranscodeAlbumArt.h>
+#include <sbITranscodeCache.h>
 #include <sbITranscodeError.h>
 #include <sbITranscodeManager.h>
 #include <sbITranscodeVideoJob.h>
@@ -76,6 +82,13 @@ extern PRLogModuleInfo* gBaseDeviceLog;
 #define TRACE(args) do { } while(0)
 #endif
 
+#define PREF_TRANSCODE_BRANCH "songbird.device.transcode."
+#define PREF_TRANSCODE_MAX_JOBS "max_jobs"
+#define PREF_TRANSCODE_TEMP_SPACE "temp_space_mb"
+
+// Default space, in megabytes, the outputs of running transcodes may take
+#define DEFAULT_TRANSCODE_TEMP_SPACE 1024
+
 sbDeviceTranscoding::sbDeviceTranscoding(sbBaseDevice * aBaseDevice) :
   mBaseDevice(aBaseDevice)
 {
@@ -246,6 +259,14 @@ sbDeviceTranscoding::PrepareBatchForTranscoding(Batch & aBatch)
     NS_ENSURE_SUCCESS(rv, rv);
   }
 
+  // Inspect the videos of the batch up front, several at a time, so finding
+  // their transcode profiles below doesn't inspect them one after another.
+  rv = InspectBatchVideos(aBatch);
+  if (rv == NS_ERROR_ABORT) {
+    return rv;
+  }
+  NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Failed to inspect the batch videos");
+
   // Iterate over the batch getting the transcode profiles if needed.
   const Batch::const_iterator end = aBatch.end();
   for (Batch::const_iterator iter = aBatch.begin();
@@ -312,6 +333,56 @@ sbDeviceTranscoding::PrepareBatchForTranscoding(Batch & aBatch)
   return NS_OK;
 }
 
+nsresult
+sbDeviceTranscoding::InspectBatchVideos(Batch & aBatch)
+{
+  TRACE(("%s", __FUNCTION__));
+
+  nsresult rv;
+
+  nsCOMPtr<nsIMutableArray> videos =
+    do_CreateInstance("@songbirdnest.com/moz/xpcom/threadsafe-array;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  const Batch::const_iterator end = aBatch.end();
+  for (Batch::const_iterator iter = aBatch.begin();
+       iter != end;
+       ++iter) {
+    TransferRequest * request = static_cast<TransferRequest*>(*iter);
+
+    if (mBaseDevice->IsRequestAborted()) {
+      return NS_ERROR_ABORT;
+    }
+
+    if (request->GetType() != sbIDevice::REQUEST_WRITE ||
+        request->IsPlaylist() ||
+        GetTranscodeType(request->item) !=
+          sbITranscodeProfile::TRANSCODE_TYPE_AUDIO_VIDEO ||
+        sbDeviceUtils::IsItemDRMProtected(request->item)) {
+      continue;
+    }
+
+    rv = videos->AppendElement(request->item, PR_FALSE);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  PRUint32 length;
+  rv = videos->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (!length) {
+    return NS_OK;
+  }
+
+  nsCOMPtr<sbIMediaInspectorService> inspectorService;
+  rv = GetMediaInspectorService(getter_AddRefs(inspectorService));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = inspectorService->InspectMediaItems(videos);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
 PRUint32
 sbDeviceTranscoding::GetTranscodeType(sbIMediaItem * aMediaItem)
 {
@@ -557,12 +628,15 @@ sbDeviceTranscoding::GetMediaFormat(PRUint32 aTranscodeType,
     return NS_OK;
   }
   else {
-    if (!mMediaInspector) {
-      mMediaInspector = do_CreateInstance(SB_MEDIAINSPECTOR_CONTRACTID, &rv);
-      NS_ENSURE_SUCCESS(rv, rv);
-    }
+    // The inspector service returns the format straight away if the batch
+    // already inspected this item.
+    nsCOMPtr<sbIMediaInspectorService> inspectorService;
+    rv = GetMediaInspectorService(getter_AddRefs(inspectorService));
+    NS_ENSURE_SUCCESS(rv, rv);
+
     nsCOMPtr<sbIMediaFormat> mediaFormat;
-    rv = mMediaInspector->InspectMedia(aMediaItem, getter_AddRefs(mediaFormat));
+    rv = inspectorService->InspectMedia(aMediaItem,
+                                        getter_AddRefs(mediaFormat));
     NS_ENSURE_SUCCESS(rv, rv);
 
     mediaFormat.forget(aMediaFormat);
@@ -582,20 +656,109 @@ sbDeviceTranscoding::GetMediaInspector(sbIMediaInspector** _retval)
   return NS_OK;
 }
 
+nsresult
+sbDeviceTranscoding::GetMediaInspectorService(
+                                      sbIMediaInspectorService** _retval)
+{
+  nsresult rv;
+  if (!mMediaInspectorService) {
+    mMediaInspectorService =
+      do_GetService(SB_MEDIAINSPECTORSERVICE_CONTRACTID, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  NS_ADDREF(*_retval = mMediaInspectorService);
+  return NS_OK;
+}
+
+struct sbDeviceTranscoding::TranscodeJob
+{
+  TransferRequest * request;
+  nsCOMPtr<sbITranscodeVideoJob> transcodeJob;
+  nsCOMPtr<sbIJobProgress> progress;
+  nsRefPtr<sbTranscodeProgressListener> listener;
+  PRInt64 estimatedSize;
+  // Set when the output was taken from the transcode cache
+  nsCOMPtr<nsIURI> cachedURI;
+  // Where to add the output to the transcode cache, if anywhere
+  nsCOMPtr<sbITranscodeCache> cache;
+  nsCOMPtr<nsIFile> sourceFile;
+  nsCOMPtr<sbITranscodeProfile> profile;
+  nsString cacheContext;
+};
+
 nsresult
 sbDeviceTranscoding::TranscodeMediaItem(
                                      sbIMediaItem *aMediaItem,
                                      sbDeviceStatusHelper * aDeviceStatusHelper,
                                      nsIURI * aDestinationURI,
-                                     nsIURI ** aTranscodedDestinationURI)
+                                     nsIURI ** aTranscodedDestinationURI,
+                                     sbITranscodeProfile * aProfile)
 {
   NS_ENSURE_ARG_POINTER(aMediaItem);
   NS_ENSURE_ARG_POINTER(aDeviceStatusHelper);
   NS_ENSURE_ARG_POINTER(aDestinationURI);
 
+  nsresult rv;
+
+  TranscodeJob job;
+  job.request = nsnull;
+  job.estimatedSize = 0;
+  rv = StartTranscode(aMediaItem,
+                      aDeviceStatusHelper,
+                      aDestinationURI,
+                      aProfile,
+                      job);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (job.cachedURI) {
+    if (aTranscodedDestinationURI)
+      job.cachedURI.forget(aTranscodedDestinationURI);
+    return NS_OK;
+  }
+
+  PRMonitor * const stopMonitor =
+    mBaseDevice->mRequestThreadQueue->GetStopWaitMonitor();
+  NS_ENSURE_TRUE(stopMonitor, NS_ERROR_UNEXPECTED);
+
+  // Wait until the transcode job is complete.
+  //XXXeps should check for abort.  To do this, the job will have to be
+  //       canceled.
+  PRBool isComplete = PR_FALSE;
+  while (!isComplete) {
+    // Operate within the request wait monitor.
+    nsAutoMonitor monitor(stopMonitor);
+
+    // Check if the job is complete.
+    isComplete = job.listener->IsComplete();
+
+    // If not complete, wait for completion.
+    if (!isComplete)
+      monitor.Wait();
+  }
+
+  return FinishTranscode(job, aTranscodedDestinationURI);
+}
+
+nsresult
+sbDeviceTranscoding::StartTranscode(sbIMediaItem * aMediaItem,
+                                    sbDeviceStatusHelper * aDeviceStatusHelper,
+                                    nsIURI * aDestinationURI,
+                                    sbITranscodeProfile * aProfile,
+                                    TranscodeJob & aJob)
+{
   // Function variables.
   nsresult rv;
 
+  // The same conversion may have been done already, for this or another
+  // device of the same model.
+  if (aProfile) {
+    rv = CopyCachedOutput(aMediaItem, aDestinationURI, aProfile, aJob);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Failed to read the transcode cache");
+    if (aJob.cachedURI) {
+      return NS_OK;
+    }
+  }
+
   // Create a transcode job.
   nsCOMPtr<nsISupports> tcJob;
   nsCOMPtr<sbITranscodeManager> txMgr;
@@ -609,25 +772,6 @@ sbDeviceTranscoding::TranscodeMediaItem(
   rv = NS_GetMainThread(getter_AddRefs(target));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsCOMPtr<nsIIOService> ioService =
-      do_ProxiedGetService("@mozilla.org/network/io-service;1", &rv);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  nsCOMPtr<nsIURI> transcodedDestinationURI;
-  nsCOMPtr<nsIURI> transcodedDestinationURIProxy;
-  rv = ioService->NewURI(NS_LITERAL_CSTRING(""),
-                         nsnull,
-                         aDestinationURI,
-                         getter_AddRefs(transcodedDestinationURI));
-  NS_ENSURE_SUCCESS(rv, rv);
-  rv = do_GetProxyForObject(target,
-                            NS_GET_IID(nsIURI),
-                            transcodedDestinationURI,
-                            NS_PROXY_SYNC | NS_PROXY_ALWAYS,
-                            getter_AddRefs(transcodedDestinationURIProxy));
-  NS_ENSURE_SUCCESS(rv, rv);
-  transcodedDestinationURI = transcodedDestinationURIProxy;
-
   nsCOMPtr<sbITranscodeVideoJob> transcodeJob = do_QueryInterface(tcJob, &rv);
   NS_ENSURE_SUCCESS(rv, rv);
   nsCOMPtr<sbITranscodeVideoJob> proxyTranscodeJob;
@@ -747,23 +891,41 @@ sbDeviceTranscoding::TranscodeMediaItem(
   rv = transcodeJob->Transcode();
   NS_ENSURE_SUCCESS(rv, rv);
 
-  // Wait until the transcode job is complete.
-  //XXXeps should check for abort.  To do this, the job will have to be
-  //       canceled.
-  PRBool isComplete = PR_FALSE;
-  while (!isComplete) {
-    // Operate within the request wait monitor.
-    nsAutoMonitor monitor(stopMonitor);
+  aJob.transcodeJob = transcodeJob;
+  aJob.progress = progress;
+  aJob.listener = listener;
 
-    // Check if the job is complete.
-    isComplete = listener->IsComplete();
+  return NS_OK;
+}
 
-    // If not complete, wait for completion.
-    if (!isComplete)
-      monitor.Wait();
+nsresult
+sbDeviceTranscoding::FinishTranscode(TranscodeJob & aJob,
+                                     nsIURI ** aTranscodedDestinationURI)
+{
+  nsresult rv;
+
+  nsCOMPtr<nsIThread> target;
+  rv = NS_GetMainThread(getter_AddRefs(target));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIIOService> ioService =
+      do_ProxiedGetService("@mozilla.org/network/io-service;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (aJob.cachedURI) {
+    if (aTranscodedDestinationURI)
+      NS_ADDREF(*aTranscodedDestinationURI = aJob.cachedURI);
+    return NS_OK;
   }
 
+  nsCOMPtr<sbITranscodeVideoJob> transcodeJob = aJob.transcodeJob;
+  nsCOMPtr<sbIJobProgress> progress = aJob.progress;
+  nsRefPtr<sbTranscodeProgressListener> listener = aJob.listener;
+
   // Get the transcoded video file URI.
+  nsCOMPtr<nsIURI> transcodedDestinationURI;
+  nsCOMPtr<nsIURI> transcodedDestinationURIProxy;
+
   nsAutoString destURI;
   rv = transcodeJob->GetDestURI(destURI);
   NS_ENSURE_SUCCESS(rv, rv);
@@ -843,9 +1005,304 @@ sbDeviceTranscoding::TranscodeMediaItem(
   // sbTranscodeProgressListener::OnMediacoreEvent
   NS_ENSURE_TRUE(status == sbIJobProgress::STATUS_SUCCEEDED, NS_ERROR_FAILURE);
 
+  // Keep the output for the next device that needs the same conversion
+  if (aJob.cache) {
+    nsCOMPtr<nsIFileURL> fileURL =
+      do_QueryInterface(transcodedDestinationURIProxy, &rv);
+    nsCOMPtr<nsIFile> file;
+    if (NS_SUCCEEDED(rv))
+      rv = fileURL->GetFile(getter_AddRefs(file));
+    if (NS_SUCCEEDED(rv)) {
+      rv = aJob.cache->AddOutput(aJob.sourceFile,
+                                 aJob.profile,
+                                 aJob.cacheContext,
+                                 file);
+    }
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+                     "Failed to add the output to the transcode cache");
+  }
+
   return NS_OK;
 }
 
+nsresult
+sbDeviceTranscoding::CopyCachedOutput(sbIMediaItem * aMediaItem,
+                                      nsIURI * aDestinationURI,
+                                      sbITranscodeProfile * aProfile,
+                                      TranscodeJob & aJob)
+{
+  nsresult rv;
+
+  nsCOMPtr<sbITranscodeCache> cache =
+    do_GetService(SONGBIRD_TRANSCODECACHE_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Only local sources are cached
+  nsCOMPtr<nsIURI> sourceURI;
+  rv = aMediaItem->GetContentSrc(getter_AddRefs(sourceURI));
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsCOMPtr<nsIFileURL> sourceFileURL = do_MainThreadQueryInterface(sourceURI);
+  if (!sourceFileURL) {
+    return NS_OK;
+  }
+  nsCOMPtr<nsIFile> sourceFile;
+  rv = sourceFileURL->GetFile(getter_AddRefs(sourceFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Outputs depend on the device model as well as on the profile, since the
+  // configurator fits the profile's properties to the device.
+  nsString context;
+  nsCOMPtr<sbIDeviceProperties> deviceProperties;
+  rv = mBaseDevice->GetProperties(getter_AddRefs(deviceProperties));
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsString value;
+  rv = deviceProperties->GetVendorName(value);
+  if (NS_SUCCEEDED(rv))
+    context.Append(value);
+  context.Append(PRUnichar('\n'));
+  nsCOMPtr<nsIVariant> modelNumber;
+  rv = deviceProperties->GetModelNumber(getter_AddRefs(modelNumber));
+  if (NS_SUCCEEDED(rv) && modelNumber) {
+    rv = modelNumber->GetAsAString(value);
+    if (NS_SUCCEEDED(rv))
+      context.Append(value);
+  }
+  context.Append(PRUnichar('\n'));
+  rv = deviceProperties->GetFirmwareVersion(value);
+  if (NS_SUCCEEDED(rv))
+    context.Append(value);
+
+  aJob.cache = cache;
+  aJob.sourceFile = sourceFile;
+  aJob.profile = aProfile;
+  aJob.cacheContext = context;
+
+  nsCOMPtr<nsIFile> cachedFile;
+  rv = cache->GetCachedOutput(sourceFile,
+                              aProfile,
+                              context,
+                              getter_AddRefs(cachedFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (!cachedFile) {
+    return NS_OK;
+  }
+
+  // Copy it next to the destination, with the extension of the cached file
+  nsCOMPtr<nsIFileURL> destinationFileURL =
+    do_MainThreadQueryInterface(aDestinationURI, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsCOMPtr<nsIFile> destinationFile;
+  rv = destinationFileURL->GetFile(getter_AddRefs(destinationFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsCOMPtr<nsIFile> destinationDir;
+  rv = destinationFile->GetParent(getter_AddRefs(destinationDir));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsString leafName;
+  rv = destinationFile->GetLeafName(leafName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  PRInt32 dot = leafName.RFindChar('.');
+  if (dot > 0)
+    leafName.SetLength(dot);
+  nsString cachedName;
+  rv = cachedFile->GetLeafName(cachedName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  dot = cachedName.RFindChar('.');
+  if (dot >= 0)
+    leafName.Append(Substring(cachedName, dot));
+
+  rv = cachedFile->CopyTo(destinationDir, leafName);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIFile> copiedFile;
+  rv = destinationDir->Clone(getter_AddRefs(copiedFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = copiedFile->Append(leafName);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIIOService> ioService =
+      do_ProxiedGetService("@mozilla.org/network/io-service;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsCOMPtr<nsIURI> copiedURI;
+  rv = ioService->NewFileURI(copiedFile, getter_AddRefs(copiedURI));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  aJob.cachedURI = do_MainThreadQueryInterface(copiedURI, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Nothing more to add to the cache for this one
+  aJob.cache = nsnull;
+
+  return NS_OK;
+}
+
+nsresult
+sbDeviceTranscoding::TranscodeBatch(Batch & aBatch,
+                                    sbDeviceStatusHelper * aDeviceStatusHelper,
+                                    BatchTranscodeHandler * aHandler)
+{
+  TRACE(("%s", __FUNCTION__));
+  NS_ENSURE_ARG_POINTER(aDeviceStatusHelper);
+  NS_ENSURE_ARG_POINTER(aHandler);
+
+  nsresult rv;
+
+  PRMonitor * const stopMonitor =
+    mBaseDevice->mRequestThreadQueue->GetStopWaitMonitor();
+  NS_ENSURE_TRUE(stopMonitor, NS_ERROR_UNEXPECTED);
+
+  PRUint32 maxJobs;
+  PRInt64 tempSpaceBudget;
+  GetTranscodeLimits(&maxJobs, &tempSpaceBudget);
+
+  nsTArray<TranscodeJob> jobs;
+  PRInt64 tempSpaceUsed = 0;
+  PRBool aborted = PR_FALSE;
+  nsresult result = NS_OK;
+
+  const Batch::const_iterator end = aBatch.end();
+  Batch::const_iterator iter = aBatch.begin();
+  while (!jobs.IsEmpty() ||
+         (iter != end && !aborted && NS_SUCCEEDED(result))) {
+    if (!aborted && mBaseDevice->IsRequestAborted()) {
+      aborted = PR_TRUE;
+    }
+
+    // Start transcodes while there is room for them.  The space an output
+    // takes is estimated from the size of its source; one transcode always
+    // runs even if that alone is over budget.
+    while (iter != end &&
+           !aborted &&
+           NS_SUCCEEDED(result) &&
+           jobs.Length() < maxJobs) {
+      TransferRequest * request = static_cast<TransferRequest*>(*iter);
+
+      if (request->GetType() != sbIDevice::REQUEST_WRITE ||
+          request->IsPlaylist() ||
+          !request->transcodeProfile) {
+        ++iter;
+        continue;
+      }
+
+      PRInt64 estimatedSize;
+      rv = request->item->GetContentLength(&estimatedSize);
+      if (NS_FAILED(rv) || estimatedSize < 0) {
+        estimatedSize = 0;
+      }
+      if (!jobs.IsEmpty() && tempSpaceUsed + estimatedSize > tempSpaceBudget) {
+        break;
+      }
+      ++iter;
+
+      nsCOMPtr<nsIURI> destinationURI;
+      rv = aHandler->GetTranscodeDestination(request,
+                                             getter_AddRefs(destinationURI));
+      if (NS_SUCCEEDED(rv)) {
+        TranscodeJob * job = jobs.AppendElement();
+        NS_ENSURE_TRUE(job, NS_ERROR_OUT_OF_MEMORY);
+        job->request = request;
+        job->estimatedSize = estimatedSize;
+
+        rv = StartTranscode(request->item,
+                            aDeviceStatusHelper,
+                            destinationURI,
+                            request->transcodeProfile,
+                            *job);
+        if (NS_SUCCEEDED(rv) && !job->cachedURI) {
+          tempSpaceUsed += estimatedSize;
+          continue;
+        }
+
+        // Taken from the cache, it can be written straight away
+        nsCOMPtr<nsIURI> cachedURI = job->cachedURI;
+        jobs.RemoveElementAt(jobs.Length() - 1);
+        if (cachedURI) {
+          result = aHandler->OnTranscodeComplete(request, cachedURI, NS_OK);
+          continue;
+        }
+      }
+
+      TRACE(("%s: unable to start transcode", __FUNCTION__));
+      result = aHandler->OnTranscodeComplete(request, nsnull, rv);
+    }
+
+    if (jobs.IsEmpty()) {
+      continue;
+    }
+
+    // Wait for any of the running transcodes to complete
+    PRInt32 completed = -1;
+    {
+      nsAutoMonitor monitor(stopMonitor);
+      while (completed < 0) {
+        for (PRUint32 i = 0; i < jobs.Length(); ++i) {
+          if (jobs[i].listener->IsComplete()) {
+            completed = i;
+            break;
+          }
+        }
+        if (completed < 0)
+          monitor.Wait();
+      }
+    }
+
+    TranscodeJob job = jobs[completed];
+    jobs.RemoveElementAt(completed);
+    tempSpaceUsed -= job.estimatedSize;
+
+    nsCOMPtr<nsIURI> transcodedURI;
+    rv = FinishTranscode(job, getter_AddRefs(transcodedURI));
+    if (rv == NS_ERROR_ABORT) {
+      aborted = PR_TRUE;
+      continue;
+    }
+    if (NS_FAILED(rv)) {
+      transcodedURI = nsnull;
+    }
+
+    // Hand the output over to be written while the others keep going
+    nsresult handlerResult =
+      aHandler->OnTranscodeComplete(job.request, transcodedURI, rv);
+    if (NS_SUCCEEDED(result)) {
+      result = handlerResult;
+    }
+  }
+
+  if (aborted) {
+    return NS_ERROR_ABORT;
+  }
+
+  return result;
+}
+
+void
+sbDeviceTranscoding::GetTranscodeLimits(PRUint32 * aMaxJobs,
+                                        PRInt64 * aTempSpaceBudget)
+{
+  nsresult rv;
+
+  PRInt32 maxJobs = PR_GetNumberOfProcessors();
+  PRInt32 tempSpace = DEFAULT_TRANSCODE_TEMP_SPACE;
+
+  nsCOMPtr<nsIPrefBranch> prefBranch;
+  rv = mBaseDevice->GetPrefBranch(PREF_TRANSCODE_BRANCH,
+                                  getter_AddRefs(prefBranch));
+  if (NS_SUCCEEDED(rv)) {
+    PRInt32 value;
+    rv = prefBranch->GetIntPref(PREF_TRANSCODE_MAX_JOBS, &value);
+    if (NS_SUCCEEDED(rv)) {
+      maxJobs = value;
+    }
+    rv = prefBranch->GetIntPref(PREF_TRANSCODE_TEMP_SPACE, &value);
+    if (NS_SUCCEEDED(rv)) {
+      tempSpace = value;
+    }
+  }
+
+  *aMaxJobs = NS_MAX(maxJobs, 1);
+  *aTempSpaceBudget = static_cast<PRInt64>(NS_MAX(tempSpace, 0)) * 1024 * 1024;
+}
+
 nsresult sbDeviceTranscoding::GetTranscodeManager(
                                        sbITranscodeManager ** aTranscodeManager)
 {
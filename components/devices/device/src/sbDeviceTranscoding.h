@@ -41,6 +41,7 @@
 #include "sbBaseDevice.h"
 
 class sbIMediaInspector;
+class sbIMediaInspectorService;
 class sbITranscodeVideoJob;
 class sbDeviceStatusHelper;
 
@@ -100,6 +101,12 @@ public:
    */
   nsresult PrepareBatchForTranscoding(Batch & aBatch);
 
+  /**
+   * Inspect the video items of the batch together so that GetMediaFormat
+   * finds their formats already known.
+   */
+  nsresult InspectBatchVideos(Batch & aBatch);
+
   /**
    * Returns the transcode type for the item
    */
@@ -124,23 +131,102 @@ public:
    */
   nsresult GetMediaInspector(sbIMediaInspector** _retval);
 
+  /**
+   * Get the media inspector service, which caches the formats it finds
+   */
+  nsresult GetMediaInspectorService(sbIMediaInspectorService** _retval);
+
   /**
    * Transcode a media item to the destination specified
    * by aDestinationURI.  If aTranscodedDestinationURI is not null, return the
    * final destination URI with transcoded file extension in
-   * aTranscodedDestinationURI.
+   * aTranscodedDestinationURI.  If aProfile, the profile the item was found
+   * to need, is given the output is looked up in and added to the transcode
+   * cache.
    */
   nsresult TranscodeMediaItem(sbIMediaItem *aItem,
                               sbDeviceStatusHelper * aDeviceStatusHelper,
                               nsIURI * aDestinationURI,
-                              nsIURI ** aTranscodedDestinationURI = nsnull);
+                              nsIURI ** aTranscodedDestinationURI = nsnull,
+                              sbITranscodeProfile * aProfile = nsnull);
+
+  /**
+   * Receives the items of a batch transcode. Both methods are called on the
+   * request thread.
+   */
+  class BatchTranscodeHandler
+  {
+  public:
+    /**
+     * Return the URI the request's item should be transcoded to.
+     */
+    virtual nsresult GetTranscodeDestination(TransferRequest * aRequest,
+                                             nsIURI ** aDestinationURI) = 0;
+
+    /**
+     * Called as each transcode finishes, in the order they finish, so the
+     * output can be written to the device while later items are still being
+     * transcoded. aTranscodedURI is null if aResult is a failure. A failure
+     * returned from here stops the batch once the running transcodes end.
+     */
+    virtual nsresult OnTranscodeComplete(TransferRequest * aRequest,
+                                         nsIURI * aTranscodedURI,
+                                         nsresult aResult) = 0;
+  protected:
+    ~BatchTranscodeHandler() {}
+  };
+
+  /**
+   * Transcode the write requests of a batch that have a transcode profile,
+   * running several transcodes at once. The number of transcodes is bounded
+   * by the processor count and by an estimate of the temporary space their
+   * outputs take. Returns NS_ERROR_ABORT if the request was aborted.
+   */
+  nsresult TranscodeBatch(Batch & aBatch,
+                          sbDeviceStatusHelper * aDeviceStatusHelper,
+                          BatchTranscodeHandler * aHandler);
 private:
+  struct TranscodeJob;
+
   sbDeviceTranscoding(sbBaseDevice * aBaseDevice);
   nsresult GetTranscodeManager(sbITranscodeManager ** aTranscodeManager);
 
+  /**
+   * Set up a transcode of aItem to aDestinationURI and start it, unless the
+   * output for aProfile is in the transcode cache
+   */
+  nsresult StartTranscode(sbIMediaItem * aItem,
+                          sbDeviceStatusHelper * aDeviceStatusHelper,
+                          nsIURI * aDestinationURI,
+                          sbITranscodeProfile * aProfile,
+                          TranscodeJob & aJob);
+
+  /**
+   * Copy the cached output of transcoding aItem with aProfile next to
+   * aDestinationURI, setting aJob.cachedURI if there was one. Otherwise sets
+   * aJob up to add the output to the cache once transcoded.
+   */
+  nsresult CopyCachedOutput(sbIMediaItem * aItem,
+                            nsIURI * aDestinationURI,
+                            sbITranscodeProfile * aProfile,
+                            TranscodeJob & aJob);
+
+  /**
+   * Check the result of a transcode once it has completed
+   */
+  nsresult FinishTranscode(TranscodeJob & aJob,
+                           nsIURI ** aTranscodedDestinationURI);
+
+  /**
+   * Read how many transcodes may run at once and how much temporary space,
+   * in bytes, their outputs may take
+   */
+  void GetTranscodeLimits(PRUint32 * aMaxJobs, PRInt64 * aTempSpaceBudget);
+
   sbBaseDevice * mBaseDevice;
   nsCOMPtr<nsIArray> mTranscodeProfiles;
   nsCOMPtr<sbIMediaInspector> mMediaInspector;
+  nsCOMPtr<sbIMediaInspectorService> mMediaInspectorService;
   nsCOMPtr<sbITranscodeManager> mTranscodeManager;
 };
 
@@ -79,7 +79,7 @@ create index idx_resource_properties_property_id_obj_sortable_obj_secondary_sort
 create table simple_media_lists (
   media_item_id integer not null,
   member_media_item_id integer not null,
-  ordinal text not null collate tree
+  ordinal integer not null
 );
 create index idx_simple_media_lists_media_item_id_member_media_item_id on simple_media_lists (media_item_id, member_media_item_id, ordinal);
 create unique index idx_simple_media_lists_media_item_id_ordinal on simple_media_lists (media_item_id, ordinal);
@@ -128,7 +128,7 @@ insert into media_list_types (type, factory_contractid) values ('simple', '@song
 /*  XXXAus: !!!WARNING!!! When changing this value, you _MUST_ update         */
 /*  sbLocalDatabaseMigrationHelper._latestSchemaVersion.                      */
 /**************************************************************************** */
-insert into library_metadata (name, value) values ('version', '29');
+insert into library_metadata (name, value) values ('version', '30');
 
 /**************************************************************************** */
 /*  XXXkreeger: !! WARNING !! When changing this schema, the |ANALYZE| data   */
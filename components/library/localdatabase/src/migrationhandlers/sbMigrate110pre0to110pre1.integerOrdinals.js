@@ -0,0 +1,119 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+Components.utils.import("resource://gre/modules/XPCOMUtils.jsm");
+Components.utils.import("resource://app/jsmodules/sbLocalDatabaseMigrationUtils.jsm");
+Components.utils.import("resource://app/jsmodules/SBJobUtils.jsm");
+
+const Cc = Components.classes;
+const Ci = Components.interfaces;
+const Cr = Components.results;
+
+const FROM_VERSION = 29;
+const TO_VERSION = 30;
+
+function LOG(s) {
+  dump("----++++----++++sbLibraryMigration " +
+       FROM_VERSION + " to " + TO_VERSION + ": " +
+       s +
+       "\n----++++----++++\n");
+}
+
+function sbLibraryMigration()
+{
+  SBLocalDatabaseMigrationUtils.BaseMigrationHandler.call(this);
+  this._errors = [];
+}
+
+//-----------------------------------------------------------------------------
+// sbLocalDatabaseMigration Implementation
+//-----------------------------------------------------------------------------
+
+sbLibraryMigration.prototype = {
+  __proto__: SBLocalDatabaseMigrationUtils.BaseMigrationHandler.prototype,
+  classDescription: 'Songbird Migration Handler, version ' +
+                     FROM_VERSION + ' to ' + TO_VERSION,
+  classID: Components.ID("{05fe137a-8442-4a1d-bf5f-56b48ac00ada}"),
+  contractID: SBLocalDatabaseMigrationUtils.baseHandlerContractID +
+              FROM_VERSION + 'to' + TO_VERSION,
+
+  fromVersion: FROM_VERSION,
+  toVersion: TO_VERSION,
+
+  migrate: function sbLibraryMigration_migrate(aLibrary) {
+    try {
+      this._databaseGUID = aLibrary.databaseGuid;
+      this._databaseLocation = aLibrary.databaseLocation;
+
+      // Simple media list ordinals used to be dotted paths sorted with the
+      // tree collation.  Renumber every list in its current order with
+      // integers spaced 1024 apart, keeping the rowids of the rows.
+      var query = this.createMigrationQuery(aLibrary);
+      query.addQuery("create temp table migrate_sml_order (position integer primary key, sml_rowid integer not null, media_item_id integer not null)");
+      query.addQuery("insert into migrate_sml_order (sml_rowid, media_item_id) select rowid, media_item_id from simple_media_lists order by media_item_id, ordinal");
+      query.addQuery("create temp table migrate_sml_start as select media_item_id, min(position) as start from migrate_sml_order group by media_item_id");
+      query.addQuery("create table simple_media_lists_new (media_item_id integer not null, member_media_item_id integer not null, ordinal integer not null)");
+      query.addQuery("insert into simple_media_lists_new (rowid, media_item_id, member_media_item_id, ordinal) select sml.rowid, sml.media_item_id, sml.member_media_item_id, (o.position - s.start) * 1024 from migrate_sml_order as o join migrate_sml_start as s on s.media_item_id = o.media_item_id join simple_media_lists as sml on sml.rowid = o.sml_rowid");
+      query.addQuery("drop table simple_media_lists");
+      query.addQuery("alter table simple_media_lists_new rename to simple_media_lists");
+      query.addQuery("create index idx_simple_media_lists_media_item_id_member_media_item_id on simple_media_lists (media_item_id, member_media_item_id, ordinal)");
+      query.addQuery("create unique index idx_simple_media_lists_media_item_id_ordinal on simple_media_lists (media_item_id, ordinal)");
+      query.addQuery("create index idx_simple_media_lists_member_media_item_id on simple_media_lists (member_media_item_id)");
+      query.addQuery("drop table migrate_sml_order");
+      query.addQuery("drop table migrate_sml_start");
+      query.addQuery("analyze");
+      query.addQuery("commit");
+
+      this.migrationQuery = query;
+      
+      var sip = Cc["@mozilla.org/supports-interface-pointer;1"]
+                  .createInstance(Ci.nsISupportsInterfacePointer);
+      sip.data = this;
+      
+      this._titleText = "Library Migration Helper";
+      this._statusText = "Migrating playlist order in 1.10 database...";
+
+      query.setAsyncQuery(true);
+      query.execute();
+      
+      this.startNotificationTimer();
+      SBJobUtils.showProgressDialog(sip.data, null, 0);
+      this.stopNotificationTimer();
+    }
+    catch (e) {
+      dump("Exception occured: " + e);
+      throw e;
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+// Module
+//-----------------------------------------------------------------------------
+function NSGetModule(compMgr, fileSpec) {
+  return XPCOMUtils.generateModule([
+    sbLibraryMigration
+  ]);
+}
+
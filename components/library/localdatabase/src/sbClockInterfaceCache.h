@@ -0,0 +1,272 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2010 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+#ifndef SBCLOCKINTERFACECACHE_H_
+#define SBCLOCKINTERFACECACHE_H_
+
+#include <nsCOMArray.h>
+#include <nsDataHashtable.h>
+#include <nsTArray.h>
+
+/**
+ * This class provides a cache for interface pointers bounded by the
+ * estimated memory used by the cached objects rather than by their number.
+ * It holds an owning reference to the pointer, but hands out
+ * raw pointers that must be AddRef'd by the caller if they
+ * wish to hold on to it.
+ *
+ * Entries are aged out with the CLOCK algorithm: a lookup marks the entry
+ * as referenced, and when room is needed a hand sweeps the entries, clearing
+ * the mark on referenced entries and evicting the first unmarked one. This
+ * approximates LRU without touching anything but a flag on a hit.
+ *
+ * KeyStorage is the type used to keep a copy of a key, e.g. nsString for
+ * nsStringHashKey.
+ *
+ * The class is not threadsafe, callers must provide their own locking.
+ */
+template <class KeyClass, class KeyStorage, class Interface>
+class sbClockInterfaceCache
+{
+public:
+  typedef typename KeyClass::KeyType KeyType;
+
+  /**
+   * Initializes the cache. aInitialSize is the number of entries the
+   * storage is sized for initially, aBudget the total cost allowed.
+   */
+  sbClockInterfaceCache(PRUint32 aInitialSize, PRUint64 aBudget) :
+    mHand(0),
+    mCount(0),
+    mBudget(aBudget),
+    mCost(0),
+    mHits(0),
+    mMisses(0),
+    mEvictions(0)
+  {
+    NS_ASSERTION(aInitialSize, "sbClockInterfaceCache must have a size > 0");
+    mEntries.SetCapacity(aInitialSize);
+    mIndex.Init(aInitialSize);
+  }
+  /**
+   * Releases references to the objects we're holding
+   */
+  ~sbClockInterfaceCache()
+  {
+    Clear();
+  }
+  /**
+   * Replaces or adds the interface pointer for aKey with the estimated cost
+   * aCost. The previous interface pointer is released if there is one.
+   * Entries are evicted until the new one fits within the budget, the
+   * evicted pointers are appended to aEvicted if it is given.
+   */
+  void Put(KeyType aKey,
+           Interface * aValue,
+           PRUint32 aCost,
+           nsCOMArray<Interface> * aEvicted = nsnull)
+  {
+    NS_ENSURE_TRUE(aValue, /* void */);
+
+    PRUint32 slot;
+    if (mIndex.Get(aKey, &slot)) {
+      Entry & entry = mEntries[slot];
+      NS_ADDREF(aValue);
+      NS_RELEASE(entry.mValue);
+      entry.mValue = aValue;
+      mCost = mCost - entry.mCost + aCost;
+      entry.mCost = aCost;
+      entry.mReferenced = PR_TRUE;
+      Evict(0, aEvicted);
+      return;
+    }
+
+    Evict(aCost, aEvicted);
+
+    PRUint32 const freeCount = mFreeSlots.Length();
+    if (freeCount) {
+      slot = mFreeSlots[freeCount - 1];
+      mFreeSlots.RemoveElementAt(freeCount - 1);
+    }
+    else {
+      slot = mEntries.Length();
+      NS_ENSURE_TRUE(mEntries.AppendElement(), /* void */);
+    }
+
+    if (!mIndex.Put(aKey, slot)) {
+      mFreeSlots.AppendElement(slot);
+      return;
+    }
+
+    Entry & entry = mEntries[slot];
+    entry.mKey = aKey;
+    NS_ADDREF(entry.mValue = aValue);
+    entry.mCost = aCost;
+    entry.mReferenced = PR_FALSE;
+    mCost += aCost;
+    ++mCount;
+  }
+  /**
+   * Returns the interface pointer for aKey and marks it as recently used.
+   * If it's not found then nsnull is returned. The pointer returned is not
+   * addref'd so if you want to keep it around be sure to do it youself
+   */
+  Interface * Get(KeyType aKey)
+  {
+    PRUint32 slot;
+    if (!mIndex.Get(aKey, &slot)) {
+      ++mMisses;
+      return nsnull;
+    }
+    ++mHits;
+    Entry & entry = mEntries[slot];
+    entry.mReferenced = PR_TRUE;
+    return entry.mValue;
+  }
+  /**
+   * Returns the interface pointer for aKey like Get, but without counting
+   * the lookup or marking the entry as used
+   */
+  Interface * Peek(KeyType aKey) const
+  {
+    PRUint32 slot;
+    if (!mIndex.Get(aKey, &slot)) {
+      return nsnull;
+    }
+    return mEntries[slot].mValue;
+  }
+  /**
+   * Removes the entry for aKey, if there is one
+   */
+  void Remove(KeyType aKey)
+  {
+    PRUint32 slot;
+    if (mIndex.Get(aKey, &slot)) {
+      RemoveSlot(slot);
+    }
+  }
+  /**
+   * Releases every entry. Statistics are kept.
+   */
+  void Clear()
+  {
+    PRUint32 const length = mEntries.Length();
+    for (PRUint32 slot = 0; slot < length; ++slot) {
+      NS_IF_RELEASE(mEntries[slot].mValue);
+    }
+    mEntries.Clear();
+    mFreeSlots.Clear();
+    mIndex.Clear();
+    mHand = 0;
+    mCount = 0;
+    mCost = 0;
+  }
+  /**
+   * Changes the budget, evicting entries if the cache is now over it
+   */
+  void SetBudget(PRUint64 aBudget)
+  {
+    mBudget = aBudget;
+    Evict(0);
+  }
+  PRUint64 Budget() const { return mBudget; }
+  PRUint64 Cost() const { return mCost; }
+  PRUint32 Count() const { return mCount; }
+  PRUint64 Hits() const { return mHits; }
+  PRUint64 Misses() const { return mMisses; }
+  PRUint64 Evictions() const { return mEvictions; }
+  /**
+   * Counts a miss for callers that can tell a lookup misses without asking
+   * the cache
+   */
+  void NoteMiss() { ++mMisses; }
+  void ResetStatistics()
+  {
+    mHits = 0;
+    mMisses = 0;
+    mEvictions = 0;
+  }
+private:
+  struct Entry
+  {
+    Entry() : mValue(nsnull), mCost(0), mReferenced(PR_FALSE) {}
+    KeyStorage mKey;
+    Interface * mValue;
+    PRUint32 mCost;
+    PRPackedBool mReferenced;
+  };
+
+  /**
+   * Sweeps the clock hand until aCost more fits within the budget
+   */
+  void Evict(PRUint32 aCost, nsCOMArray<Interface> * aEvicted = nsnull)
+  {
+    while (mCount && mCost + aCost > mBudget) {
+      if (mHand >= mEntries.Length()) {
+        mHand = 0;
+      }
+      Entry & entry = mEntries[mHand];
+      if (entry.mValue) {
+        if (entry.mReferenced) {
+          entry.mReferenced = PR_FALSE;
+        }
+        else {
+          if (aEvicted) {
+            aEvicted->AppendObject(entry.mValue);
+          }
+          RemoveSlot(mHand);
+          ++mEvictions;
+        }
+      }
+      ++mHand;
+    }
+  }
+  void RemoveSlot(PRUint32 aSlot)
+  {
+    Entry & entry = mEntries[aSlot];
+    mIndex.Remove(entry.mKey);
+    NS_RELEASE(entry.mValue);
+    mCost -= entry.mCost;
+    entry.mCost = 0;
+    entry.mReferenced = PR_FALSE;
+    --mCount;
+    mFreeSlots.AppendElement(aSlot);
+  }
+
+  // The cached entries, slots of removed entries are reused
+  nsTArray<Entry> mEntries;
+  nsTArray<PRUint32> mFreeSlots;
+  // Maps a key to its slot in mEntries
+  nsDataHashtable<KeyClass, PRUint32> mIndex;
+  PRUint32 mHand;
+  PRUint32 mCount;
+  PRUint64 mBudget;
+  PRUint64 mCost;
+  PRUint64 mHits;
+  PRUint64 mMisses;
+  PRUint64 mEvictions;
+};
+
+#endif /* SBCLOCKINTERFACECACHE_H_ */
@@ -34,6 +34,7 @@
 #include <nsIThread.h>
 #include <nsIURI.h>
 #include <nsThreadUtils.h>
+#include <pratom.h>
 #include <prlog.h>
 #include <sbILocalDatabasePropertyCache.h>
 #include <sbLocalDatabaseCID.h>
@@ -55,6 +56,9 @@ static PRLogModuleInfo* gLocalDatabaseAsyncGUIDArrayLog = nsnull;
 // Shut down the thread after 45 seconds of inactivity
 #define SB_LOCALDATABASE_ASYNCGUIDARRAY_THREAD_TIMEOUT (45)
 
+// Rows a prefetch reads per hold of the sync monitor
+#define SB_LOCALDATABASE_ASYNCGUIDARRAY_PREFETCH_CHUNK (50)
+
 
 static const char kShutdownMessage[] = "xpcom-shutdown-threads";
 
@@ -65,7 +69,8 @@ NS_IMPL_THREADSAFE_ISUPPORTS4(sbLocalDatabaseAsyncGUIDArray,
                               nsISupportsWeakReference)
 
 sbLocalDatabaseAsyncGUIDArray::sbLocalDatabaseAsyncGUIDArray() :
-  mThreadShouldExit(PR_FALSE)
+  mThreadShouldExit(PR_FALSE),
+  mPrefetchGeneration(0)
 {
 #ifdef PR_LOGGING
   if (!gLocalDatabaseAsyncGUIDArrayLog) {
@@ -181,6 +186,87 @@ sbLocalDatabaseAsyncGUIDArray::EnqueueCommand(CommandType aType,
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseAsyncGUIDArray::Prefetch(const CommandSpec& aCommand)
+{
+  nsresult rv;
+
+  TRACE(("sbLocalDatabaseAsyncGUIDArray[0x%x] - Background Prefetch(%d, %d)",
+         this, aCommand.index, aCommand.count));
+
+  nsCOMPtr<sbILocalDatabasePropertyCache> propertyCache;
+  nsTArray<nsString> guids;
+  nsTArray<const PRUnichar*> guidPointers;
+
+  PRUint32 index = aCommand.index;
+  PRUint32 const end = aCommand.index + aCommand.count;
+  while (index < end) {
+
+    // A newer prefetch makes this one stale
+    if (aCommand.generation != mPrefetchGeneration) {
+      TRACE(("sbLocalDatabaseAsyncGUIDArray[0x%x] - Prefetch superseded",
+             this));
+      return NS_OK;
+    }
+
+    guids.Clear();
+
+    // Only hold the sync monitor for a chunk at a time so the synchronous
+    // calls the tree makes while painting don't wait behind the whole range
+    {
+      nsAutoMonitor monitor(mSyncMonitor);
+
+      PRUint32 length;
+      rv = mInner->GetLength(&length);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      PRUint32 const chunkEnd =
+        PR_MIN(PR_MIN(index + SB_LOCALDATABASE_ASYNCGUIDARRAY_PREFETCH_CHUNK,
+                      end),
+               length);
+      if (index >= chunkEnd) {
+        break;
+      }
+
+      if (!propertyCache) {
+        // Distinct arrays hold property values rather than GUIDs, so there
+        // are no bags to read for them
+        PRBool isDistinct;
+        rv = mInner->GetIsDistinct(&isDistinct);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        if (!isDistinct) {
+          rv = mInner->GetPropertyCache(getter_AddRefs(propertyCache));
+          NS_ENSURE_SUCCESS(rv, rv);
+        }
+      }
+
+      for (; index < chunkEnd; index++) {
+        nsString* guid = guids.AppendElement();
+        NS_ENSURE_TRUE(guid, NS_ERROR_OUT_OF_MEMORY);
+
+        rv = mInner->GetGuidByIndex(index, *guid);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+    }
+
+    if (propertyCache) {
+      guidPointers.Clear();
+      for (PRUint32 i = 0; i < guids.Length(); i++) {
+        const PRUnichar** guid = guidPointers.AppendElement();
+        NS_ENSURE_TRUE(guid, NS_ERROR_OUT_OF_MEMORY);
+        *guid = guids[i].BeginReading();
+      }
+
+      rv = propertyCache->CacheProperties(guidPointers.Elements(),
+                                          guidPointers.Length());
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  return NS_OK;
+}
+
 // sbILocalDatabaseAsyncGUIDArray
 NS_IMETHODIMP
 sbLocalDatabaseAsyncGUIDArray::AddAsyncListener
@@ -279,6 +365,48 @@ sbLocalDatabaseAsyncGUIDArray::GetMediaItemIdByIndexAsync(PRUint32 aIndex)
   return EnqueueCommand(eGetMediaItemIdByIndex, aIndex);
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::PrefetchAsync(PRUint32 aIndex,
+                                             PRUint32 aCount)
+{
+  nsresult rv;
+
+  TRACE(("sbLocalDatabaseAsyncGUIDArray[0x%x] - PrefetchAsync(%d, %d)",
+         this, aIndex, aCount));
+
+  if (!aCount) {
+    return NS_OK;
+  }
+
+  {
+    nsAutoMonitor mon(mQueueMonitor);
+
+    // Only the latest prefetch is worth doing, drop the queued ones and tell
+    // a running one to stop
+    for (PRInt32 i = mQueue.Length() - 1; i >= 0; i--) {
+      if (mQueue[i].type == ePrefetch) {
+        mQueue.RemoveElementAt(i);
+      }
+    }
+
+    CommandSpec* cs = mQueue.AppendElement();
+    NS_ENSURE_TRUE(cs, NS_ERROR_OUT_OF_MEMORY);
+    cs->type       = ePrefetch;
+    cs->index      = aIndex;
+    cs->count      = aCount;
+    cs->generation = PR_AtomicIncrement(&mPrefetchGeneration);
+
+    if (!mThread) {
+      rv = InitalizeThread();
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
+    mon.Notify();
+  }
+
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseAsyncGUIDArray::CloneAsyncArray(sbILocalDatabaseAsyncGUIDArray** _retval)
 {
@@ -506,6 +634,60 @@ sbLocalDatabaseAsyncGUIDArray::GetLengthCache(
   return mInner->GetLengthCache(aLengthCache);
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::SetSortIndex(
+        sbILocalDatabaseGUIDArraySortIndex *aSortIndex)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->SetSortIndex(aSortIndex);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::GetSortIndex(
+        sbILocalDatabaseGUIDArraySortIndex **aSortIndex)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->GetSortIndex(aSortIndex);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::SetFilterSnapshot(
+        sbILocalDatabaseFilterSnapshot *aFilterSnapshot)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->SetFilterSnapshot(aFilterSnapshot);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::GetFilterSnapshot(
+        sbILocalDatabaseFilterSnapshot **aFilterSnapshot)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->GetFilterSnapshot(aFilterSnapshot);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::SetSearchIndex(
+        sbILocalDatabaseSearchIndex *aSearchIndex)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->SetSearchIndex(aSearchIndex);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::GetSearchIndex(
+        sbILocalDatabaseSearchIndex **aSearchIndex)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->GetSearchIndex(aSearchIndex);
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseAsyncGUIDArray::MayInvalidate(PRUint32 * aDirtyPropIDs,
                                         PRUint32 aCount)
@@ -515,6 +697,40 @@ sbLocalDatabaseAsyncGUIDArray::MayInvalidate(PRUint32 * aDirtyPropIDs,
   return mInner->MayInvalidate(aDirtyPropIDs, aCount);
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::MayInvalidateItems(const PRUnichar** aDirtyGUIDs,
+                                                  PRUint32* aDirtyPropIDs,
+                                                  PRUint32 aCount)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->MayInvalidateItems(aDirtyGUIDs, aDirtyPropIDs, aCount);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::ApplyItemAdded(const nsAString& aGuid)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->ApplyItemAdded(aGuid);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::ApplyItemRemoved(const nsAString& aGuid)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->ApplyItemRemoved(aGuid);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseAsyncGUIDArray::ApplyItemUpdated(const nsAString& aGuid)
+{
+  nsAutoMonitor monitor(mSyncMonitor);
+
+  return mInner->ApplyItemUpdated(aGuid);
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseAsyncGUIDArray::AddSort(const nsAString& aProperty,
                                        PRBool aAscending)
@@ -896,6 +1112,11 @@ CommandProcessor::Run()
                                                              NS_ERROR_ABORT);
             break;
 
+            case ePrefetch:
+              // Nobody waits on a prefetch
+              rv = NS_OK;
+            break;
+
             default:
               NS_NOTREACHED("Invalid command type");
               rv = NS_ERROR_UNEXPECTED;
@@ -910,11 +1131,18 @@ CommandProcessor::Run()
 
       // Pop the next command off the top of the queue
       const CommandSpec& top = mFriendArray->mQueue[0];
-      cs.type  = top.type;
-      cs.index = top.index;
+      cs = top;
       mFriendArray->mQueue.RemoveElementAt(0);
     }
 
+    // Prefetches take the sync monitor per chunk themselves and don't
+    // notify listeners
+    if (cs.type == ePrefetch) {
+      rv = mFriendArray->Prefetch(cs);
+      NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Prefetch failed");
+      continue;
+    }
+
     // Sync lock here so we don't run over synchronous usage of the array
     {
       nsAutoMonitor monitor(mFriendArray->mSyncMonitor);
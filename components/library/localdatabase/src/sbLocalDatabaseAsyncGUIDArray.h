@@ -52,17 +52,23 @@ enum CommandType {
   eGetLength,
   eGetByIndex,
   eGetSortPropertyValueByIndex,
-  eGetMediaItemIdByIndex
+  eGetMediaItemIdByIndex,
+  ePrefetch
 };
 
 struct CommandSpec {
   CommandSpec() :
     type(eNone),
-    index(0)
+    index(0),
+    count(0),
+    generation(0)
   {
   }
   CommandType type;
   PRUint32 index;
+  // Only used by ePrefetch
+  PRUint32 count;
+  PRInt32 generation;
 };
 
 typedef nsTArray<CommandSpec> sbCommandQueue;
@@ -83,6 +89,7 @@ public:
   nsresult InitalizeThread();
   nsresult ShutdownThread();
   nsresult EnqueueCommand(CommandType aType, PRUint32 aIndex);
+  nsresult Prefetch(const CommandSpec& aCommand);
 
   sbLocalDatabaseAsyncGUIDArray();
   virtual ~sbLocalDatabaseAsyncGUIDArray();
@@ -113,6 +120,10 @@ private:
   // Tell our background thread it should exit
   PRPackedBool mThreadShouldExit;
 
+  // Bumped by each prefetch request, a running prefetch with an older
+  // generation stops at its next chunk
+  PRInt32 mPrefetchGeneration;
+
   nsresult SendOnGetLength(PRUint32 aLength, nsresult aResult);
   nsresult SendOnGetGuidByIndex(PRUint32 aIndex,
                                 const nsAString& aGUID,
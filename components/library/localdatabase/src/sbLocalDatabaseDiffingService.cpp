@@ -38,6 +38,10 @@
 #include <nsIProgrammingLanguage.h>
 #include <nsIStringEnumerator.h>
 
+#include <sbIDatabaseQuery.h>
+#include <sbIDatabaseResult.h>
+#include <sbILocalDatabaseLibrary.h>
+#include <sbILocalDatabasePropertyCache.h>
 #include <sbIMediaListView.h>
 
 #include <nsArrayUtils.h>
@@ -57,8 +61,92 @@
 #include <sbStandardProperties.h>
 #include <sbStringUtils.h>
 
+#include "sbLocalDatabaseSchemaInfo.h"
+#include "sbLocalDatabaseSQL.h"
+
 static nsID const NULL_GUID = {0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0 } };
 
+/**
+ * Number of media items read from the database at a time when diffing
+ * local database libraries
+ */
+#define DIFF_READ_PAGE_SIZE (1000)
+
+/**
+ * These properties are excluded from comparing items since they are
+ * automatically maintained and do not reflect actual metadata differences.
+ * Sadly content length has to be excluded too because on a device the
+ * length may be different.
+ */
+static char const * const sExcludedProperties[] = {
+  SB_PROPERTY_CREATED,
+  SB_PROPERTY_UPDATED,
+  SB_PROPERTY_GUID,
+  SB_PROPERTY_ORIGINITEMGUID,
+  SB_PROPERTY_ORIGINLIBRARYGUID,
+  SB_PROPERTY_ORIGINURL,
+  SB_PROPERTY_CONTENTLENGTH
+};
+
+static PRBool
+IsExcludedProperty(nsAString const & aPropertyID)
+{
+  for (PRUint32 i = 0; i < NS_ARRAY_LENGTH(sExcludedProperties); ++i) {
+    if (aPropertyID.EqualsLiteral(sExcludedProperties[i])) {
+      return PR_TRUE;
+    }
+  }
+  return PR_FALSE;
+}
+
+/**
+ * 64 bit FNV-1a hash of a property and its value. The hashes of an item's
+ * properties are summed, so the order they are read in doesn't matter.
+ */
+static PRUint64
+HashProperty(nsAString const & aPropertyID, nsAString const & aValue)
+{
+  PRUint64 const prime = (PRUint64(0x100) << 32) | 0x1b3;
+  PRUint64 hash = (PRUint64(0xcbf29ce4) << 32) | 0x84222325;
+
+  PRUnichar const * const idChars = aPropertyID.BeginReading();
+  PRUint32 const idLength = aPropertyID.Length();
+  for (PRUint32 i = 0; i < idLength; ++i) {
+    hash ^= idChars[i];
+    hash *= prime;
+  }
+
+  // Keep the id and value apart
+  hash *= prime;
+
+  PRUnichar const * const valueChars = aValue.BeginReading();
+  PRUint32 const valueLength = aValue.Length();
+  for (PRUint32 i = 0; i < valueLength; ++i) {
+    hash ^= valueChars[i];
+    hash *= prime;
+  }
+
+  return hash;
+}
+
+/**
+ * Returns aValue the way SQLite's quote() returns a text value
+ */
+static nsString
+QuoteSQLString(nsAString const & aValue)
+{
+  nsString value(aValue);
+  nsString_ReplaceSubstring(value,
+                            NS_LITERAL_STRING("'"),
+                            NS_LITERAL_STRING("''"));
+
+  nsString quoted;
+  quoted.AppendLiteral("'");
+  quoted.Append(value);
+  quoted.AppendLiteral("'");
+  return quoted;
+}
+
 #ifdef PR_LOGGING
   static PRLogModuleInfo* gsbLocalDatabaseDiffingLog = nsnull;
 # define TRACE(args) \
@@ -170,13 +258,19 @@ public:
     ItemInfo() : mID(NULL_GUID),
                  mOriginID(NULL_GUID),
                  mAction(ACTION_NONE),
-                 mPosition(0)
+                 mPosition(0),
+                 mPropertyHash(0),
+                 mHasPropertyHash(PR_FALSE)
     {
     }
     nsID mID;
     nsID mOriginID;
     Action mAction;
     PRUint32 mPosition;
+    // Sum of the hashes of the compared properties, only set for items read
+    // straight from the database
+    PRUint64 mPropertyHash;
+    PRBool mHasPropertyHash;
   };
   static bool lessThan(nsID const & aLeftID, nsID const & aRightID)
   {
@@ -201,14 +295,12 @@ public:
       return false;
     }
 
-    if (aLeftID.m2 < aRightID.m2) {
-      for (PRUint32 index = 0; index < 8; ++index) {
-        if (aLeftID.m3[index] < aRightID.m3[index]) {
-          return true;
-        }
-        else if (aLeftID.m3[index] > aRightID.m3[index]) {
-          return false;
-        }
+    for (PRUint32 index = 0; index < 8; ++index) {
+      if (aLeftID.m3[index] < aRightID.m3[index]) {
+        return true;
+      }
+      else if (aLeftID.m3[index] > aRightID.m3[index]) {
+        return false;
       }
     }
     return false;
@@ -302,6 +394,16 @@ public:
 
   sbLDBDSEnumerator();
 
+  /**
+   * Reads the items of a local database library straight from its database,
+   * along with a hash of the properties the diff compares, instead of
+   * enumerating them as media items. The hash follows the comparison, so
+   * the destination's items hash their origin URL as their content URL and
+   * durations are hashed in whole seconds.
+   */
+  nsresult ReadLibrary(sbILocalDatabaseLibrary * aLibrary,
+                       PRBool aIsDestination);
+
   void Sort()
   {
     mIDIndex.Build(mItemInfos.begin(),
@@ -477,6 +579,210 @@ sbLDBDSEnumerator::OnEnumerationEnd(sbIMediaList *aMediaList,
   return NS_OK;
 }
 
+nsresult
+sbLDBDSEnumerator::ReadLibrary(sbILocalDatabaseLibrary * aLibrary,
+                               PRBool aIsDestination)
+{
+  NS_ENSURE_ARG_POINTER(aLibrary);
+
+  LOG(("Reading items from the database"));
+
+  NS_NAMED_LITERAL_STRING(ORIGIN_ID, SB_PROPERTY_ORIGINITEMGUID);
+  NS_NAMED_LITERAL_STRING(ORIGIN_URL, SB_PROPERTY_ORIGINURL);
+  NS_NAMED_LITERAL_STRING(CONTENT_URL, SB_PROPERTY_CONTENTURL);
+  NS_NAMED_LITERAL_STRING(DURATION, SB_PROPERTY_DURATION);
+
+  // Changed properties have to be in the database to be read
+  nsCOMPtr<sbILocalDatabasePropertyCache> propertyCache;
+  nsresult rv = aLibrary->GetPropertyCache(getter_AddRefs(propertyCache));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = propertyCache->Write();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The compared top level properties are read along with the guid. quote()
+  // tells NULL and empty values apart.
+  nsTArray<nsString> columnProperties;
+  nsString columns;
+  for (PRUint32 i = 0; i < sStaticPropertyCount; ++i) {
+    NS_ConvertASCIItoUTF16 propertyID(sStaticProperties[i].mPropertyID);
+    if (IsExcludedProperty(propertyID)) {
+      continue;
+    }
+    NS_ENSURE_TRUE(columnProperties.AppendElement(propertyID),
+                   NS_ERROR_OUT_OF_MEMORY);
+    columns.AppendLiteral(", quote(");
+    columns.AppendLiteral(sStaticProperties[i].mColumn);
+    columns.AppendLiteral(")");
+  }
+  PRUint32 const columnCount = columnProperties.Length();
+
+  nsString const itemsSQL = sbLocalDatabaseSQL::DiffingItemsSelect(columns);
+  nsString const propertiesSQL = sbLocalDatabaseSQL::DiffingPropertiesSelect();
+
+  mItemIndex = 0;
+  PRInt64 lastMediaItemID = 0;
+  PRUint32 itemCount;
+  do {
+    nsCOMPtr<sbIDatabaseQuery> query;
+    rv = aLibrary->CreateQuery(getter_AddRefs(query));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->AddQuery(itemsSQL);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt64Parameter(0, lastMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(1, DIFF_READ_PAGE_SIZE);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRInt32 dbOk;
+    rv = query->Execute(&dbOk);
+    NS_ENSURE_SUCCESS(rv, rv);
+    NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+    nsCOMPtr<sbIDatabaseResult> items;
+    rv = query->GetResultObject(getter_AddRefs(items));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = items->GetRowCount(&itemCount);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (!itemCount) {
+      break;
+    }
+
+    PRInt64 firstMediaItemID;
+    rv = items->GetRowCellAsInt64(0, 0, &firstMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = items->GetRowCellAsInt64(itemCount - 1, 0, &lastMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // The properties of the same items
+    rv = aLibrary->CreateQuery(getter_AddRefs(query));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->AddQuery(propertiesSQL);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt64Parameter(0, firstMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt64Parameter(1, lastMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->Execute(&dbOk);
+    NS_ENSURE_SUCCESS(rv, rv);
+    NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+    nsCOMPtr<sbIDatabaseResult> properties;
+    rv = query->GetResultObject(getter_AddRefs(properties));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRUint32 propertyCount;
+    rv = properties->GetRowCount(&propertyCount);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Both are in media item id order, so walk them together
+    PRUint32 propertyRow = 0;
+    for (PRUint32 itemRow = 0; itemRow < itemCount; ++itemRow) {
+      PRInt64 mediaItemID;
+      rv = items->GetRowCellAsInt64(itemRow, 0, &mediaItemID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      nsString guid;
+      rv = items->GetRowCell(itemRow, 1, guid);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      ItemInfo info;
+      PRBool success =
+        info.mID.Parse(NS_LossyConvertUTF16toASCII(guid).BeginReading());
+      NS_ENSURE_TRUE(success, NS_ERROR_FAILURE);
+
+      PRUint64 hash = 0;
+      nsString value;
+      nsString contentURL;
+      nsString originURL;
+      for (PRUint32 column = 0; column < columnCount; ++column) {
+        rv = items->GetRowCell(itemRow, column + 2, value);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        // Hashed once the origin URL is known
+        if (columnProperties[column].Equals(CONTENT_URL)) {
+          contentURL = value;
+          continue;
+        }
+        hash += HashProperty(columnProperties[column], value);
+      }
+
+      for (; propertyRow < propertyCount; ++propertyRow) {
+        PRInt64 propertyMediaItemID;
+        rv = properties->GetRowCellAsInt64(propertyRow,
+                                           0,
+                                           &propertyMediaItemID);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        if (propertyMediaItemID > mediaItemID) {
+          break;
+        }
+        // Left over from an item removed in between the two reads
+        if (propertyMediaItemID < mediaItemID) {
+          continue;
+        }
+
+        nsString propertyID;
+        rv = properties->GetRowCell(propertyRow, 1, propertyID);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = properties->GetRowCell(propertyRow, 2, value);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        if (propertyID.Equals(ORIGIN_ID)) {
+          nsID originID;
+          if (!value.IsEmpty() &&
+              originID.Parse(NS_LossyConvertUTF16toASCII(value).BeginReading())) {
+            info.mOriginID = originID;
+          }
+        }
+        else if (propertyID.Equals(ORIGIN_URL)) {
+          originURL = value;
+        }
+        // Durations less than a second apart compare the same
+        else if (propertyID.Equals(DURATION)) {
+          PRUint64 const duration = nsString_ToUint64(value, &rv);
+          if (NS_SUCCEEDED(rv)) {
+            value.Truncate();
+            AppendInt(value, duration / PR_USEC_PER_SEC);
+          }
+        }
+
+        if (!IsExcludedProperty(propertyID)) {
+          hash += HashProperty(propertyID, value);
+        }
+      }
+
+      // A source item's content URL compares the same as the origin URL of
+      // its copy in the destination
+      if (aIsDestination && !originURL.IsEmpty()) {
+        contentURL = QuoteSQLString(originURL);
+      }
+      hash += HashProperty(CONTENT_URL, contentURL);
+
+      info.mPropertyHash = hash;
+      info.mHasPropertyHash = PR_TRUE;
+      info.mPosition = mItemIndex++;
+      mItemInfos.push_back(info);
+    }
+  } while (itemCount == DIFF_READ_PAGE_SIZE);
+
+  LOG(("Read %u items, sorting", mItemIndex));
+  Sort();
+
+  return NS_OK;
+}
+
 NS_IMPL_THREADSAFE_ADDREF(sbLocalDatabaseDiffingService)
 NS_IMPL_THREADSAFE_RELEASE(sbLocalDatabaseDiffingService)
 
@@ -641,10 +947,25 @@ sbLocalDatabaseDiffingService::CreateChanges(sbIMediaList * aSrcList,
 
   // For each item in the source, verify presence in destination library.
   sbLDBDSEnumerator::const_iterator const srcEnd = aSrcEnum->end();
+  sbLDBDSEnumerator::IDIterator const destIDEnd = aDestEnum->IDEnd();
   for(sbLDBDSEnumerator::const_iterator srcIter = aSrcEnum->begin();
       srcIter != srcEnd;
       ++srcIter) {
 
+    // Items read from the database carry a hash of the compared properties,
+    // so an update whose items hash the same has nothing to change and
+    // neither item needs loading
+    if (srcIter->mAction == sbLDBDSEnumerator::ItemInfo::ACTION_UPDATE &&
+        srcIter->mHasPropertyHash) {
+      sbLDBDSEnumerator::IDIterator const destIDIter =
+        aDestEnum->FindByID(srcIter->mOriginID);
+      if (destIDIter != destIDEnd &&
+          (*destIDIter)->mHasPropertyHash &&
+          (*destIDIter)->mPropertyHash == srcIter->mPropertyHash) {
+        continue;
+      }
+    }
+
     rv = aSrcList->GetItemByGuid(sbGUIDToString(srcIter->mID),
                                  getter_AddRefs(srcItem));
     if (NS_FAILED(rv) || !srcItem) {
@@ -1006,43 +1327,6 @@ sbLocalDatabaseDiffingService::CreatePropertyChangesFromProperties(
   PRBool success = sourcePropertyNamesFoundInDestination.Init();
   NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
 
-  // These properties are excluded from checking since they
-  // are automatically maintained and do not reflect actual
-  // metadata differences in the items.
-  nsTHashtable<nsStringHashKey> propertyExclusionList;
-  success = propertyExclusionList.Init();
-  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
-
-  nsStringHashKey* successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_CREATED));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_UPDATED));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_GUID));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_ORIGINITEMGUID));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_ORIGINLIBRARYGUID));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_ORIGINURL));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
-  // Sadly we can't use content length because on a device the length may be
-  // different
-  successHashkey =
-    propertyExclusionList.PutEntry(NS_LITERAL_STRING(SB_PROPERTY_CONTENTLENGTH));
-  NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
-
   nsString propertyId;
   nsString propertyValue;
   nsString propertyDestinationValue;
@@ -1059,7 +1343,7 @@ sbLocalDatabaseDiffingService::CreatePropertyChangesFromProperties(
     rv = property->GetValue(propertyValue);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    if(propertyExclusionList.GetEntry(propertyId)) {
+    if(IsExcludedProperty(propertyId)) {
       continue;
     }
 
@@ -1089,7 +1373,8 @@ sbLocalDatabaseDiffingService::CreatePropertyChangesFromProperties(
       NS_ENSURE_SUCCESS(rv, rv);
 
       // Didn't fail, it should be present in both source and destination.
-      successHashkey = sourcePropertyNamesFoundInDestination.PutEntry(propertyId);
+      nsStringHashKey* successHashkey =
+        sourcePropertyNamesFoundInDestination.PutEntry(propertyId);
       NS_ENSURE_TRUE(successHashkey, NS_ERROR_OUT_OF_MEMORY);
 
       if (propertyId.EqualsLiteral(SB_PROPERTY_CONTENTURL)) {
@@ -1157,7 +1442,7 @@ sbLocalDatabaseDiffingService::CreatePropertyChangesFromProperties(
     rv = property->GetValue(propertyDestinationValue);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    if(propertyExclusionList.GetEntry(propertyId)) {
+    if(IsExcludedProperty(propertyId)) {
       continue;
     }
 
@@ -1306,13 +1591,28 @@ sbLocalDatabaseDiffingService::CreateLibraryChangesetFromLibraries(
   NS_NEWXPCOM(destinationEnum, sbLDBDSEnumerator);
   NS_ENSURE_TRUE(destinationEnum, NS_ERROR_OUT_OF_MEMORY);
 
-  rv = aSourceLibrary->EnumerateAllItems(sourceEnum,
-                                         sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
-  NS_ENSURE_SUCCESS(rv, rv);
+  // Local database libraries are read straight from their databases, which
+  // saves creating a media item for every item just to look at its ids
+  nsCOMPtr<sbILocalDatabaseLibrary> sourceLocalLibrary =
+    do_QueryInterface(aSourceLibrary);
+  nsCOMPtr<sbILocalDatabaseLibrary> destinationLocalLibrary =
+    do_QueryInterface(aDestinationLibrary);
+  if (sourceLocalLibrary && destinationLocalLibrary) {
+    rv = sourceEnum->ReadLibrary(sourceLocalLibrary, PR_FALSE);
+    NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = aDestinationLibrary->EnumerateAllItems(destinationEnum,
-                                              sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
-  NS_ENSURE_SUCCESS(rv, rv);
+    rv = destinationEnum->ReadLibrary(destinationLocalLibrary, PR_TRUE);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else {
+    rv = aSourceLibrary->EnumerateAllItems(sourceEnum,
+                                           sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = aDestinationLibrary->EnumerateAllItems(destinationEnum,
+                                                sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
 
   MarkLists(sourceEnum, destinationEnum);
 
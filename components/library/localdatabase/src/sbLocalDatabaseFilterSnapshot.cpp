@@ -0,0 +1,1034 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#include "sbLocalDatabaseFilterSnapshot.h"
+
+#include <nsAutoLock.h>
+#include <nsCOMArray.h>
+#include <nsComponentManagerUtils.h>
+#include <nsIPrefBranch.h>
+#include <nsIURI.h>
+#include <nsMemory.h>
+#include <nsQuickSort.h>
+#include <nsServiceManagerUtils.h>
+
+#include <DatabaseQuery.h>
+#include <sbIDatabaseEngine.h>
+#include <sbIDatabaseQuery.h>
+#include <sbIDatabaseResult.h>
+#include <sbILocalDatabaseMediaItem.h>
+#include <sbILocalDatabaseResourcePropertyBag.h>
+#include <sbIMediaItem.h>
+#include <sbMemoryUtils.h>
+#include <sbStandardProperties.h>
+
+#include "sbLocalDatabasePropertyCache.h"
+#include "sbLocalDatabaseSchemaInfo.h"
+#include "sbLocalDatabaseSQL.h"
+
+#include <algorithm>
+
+/**
+ * \brief Whether the filter panes read from the in memory snapshot
+ */
+#define PREF_FILTERSNAPSHOT_ENABLED \
+  "songbird.library.localdatabase.filterSnapshot.enabled"
+#define DEFAULT_FILTERSNAPSHOT_ENABLED PR_TRUE
+
+/**
+ * \brief Most media items looked up by one guid query
+ */
+#define FILTERSNAPSHOT_GUID_CHUNK_SIZE 500
+
+// Rows are kept in a bitmap of 32 bit words
+#define ROW_WORD(row) ((row) >> 5)
+#define ROW_BIT(row) (1U << ((row) & 31))
+
+NS_IMPL_THREADSAFE_ISUPPORTS3(sbLocalDatabaseFilterSnapshot,
+                              sbILocalDatabaseFilterSnapshot,
+                              sbIMediaListListener,
+                              nsISupportsWeakReference)
+
+sbLocalDatabaseFilterSnapshot::sbLocalDatabaseFilterSnapshot() :
+  mMonitor(nsnull),
+  mEnabled(DEFAULT_FILTERSNAPSHOT_ENABLED),
+  mLoaded(PR_FALSE)
+{
+}
+
+sbLocalDatabaseFilterSnapshot::~sbLocalDatabaseFilterSnapshot()
+{
+  if (mMonitor) {
+    nsAutoMonitor::DestroyMonitor(mMonitor);
+  }
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::Init(const nsAString& aDatabaseGUID,
+                                    nsIURI* aDatabaseLocation,
+                                    sbLocalDatabasePropertyCache* aPropertyCache)
+{
+  NS_ENSURE_ARG_POINTER(aPropertyCache);
+
+  nsresult rv;
+
+  mMonitor =
+    nsAutoMonitor::NewMonitor("sbLocalDatabaseFilterSnapshot::mMonitor");
+  NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
+
+  mDatabaseGUID = aDatabaseGUID;
+  mDatabaseLocation = aDatabaseLocation;
+  mPropertyCache = aPropertyCache;
+
+  mDatabaseEngine =
+    do_GetService("@songbirdnest.com/Songbird/DatabaseEngine;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_GetService("@mozilla.org/preferences-service;1", &rv);
+  if (NS_SUCCEEDED(rv)) {
+    PRBool value;
+    rv = prefBranch->GetBoolPref(PREF_FILTERSNAPSHOT_ENABLED, &value);
+    if (NS_SUCCEEDED(rv)) {
+      mEnabled = value;
+    }
+  }
+
+  // Nothing is loaded until a filter pane asks for it
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::MakeQuery(sbIDatabaseQuery** _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  nsCOMPtr<sbIDatabaseQuery> query =
+    do_CreateInstance(SONGBIRD_DATABASEQUERY_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->SetDatabaseGUID(mDatabaseGUID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (mDatabaseLocation) {
+    rv = query->SetDatabaseLocation(mDatabaseLocation);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->SetAsyncQuery(PR_FALSE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ADDREF(*_retval = query);
+  return NS_OK;
+}
+
+void
+sbLocalDatabaseFilterSnapshot::Clear()
+{
+  nsAutoMonitor mon(mMonitor);
+
+  mLoaded = PR_FALSE;
+  mMediaItemIDs.Clear();
+  mLiveRows.Clear();
+  mColumns.Clear();
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::LoadItems()
+{
+  // LoadItems always gets called with mMonitor acquired!
+  nsresult rv;
+  PRInt32 dbOk;
+
+  Clear();
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::FilterSnapshotItemsSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // isList comes from media_items rather than resource_properties, so its
+  // column is filled here along with the rows
+  nsAutoPtr<Column> isList(new Column);
+  NS_ENSURE_TRUE(isList, NS_ERROR_OUT_OF_MEMORY);
+  NS_ENSURE_TRUE(isList->codes.Init(), NS_ERROR_OUT_OF_MEMORY);
+
+  isList->property.AssignLiteral(SB_PROPERTY_ISLIST);
+  rv = mPropertyCache->GetPropertyDBID(isList->property, &isList->propertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ENSURE_TRUE(mMediaItemIDs.SetCapacity(rowCount), NS_ERROR_OUT_OF_MEMORY);
+  NS_ENSURE_TRUE(isList->rowCodes.SetCapacity(rowCount),
+                 NS_ERROR_OUT_OF_MEMORY);
+  NS_ENSURE_TRUE(mLiveRows.SetLength(ROW_WORD(rowCount + 31)),
+                 NS_ERROR_OUT_OF_MEMORY);
+  memset(mLiveRows.Elements(), 0, mLiveRows.Length() * sizeof(PRUint32));
+
+  for (PRUint32 row = 0; row < rowCount; row++) {
+    PRInt64 mediaItemID;
+    rv = result->GetRowCellAsInt64(row, 0, &mediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString value;
+    rv = result->GetRowCell(row, 1, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRUint32 code;
+    rv = GetCode(*isList, value, &code);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    mMediaItemIDs.AppendElement(static_cast<PRUint32>(mediaItemID));
+    isList->rowCodes.AppendElement(code);
+    mLiveRows[ROW_WORD(row)] |= ROW_BIT(row);
+  }
+
+  nsAutoPtr<Column>* added = mColumns.AppendElement(isList.forget());
+  NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+
+  mLoaded = PR_TRUE;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::GetColumn(const nsAString& aProperty,
+                                         Column** _retval)
+{
+  // GetColumn always gets called with mMonitor acquired!
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  PRUint32 const count = mColumns.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    if (mColumns[i]->property.Equals(aProperty)) {
+      *_retval = mColumns[i];
+      return NS_OK;
+    }
+  }
+
+  // Only properties stored in resource_properties can be loaded
+  if (SB_IsTopLevelProperty(aProperty)) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  nsAutoPtr<Column> column(new Column);
+  NS_ENSURE_TRUE(column, NS_ERROR_OUT_OF_MEMORY);
+  NS_ENSURE_TRUE(column->codes.Init(), NS_ERROR_OUT_OF_MEMORY);
+
+  column->property = aProperty;
+  rv = mPropertyCache->GetPropertyDBID(aProperty, &column->propertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = LoadColumn(*column);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoPtr<Column>* added = mColumns.AppendElement(column.forget());
+  NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+
+  *_retval = *added;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::LoadColumn(Column& aColumn)
+{
+  // LoadColumn always gets called with mMonitor acquired!
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::FilterSnapshotColumnSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aColumn.propertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 const itemCount = mMediaItemIDs.Length();
+  NS_ENSURE_TRUE(aColumn.rowCodes.SetLength(itemCount),
+                 NS_ERROR_OUT_OF_MEMORY);
+  memset(aColumn.rowCodes.Elements(), 0, itemCount * sizeof(PRUint32));
+
+  // Both lists are in media item id order, so walk them side by side.  Items
+  // added to the database since the rows were loaded are skipped; they are
+  // reported by the item listener.
+  PRUint32 item = 0;
+  for (PRUint32 row = 0; row < rowCount && item < itemCount; row++) {
+    PRInt64 mediaItemID;
+    rv = result->GetRowCellAsInt64(row, 0, &mediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    while (item < itemCount &&
+           mMediaItemIDs[item] < static_cast<PRUint32>(mediaItemID)) {
+      item++;
+    }
+    if (item == itemCount ||
+        mMediaItemIDs[item] != static_cast<PRUint32>(mediaItemID)) {
+      continue;
+    }
+
+    nsString value;
+    rv = result->GetRowCell(row, 1, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = GetCode(aColumn, value, &aColumn.rowCodes[item]);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::GetCode(Column& aColumn,
+                                       const nsAString& aValue,
+                                       PRUint32* _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  if (aValue.IsVoid()) {
+    *_retval = 0;
+    return NS_OK;
+  }
+
+  nsString value(aValue);
+  if (aColumn.codes.Get(value, _retval)) {
+    return NS_OK;
+  }
+
+  NS_ENSURE_TRUE(aColumn.values.AppendElement(value), NS_ERROR_OUT_OF_MEMORY);
+  *_retval = aColumn.values.Length();
+  NS_ENSURE_TRUE(aColumn.codes.Put(value, *_retval), NS_ERROR_OUT_OF_MEMORY);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::GetBagValue(const Column& aColumn,
+                                           sbILocalDatabaseResourcePropertyBag* aBag,
+                                           nsAString& aValue)
+{
+  NS_ENSURE_ARG_POINTER(aBag);
+
+  nsresult rv;
+
+  // Same values as the database columns the snapshot was loaded from
+  if (aColumn.property.EqualsLiteral(SB_PROPERTY_ISLIST)) {
+    nsAutoString value;
+    rv = aBag->GetProperty(aColumn.property, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (!value.IsEmpty() && !value.EqualsLiteral("0")) {
+      aValue.AssignLiteral("1");
+    }
+    else {
+      aValue.AssignLiteral("0");
+    }
+    return NS_OK;
+  }
+
+  rv = aBag->GetSortablePropertyByID(aColumn.propertyID, aValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+struct sbFilterSnapshotSortContext {
+  sbIDatabaseEngine* engine;
+  const nsTArray<nsString>* values;
+};
+
+static int
+CompareCodes(const void* aElement1, const void* aElement2, void* aData)
+{
+  sbFilterSnapshotSortContext* context =
+    static_cast<sbFilterSnapshotSortContext*>(aData);
+  PRUint32 const code1 = *static_cast<const PRUint32*>(aElement1);
+  PRUint32 const code2 = *static_cast<const PRUint32*>(aElement2);
+
+  PRInt32 result = 0;
+  nsresult rv = context->engine->Collate((*context->values)[code1 - 1],
+                                         (*context->values)[code2 - 1],
+                                         &result);
+  if (NS_FAILED(rv) || !result) {
+    result = code1 < code2 ? -1 : code1 > code2;
+  }
+  return result;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::SortCodes(Column& aColumn)
+{
+  PRUint32 const count = aColumn.values.Length();
+  if (aColumn.sortedCodes.Length() == count) {
+    return NS_OK;
+  }
+
+  NS_ENSURE_TRUE(aColumn.sortedCodes.SetLength(count), NS_ERROR_OUT_OF_MEMORY);
+  for (PRUint32 i = 0; i < count; i++) {
+    aColumn.sortedCodes[i] = i + 1;
+  }
+
+  sbFilterSnapshotSortContext context = { mDatabaseEngine, &aColumn.values };
+  NS_QuickSort(aColumn.sortedCodes.Elements(),
+               count,
+               sizeof(PRUint32),
+               CompareCodes,
+               &context);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::GetGUIDs(const nsTArray<PRUint32>& aMediaItemIDs,
+                                        nsTArray<nsString>& aGUIDs)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsDataHashtable<nsUint32HashKey, nsString> guids;
+  NS_ENSURE_TRUE(guids.Init(aMediaItemIDs.Length()), NS_ERROR_OUT_OF_MEMORY);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 const count = aMediaItemIDs.Length();
+  for (PRUint32 start = 0; start < count;
+       start += FILTERSNAPSHOT_GUID_CHUNK_SIZE) {
+    PRUint32 const chunk =
+      PR_MIN(count - start, FILTERSNAPSHOT_GUID_CHUNK_SIZE);
+
+    rv = query->ResetQuery();
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->AddQuery(
+           sbLocalDatabaseSQL::FilterSnapshotGUIDsSelect(aMediaItemIDs,
+                                                         start,
+                                                         chunk));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->Execute(&dbOk);
+    NS_ENSURE_SUCCESS(rv, rv);
+    NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+    nsCOMPtr<sbIDatabaseResult> result;
+    rv = query->GetResultObject(getter_AddRefs(result));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRUint32 rowCount;
+    rv = result->GetRowCount(&rowCount);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    for (PRUint32 row = 0; row < rowCount; row++) {
+      PRInt64 mediaItemID;
+      rv = result->GetRowCellAsInt64(row, 0, &mediaItemID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      nsString guid;
+      rv = result->GetRowCell(row, 1, guid);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      NS_ENSURE_TRUE(guids.Put(static_cast<PRUint32>(mediaItemID), guid),
+                     NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
+  NS_ENSURE_TRUE(aGUIDs.SetCapacity(count), NS_ERROR_OUT_OF_MEMORY);
+  for (PRUint32 i = 0; i < count; i++) {
+    nsString guid;
+    // An item missing here was removed while we weren't looking, so the
+    // snapshot can't be trusted
+    NS_ENSURE_TRUE(guids.Get(aMediaItemIDs[i], &guid), NS_ERROR_NOT_AVAILABLE);
+    aGUIDs.AppendElement(guid);
+  }
+
+  return NS_OK;
+}
+
+sbLocalDatabaseFilterSnapshot::Column*
+sbLocalDatabaseFilterSnapshot::FindColumn(PRUint32 aPropertyID)
+{
+  // FindColumn always gets called with mMonitor acquired!
+  PRUint32 const count = mColumns.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    if (mColumns[i]->propertyID == aPropertyID) {
+      return mColumns[i];
+    }
+  }
+  return nsnull;
+}
+
+PRInt32
+sbLocalDatabaseFilterSnapshot::FindRow(PRUint32 aMediaItemID)
+{
+  // FindRow always gets called with mMonitor acquired!
+  PRUint32 low = 0;
+  PRUint32 high = mMediaItemIDs.Length();
+  while (low < high) {
+    PRUint32 const middle = low + (high - low) / 2;
+    if (mMediaItemIDs[middle] < aMediaItemID) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+
+  if (low < mMediaItemIDs.Length() && mMediaItemIDs[low] == aMediaItemID) {
+    return low;
+  }
+  return -1;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::GetDistinctValues(const nsAString& aProperty,
+                                                 PRBool aAscending,
+                                                 PRUint32 aFilterCount,
+                                                 const PRUnichar** aFilterProperties,
+                                                 const PRUnichar** aFilterValues,
+                                                 PRUint32* aCount,
+                                                 PRUint32** aMediaItemIDs,
+                                                 PRUnichar*** aGUIDs,
+                                                 PRUnichar*** aValues)
+{
+  if (aFilterCount) {
+    NS_ENSURE_ARG_POINTER(aFilterProperties);
+    NS_ENSURE_ARG_POINTER(aFilterValues);
+  }
+  NS_ENSURE_ARG_POINTER(aCount);
+  NS_ENSURE_ARG_POINTER(aMediaItemIDs);
+  NS_ENSURE_ARG_POINTER(aGUIDs);
+  NS_ENSURE_ARG_POINTER(aValues);
+
+  nsresult rv;
+
+  nsAutoMonitor mon(mMonitor);
+
+  if (!mEnabled) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  if (!mLoaded) {
+    rv = LoadItems();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  Column* column;
+  rv = GetColumn(aProperty, &column);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Start from the items still in the library and narrow down by each filter
+  nsTArray<PRUint32> rows;
+  NS_ENSURE_TRUE(rows.AppendElements(mLiveRows), NS_ERROR_OUT_OF_MEMORY);
+  PRUint32 const wordCount = rows.Length();
+
+  PRUint32 filter = 0;
+  while (filter < aFilterCount) {
+    nsDependentString const property(aFilterProperties[filter]);
+    PRBool const isList = property.EqualsLiteral(SB_PROPERTY_ISLIST);
+
+    Column* filterColumn;
+    rv = GetColumn(property, &filterColumn);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Mark the codes of the values of this filter, which come one after the
+    // other
+    nsTArray<PRPackedBool> selected;
+    NS_ENSURE_TRUE(selected.SetLength(filterColumn->values.Length() + 1),
+                   NS_ERROR_OUT_OF_MEMORY);
+    memset(selected.Elements(), 0, selected.Length() * sizeof(PRPackedBool));
+
+    for (; filter < aFilterCount &&
+           property.Equals(aFilterProperties[filter]); filter++) {
+      nsString value(aFilterValues[filter]);
+      if (isList && !value.EqualsLiteral("0")) {
+        value.AssignLiteral("1");
+      }
+
+      PRUint32 code;
+      if (filterColumn->codes.Get(value, &code)) {
+        selected[code] = PR_TRUE;
+      }
+    }
+
+    const PRUint32* rowCodes = filterColumn->rowCodes.Elements();
+    for (PRUint32 word = 0; word < wordCount; word++) {
+      PRUint32 bits = rows[word];
+      if (!bits) {
+        continue;
+      }
+
+      PRUint32 matched = 0;
+      PRUint32 const base = word << 5;
+      for (PRUint32 bit = 0; bit < 32; bit++) {
+        if ((bits & (1U << bit)) && selected[rowCodes[base + bit]]) {
+          matched |= 1U << bit;
+        }
+      }
+      rows[word] = matched;
+    }
+  }
+
+  // The first matching row of each value stands for it
+  PRUint32 const valueCount = column->values.Length();
+  nsTArray<PRUint32> firstRows;
+  NS_ENSURE_TRUE(firstRows.SetLength(valueCount + 1), NS_ERROR_OUT_OF_MEMORY);
+  for (PRUint32 i = 0; i <= valueCount; i++) {
+    firstRows[i] = PR_UINT32_MAX;
+  }
+
+  const PRUint32* rowCodes = column->rowCodes.Elements();
+  for (PRUint32 word = 0; word < wordCount; word++) {
+    PRUint32 const bits = rows[word];
+    if (!bits) {
+      continue;
+    }
+
+    PRUint32 const base = word << 5;
+    for (PRUint32 bit = 0; bit < 32; bit++) {
+      if (bits & (1U << bit)) {
+        PRUint32 const code = rowCodes[base + bit];
+        if (code && firstRows[code] == PR_UINT32_MAX) {
+          firstRows[code] = base + bit;
+        }
+      }
+    }
+  }
+
+  rv = SortCodes(*column);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsTArray<PRUint32> codes;
+  nsTArray<PRUint32> mediaItemIDs;
+  for (PRUint32 i = 0; i < valueCount; i++) {
+    PRUint32 const code =
+      column->sortedCodes[aAscending ? i : valueCount - i - 1];
+    PRUint32 const row = firstRows[code];
+    if (row == PR_UINT32_MAX || column->values[code - 1].IsEmpty()) {
+      continue;
+    }
+
+    NS_ENSURE_TRUE(codes.AppendElement(code), NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_TRUE(mediaItemIDs.AppendElement(mMediaItemIDs[row]),
+                   NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  nsTArray<nsString> guids;
+  rv = GetGUIDs(mediaItemIDs, guids);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 const count = codes.Length();
+  if (!count) {
+    *aCount = 0;
+    *aMediaItemIDs = nsnull;
+    *aGUIDs = nsnull;
+    *aValues = nsnull;
+    return NS_OK;
+  }
+
+  sbAutoNSTypePtr<PRUint32> outIDs(
+    static_cast<PRUint32*>(NS_Alloc(count * sizeof(PRUint32))));
+  NS_ENSURE_TRUE(outIDs, NS_ERROR_OUT_OF_MEMORY);
+
+  PRUnichar** guidArray =
+    static_cast<PRUnichar**>(NS_Alloc(count * sizeof(PRUnichar*)));
+  NS_ENSURE_TRUE(guidArray, NS_ERROR_OUT_OF_MEMORY);
+  memset(guidArray, 0, count * sizeof(PRUnichar*));
+  sbAutoNSArray<PRUnichar*> outGUIDs(guidArray, count);
+
+  PRUnichar** valueArray =
+    static_cast<PRUnichar**>(NS_Alloc(count * sizeof(PRUnichar*)));
+  NS_ENSURE_TRUE(valueArray, NS_ERROR_OUT_OF_MEMORY);
+  memset(valueArray, 0, count * sizeof(PRUnichar*));
+  sbAutoNSArray<PRUnichar*> outValues(valueArray, count);
+
+  for (PRUint32 i = 0; i < count; i++) {
+    outIDs.get()[i] = mediaItemIDs[i];
+
+    guidArray[i] = ToNewUnicode(guids[i]);
+    NS_ENSURE_TRUE(guidArray[i], NS_ERROR_OUT_OF_MEMORY);
+
+    valueArray[i] = ToNewUnicode(column->values[codes[i] - 1]);
+    NS_ENSURE_TRUE(valueArray[i], NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  *aCount = count;
+  *aMediaItemIDs = outIDs.forget();
+  *aGUIDs = outGUIDs.forget();
+  *aValues = outValues.forget();
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::ApplyPropertyChanges(const nsTArray<nsString>& aGUIDs,
+                                                    const nsTArray<PRUint32>& aPropertyIDs)
+{
+  NS_ENSURE_TRUE(aGUIDs.Length() == aPropertyIDs.Length(),
+                 NS_ERROR_INVALID_ARG);
+
+  nsresult rv;
+
+  // Only the changes to properties that have a column
+  nsTArray<nsString> guids;
+  nsTArray<PRUint32> propertyIDs;
+  {
+    nsAutoMonitor mon(mMonitor);
+
+    if (!mLoaded) {
+      return NS_OK;
+    }
+
+    PRUint32 const count = aGUIDs.Length();
+    for (PRUint32 i = 0; i < count; i++) {
+      if (FindColumn(aPropertyIDs[i])) {
+        NS_ENSURE_TRUE(guids.AppendElement(aGUIDs[i]),
+                       NS_ERROR_OUT_OF_MEMORY);
+        NS_ENSURE_TRUE(propertyIDs.AppendElement(aPropertyIDs[i]),
+                       NS_ERROR_OUT_OF_MEMORY);
+      }
+    }
+  }
+
+  if (!guids.Length()) {
+    return NS_OK;
+  }
+
+  // The bags are fetched without the monitor, the property cache may call
+  // into the GUID arrays, which read from the snapshot while holding their
+  // own locks
+  PRUint32 const bagsCount = guids.Length();
+  nsCOMArray<sbILocalDatabaseResourcePropertyBag> bags(bagsCount);
+  for (PRUint32 i = 0; i < bagsCount; i++) {
+    nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+    rv = mPropertyCache->GetCurrentProperties(guids[i], getter_AddRefs(bag));
+    if (NS_SUCCEEDED(rv) && !bags.AppendObject(bag)) {
+      rv = NS_ERROR_OUT_OF_MEMORY;
+    }
+    if (NS_FAILED(rv)) {
+      Clear();
+      return rv;
+    }
+  }
+
+  nsAutoMonitor mon(mMonitor);
+
+  // The snapshot may have been dropped in the meantime
+  if (!mLoaded) {
+    return NS_OK;
+  }
+
+  for (PRUint32 i = 0; i < bagsCount; i++) {
+    // Items that are gone are left to the item listener.  Columns may have
+    // been dropped in the meantime.
+    Column* column = FindColumn(propertyIDs[i]);
+    if (!column) {
+      continue;
+    }
+
+    PRUint32 mediaItemID;
+    rv = bags[i]->GetMediaItemId(&mediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRInt32 const row = FindRow(mediaItemID);
+    if (row < 0) {
+      continue;
+    }
+
+    nsString value;
+    rv = GetBagValue(*column, bags[i], value);
+    if (NS_SUCCEEDED(rv)) {
+      rv = GetCode(*column, value, &column->rowCodes[row]);
+    }
+    if (NS_FAILED(rv)) {
+      Clear();
+      return rv;
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::RemoveColumnsForProperties(
+                                 const std::vector<PRUint32>& aPropertyIDs)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  for (PRUint32 i = mColumns.Length(); i > 0; i--) {
+    Column& column = *mColumns[i - 1];
+    if (std::find(aPropertyIDs.begin(),
+                  aPropertyIDs.end(),
+                  column.propertyID) == aPropertyIDs.end()) {
+      continue;
+    }
+
+    // isList is loaded with the rows, so it can only go with them
+    if (column.property.EqualsLiteral(SB_PROPERTY_ISLIST)) {
+      Clear();
+      return NS_OK;
+    }
+    mColumns.RemoveElementAt(i - 1);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::AddItem(sbIMediaItem* aMediaItem)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+
+  nsresult rv;
+
+  {
+    nsAutoMonitor mon(mMonitor);
+    if (!mLoaded) {
+      return NS_OK;
+    }
+  }
+
+  nsCOMPtr<sbILocalDatabaseMediaItem> item =
+    do_QueryInterface(aMediaItem, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 mediaItemID;
+  rv = item->GetMediaItemId(&mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsString guid;
+  rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Fetched without the monitor, see ApplyPropertyChanges.  A new item's
+  // bag is usually dirty, and is read as it is rather than written out.
+  nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+  rv = mPropertyCache->GetCurrentProperties(guid, getter_AddRefs(bag));
+  if (NS_FAILED(rv)) {
+    Clear();
+    return rv;
+  }
+
+  nsAutoMonitor mon(mMonitor);
+
+  if (!mLoaded) {
+    return NS_OK;
+  }
+
+  // New items get the highest id, anything else means the rows are out of
+  // step with the database
+  PRUint32 const row = mMediaItemIDs.Length();
+  if (row && mMediaItemIDs[row - 1] >= mediaItemID) {
+    if (FindRow(mediaItemID) < 0) {
+      Clear();
+    }
+    return NS_OK;
+  }
+
+  PRUint32 const columnCount = mColumns.Length();
+  for (PRUint32 i = 0; i < columnCount; i++) {
+    Column& column = *mColumns[i];
+
+    nsString value;
+    PRUint32 code;
+    rv = GetBagValue(column, bag, value);
+    if (NS_SUCCEEDED(rv)) {
+      rv = GetCode(column, value, &code);
+    }
+    if (NS_SUCCEEDED(rv) && !column.rowCodes.AppendElement(code)) {
+      rv = NS_ERROR_OUT_OF_MEMORY;
+    }
+    if (NS_FAILED(rv)) {
+      Clear();
+      return rv;
+    }
+  }
+
+  NS_ENSURE_TRUE(mMediaItemIDs.AppendElement(mediaItemID),
+                 NS_ERROR_OUT_OF_MEMORY);
+  if (ROW_WORD(row) >= mLiveRows.Length()) {
+    NS_ENSURE_TRUE(mLiveRows.AppendElement(0), NS_ERROR_OUT_OF_MEMORY);
+  }
+  mLiveRows[ROW_WORD(row)] |= ROW_BIT(row);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseFilterSnapshot::RemoveItem(sbIMediaItem* aMediaItem)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+
+  nsresult rv;
+
+  nsAutoMonitor mon(mMonitor);
+
+  if (!mLoaded) {
+    return NS_OK;
+  }
+
+  nsCOMPtr<sbILocalDatabaseMediaItem> item =
+    do_QueryInterface(aMediaItem, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 mediaItemID;
+  rv = item->GetMediaItemId(&mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The row itself stays so the columns keep lining up
+  PRInt32 const row = FindRow(mediaItemID);
+  if (row >= 0) {
+    mLiveRows[ROW_WORD(row)] &= ~ROW_BIT(row);
+  }
+
+  return NS_OK;
+}
+
+// sbIMediaListListener
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnItemAdded(sbIMediaList* aMediaList,
+                                           sbIMediaItem* aMediaItem,
+                                           PRUint32 aIndex,
+                                           PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsresult rv = AddItem(aMediaItem);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnBeforeItemRemoved(sbIMediaList* aMediaList,
+                                                   sbIMediaItem* aMediaItem,
+                                                   PRUint32 aIndex,
+                                                   PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnAfterItemRemoved(sbIMediaList* aMediaList,
+                                                  sbIMediaItem* aMediaItem,
+                                                  PRUint32 aIndex,
+                                                  PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsresult rv = RemoveItem(aMediaItem);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnItemUpdated(sbIMediaList* aMediaList,
+                                             sbIMediaItem* aMediaItem,
+                                             sbIPropertyArray* aProperties,
+                                             PRBool* aNoMoreForBatch)
+{
+  // Property changes are reported by the property cache once written
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnItemMoved(sbIMediaList* aMediaList,
+                                           PRUint32 aFromIndex,
+                                           PRUint32 aToIndex,
+                                           PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnBeforeListCleared(sbIMediaList* aMediaList,
+                                                   PRBool aExcludeLists,
+                                                   PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnListCleared(sbIMediaList* aMediaList,
+                                             PRBool aExcludeLists,
+                                             PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  Clear();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnBatchBegin(sbIMediaList* aMediaList)
+{
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseFilterSnapshot::OnBatchEnd(sbIMediaList* aMediaList)
+{
+  return NS_OK;
+}
@@ -0,0 +1,160 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#ifndef __SBLOCALDATABASEFILTERSNAPSHOT_H__
+#define __SBLOCALDATABASEFILTERSNAPSHOT_H__
+
+#include <sbILocalDatabaseGUIDArray.h>
+#include <sbIMediaListListener.h>
+
+#include <nsAutoPtr.h>
+#include <nsCOMPtr.h>
+#include <nsDataHashtable.h>
+#include <nsHashKeys.h>
+#include <nsStringGlue.h>
+#include <nsTArray.h>
+#include <nsWeakReference.h>
+#include <prmon.h>
+
+#include <vector>
+
+class nsIURI;
+class sbIDatabaseEngine;
+class sbIDatabaseQuery;
+class sbILocalDatabaseResourcePropertyBag;
+class sbLocalDatabasePropertyCache;
+
+/**
+ * \brief In memory copy of the filterable properties of a library.
+ *
+ * Each property the filter panes ask about is loaded once into a column that
+ * holds a small integer code per item, with the values themselves kept in a
+ * per column dictionary.  Filtering then means comparing codes into a bitmap
+ * of matching items, and listing the distinct values of a pane means walking
+ * that bitmap once, so cascading filters don't need a grouped query over
+ * resource_properties each time.  The columns follow item and property
+ * changes; a change that can't be applied drops the snapshot and the next
+ * request loads it again.
+ */
+class sbLocalDatabaseFilterSnapshot :
+    public sbILocalDatabaseFilterSnapshot,
+    public sbIMediaListListener,
+    public nsSupportsWeakReference
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBILOCALDATABASEFILTERSNAPSHOT
+  NS_DECL_SBIMEDIALISTLISTENER
+
+  sbLocalDatabaseFilterSnapshot();
+
+  nsresult Init(const nsAString& aDatabaseGUID,
+                nsIURI* aDatabaseLocation,
+                sbLocalDatabasePropertyCache* aPropertyCache);
+
+  /**
+   * \brief Called by the property cache once it has written properties.
+   *        aGUIDs and aPropertyIDs hold the changed item/property pairs.
+   */
+  nsresult ApplyPropertyChanges(const nsTArray<nsString>& aGUIDs,
+                                const nsTArray<PRUint32>& aPropertyIDs);
+
+  /**
+   * \brief Drop the columns of the given properties, for when too many items
+   *        changed to say which.
+   */
+  nsresult RemoveColumnsForProperties(const std::vector<PRUint32>& aPropertyIDs);
+
+  /**
+   * \brief Drop everything, the next request loads the snapshot again.
+   */
+  void Clear();
+
+private:
+  ~sbLocalDatabaseFilterSnapshot();
+
+  struct Column {
+    nsString property;
+    PRUint32 propertyID;
+    // Code of the value of each row, 0 for items without one
+    nsTArray<PRUint32> rowCodes;
+    // Value of each code, code n is at n - 1.  Values are only ever added so
+    // codes stay valid as items change.
+    nsTArray<nsString> values;
+    nsDataHashtable<nsStringHashKey, PRUint32> codes;
+    // Codes in ascending collation order, rebuilt when values were added
+    nsTArray<PRUint32> sortedCodes;
+  };
+
+  nsresult MakeQuery(sbIDatabaseQuery** _retval);
+
+  nsresult LoadItems();
+
+  nsresult GetColumn(const nsAString& aProperty, Column** _retval);
+
+  nsresult LoadColumn(Column& aColumn);
+
+  nsresult GetCode(Column& aColumn, const nsAString& aValue, PRUint32* _retval);
+
+  nsresult GetBagValue(const Column& aColumn,
+                       sbILocalDatabaseResourcePropertyBag* aBag,
+                       nsAString& aValue);
+
+  nsresult SortCodes(Column& aColumn);
+
+  nsresult GetGUIDs(const nsTArray<PRUint32>& aMediaItemIDs,
+                    nsTArray<nsString>& aGUIDs);
+
+  nsresult AddItem(sbIMediaItem* aMediaItem);
+
+  nsresult RemoveItem(sbIMediaItem* aMediaItem);
+
+  // Returns the column of a property, or null if it isn't loaded
+  Column* FindColumn(PRUint32 aPropertyID);
+
+  // Returns the row of a media item, or -1 if it isn't in the snapshot
+  PRInt32 FindRow(PRUint32 aMediaItemID);
+
+  // Protects everything below
+  PRMonitor* mMonitor;
+
+  nsString mDatabaseGUID;
+  nsCOMPtr<nsIURI> mDatabaseLocation;
+
+  nsRefPtr<sbLocalDatabasePropertyCache> mPropertyCache;
+  nsCOMPtr<sbIDatabaseEngine> mDatabaseEngine;
+
+  PRBool mEnabled;
+  PRBool mLoaded;
+
+  // Media item id of each row, ascending
+  nsTArray<PRUint32> mMediaItemIDs;
+
+  // One bit per row, cleared once the item is removed
+  nsTArray<PRUint32> mLiveRows;
+
+  nsTArray<nsAutoPtr<Column> > mColumns;
+};
+
+#endif /* __SBLOCALDATABASEFILTERSNAPSHOT_H__ */
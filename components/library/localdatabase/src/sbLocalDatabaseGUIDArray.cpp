@@ -29,8 +29,10 @@
 #include "sbLocalDatabaseResourcePropertyBag.h"
 #include "sbLocalDatabaseSchemaInfo.h"
 #include "sbLocalDatabaseLibrary.h"
+#include "sbLocalDatabaseSQL.h"
 
 #include <algorithm>
+#include <vector>
 
 #include <DatabaseQuery.h>
 #include <nsComponentManagerUtils.h>
@@ -94,6 +96,7 @@ sbLocalDatabaseGUIDArray::sbLocalDatabaseGUIDArray() :
   mDistinctWithSortableValues(PR_FALSE),
   mValid(PR_FALSE),
   mQueriesValid(PR_FALSE),
+  mSortIndexID(0),
   mNullsFirst(PR_FALSE),
   mPrefetchedRows(PR_FALSE),
   mIsFullLibrary(PR_FALSE),
@@ -387,6 +390,66 @@ sbLocalDatabaseGUIDArray::GetLengthCache(
   return NS_OK;
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::SetSortIndex(
+        sbILocalDatabaseGUIDArraySortIndex *aSortIndex)
+{
+  mSortIndex = aSortIndex;
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::GetSortIndex(
+        sbILocalDatabaseGUIDArraySortIndex **aSortIndex)
+{
+  NS_ENSURE_ARG_POINTER(aSortIndex);
+
+  NS_IF_ADDREF(*aSortIndex = mSortIndex);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::SetFilterSnapshot(
+        sbILocalDatabaseFilterSnapshot *aFilterSnapshot)
+{
+  mFilterSnapshot = aFilterSnapshot;
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::GetFilterSnapshot(
+        sbILocalDatabaseFilterSnapshot **aFilterSnapshot)
+{
+  NS_ENSURE_ARG_POINTER(aFilterSnapshot);
+
+  NS_IF_ADDREF(*aFilterSnapshot = mFilterSnapshot);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::SetSearchIndex(
+        sbILocalDatabaseSearchIndex *aSearchIndex)
+{
+  mSearchIndex = aSearchIndex;
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::GetSearchIndex(
+        sbILocalDatabaseSearchIndex **aSearchIndex)
+{
+  NS_ENSURE_ARG_POINTER(aSearchIndex);
+
+  NS_IF_ADDREF(*aSearchIndex = mSearchIndex);
+
+  return NS_OK;
+}
+
 nsresult sbLocalDatabaseGUIDArray::AddSortInternal(const nsAString& aProperty,
                                                    PRBool aAscending,
                                                    PRBool aSecondary) {
@@ -505,6 +568,604 @@ sbLocalDatabaseGUIDArray::MayInvalidate(PRUint32 * aDirtyPropIDs,
   return NS_OK;
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::MayInvalidateItems(const PRUnichar** aDirtyGUIDs,
+                                             PRUint32* aDirtyPropIDs,
+                                             PRUint32 aCount)
+{
+  if (!aCount) {
+    return NS_OK;
+  }
+  NS_ENSURE_ARG_POINTER(aDirtyGUIDs);
+  NS_ENSURE_ARG_POINTER(aDirtyPropIDs);
+
+  std::vector<PRUint32> dirtyPropIDs(aDirtyPropIDs, aDirtyPropIDs + aCount);
+  std::sort(dirtyPropIDs.begin(), dirtyPropIDs.end());
+  dirtyPropIDs.erase(std::unique(dirtyPropIDs.begin(), dirtyPropIDs.end()),
+                     dirtyPropIDs.end());
+
+  if (!CanEditInPlace()) {
+    return MayInvalidate(&dirtyPropIDs[0], dirtyPropIDs.size());
+  }
+
+  // A change to a filtered property may add or remove items, leave that to
+  // a full invalidation.
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    PRUint32 propertyDBID;
+    nsresult rv = mPropertyCache->GetPropertyDBID(mFilters[index].property,
+                                                  &propertyDBID);
+    if (NS_FAILED(rv)) {
+      continue;
+    }
+    if (std::binary_search(dirtyPropIDs.begin(),
+                           dirtyPropIDs.end(),
+                           propertyDBID)) {
+      return MayInvalidate(&dirtyPropIDs[0], dirtyPropIDs.size());
+    }
+  }
+
+  // Otherwise only the items whose sort key changed have to move.
+  PRUint32 const sortPropertyId = mSorts[0].propertyId;
+  nsTHashtable<nsStringHashKey> seen;
+  PRBool success = seen.Init(aCount);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
+  nsTArray<nsString> guids;
+  for (PRUint32 i = 0; i < aCount; i++) {
+    if (aDirtyPropIDs[i] != sortPropertyId || !aDirtyGUIDs[i]) {
+      continue;
+    }
+    nsDependentString guid(aDirtyGUIDs[i]);
+    if (!seen.GetEntry(guid)) {
+      NS_ENSURE_TRUE(seen.PutEntry(guid), NS_ERROR_OUT_OF_MEMORY);
+      nsString* appended = guids.AppendElement(guid);
+      NS_ENSURE_TRUE(appended, NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
+  if (guids.IsEmpty()) {
+    return NS_OK;
+  }
+
+  return ApplyItemChanges(ITEM_UPDATED, guids);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::ApplyItemAdded(const nsAString& aGuid)
+{
+  nsTArray<nsString> guids;
+  nsString* appended = guids.AppendElement(aGuid);
+  NS_ENSURE_TRUE(appended, NS_ERROR_OUT_OF_MEMORY);
+
+  return ApplyItemChanges(ITEM_ADDED, guids);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::ApplyItemRemoved(const nsAString& aGuid)
+{
+  nsTArray<nsString> guids;
+  nsString* appended = guids.AppendElement(aGuid);
+  NS_ENSURE_TRUE(appended, NS_ERROR_OUT_OF_MEMORY);
+
+  return ApplyItemChanges(ITEM_REMOVED, guids);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArray::ApplyItemUpdated(const nsAString& aGuid)
+{
+  nsTArray<nsString> guids;
+  nsString* appended = guids.AppendElement(aGuid);
+  NS_ENSURE_TRUE(appended, NS_ERROR_OUT_OF_MEMORY);
+
+  return ApplyItemChanges(ITEM_UPDATED, guids);
+}
+
+PRBool
+sbLocalDatabaseGUIDArray::CanEditInPlace()
+{
+  // Only a library sorted on a single property has everything needed to
+  // place an item in the cache: its rows are ordered by the sortable value
+  // and then the media item id, both of which the cache holds.  Top level
+  // properties are cached raw rather than sortable, and the null rows are
+  // ordered by the database in ways we can't reproduce.
+  if (!mValid || mSuppress > 0 || !mIsFullLibrary || mIsDistinct ||
+      !mBaseConstraintColumn.IsEmpty() || !mPropertyCache ||
+      mSorts.Length() != 1 || SB_IsTopLevelProperty(mSorts[0].property)) {
+    return PR_FALSE;
+  }
+
+  // Search results come from the full text index
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    if (mFilters[index].isSearch) {
+      return PR_FALSE;
+    }
+  }
+
+  return PR_TRUE;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::ApplyItemChanges(ItemChange aChange,
+                                           const nsTArray<nsString>& aGuids)
+{
+  nsresult rv;
+
+  // Adding or removing items always changes the length.  A moved item can
+  // change it too when it falls back to an invalidation, as it may have moved
+  // in or out of the null rows.
+  PRBool changesLength = aChange != ITEM_UPDATED;
+
+  if (!CanEditInPlace()) {
+    return Invalidate(PR_TRUE);
+  }
+
+  if (!mDatabaseEngine) {
+    mDatabaseEngine =
+      do_GetService("@songbirdnest.com/Songbird/DatabaseEngine;1", &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Look up what we need to know about the items before taking the cache
+  // monitor.
+  PRUint32 const count = aGuids.Length();
+  nsTArray<ItemEdit> edits(count);
+  for (PRUint32 i = 0; i < count; i++) {
+    ItemEdit* edit = edits.AppendElement();
+    NS_ENSURE_TRUE(edit, NS_ERROR_OUT_OF_MEMORY);
+    edit->guid = aGuids[i];
+
+    rv = PrepareItemEdit(aChange, *edit);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Make sure every change can be applied to the cache before telling the
+  // listener anything.
+  PRBool hasEdits = PR_FALSE;
+  {
+    nsAutoMonitor mon(mCacheMonitor);
+    for (PRUint32 i = 0; i < count; i++) {
+      EditPlan plan;
+      rv = PlanItemEdit(aChange, edits[i], &plan);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      if (plan == EDIT_INVALIDATE) {
+        mon.Exit();
+        return Invalidate(PR_TRUE);
+      }
+      hasEdits |= plan == EDIT_APPLY;
+    }
+  }
+
+  if (!hasEdits) {
+    return NS_OK;
+  }
+
+  nsCOMPtr<sbILocalDatabaseGUIDArrayListener> listener;
+  rv = GetMTListener(getter_AddRefs(listener));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (listener) {
+    listener->OnBeforeInvalidate(changesLength);
+  }
+
+  // Scope for monitor.
+  {
+    nsAutoMonitor mon(mCacheMonitor);
+
+    // Each edit shifts the rows the following ones are placed against, so
+    // plan them again one at a time.  Should one fail after all, drop the
+    // cache like Invalidate would.
+    PRBool applied = PR_TRUE;
+    for (PRUint32 i = 0; applied && i < count; i++) {
+      EditPlan plan;
+      rv = PlanItemEdit(aChange, edits[i], &plan);
+      if (NS_FAILED(rv) || plan == EDIT_INVALIDATE) {
+        applied = PR_FALSE;
+      }
+      else if (plan == EDIT_APPLY) {
+        rv = ApplyItemEdit(aChange, edits[i]);
+        applied = NS_SUCCEEDED(rv);
+      }
+    }
+
+    if (!applied) {
+      ClearCache();
+      changesLength = PR_TRUE;
+    }
+
+    if (changesLength && mLengthCache) {
+      if (applied && !mCachedLengthKey.IsEmpty() && !mNeedNewKey) {
+        mLengthCache->AddCachedLength(mCachedLengthKey, mLength);
+        mLengthCache->AddCachedNonNullLength(mCachedLengthKey, mNonNullLength);
+      }
+      else {
+        mLengthCache->RemoveCachedLength(mCachedLengthKey);
+        mLengthCache->RemoveCachedNonNullLength(mCachedLengthKey);
+        mNeedNewKey = PR_TRUE;
+      }
+    }
+  }
+
+  rv = GetMTListener(getter_AddRefs(listener));
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (listener) {
+    listener->OnAfterInvalidate();
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::PrepareItemEdit(ItemChange aChange,
+                                          ItemEdit& aEdit)
+{
+  nsresult rv;
+
+  aEdit.mediaItemId = 0;
+  aEdit.isMember = PR_FALSE;
+  aEdit.fromIndex = 0;
+  aEdit.toIndex = 0;
+
+  // A removed item is only looked up in the cache
+  if (aChange == ITEM_REMOVED) {
+    return NS_OK;
+  }
+
+  // A just added item's bag is dirty.  Read it as it is, writing it out
+  // here would come back to this array to invalidate it.
+  nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+  rv = mPropertyCache->GetCurrentProperties(aEdit.guid, getter_AddRefs(bag));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // No bag means the item is gone, it can't be part of the array
+  if (!bag) {
+    return NS_OK;
+  }
+
+  rv = bag->GetMediaItemId(&aEdit.mediaItemId);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = bag->GetSortablePropertyByID(mSorts[0].propertyId, aEdit.sortValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = MatchesFilters(mFilters, mPropertyCache, bag, &aEdit.isMember);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::PlanItemEdit(ItemChange aChange,
+                                       ItemEdit& aEdit,
+                                       EditPlan* _retval)
+{
+  nsresult rv;
+
+  // PlanItemEdit always gets called with mCacheMonitor acquired!
+
+  *_retval = EDIT_INVALIDATE;
+
+  // Somebody may have invalidated us in the meantime
+  if (!CanEditInPlace()) {
+    return NS_OK;
+  }
+
+  PRUint32 index;
+  PRBool isCached = mGuidToFirstIndexMap.Get(aEdit.guid, &index);
+
+  switch (aChange) {
+    case ITEM_REMOVED:
+      // If the item isn't cached we can't tell where it was, or whether it
+      // was part of the array at all.
+      if (isCached) {
+        aEdit.fromIndex = index;
+        *_retval = EDIT_APPLY;
+      }
+      return NS_OK;
+
+    case ITEM_ADDED:
+      if (isCached || !aEdit.isMember) {
+        *_retval = EDIT_NONE;
+        return NS_OK;
+      }
+      break;
+
+    case ITEM_UPDATED:
+      // The filters didn't change, so neither did membership.  An uncached
+      // member may have moved anywhere though.
+      if (!isCached) {
+        *_retval = aEdit.isMember ? EDIT_INVALIDATE : EDIT_NONE;
+        return NS_OK;
+      }
+      if (!aEdit.isMember || !IsNonNullIndex(index)) {
+        return NS_OK;
+      }
+      if (mCache[index]->sortPropertyValue.Equals(aEdit.sortValue)) {
+        *_retval = EDIT_NONE;
+        return NS_OK;
+      }
+      aEdit.fromIndex = index;
+      break;
+  }
+
+  // An item without a value for the primary sort belongs to the null rows
+  if (aEdit.sortValue.IsEmpty()) {
+    return NS_OK;
+  }
+
+  PRBool found;
+  rv = FindSortedPosition(aEdit.sortValue,
+                          aEdit.mediaItemId,
+                          &found,
+                          &aEdit.toIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (found) {
+    *_retval = EDIT_APPLY;
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::ApplyItemEdit(ItemChange aChange,
+                                        const ItemEdit& aEdit)
+{
+  nsresult rv;
+
+  // ApplyItemEdit always gets called with mCacheMonitor acquired!
+
+  PRUint32 firstMoved;
+
+  if (aChange == ITEM_REMOVED) {
+    NS_ENSURE_TRUE(aEdit.fromIndex < mCache.Length(), NS_ERROR_UNEXPECTED);
+
+    ArrayItem* item = mCache[aEdit.fromIndex];
+    NS_ENSURE_TRUE(item, NS_ERROR_UNEXPECTED);
+
+    nsAutoString viewItemUID;
+    GetViewItemUID(item, viewItemUID);
+    mViewItemUIDToIndexMap.Remove(viewItemUID);
+    mGuidToFirstIndexMap.Remove(item->guid);
+
+    if (IsNonNullIndex(aEdit.fromIndex)) {
+      mNonNullLength--;
+    }
+    mLength--;
+
+    mCache.RemoveElementAt(aEdit.fromIndex);
+    firstMoved = aEdit.fromIndex;
+
+    rv = ReindexRows(firstMoved, mCache.Length());
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else if (aChange == ITEM_ADDED) {
+    NS_ENSURE_TRUE(aEdit.toIndex <= mCache.Length(), NS_ERROR_UNEXPECTED);
+
+    // Library rows use the media item id as their rowid
+    ArrayItem* item = new ArrayItem(aEdit.mediaItemId,
+                                    aEdit.guid,
+                                    aEdit.sortValue,
+                                    EmptyString(),
+                                    aEdit.mediaItemId);
+    NS_ENSURE_TRUE(item, NS_ERROR_OUT_OF_MEMORY);
+
+    nsAutoPtr<ArrayItem>* inserted = mCache.InsertElementAt(aEdit.toIndex,
+                                                            item);
+    if (!inserted) {
+      delete item;
+      return NS_ERROR_OUT_OF_MEMORY;
+    }
+
+    mNonNullLength++;
+    mLength++;
+    firstMoved = aEdit.toIndex;
+
+    rv = ReindexRows(firstMoved, mCache.Length());
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else {
+    NS_ENSURE_TRUE(aEdit.fromIndex < mCache.Length(), NS_ERROR_UNEXPECTED);
+    NS_ENSURE_TRUE(aEdit.toIndex <= mCache.Length(), NS_ERROR_UNEXPECTED);
+
+    nsAutoPtr<ArrayItem> item(mCache[aEdit.fromIndex].forget());
+    NS_ENSURE_TRUE(item, NS_ERROR_UNEXPECTED);
+    item->sortPropertyValue = aEdit.sortValue;
+
+    // The position was found with the item still in place
+    mCache.RemoveElementAt(aEdit.fromIndex);
+    PRUint32 toIndex = aEdit.toIndex > aEdit.fromIndex ? aEdit.toIndex - 1 :
+                                                         aEdit.toIndex;
+
+    nsAutoPtr<ArrayItem>* inserted = mCache.InsertElementAt(toIndex,
+                                                            item.get());
+    NS_ENSURE_TRUE(inserted, NS_ERROR_OUT_OF_MEMORY);
+    item.forget();
+
+    firstMoved = PR_MIN(aEdit.fromIndex, toIndex);
+    rv = ReindexRows(firstMoved, PR_MAX(aEdit.fromIndex, toIndex) + 1);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  mLengthX = mNullsFirst ? mLength - mNonNullLength : mNonNullLength;
+
+  // Sort key positions past the edit are off by one now
+  if (mPrimarySortKeyPositionCache.IsInitialized()) {
+    mPrimarySortKeyPositionCache.Clear();
+  }
+
+  return NS_OK;
+}
+
+/* static */ nsresult
+sbLocalDatabaseGUIDArray::MatchesFilters(const nsTArray<FilterSpec>& aFilters,
+                                         sbILocalDatabasePropertyCache* aPropertyCache,
+                                         sbILocalDatabaseResourcePropertyBag* aBag,
+                                         PRBool* _retval)
+{
+  NS_ASSERTION(aPropertyCache, "aPropertyCache is null");
+  NS_ASSERTION(aBag, "aBag is null");
+  nsresult rv;
+
+  // This mirrors the non search constraints of sbLocalDatabaseQuery
+  *_retval = PR_TRUE;
+  PRUint32 filterCount = aFilters.Length();
+  for (PRUint32 index = 0; *_retval && index < filterCount; index++) {
+    const FilterSpec& fs = aFilters[index];
+    NS_ENSURE_STATE(fs.values.Length());
+
+    nsAutoString value;
+    if (fs.property.EqualsLiteral(SB_PROPERTY_ISLIST)) {
+      rv = aBag->GetProperty(fs.property, value);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      PRBool isList = !value.IsEmpty() && !value.EqualsLiteral("0");
+      *_retval = fs.values[0].EqualsLiteral("0") ? !isList : isList;
+      continue;
+    }
+
+    if (SB_IsTopLevelProperty(fs.property)) {
+      rv = aBag->GetProperty(fs.property, value);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    else {
+      PRUint32 propertyDBID;
+      rv = aPropertyCache->GetPropertyDBID(fs.property, &propertyDBID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aBag->GetSortablePropertyByID(propertyDBID, value);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
+    PRBool matched = PR_FALSE;
+    if (!value.IsVoid()) {
+      PRUint32 valueCount = fs.values.Length();
+      for (PRUint32 i = 0; !matched && i < valueCount; i++) {
+        matched = fs.values[i].Equals(value);
+      }
+    }
+    *_retval = matched;
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::CompareSortKey(const nsAString& aValue,
+                                         PRUint32 aMediaItemId,
+                                         const ArrayItem* aItem,
+                                         PRInt32* _retval)
+{
+  // Same order as the range queries: the sortable value in the database's
+  // collation, then the media item id, both in the direction of the sort.
+  PRInt32 result;
+  nsresult rv = mDatabaseEngine->Collate(aValue,
+                                         aItem->sortPropertyValue,
+                                         &result);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (result == 0 && aMediaItemId != aItem->mediaItemId) {
+    result = aMediaItemId < aItem->mediaItemId ? -1 : 1;
+  }
+
+  *_retval = mSorts[0].ascending ? result : -result;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::FindSortedPosition(const nsAString& aValue,
+                                             PRUint32 aMediaItemId,
+                                             PRBool* aFound,
+                                             PRUint32* _retval)
+{
+  nsresult rv;
+
+  // FindSortedPosition always gets called with mCacheMonitor acquired!
+
+  // Binary search the non null rows.  Only cached rows can be compared
+  // against, so each probe uses the cached row closest to the middle of the
+  // remaining range.  Once no cached row is left in that range the position
+  // lies somewhere in rows we haven't read and can't be known.
+  PRUint32 low = mNullsFirst ? mLength - mNonNullLength : 0;
+  PRUint32 high = mNullsFirst ? mLength : mNonNullLength;
+  PRUint32 const cacheLength = mCache.Length();
+
+  while (low < high) {
+    PRUint32 middle = low + (high - low) / 2;
+    PRUint32 end = PR_MIN(high, cacheLength);
+
+    PRUint32 probe = middle;
+    while (probe < end && !mCache[probe]) {
+      probe++;
+    }
+
+    if (probe >= end) {
+      probe = PR_MIN(middle, end);
+      while (probe > low && !mCache[probe - 1]) {
+        probe--;
+      }
+      if (probe == low) {
+        *aFound = PR_FALSE;
+        return NS_OK;
+      }
+      probe--;
+    }
+
+    PRInt32 compare;
+    rv = CompareSortKey(aValue, aMediaItemId, mCache[probe], &compare);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (compare > 0) {
+      low = probe + 1;
+    }
+    else {
+      high = probe;
+    }
+  }
+
+  *aFound = PR_TRUE;
+  *_retval = low;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::ReindexRows(PRUint32 aStartIndex,
+                                      PRUint32 aEndIndex)
+{
+  // ReindexRows always gets called with mCacheMonitor acquired!
+
+  aEndIndex = PR_MIN(aEndIndex, mCache.Length());
+  for (PRUint32 index = aStartIndex; index < aEndIndex; index++) {
+    ArrayItem* item = mCache[index];
+    if (!item) {
+      continue;
+    }
+
+    // Library guids are unique, so this is also the first index
+    PRBool added = mGuidToFirstIndexMap.Put(item->guid, index);
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+
+    nsAutoString viewItemUID;
+    GetViewItemUID(item, viewItemUID);
+    added = mViewItemUIDToIndexMap.Put(viewItemUID, index);
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  return NS_OK;
+}
+
+/* static */ void
+sbLocalDatabaseGUIDArray::GetViewItemUID(const ArrayItem* aItem,
+                                         nsAString& _retval)
+{
+  _retval.Truncate();
+  AppendInt(_retval, aItem->rowid);
+  _retval.Append('-');
+  _retval.AppendInt(aItem->mediaItemId);
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseGUIDArray::AddSort(const nsAString& aProperty,
                                   PRBool aAscending)
@@ -831,17 +1492,7 @@ sbLocalDatabaseGUIDArray::Invalidate(PRBool aInvalidateLength)
   // Scope for monitor.
   {
     nsAutoMonitor mon(mCacheMonitor);
-
-    mCache.Clear();
-    mGuidToFirstIndexMap.Clear();
-    mViewItemUIDToIndexMap.Clear();
-    mPrefetchedRows = PR_FALSE;
-
-    if (mPrimarySortKeyPositionCache.IsInitialized()) {
-      mPrimarySortKeyPositionCache.Clear();
-    }
-
-    mValid = PR_FALSE;
+    ClearCache();
   }
 
   rv = GetMTListener(getter_AddRefs(listener));
@@ -853,6 +1504,23 @@ sbLocalDatabaseGUIDArray::Invalidate(PRBool aInvalidateLength)
   return NS_OK;
 }
 
+void
+sbLocalDatabaseGUIDArray::ClearCache()
+{
+  // ClearCache always gets called with mCacheMonitor acquired!
+
+  mCache.Clear();
+  mGuidToFirstIndexMap.Clear();
+  mViewItemUIDToIndexMap.Clear();
+  mPrefetchedRows = PR_FALSE;
+
+  if (mPrimarySortKeyPositionCache.IsInitialized()) {
+    mPrimarySortKeyPositionCache.Clear();
+  }
+
+  mValid = PR_FALSE;
+}
+
 /**
  * Copy all the base properties of the guid array. This method will fail if any
  * of the clone operations fail.
@@ -935,6 +1603,15 @@ sbLocalDatabaseGUIDArray::CloneInto(sbILocalDatabaseGUIDArray* aDest)
   rv = aDest->SetLengthCache(mLengthCache);
   NS_ENSURE_SUCCESS(rv, rv);
 
+  rv = aDest->SetSortIndex(mSortIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aDest->SetFilterSnapshot(mFilterSnapshot);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aDest->SetSearchIndex(mSearchIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   return NS_OK;
 }
 
@@ -1395,6 +2072,268 @@ sbLocalDatabaseGUIDArray::Initialize()
 
   mValid = PR_TRUE;
 
+  // The array works without its sort index, just slower
+  rv = UpdateSortIndex();
+  NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Failed to update the sort index");
+
+  return NS_OK;
+}
+
+PRBool
+sbLocalDatabaseGUIDArray::CanUseSortIndex()
+{
+  // The index stores the order of a library sorted on a single primary
+  // property.  Secondary sorts are fine, the range queries order by
+  // obj_secondary_sortable for them, and so does the index.
+  if (!mSortIndex || !mPropertyCache || mCachedLengthKey.IsEmpty() ||
+      !mIsFullLibrary || mIsDistinct || !mBaseConstraintColumn.IsEmpty() ||
+      mPrimarySortsCount != 1 || SB_IsTopLevelProperty(mSorts[0].property)) {
+    return PR_FALSE;
+  }
+
+  // Search results come from the full text index, which the index can't
+  // keep up with
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    if (mFilters[index].isSearch || !mFilters[index].values.Length()) {
+      return PR_FALSE;
+    }
+  }
+
+  return PR_TRUE;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::UpdateSortIndex()
+{
+  nsresult rv;
+
+  nsAutoMonitor mon(mCacheMonitor);
+
+  mSortIndexStatement = nsnull;
+  mSortIndexID = 0;
+
+  if (!CanUseSortIndex()) {
+    return NS_OK;
+  }
+
+  PRUint32 length;
+  PRUint32 nonNullLength;
+  PRUint32 indexID;
+  rv = mSortIndex->GetIndex(mCachedLengthKey,
+                            &length,
+                            &nonNullLength,
+                            &indexID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // An index that doesn't agree with our length missed a change
+  if (indexID && (length != mLength || nonNullLength != mNonNullLength)) {
+    rv = mSortIndex->RemoveIndex(mCachedLengthKey);
+    NS_ENSURE_SUCCESS(rv, rv);
+    indexID = 0;
+  }
+
+  if (!indexID) {
+    PRBool create;
+    rv = mSortIndex->ShouldCreateIndex(mLength, &create);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (!create) {
+      return NS_OK;
+    }
+
+    rv = CreateSortIndex(&indexID);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  nsCOMPtr<sbIDatabaseQuery> query =
+    do_CreateInstance(SONGBIRD_DATABASEQUERY_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->SetDatabaseGUID(mDatabaseGUID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (mDatabaseLocation) {
+    rv = query->SetDatabaseLocation(mDatabaseLocation);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->PrepareQuery(
+         sbLocalDatabaseSQL::SortIndexRowsSelect(indexID,
+                                                 mSorts[0].propertyId),
+         getter_AddRefs(mSortIndexStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  mSortIndexID = indexID;
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::CreateSortIndex(PRUint32* _retval)
+{
+  nsresult rv;
+
+  // CreateSortIndex always gets called with mCacheMonitor acquired!
+
+  // Read all the rows the usual way and store the order they came in
+  rv = FetchRows(0, 0);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(mCache.Length() == mLength, NS_ERROR_UNEXPECTED);
+
+  nsTArray<PRUint32> mediaItemIds(mLength);
+  for (PRUint32 i = 0; i < mLength; i++) {
+    ArrayItem* item = mCache[i];
+    NS_ENSURE_TRUE(item && item->mediaItemId, NS_ERROR_UNEXPECTED);
+    mediaItemIds.AppendElement(item->mediaItemId);
+  }
+
+  nsTArray<const PRUnichar*> filterProperties;
+  nsTArray<const PRUnichar*> filterValues;
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    const FilterSpec& fs = mFilters[index];
+    PRUint32 valueCount = fs.values.Length();
+    for (PRUint32 i = 0; i < valueCount; i++) {
+      NS_ENSURE_TRUE(filterProperties.AppendElement(fs.property.get()),
+                     NS_ERROR_OUT_OF_MEMORY);
+      NS_ENSURE_TRUE(filterValues.AppendElement(fs.values[i].get()),
+                     NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
+  rv = mSortIndex->CreateIndex(mCachedLengthKey,
+                               mSorts[0].propertyId,
+                               mSorts[0].ascending,
+                               mNullsFirst,
+                               filterProperties.Length(),
+                               filterProperties.Elements(),
+                               filterValues.Elements(),
+                               mNonNullLength,
+                               mediaItemIds.Length(),
+                               mediaItemIds.Elements(),
+                               _retval);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+PRBool
+sbLocalDatabaseGUIDArray::IsSortIndexCurrent()
+{
+  // IsSortIndexCurrent always gets called with mCacheMonitor acquired!
+
+  if (!mSortIndexStatement) {
+    return PR_FALSE;
+  }
+
+  // The index may have been dropped, or missed a change we saw
+  PRUint32 length;
+  PRUint32 nonNullLength;
+  PRUint32 indexID;
+  nsresult rv = mSortIndex->GetIndex(mCachedLengthKey,
+                                     &length,
+                                     &nonNullLength,
+                                     &indexID);
+  if (NS_FAILED(rv) || indexID != mSortIndexID || length != mLength ||
+      nonNullLength != mNonNullLength) {
+    mSortIndexStatement = nsnull;
+    mSortIndexID = 0;
+    return PR_FALSE;
+  }
+
+  return PR_TRUE;
+}
+
+PRBool
+sbLocalDatabaseGUIDArray::CanUseFilterSnapshot()
+{
+  // The snapshot lists the sortable values of one property across the whole
+  // library, which is what the filter panes show
+  if (!mFilterSnapshot || !mIsDistinct || !mDistinctWithSortableValues ||
+      !mIsFullLibrary || !mBaseConstraintColumn.IsEmpty() ||
+      mPrimarySortsCount != 1 || SB_IsTopLevelProperty(mSorts[0].property)) {
+    return PR_FALSE;
+  }
+
+  // Search results come from the full text index
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    if (mFilters[index].isSearch || !mFilters[index].values.Length()) {
+      return PR_FALSE;
+    }
+  }
+
+  return PR_TRUE;
+}
+
+nsresult
+sbLocalDatabaseGUIDArray::ReadFilterSnapshotRows()
+{
+  // ReadFilterSnapshotRows always gets called with mCacheMonitor acquired!
+  nsresult rv;
+
+  nsTArray<const PRUnichar*> filterProperties;
+  nsTArray<const PRUnichar*> filterValues;
+  PRUint32 filterCount = mFilters.Length();
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    const FilterSpec& fs = mFilters[index];
+    PRUint32 valueCount = fs.values.Length();
+    for (PRUint32 i = 0; i < valueCount; i++) {
+      NS_ENSURE_TRUE(filterProperties.AppendElement(fs.property.get()),
+                     NS_ERROR_OUT_OF_MEMORY);
+      NS_ENSURE_TRUE(filterValues.AppendElement(fs.values[i].get()),
+                     NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
+  PRUint32 count = 0;
+  PRUint32* mediaItemIds = nsnull;
+  PRUnichar** guids = nsnull;
+  PRUnichar** values = nsnull;
+  rv = mFilterSnapshot->GetDistinctValues(mSorts[0].property,
+                                          mSorts[0].ascending,
+                                          filterProperties.Length(),
+                                          filterProperties.Elements(),
+                                          filterValues.Elements(),
+                                          &count,
+                                          &mediaItemIds,
+                                          &guids,
+                                          &values);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  sbAutoNSTypePtr<PRUint32> autoMediaItemIds(mediaItemIds);
+  sbAutoNSArray<PRUnichar*> autoGuids(guids, count);
+  sbAutoNSArray<PRUnichar*> autoValues(values, count);
+
+  NS_ENSURE_TRUE(mCache.SetLength(count), NS_ERROR_OUT_OF_MEMORY);
+
+  // Rows of the library are keyed by their media item id, like the distinct
+  // query does with media_items.rowid
+  for (PRUint32 index = 0; index < count; index++) {
+    ArrayItem* item = new ArrayItem(mediaItemIds[index],
+                                    nsDependentString(guids[index]),
+                                    nsDependentString(values[index]),
+                                    EmptyString(),
+                                    mediaItemIds[index]);
+    NS_ENSURE_TRUE(item, NS_ERROR_OUT_OF_MEMORY);
+
+    mCache[index] = item;
+
+    PRUint32 firstGuidIndex;
+    PRBool found = mGuidToFirstIndexMap.Get(item->guid, &firstGuidIndex);
+    if (!found || index < firstGuidIndex) {
+      PRBool added = mGuidToFirstIndexMap.Put(item->guid, index);
+      NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+    }
+
+    nsAutoString viewItemUID;
+    GetViewItemUID(item, viewItemUID);
+
+    PRBool added = mViewItemUIDToIndexMap.Put(viewItemUID, index);
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
   return NS_OK;
 }
 
@@ -1413,12 +2352,20 @@ sbLocalDatabaseGUIDArray::UpdateLength()
   if ((mFetchSize == PR_UINT32_MAX || mFetchSize == 0) &&
       mNonNullCountQuery.IsEmpty() && mNullGuidRangeQuery.IsEmpty())
   {
-    rv = ReadRowRange(mFullGuidRangeStatement,
-                      0,
-                      PR_UINT32_MAX,
-                      0,
-                      PR_FALSE);
-    NS_ENSURE_SUCCESS(rv, rv);
+    // The distinct values of the filter panes can come from the filter
+    // snapshot, falling back on the query when it can't answer
+    rv = NS_ERROR_NOT_AVAILABLE;
+    if (CanUseFilterSnapshot()) {
+      rv = ReadFilterSnapshotRows();
+    }
+    if (NS_FAILED(rv)) {
+      rv = ReadRowRange(mFullGuidRangeStatement,
+                        0,
+                        PR_UINT32_MAX,
+                        0,
+                        PR_FALSE);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
 
     mLength = mCache.Length();
     mNonNullLength = mLength;
@@ -1456,7 +2403,8 @@ sbLocalDatabaseGUIDArray::UpdateLength()
           rv = RunLengthQuery(mNonNullCountStatement, &mNonNullLength);
           NS_ENSURE_SUCCESS(rv, rv);
 
-          rv = mLengthCache->AddCachedNonNullLength(mCachedLengthKey, mLength);
+          rv = mLengthCache->AddCachedNonNullLength(mCachedLengthKey,
+                                                    mNonNullLength);
           NS_ENSURE_SUCCESS(rv, rv);
         }
       }
@@ -1553,6 +2501,19 @@ sbLocalDatabaseGUIDArray::UpdateQueries()
    */
   nsAutoPtr<sbLocalDatabaseQuery> ldq;
 
+  // Searches go through the word index once it covers the library.  Until
+  // then they use the full text table while the index builds.
+  PRBool useSearchIndex = PR_FALSE;
+  if (mSearchIndex) {
+    for (PRUint32 index = 0; index < mFilters.Length(); index++) {
+      if (mFilters[index].isSearch) {
+        rv = mSearchIndex->EnsureIndex(&useSearchIndex);
+        NS_ENSURE_SUCCESS(rv, rv);
+        break;
+      }
+    }
+  }
+
   ldq = new sbLocalDatabaseQuery(mBaseTable,
                                  mBaseConstraintColumn,
                                  mBaseConstraintValue,
@@ -1561,6 +2522,7 @@ sbLocalDatabaseGUIDArray::UpdateQueries()
                                  &mSorts,
                                  mIsDistinct,
                                  mDistinctWithSortableValues,
+                                 useSearchIndex,
                                  mPropertyCache);
 
   // Full Count Query
@@ -1750,6 +2712,21 @@ sbLocalDatabaseGUIDArray::FetchRows(PRUint32 aRequestedIndex,
   }
   PRUint32 lengthDE = indexE - indexD + 1;
 
+  /*
+   * The sort index holds the position of every row, so it can return DE
+   * directly whichever side of B it lies on
+   */
+  if (IsSortIndexCurrent()) {
+    rv = ReadRowRange(mSortIndexStatement,
+                      indexD,
+                      lengthDE,
+                      indexD,
+                      PR_FALSE);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    return NS_OK;
+  }
+
   /*
    * If DE lies entirely within [A, B - 1], use query X to return the data
    */
@@ -1895,12 +2872,11 @@ sbLocalDatabaseGUIDArray::ReadRowRange(sbIDatabasePreparedStatement *aStatement,
   for (PRUint32 i = 0; i < rowCount; i++) {
     PRUint32 index = i + aDestIndexOffset;
 
-    nsString mediaItemIdStr;
-    rv = result->GetRowCell(i, 0, mediaItemIdStr);
+    PRInt64 mediaItemId64;
+    rv = result->GetRowCellAsInt64(i, 0, &mediaItemId64);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    PRUint32 mediaItemId = mediaItemIdStr.ToInteger(&rv);
-    NS_ENSURE_SUCCESS(rv, rv);
+    PRUint32 mediaItemId = static_cast<PRUint32>(mediaItemId64);
 
     nsString guid;
     rv = result->GetRowCell(i, 1, guid);
@@ -1914,14 +2890,12 @@ sbLocalDatabaseGUIDArray::ReadRowRange(sbIDatabasePreparedStatement *aStatement,
     rv = result->GetRowCell(i, 3, ordinal);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsString rowidStr;
-    rv = result->GetRowCell(i, 4, rowidStr);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    PRUint64 rowid = nsString_ToUint64(rowidStr, &rv);
+    PRInt64 rowid;
+    rv = result->GetRowCellAsInt64(i, 4, &rowid);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    ArrayItem* item = new ArrayItem(mediaItemId, guid, value, ordinal, rowid);
+    ArrayItem* item = new ArrayItem(mediaItemId, guid, value, ordinal,
+                                    static_cast<PRUint64>(rowid));
     NS_ENSURE_TRUE(item, NS_ERROR_OUT_OF_MEMORY);
 
     nsAutoPtr<ArrayItem>* success =
@@ -2262,12 +3236,11 @@ sbLocalDatabaseGUIDArray::SortRows(PRUint32 aStartIndex,
     PRUint32 row = offset + i;
     nsAutoPtr<ArrayItem>& item = mCache[i + aStartIndex];
 
-    nsString mediaItemIdStr;
-    rv = result->GetRowCell(row, 0, mediaItemIdStr);
+    PRInt64 mediaItemId;
+    rv = result->GetRowCellAsInt64(row, 0, &mediaItemId);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    item->mediaItemId = mediaItemIdStr.ToInteger(&rv);
-    NS_ENSURE_SUCCESS(rv, rv);
+    item->mediaItemId = static_cast<PRUint32>(mediaItemId);
 
     rv = result->GetRowCell(row, 1, item->guid);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -2275,12 +3248,11 @@ sbLocalDatabaseGUIDArray::SortRows(PRUint32 aStartIndex,
     rv = result->GetRowCell(row, 2, item->ordinal);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsString rowidStr;
-    rv = result->GetRowCell(row, 3, rowidStr);
+    PRInt64 rowid;
+    rv = result->GetRowCellAsInt64(row, 3, &rowid);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    item->rowid = nsString_ToUint64(rowidStr, &rv);
-    NS_ENSURE_SUCCESS(rv, rv);
+    item->rowid = static_cast<PRUint64>(rowid);
   }
 
   return NS_OK;
@@ -2392,9 +3364,10 @@ sbLocalDatabaseGUIDArray::GetByIndexInternal(PRUint32 aIndex,
   }
 #else
   /*
-   * Cache miss, cache all GUIDs. FetchRows takes care of it's own locking.
+   * Cache miss, cache all GUIDs unless the sort index makes reading just the
+   * surrounding rows cheap. FetchRows takes care of it's own locking.
    */
-  rv = FetchRows(0, 0);
+  rv = FetchRows(aIndex, mSortIndexStatement ? mFetchSize : 0);
   NS_ENSURE_SUCCESS(rv, rv);
   NS_ENSURE_TRUE(aIndex < mCache.Length(), NS_ERROR_FAILURE);
 #endif
@@ -2534,6 +3507,47 @@ sbLocalDatabaseGUIDArray::GenerateCachedLengthKey()
     mCachedLengthKey.AppendInt(sortSpec.ascending);
     mCachedLengthKey.AppendInt(sortSpec.secondary);
   }
+
+  // Filtered arrays over the whole library can have their lengths counted up
+  // and down by the length cache as items come and go instead of counting
+  // the rows again.
+  if (!mLengthCache || !mFilters.Length() || mIsDistinct ||
+      !mBaseTable.Equals(MEDIAITEMS_TABLE) || !mBaseConstraintColumn.IsEmpty()) {
+    return;
+  }
+
+  nsTArray<const PRUnichar*> filterProperties;
+  nsTArray<const PRUnichar*> filterValues;
+  for (PRUint32 index = 0; index < filterCount; index++) {
+    const FilterSpec& fs = mFilters[index];
+    if (fs.isSearch) {
+      return;
+    }
+
+    PRUint32 valueCount = fs.values.Length();
+    for (PRUint32 i = 0; i < valueCount; i++) {
+      if (!filterProperties.AppendElement(fs.property.get()) ||
+          !filterValues.AppendElement(fs.values[i].get())) {
+        return;
+      }
+    }
+  }
+
+  // Ordinal has no values in the library, every row counts as non-null
+  nsString nonNullProperty;
+  if (sortCount &&
+      !mSorts[0].property.EqualsLiteral(SB_PROPERTY_ORDINAL)) {
+    nonNullProperty = mSorts[0].property;
+  }
+
+  nsresult rv =
+    mLengthCache->SetLengthDependencies(mCachedLengthKey,
+                                        nonNullProperty,
+                                        filterProperties.Length(),
+                                        filterProperties.Elements(),
+                                        filterValues.Elements());
+  NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+    "Failed to set length dependencies, lengths will be counted again.");
 }
 
 NS_IMPL_ISUPPORTS1(sbGUIDArrayEnumerator, nsISimpleEnumerator)
@@ -27,8 +27,8 @@
 
 #include "sbILocalDatabaseGUIDArray.h"
 #include "sbILocalDatabasePropertyCache.h"
-#include "sbLocalDatabaseGUIDArrayLengthCache.h"
 
+#include <nsAutoLock.h>
 #include <nsAutoPtr.h>
 #include <nsCOMPtr.h>
 #include <nsDataHashtable.h>
@@ -38,6 +38,7 @@
 #include <sbISQLBuilder.h>
 #include <nsISimpleEnumerator.h>
 #include <nsIStringEnumerator.h>
+#include <sbIDatabaseEngine.h>
 #include <sbIDatabasePreparedStatement.h>
 #include <sbILocalDatabaseLibrary.h>
 #include <sbIMediaItem.h>
@@ -50,6 +51,7 @@
 class nsIURI;
 class nsIWeakReference;
 class sbILibrary;
+class sbILocalDatabaseResourcePropertyBag;
 class sbIPropertyManager;
 class sbLocalDatabaseResourcePropertyBag;
 
@@ -75,6 +77,15 @@ public:
     PRBool secondary;
   };
 
+  /**
+   * \brief Check whether an item passes a set of non search filters, the
+   *        same way the database queries of the array would.
+   */
+  static nsresult MatchesFilters(const nsTArray<FilterSpec>& aFilters,
+                                 sbILocalDatabasePropertyCache* aPropertyCache,
+                                 sbILocalDatabaseResourcePropertyBag* aBag,
+                                 PRBool* _retval);
+
 private:
 
   struct ArrayItem {
@@ -178,6 +189,76 @@ private:
     mQueriesValid = PR_FALSE;
   }
 
+  void ClearCache();
+
+  // In place maintenance of the cached rows
+  enum ItemChange {
+    ITEM_ADDED,
+    ITEM_REMOVED,
+    ITEM_UPDATED
+  };
+
+  enum EditPlan {
+    EDIT_NONE,       // the array is not affected by the change
+    EDIT_APPLY,      // the cached rows can be edited in place
+    EDIT_INVALIDATE  // the array has to be invalidated
+  };
+
+  struct ItemEdit {
+    nsString guid;
+    nsString sortValue;
+    PRUint32 mediaItemId;
+    PRBool isMember;
+    PRUint32 fromIndex;
+    PRUint32 toIndex;
+  };
+
+  PRBool CanEditInPlace();
+
+  nsresult ApplyItemChanges(ItemChange aChange,
+                            const nsTArray<nsString>& aGuids);
+
+  nsresult PrepareItemEdit(ItemChange aChange, ItemEdit& aEdit);
+
+  nsresult PlanItemEdit(ItemChange aChange,
+                        ItemEdit& aEdit,
+                        EditPlan* _retval);
+
+  nsresult ApplyItemEdit(ItemChange aChange, const ItemEdit& aEdit);
+
+  nsresult CompareSortKey(const nsAString& aValue,
+                          PRUint32 aMediaItemId,
+                          const ArrayItem* aItem,
+                          PRInt32* _retval);
+
+  nsresult FindSortedPosition(const nsAString& aValue,
+                              PRUint32 aMediaItemId,
+                              PRBool* aFound,
+                              PRUint32* _retval);
+
+  PRBool IsNonNullIndex(PRUint32 aIndex) {
+    return mNullsFirst ? aIndex >= mLength - mNonNullLength :
+                         aIndex < mNonNullLength;
+  }
+
+  nsresult ReindexRows(PRUint32 aStartIndex, PRUint32 aEndIndex);
+
+  static void GetViewItemUID(const ArrayItem* aItem, nsAString& _retval);
+
+  // Reading rows from the persistent sort index
+  PRBool CanUseSortIndex();
+
+  nsresult UpdateSortIndex();
+
+  nsresult CreateSortIndex(PRUint32* _retval);
+
+  PRBool IsSortIndexCurrent();
+
+  // Reading the rows of distinct arrays from the filter snapshot
+  PRBool CanUseFilterSnapshot();
+
+  nsresult ReadFilterSnapshotRows();
+
   // GUID Array Length Caching Key and Hashtables.
   void GenerateCachedLengthKey();
   PRPackedBool  mNeedNewKey;
@@ -185,6 +266,20 @@ private:
 
   nsCOMPtr<sbILocalDatabaseGUIDArrayLengthCache> mLengthCache;
 
+  // Sort index shared by the arrays of the library, and the statement reading
+  // this array's rows from it when it has one
+  nsCOMPtr<sbILocalDatabaseGUIDArraySortIndex> mSortIndex;
+  nsCOMPtr<sbIDatabasePreparedStatement> mSortIndexStatement;
+  PRUint32 mSortIndexID;
+
+  // In memory copy of the library's filterable properties, for the distinct
+  // arrays of the filter panes
+  nsCOMPtr<sbILocalDatabaseFilterSnapshot> mFilterSnapshot;
+
+  // Word index the queries search instead of the full text table once it
+  // covers the library
+  nsCOMPtr<sbILocalDatabaseSearchIndex> mSearchIndex;
+
   // Set of property IDs used in the length cache key; the cache entry should
   // be removed if any of these property IDs are invalidated.
   std::set<PRUint32> mPropIdsUsedInCacheKey;
@@ -279,6 +374,9 @@ private:
   // Paired property cache
   nsCOMPtr<sbILocalDatabasePropertyCache> mPropertyCache;
 
+  // Used to collate sort keys the way the database does
+  nsCOMPtr<sbIDatabaseEngine> mDatabaseEngine;
+
   // Map of guid -> first array index
   nsDataHashtable<nsStringHashKey, PRUint32> mGuidToFirstIndexMap;
 
@@ -24,15 +24,40 @@
 
 #include "sbLocalDatabaseGUIDArrayLengthCache.h"
 
-NS_IMPL_THREADSAFE_ISUPPORTS1(sbLocalDatabaseGUIDArrayLengthCache,
-        sbILocalDatabaseGUIDArrayLengthCache);
+#include <sbILocalDatabaseResourcePropertyBag.h>
+#include <sbIMediaItem.h>
+#include <sbMemoryUtils.h>
 
-sbLocalDatabaseGUIDArrayLengthCache::sbLocalDatabaseGUIDArrayLengthCache()
+#include "sbLocalDatabasePropertyCache.h"
+
+/**
+ * \brief Most keys whose lengths are counted up and down.  Past this the
+ *        oldest key is forgotten and its lengths dropped.
+ */
+#define MAX_TRACKED_KEYS 128
+
+/**
+ * \brief Most items whose counts are checked once their properties are
+ *        written.  Past this they are forgotten, and the lengths depending
+ *        on their properties are dropped as for any other item.
+ */
+#define MAX_COUNTED_ITEMS 1000
+
+NS_IMPL_THREADSAFE_ISUPPORTS3(sbLocalDatabaseGUIDArrayLengthCache,
+                              sbILocalDatabaseGUIDArrayLengthCache,
+                              sbIMediaListListener,
+                              nsISupportsWeakReference)
+
+sbLocalDatabaseGUIDArrayLengthCache::sbLocalDatabaseGUIDArrayLengthCache() :
+  mGeneration(0)
 {
   mLock = nsAutoLock::NewLock("sbLocalDatabaseGUIDArrayLengthCache");
 
   mCachedLengths.Init();
   mCachedNonNullLengths.Init();
+  mDependencies.Init();
+  mRemovedBags.Init();
+  mCountedItems.Init();
 }
 
 sbLocalDatabaseGUIDArrayLengthCache::~sbLocalDatabaseGUIDArrayLengthCache()
@@ -40,6 +65,18 @@ sbLocalDatabaseGUIDArrayLengthCache::~sbLocalDatabaseGUIDArrayLengthCache()
   nsAutoLock::DestroyLock(mLock);
 }
 
+nsresult
+sbLocalDatabaseGUIDArrayLengthCache::Init(
+        sbLocalDatabasePropertyCache* aPropertyCache)
+{
+  NS_ENSURE_ARG_POINTER(aPropertyCache);
+  NS_ENSURE_TRUE(mLock, NS_ERROR_OUT_OF_MEMORY);
+
+  mPropertyCache = aPropertyCache;
+
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseGUIDArrayLengthCache::AddCachedLength(const nsAString &aKey,
                                                      PRUint32 aLength)
@@ -48,6 +85,12 @@ sbLocalDatabaseGUIDArrayLengthCache::AddCachedLength(const nsAString &aKey,
 
   NS_ENSURE_TRUE(mCachedLengths.Put(aKey, aLength), NS_ERROR_OUT_OF_MEMORY);
 
+  // Items counted in before this length was counted are already in it
+  Dependencies* dependencies;
+  if (mDependencies.Get(aKey, &dependencies)) {
+    dependencies->lengthGeneration = ++mGeneration;
+  }
+
   return NS_OK;
 }
 
@@ -71,6 +114,10 @@ sbLocalDatabaseGUIDArrayLengthCache::RemoveCachedLength(const nsAString &aKey)
 {
   nsAutoLock lock(mLock);
 
+  // Tracked lengths are kept up to date here
+  if (mDependencies.Get(aKey, nsnull))
+    return NS_OK;
+
   // We don't care if it wasn't there
   mCachedLengths.Remove(aKey);
 
@@ -87,6 +134,11 @@ sbLocalDatabaseGUIDArrayLengthCache::AddCachedNonNullLength(
   NS_ENSURE_TRUE(mCachedNonNullLengths.Put(aKey, aLength),
           NS_ERROR_OUT_OF_MEMORY);
 
+  Dependencies* dependencies;
+  if (mDependencies.Get(aKey, &dependencies)) {
+    dependencies->nonNullGeneration = ++mGeneration;
+  }
+
   return NS_OK;
 }
 
@@ -112,9 +164,552 @@ sbLocalDatabaseGUIDArrayLengthCache::RemoveCachedNonNullLength(
 {
   nsAutoLock lock(mLock);
 
+  // Tracked lengths are kept up to date here
+  if (mDependencies.Get(aKey, nsnull))
+    return NS_OK;
+
   // We don't care if it wasn't there
   mCachedNonNullLengths.Remove(aKey);
 
   return NS_OK;
 }
 
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::SetLengthDependencies(
+        const nsAString& aKey,
+        const nsAString& aNonNullProperty,
+        PRUint32 aFilterCount,
+        const PRUnichar** aFilterProperties,
+        const PRUnichar** aFilterValues)
+{
+  NS_ENSURE_ARG(!aFilterCount || (aFilterProperties && aFilterValues));
+  NS_ENSURE_TRUE(mPropertyCache, NS_ERROR_NOT_INITIALIZED);
+
+  nsresult rv;
+
+  nsAutoPtr<Dependencies> dependencies(new Dependencies);
+  NS_ENSURE_TRUE(dependencies, NS_ERROR_OUT_OF_MEMORY);
+
+  dependencies->nonNullProperty = aNonNullProperty;
+  dependencies->nonNullPropertyID = 0;
+  if (!aNonNullProperty.IsEmpty()) {
+    rv = mPropertyCache->GetPropertyDBID(aNonNullProperty,
+                                         &dependencies->nonNullPropertyID);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Values of the same filter are passed one after the other
+  for (PRUint32 i = 0; i < aFilterCount; i++) {
+    nsDependentString property(aFilterProperties[i]);
+    PRUint32 filterCount = dependencies->filters.Length();
+    if (!filterCount ||
+        !dependencies->filters[filterCount - 1].property.Equals(property)) {
+      sbLocalDatabaseGUIDArray::FilterSpec* fs =
+        dependencies->filters.AppendElement();
+      NS_ENSURE_TRUE(fs, NS_ERROR_OUT_OF_MEMORY);
+
+      fs->property = property;
+      fs->isSearch = PR_FALSE;
+
+      PRUint32 propertyID;
+      rv = mPropertyCache->GetPropertyDBID(property, &propertyID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      NS_ENSURE_TRUE(dependencies->filterPropertyIDs.AppendElement(propertyID),
+                     NS_ERROR_OUT_OF_MEMORY);
+      filterCount++;
+    }
+
+    nsString* added = dependencies->filters[filterCount - 1].values.AppendElement(
+                        nsDependentString(aFilterValues[i]));
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  nsAutoLock lock(mLock);
+
+  dependencies->lengthGeneration = ++mGeneration;
+  dependencies->nonNullGeneration = ++mGeneration;
+
+  if (!mDependencies.Get(aKey, nsnull)) {
+    while (mTrackedKeys.Length() >= MAX_TRACKED_KEYS) {
+      nsString oldest(mTrackedKeys[0]);
+      RemoveTrackedKey(oldest);
+    }
+
+    NS_ENSURE_TRUE(mTrackedKeys.AppendElement(aKey), NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  NS_ENSURE_TRUE(mDependencies.Put(aKey, dependencies),
+                 NS_ERROR_OUT_OF_MEMORY);
+  dependencies.forget();
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArrayLengthCache::InvalidateProperties(
+        const std::vector<PRUint32>& aPropertyIDs)
+{
+  std::set<PRUint32> propertyIDs(aPropertyIDs.begin(), aPropertyIDs.end());
+
+  nsAutoLock lock(mLock);
+
+  DropLengths(propertyIDs, nsnull);
+
+  // We don't know which items were written, so there is nothing left to
+  // check them against
+  mCountedItems.Clear();
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArrayLengthCache::ApplyPropertyChanges(
+        const nsTArray<nsString>& aGUIDs,
+        const nsTArray<PRUint32>& aPropertyIDs)
+{
+  NS_ENSURE_TRUE(aGUIDs.Length() == aPropertyIDs.Length(),
+                 NS_ERROR_INVALID_ARG);
+
+  nsAutoLock lock(mLock);
+
+  std::set<PRUint32> propertyIDs;
+
+  PRUint32 const count = aGUIDs.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    CountedItem* counted;
+    if (!mCountedItems.Get(aGUIDs[i], &counted)) {
+      propertyIDs.insert(aPropertyIDs[i]);
+      continue;
+    }
+
+    // Lengths the item wasn't counted in can't be checked against its bag
+    std::set<PRUint32> itemPropertyIDs;
+    itemPropertyIDs.insert(aPropertyIDs[i]);
+    DropLengths(itemPropertyIDs, counted);
+  }
+
+  DropLengths(propertyIDs, nsnull);
+
+  for (PRUint32 i = 0; i < count; i++) {
+    CountedItem* counted;
+    if (mCountedItems.Get(aGUIDs[i], &counted)) {
+      CheckCountedItem(counted);
+      mCountedItems.Remove(aGUIDs[i]);
+    }
+  }
+
+  return NS_OK;
+}
+
+void
+sbLocalDatabaseGUIDArrayLengthCache::DropLengths(
+        const std::set<PRUint32>& aPropertyIDs,
+        CountedItem* aSkip)
+{
+  if (aPropertyIDs.empty()) {
+    return;
+  }
+
+  PRUint32 const count = mTrackedKeys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    const nsString& key = mTrackedKeys[i];
+
+    Dependencies* dependencies;
+    if (!mDependencies.Get(key, &dependencies)) {
+      continue;
+    }
+
+    if (aSkip && GetCountedKey(aSkip, key, dependencies)) {
+      continue;
+    }
+
+    PRBool dependsOnFilter = PR_FALSE;
+    PRUint32 const filterCount = dependencies->filterPropertyIDs.Length();
+    for (PRUint32 j = 0; !dependsOnFilter && j < filterCount; j++) {
+      dependsOnFilter =
+        aPropertyIDs.count(dependencies->filterPropertyIDs[j]) > 0;
+    }
+
+    if (dependsOnFilter) {
+      mCachedLengths.Remove(key);
+      mCachedNonNullLengths.Remove(key);
+    }
+    else if (dependencies->nonNullPropertyID &&
+             aPropertyIDs.count(dependencies->nonNullPropertyID)) {
+      // The rows are the same, only which of them have a value changed
+      mCachedNonNullLengths.Remove(key);
+    }
+  }
+}
+
+sbLocalDatabaseGUIDArrayLengthCache::CountedKey*
+sbLocalDatabaseGUIDArrayLengthCache::GetCountedKey(
+        CountedItem* aCounted,
+        const nsAString& aKey,
+        Dependencies* aDependencies)
+{
+  PRUint32 const count = aCounted->keys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    CountedKey& counted = aCounted->keys[i];
+    if (counted.key.Equals(aKey)) {
+      // An array counting the length again since went by the database,
+      // where the item's properties weren't written yet
+      if (counted.lengthGeneration != aDependencies->lengthGeneration ||
+          !mCachedLengths.Get(aKey, nsnull)) {
+        return nsnull;
+      }
+      return &counted;
+    }
+  }
+  return nsnull;
+}
+
+void
+sbLocalDatabaseGUIDArrayLengthCache::CheckCountedItem(CountedItem* aCounted)
+{
+  PRUint32 const count = aCounted->keys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    const nsString& key = aCounted->keys[i].key;
+
+    Dependencies* dependencies;
+    if (!mDependencies.Get(key, &dependencies)) {
+      continue;
+    }
+
+    CountedKey* counted = GetCountedKey(aCounted, key, dependencies);
+    if (!counted) {
+      continue;
+    }
+
+    PRBool matches, hasValue;
+    nsresult rv = GetMembership(dependencies, aCounted->bag,
+                                &matches, &hasValue);
+    if (NS_FAILED(rv) || matches != PRBool(counted->matched)) {
+      mCachedLengths.Remove(key);
+      mCachedNonNullLengths.Remove(key);
+    }
+    else if (hasValue != PRBool(counted->hasValue) ||
+             counted->nonNullGeneration != dependencies->nonNullGeneration) {
+      mCachedNonNullLengths.Remove(key);
+    }
+  }
+}
+
+void
+sbLocalDatabaseGUIDArrayLengthCache::RemoveTrackedKey(const nsAString& aKey)
+{
+  mCachedLengths.Remove(aKey);
+  mCachedNonNullLengths.Remove(aKey);
+  mDependencies.Remove(aKey);
+
+  PRUint32 const count = mTrackedKeys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    if (mTrackedKeys[i].Equals(aKey)) {
+      mTrackedKeys.RemoveElementAt(i);
+      break;
+    }
+  }
+}
+
+void
+sbLocalDatabaseGUIDArrayLengthCache::RemoveTrackedLengths()
+{
+  PRUint32 const count = mTrackedKeys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    mCachedLengths.Remove(mTrackedKeys[i]);
+    mCachedNonNullLengths.Remove(mTrackedKeys[i]);
+  }
+}
+
+nsresult
+sbLocalDatabaseGUIDArrayLengthCache::GetBag(
+        sbIMediaItem* aMediaItem,
+        sbILocalDatabaseResourcePropertyBag** _retval,
+        PRBool* aIsDirty)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+  NS_ENSURE_ARG_POINTER(_retval);
+  NS_ENSURE_TRUE(mPropertyCache, NS_ERROR_NOT_INITIALIZED);
+
+  nsString guid;
+  nsresult rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Don't make the property cache write the item out first, that would
+  // report its properties as changed and drop the lengths it is counted in
+  return mPropertyCache->GetCurrentProperties(guid, _retval, aIsDirty);
+}
+
+nsresult
+sbLocalDatabaseGUIDArrayLengthCache::GetMembership(
+        Dependencies* aDependencies,
+        sbILocalDatabaseResourcePropertyBag* aBag,
+        PRBool* aMatches,
+        PRBool* aHasValue)
+{
+  nsresult rv = sbLocalDatabaseGUIDArray::MatchesFilters(
+                  aDependencies->filters, mPropertyCache, aBag, aMatches);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  *aHasValue = *aMatches;
+  if (*aMatches && !aDependencies->nonNullProperty.IsEmpty()) {
+    nsAutoString value;
+    rv = aBag->GetProperty(aDependencies->nonNullProperty, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    *aHasValue = !value.IsVoid();
+  }
+
+  return NS_OK;
+}
+
+void
+sbLocalDatabaseGUIDArrayLengthCache::AdjustLengths(
+        sbILocalDatabaseResourcePropertyBag* aBag,
+        PRBool aAdded,
+        CountedItem* aCounted)
+{
+  NS_ASSERTION(aBag, "aBag is null");
+
+  nsAutoLock lock(mLock);
+
+  PRUint32 const count = mTrackedKeys.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    const nsString& key = mTrackedKeys[i];
+
+    PRUint32 length;
+    Dependencies* dependencies;
+    if (!mCachedLengths.Get(key, &length) ||
+        !mDependencies.Get(key, &dependencies)) {
+      continue;
+    }
+
+    PRBool matches, hasValue;
+    nsresult rv = GetMembership(dependencies, aBag, &matches, &hasValue);
+
+    // When we can't tell, or the item was never counted, the array has to
+    // count again
+    if (NS_FAILED(rv) || (matches && !aAdded && !length)) {
+      mCachedLengths.Remove(key);
+      mCachedNonNullLengths.Remove(key);
+      continue;
+    }
+
+    PRUint32 nonNullLength;
+    PRBool const hasNonNullLength =
+      mCachedNonNullLengths.Get(key, &nonNullLength);
+
+    if (aCounted) {
+      CountedKey* counted = aCounted->keys.AppendElement();
+      if (counted) {
+        counted->key = key;
+        counted->lengthGeneration = dependencies->lengthGeneration;
+        counted->nonNullGeneration =
+          hasNonNullLength ? dependencies->nonNullGeneration : 0;
+        counted->matched = matches;
+        counted->hasValue = hasValue;
+      }
+    }
+
+    if (!matches) {
+      continue;
+    }
+
+    mCachedLengths.Put(key, aAdded ? length + 1 : length - 1);
+
+    if (!hasNonNullLength || !hasValue) {
+      continue;
+    }
+
+    if (!aAdded && !nonNullLength) {
+      mCachedNonNullLengths.Remove(key);
+      continue;
+    }
+
+    mCachedNonNullLengths.Put(key, aAdded ? nonNullLength + 1 :
+                                            nonNullLength - 1);
+  }
+
+  if (aCounted) {
+    nsString guid;
+    nsresult rv = aBag->GetGuid(guid);
+    if (NS_FAILED(rv)) {
+      delete aCounted;
+      return;
+    }
+
+    // Forgetting an item only costs the lengths its properties depend on
+    if (mCountedItems.Count() >= MAX_COUNTED_ITEMS) {
+      mCountedItems.Clear();
+    }
+    if (!mCountedItems.Put(guid, aCounted)) {
+      delete aCounted;
+    }
+  }
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnItemAdded(sbIMediaList* aMediaList,
+                                                 sbIMediaItem* aMediaItem,
+                                                 PRUint32 aIndex,
+                                                 PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  {
+    nsAutoLock lock(mLock);
+    if (!mTrackedKeys.Length()) {
+      return NS_OK;
+    }
+  }
+
+  nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+  PRBool isDirty;
+  nsresult rv = GetBag(aMediaItem, getter_AddRefs(bag), &isDirty);
+  if (NS_FAILED(rv)) {
+    nsAutoLock lock(mLock);
+    RemoveTrackedLengths();
+    return NS_OK;
+  }
+
+  // The item's pending properties will be reported as changed once they
+  // are written, so remember where it was counted to check against then
+  CountedItem* counted = nsnull;
+  if (isDirty) {
+    counted = new CountedItem;
+    if (counted) {
+      counted->bag = bag;
+    }
+  }
+
+  AdjustLengths(bag, PR_TRUE, counted);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnBeforeItemRemoved(sbIMediaList* aMediaList,
+                                                         sbIMediaItem* aMediaItem,
+                                                         PRUint32 aIndex,
+                                                         PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  {
+    nsAutoLock lock(mLock);
+    if (!mTrackedKeys.Length()) {
+      return NS_OK;
+    }
+  }
+
+  nsString guid;
+  nsresult rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Keep the bag around, the item's properties are gone once it is removed
+  nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+  rv = GetBag(aMediaItem, getter_AddRefs(bag));
+  if (NS_SUCCEEDED(rv)) {
+    nsAutoLock lock(mLock);
+    NS_ENSURE_TRUE(mRemovedBags.Put(guid, bag), NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnAfterItemRemoved(sbIMediaList* aMediaList,
+                                                        sbIMediaItem* aMediaItem,
+                                                        PRUint32 aIndex,
+                                                        PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsString guid;
+  nsresult rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+  {
+    nsAutoLock lock(mLock);
+    mRemovedBags.Get(guid, getter_AddRefs(bag));
+    mRemovedBags.Remove(guid);
+    mCountedItems.Remove(guid);
+
+    // Without the bag we can't tell which lengths the item was in
+    if (!bag) {
+      RemoveTrackedLengths();
+      return NS_OK;
+    }
+  }
+
+  AdjustLengths(bag, PR_FALSE);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnItemUpdated(sbIMediaList* aMediaList,
+                                                   sbIMediaItem* aMediaItem,
+                                                   sbIPropertyArray* aProperties,
+                                                   PRBool* aNoMoreForBatch)
+{
+  // Property changes are reported by the property cache once written
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnItemMoved(sbIMediaList* aMediaList,
+                                                 PRUint32 aFromIndex,
+                                                 PRUint32 aToIndex,
+                                                 PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnBeforeListCleared(sbIMediaList* aMediaList,
+                                                         PRBool aExcludeLists,
+                                                         PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnListCleared(sbIMediaList* aMediaList,
+                                                   PRBool aExcludeLists,
+                                                   PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsAutoLock lock(mLock);
+  RemoveTrackedLengths();
+  mRemovedBags.Clear();
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnBatchBegin(sbIMediaList* aMediaList)
+{
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArrayLengthCache::OnBatchEnd(sbIMediaList* aMediaList)
+{
+  return NS_OK;
+}
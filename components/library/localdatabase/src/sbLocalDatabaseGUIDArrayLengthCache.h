@@ -26,29 +26,148 @@
 #define __SBLOCALDATABASEGUIDARRAYLENGTHCACHE_H__
 
 #include <sbILocalDatabaseGUIDArray.h>
+#include <sbIMediaListListener.h>
 
+#include <nsAutoPtr.h>
+#include <nsClassHashtable.h>
+#include <nsCOMPtr.h>
 #include <nsDataHashtable.h>
+#include <nsInterfaceHashtable.h>
 #include <nsAutoLock.h>
+#include <nsTArray.h>
+#include <nsWeakReference.h>
 
 #include <set>
 #include <map>
+#include <vector>
 
+#include "sbLocalDatabaseGUIDArray.h"
+
+class sbILocalDatabaseResourcePropertyBag;
+class sbIMediaItem;
+class sbLocalDatabasePropertyCache;
+
+/**
+ * \brief Lengths of the GUID arrays of a library, by cached length key.
+ *
+ * Arrays over the whole library tell the cache which filters their key
+ * depends on.  The lengths of those keys are then counted up and down as
+ * items are added and removed, and are only dropped when a property they
+ * depend on changes.
+ */
 class sbLocalDatabaseGUIDArrayLengthCache :
-    public sbILocalDatabaseGUIDArrayLengthCache
+    public sbILocalDatabaseGUIDArrayLengthCache,
+    public sbIMediaListListener,
+    public nsSupportsWeakReference
 {
 public:
   NS_DECL_ISUPPORTS
   NS_DECL_SBILOCALDATABASEGUIDARRAYLENGTHCACHE
+  NS_DECL_SBIMEDIALISTLISTENER
 
   sbLocalDatabaseGUIDArrayLengthCache();
 
+  nsresult Init(sbLocalDatabasePropertyCache* aPropertyCache);
+
+  /**
+   * \brief Called by the property cache once it has written properties.
+   *        Drops the lengths that depend on any of them.
+   */
+  nsresult InvalidateProperties(const std::vector<PRUint32>& aPropertyIDs);
+
+  /**
+   * \brief Called by the property cache once it has written the properties
+   *        of the given items, one entry per item and property.  Items
+   *        that were counted in with those properties pending only drop
+   *        the lengths they turn out to have moved in or out of.
+   */
+  nsresult ApplyPropertyChanges(const nsTArray<nsString>& aGUIDs,
+                                const nsTArray<PRUint32>& aPropertyIDs);
+
 protected:
   virtual ~sbLocalDatabaseGUIDArrayLengthCache();
 
+  struct Dependencies {
+    nsTArray<sbLocalDatabaseGUIDArray::FilterSpec> filters;
+    nsTArray<PRUint32> filterPropertyIDs;
+    nsString nonNullProperty;
+    PRUint32 nonNullPropertyID;
+    // Bumped from mGeneration whenever an array sets the lengths
+    PRUint32 lengthGeneration;
+    PRUint32 nonNullGeneration;
+  };
+
+  // Where an item was counted for one key, and the lengths it was counted in
+  struct CountedKey {
+    nsString key;
+    PRUint32 lengthGeneration;
+    PRUint32 nonNullGeneration;
+    PRPackedBool matched;
+    PRPackedBool hasValue;
+  };
+
+  // An item counted in on its add while its properties were still waiting
+  // to be written
+  struct CountedItem {
+    nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+    nsTArray<CountedKey> keys;
+  };
+
+  nsresult GetBag(sbIMediaItem* aMediaItem,
+                  sbILocalDatabaseResourcePropertyBag** _retval,
+                  PRBool* aIsDirty = nsnull);
+
+  // Whether aBag is in the rows of a key, and in its non null rows
+  nsresult GetMembership(Dependencies* aDependencies,
+                         sbILocalDatabaseResourcePropertyBag* aBag,
+                         PRBool* aMatches,
+                         PRBool* aHasValue);
+
+  // Count an item in or out of the tracked lengths it matches.  With
+  // aCounted, also note where the item was counted; aCounted is owned by
+  // the cache from then on.
+  void AdjustLengths(sbILocalDatabaseResourcePropertyBag* aBag,
+                     PRBool aAdded,
+                     CountedItem* aCounted = nsnull);
+
+  // These expect mLock to be held
+  void RemoveTrackedKey(const nsAString& aKey);
+  void RemoveTrackedLengths();
+
+  // Drops the lengths depending on aPropertyIDs, except those aSkip was
+  // counted in
+  void DropLengths(const std::set<PRUint32>& aPropertyIDs,
+                   CountedItem* aSkip);
+
+  // Returns the entry of aCounted for aKey if the item is still counted in
+  // the key's current length
+  CountedKey* GetCountedKey(CountedItem* aCounted,
+                            const nsAString& aKey,
+                            Dependencies* aDependencies);
+
+  // Drops the lengths an item counted in earlier has moved in or out of
+  void CheckCountedItem(CountedItem* aCounted);
+
   PRLock* mLock;
 
   nsDataHashtable<nsStringHashKey, PRUint32> mCachedLengths;
   nsDataHashtable<nsStringHashKey, PRUint32> mCachedNonNullLengths;
+
+  nsRefPtr<sbLocalDatabasePropertyCache> mPropertyCache;
+
+  // Dependencies of the tracked keys, oldest key first
+  nsClassHashtable<nsStringHashKey, Dependencies> mDependencies;
+  nsTArray<nsString> mTrackedKeys;
+
+  // Bags of the items being removed, by guid.  They are gone by the time the
+  // removal is done.
+  nsInterfaceHashtable<nsStringHashKey,
+                       sbILocalDatabaseResourcePropertyBag> mRemovedBags;
+
+  // Items counted in before their properties were written, by guid
+  nsClassHashtable<nsStringHashKey, CountedItem> mCountedItems;
+
+  PRUint32 mGeneration;
 };
 
 #endif
@@ -0,0 +1,1445 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#include "sbLocalDatabaseGUIDArraySortIndex.h"
+
+#include <nsAutoLock.h>
+#include <nsComponentManagerUtils.h>
+#include <nsDataHashtable.h>
+#include <nsHashKeys.h>
+#include <nsIPrefBranch.h>
+#include <nsIURI.h>
+#include <nsServiceManagerUtils.h>
+
+#include <DatabaseQuery.h>
+#include <sbDebugUtils.h>
+#include <sbIDatabaseEngine.h>
+#include <sbIDatabaseQuery.h>
+#include <sbIDatabaseResult.h>
+#include <sbILocalDatabaseMediaItem.h>
+#include <sbILocalDatabaseResourcePropertyBag.h>
+#include <sbIMediaItem.h>
+
+#include "sbLocalDatabasePropertyCache.h"
+#include "sbLocalDatabaseSQL.h"
+
+/**
+ * \brief Most sort indexes kept per library, 0 turns them off
+ */
+#define PREF_SORTINDEX_MAX_INDEXES \
+  "songbird.library.localdatabase.sortIndex.maxIndexes"
+#define DEFAULT_SORTINDEX_MAX_INDEXES 4
+
+/**
+ * \brief Fewest rows a GUID array needs before it gets a sort index.  Small
+ *        arrays sort quickly enough on their own.
+ */
+#define PREF_SORTINDEX_MIN_LENGTH \
+  "songbird.library.localdatabase.sortIndex.minLength"
+#define DEFAULT_SORTINDEX_MIN_LENGTH 5000
+
+/**
+ * \brief Most items added or removed during one batch, or changed by one
+ *        property cache write, that the indexes are updated for.  Past this
+ *        it is cheaper to drop the indexes and build them again.
+ */
+#define MAX_SORTINDEX_BATCH_CHANGES 100
+
+NS_IMPL_THREADSAFE_ISUPPORTS3(sbLocalDatabaseGUIDArraySortIndex,
+                              sbILocalDatabaseGUIDArraySortIndex,
+                              sbIMediaListListener,
+                              nsISupportsWeakReference)
+
+sbLocalDatabaseGUIDArraySortIndex::sbLocalDatabaseGUIDArraySortIndex() :
+  mMonitor(nsnull),
+  mMaxIndexes(DEFAULT_SORTINDEX_MAX_INDEXES),
+  mMinLength(DEFAULT_SORTINDEX_MIN_LENGTH),
+  mUseCount(0),
+  mBatchDepth(0),
+  mBatchChanges(0)
+{
+}
+
+sbLocalDatabaseGUIDArraySortIndex::~sbLocalDatabaseGUIDArraySortIndex()
+{
+  if (mMonitor) {
+    nsAutoMonitor::DestroyMonitor(mMonitor);
+  }
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::Init(const nsAString& aDatabaseGUID,
+                                        nsIURI* aDatabaseLocation,
+                                        sbLocalDatabasePropertyCache* aPropertyCache)
+{
+  NS_ENSURE_ARG_POINTER(aPropertyCache);
+
+  nsresult rv;
+  PRInt32 dbOk;
+
+  mMonitor =
+    nsAutoMonitor::NewMonitor("sbLocalDatabaseGUIDArraySortIndex::mMonitor");
+  NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
+
+  mDatabaseGUID = aDatabaseGUID;
+  mDatabaseLocation = aDatabaseLocation;
+  mPropertyCache = aPropertyCache;
+
+  mDatabaseEngine =
+    do_GetService("@songbirdnest.com/Songbird/DatabaseEngine;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_GetService("@mozilla.org/preferences-service;1", &rv);
+  if (NS_SUCCEEDED(rv)) {
+    PRInt32 value;
+    rv = prefBranch->GetIntPref(PREF_SORTINDEX_MAX_INDEXES, &value);
+    if (NS_SUCCEEDED(rv) && value >= 0) {
+      mMaxIndexes = value;
+    }
+    rv = prefBranch->GetIntPref(PREF_SORTINDEX_MIN_LENGTH, &value);
+    if (NS_SUCCEEDED(rv) && value >= 0) {
+      mMinLength = value;
+    }
+  }
+
+  // The tables are created on demand so that libraries of any schema
+  // version can use them without a migration.
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexesTableCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexFiltersTableCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsTableCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsPositionIndexCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsMediaItemIndexCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  rv = LoadIndexes();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::MakeQuery(sbIDatabaseQuery** _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  nsCOMPtr<sbIDatabaseQuery> query =
+    do_CreateInstance(SONGBIRD_DATABASEQUERY_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->SetDatabaseGUID(mDatabaseGUID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (mDatabaseLocation) {
+    rv = query->SetDatabaseLocation(mDatabaseLocation);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->SetAsyncQuery(PR_FALSE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ADDREF(*_retval = query);
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::LoadIndexes()
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsAutoMonitor mon(mMonitor);
+
+  mIndexes.Clear();
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexesSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 row = 0; row < rowCount; row++) {
+    nsAutoPtr<IndexInfo> info(new IndexInfo);
+    NS_ENSURE_TRUE(info, NS_ERROR_OUT_OF_MEMORY);
+
+    PRInt64 value;
+    rv = result->GetRowCellAsInt64(row, 0, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->id = static_cast<PRUint32>(value);
+
+    rv = result->GetRowCell(row, 1, info->key);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = result->GetRowCellAsInt64(row, 2, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->propertyID = static_cast<PRUint32>(value);
+
+    rv = result->GetRowCellAsInt64(row, 3, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->ascending = value != 0;
+
+    rv = result->GetRowCellAsInt64(row, 4, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->nullsFirst = value != 0;
+
+    rv = result->GetRowCellAsInt64(row, 5, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->length = static_cast<PRUint32>(value);
+
+    rv = result->GetRowCellAsInt64(row, 6, &value);
+    NS_ENSURE_SUCCESS(rv, rv);
+    info->nonNullLength = static_cast<PRUint32>(value);
+
+    info->lastUsed = 0;
+
+    nsAutoPtr<IndexInfo>* added = mIndexes.AppendElement(info.forget());
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  // Filters are stored one value per row, in the order they were added
+  rv = query->ResetQuery();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexFiltersSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  IndexInfo* info = nsnull;
+  for (PRUint32 row = 0; row < rowCount; row++) {
+    PRInt64 id;
+    rv = result->GetRowCellAsInt64(row, 0, &id);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString property;
+    rv = result->GetRowCell(row, 1, property);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString value;
+    rv = result->GetRowCell(row, 2, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (!info || info->id != static_cast<PRUint32>(id)) {
+      info = nsnull;
+      for (PRUint32 i = 0; i < mIndexes.Length(); i++) {
+        if (mIndexes[i]->id == static_cast<PRUint32>(id)) {
+          info = mIndexes[i];
+          break;
+        }
+      }
+      NS_ENSURE_TRUE(info, NS_ERROR_UNEXPECTED);
+    }
+
+    PRUint32 filterCount = info->filters.Length();
+    if (!filterCount ||
+        !info->filters[filterCount - 1].property.Equals(property)) {
+      sbLocalDatabaseGUIDArray::FilterSpec* fs =
+        info->filters.AppendElement();
+      NS_ENSURE_TRUE(fs, NS_ERROR_OUT_OF_MEMORY);
+
+      fs->property = property;
+      fs->isSearch = PR_FALSE;
+
+      PRUint32 propertyID;
+      rv = mPropertyCache->GetPropertyDBID(property, &propertyID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      NS_ENSURE_TRUE(info->filterPropertyIDs.AppendElement(propertyID),
+                     NS_ERROR_OUT_OF_MEMORY);
+      filterCount++;
+    }
+
+    nsString* added =
+      info->filters[filterCount - 1].values.AppendElement(value);
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  return NS_OK;
+}
+
+PRInt32
+sbLocalDatabaseGUIDArraySortIndex::FindIndex(const nsAString& aKey)
+{
+  // FindIndex always gets called with mMonitor acquired!
+  PRUint32 length = mIndexes.Length();
+  for (PRUint32 i = 0; i < length; i++) {
+    if (mIndexes[i]->key.Equals(aKey)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::RemoveIndexAt(PRUint32 aIndex)
+{
+  // RemoveIndexAt always gets called with mMonitor acquired!
+  NS_ENSURE_TRUE(aIndex < mIndexes.Length(), NS_ERROR_INVALID_ARG);
+
+  nsresult rv;
+  PRInt32 dbOk;
+
+  // Stop using the index first, so it isn't used even if the database
+  // can't be updated
+  PRUint32 id = mIndexes[aIndex]->id;
+  mIndexes.RemoveElementAt(aIndex);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsDelete());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexFiltersDelete());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexDelete());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::RemoveAllIndexes()
+{
+  nsAutoMonitor mon(mMonitor);
+
+  nsresult rv = NS_OK;
+  while (mIndexes.Length()) {
+    nsresult rv2 = RemoveIndexAt(mIndexes.Length() - 1);
+    if (NS_FAILED(rv2)) {
+      rv = rv2;
+    }
+  }
+
+  return rv;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::RemoveIndexesForProperties(
+        const std::vector<PRUint32>& aPropertyIDs)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  nsresult rv = NS_OK;
+  for (PRUint32 i = mIndexes.Length(); i > 0; i--) {
+    std::vector<PRUint32>::const_iterator it = aPropertyIDs.begin();
+    for (; it != aPropertyIDs.end(); ++it) {
+      if (DependsOnProperty(*mIndexes[i - 1], *it)) {
+        nsresult rv2 = RemoveIndexAt(i - 1);
+        if (NS_FAILED(rv2)) {
+          rv = rv2;
+        }
+        break;
+      }
+    }
+  }
+
+  return rv;
+}
+
+PRBool
+sbLocalDatabaseGUIDArraySortIndex::DependsOnProperty(const IndexInfo& aInfo,
+                                                     PRUint32 aPropertyID)
+{
+  // Secondary sort values are written under the primary sort property, so
+  // the primary property covers them as well.
+  return aInfo.propertyID == aPropertyID ||
+         aInfo.filterPropertyIDs.IndexOf(aPropertyID) !=
+           aInfo.filterPropertyIDs.NoIndex;
+}
+
+PRBool
+sbLocalDatabaseGUIDArraySortIndex::CountBatchChanges(PRUint32 aCount)
+{
+  // CountBatchChanges always gets called with mMonitor acquired!
+  if (mBatchDepth &&
+      (mBatchChanges += aCount) > MAX_SORTINDEX_BATCH_CHANGES) {
+    nsresult SB_UNUSED_IN_RELEASE(rv) = RemoveAllIndexes();
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Failed to remove sort indexes");
+    return PR_FALSE;
+  }
+  return PR_TRUE;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::ApplyPropertyChanges(
+        const nsTArray<nsString>& aGUIDs,
+        const nsTArray<PRUint32>& aPropertyIDs)
+{
+  NS_ENSURE_TRUE(aGUIDs.Length() == aPropertyIDs.Length(),
+                 NS_ERROR_INVALID_ARG);
+
+  nsresult rv;
+
+  {
+    nsAutoMonitor mon(mMonitor);
+    if (!mIndexes.Length()) {
+      return NS_OK;
+    }
+  }
+
+  // Collect the properties that changed on each item
+  nsDataHashtable<nsStringHashKey, PRUint32> itemIndexes;
+  NS_ENSURE_TRUE(itemIndexes.Init(), NS_ERROR_OUT_OF_MEMORY);
+
+  nsTArray<nsString> guids;
+  nsTArray<nsTArray<PRUint32> > propertyIDs;
+  PRUint32 const count = aGUIDs.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    PRUint32 item;
+    if (!itemIndexes.Get(aGUIDs[i], &item)) {
+      item = guids.Length();
+      NS_ENSURE_TRUE(guids.AppendElement(aGUIDs[i]), NS_ERROR_OUT_OF_MEMORY);
+      NS_ENSURE_TRUE(propertyIDs.AppendElement(), NS_ERROR_OUT_OF_MEMORY);
+      NS_ENSURE_TRUE(itemIndexes.Put(aGUIDs[i], item), NS_ERROR_OUT_OF_MEMORY);
+    }
+    NS_ENSURE_TRUE(propertyIDs[item].AppendElement(aPropertyIDs[i]),
+                   NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  // The bags are fetched without the monitor and without writing dirty
+  // ones out, a write would come back here through the property cache
+  PRUint32 const bagsCount = guids.Length();
+  nsCOMArray<sbILocalDatabaseResourcePropertyBag> bags(bagsCount);
+  nsTArray<PRUint32> mediaItemIDs(bagsCount);
+  for (PRUint32 i = 0; i < bagsCount; i++) {
+    // Items that are gone get no bag
+    nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+    rv = mPropertyCache->GetCurrentProperties(guids[i], getter_AddRefs(bag));
+    if (NS_FAILED(rv)) {
+      bag = nsnull;
+    }
+
+    PRUint32 mediaItemID = 0;
+    if (bag) {
+      rv = bag->GetMediaItemId(&mediaItemID);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    NS_ENSURE_TRUE(bags.AppendObject(bag), NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_TRUE(mediaItemIDs.AppendElement(mediaItemID),
+                   NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  nsAutoMonitor mon(mMonitor);
+
+  for (PRUint32 i = mIndexes.Length(); i > 0; i--) {
+    IndexInfo& info = *mIndexes[i - 1];
+
+    // Only the items whose changes matter to this index.  Items that are
+    // gone and the library itself are left to the item listener.
+    nsTArray<PRUint32> ids;
+    nsCOMArray<sbILocalDatabaseResourcePropertyBag> itemBags;
+    for (PRUint32 j = 0; j < bagsCount; j++) {
+      if (!bags[j] || !mediaItemIDs[j]) {
+        continue;
+      }
+      PRUint32 const changedCount = propertyIDs[j].Length();
+      for (PRUint32 k = 0; k < changedCount; k++) {
+        if (DependsOnProperty(info, propertyIDs[j][k])) {
+          NS_ENSURE_TRUE(ids.AppendElement(mediaItemIDs[j]),
+                         NS_ERROR_OUT_OF_MEMORY);
+          NS_ENSURE_TRUE(itemBags.AppendObject(bags[j]),
+                         NS_ERROR_OUT_OF_MEMORY);
+          break;
+        }
+      }
+    }
+
+    if (!ids.Length()) {
+      continue;
+    }
+
+    PRBool stale = ids.Length() > MAX_SORTINDEX_BATCH_CHANGES;
+    if (!stale) {
+      rv = UpdateIndex(info, ids, itemBags, &stale);
+    }
+    if (NS_FAILED(rv) || stale) {
+      rv = RemoveIndexAt(i - 1);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::ApplyItemChange(sbIMediaItem* aMediaItem,
+                                                   PRBool aRemoved)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+
+  nsresult rv;
+
+  {
+    nsAutoMonitor mon(mMonitor);
+    if (!mIndexes.Length()) {
+      return NS_OK;
+    }
+  }
+
+  nsCOMPtr<sbILocalDatabaseMediaItem> item =
+    do_QueryInterface(aMediaItem, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 mediaItemID;
+  rv = item->GetMediaItemId(&mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsTArray<PRUint32> ids;
+  NS_ENSURE_TRUE(ids.AppendElement(mediaItemID), NS_ERROR_OUT_OF_MEMORY);
+
+  nsCOMArray<sbILocalDatabaseResourcePropertyBag> bags;
+  if (aRemoved) {
+    NS_ENSURE_TRUE(bags.AppendObject(nsnull), NS_ERROR_OUT_OF_MEMORY);
+  }
+  else {
+    nsString guid;
+    rv = aMediaItem->GetGuid(guid);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Fetched without the monitor, see ApplyPropertyChanges.  A new item's
+    // bag is dirty, and is read as it is rather than written out.
+    nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+    rv = mPropertyCache->GetCurrentProperties(guid, getter_AddRefs(bag));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    NS_ENSURE_TRUE(bags.AppendObject(bag), NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  nsAutoMonitor mon(mMonitor);
+
+  // The indexes may have been dropped in the meantime
+  if (!mIndexes.Length() || !CountBatchChanges(1)) {
+    return NS_OK;
+  }
+
+  for (PRUint32 i = mIndexes.Length(); i > 0; i--) {
+    PRBool stale;
+    rv = UpdateIndex(*mIndexes[i - 1], ids, bags, &stale);
+    if (NS_FAILED(rv) || stale) {
+      rv = RemoveIndexAt(i - 1);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::UpdateIndex(
+        IndexInfo& aInfo,
+        const nsTArray<PRUint32>& aMediaItemIDs,
+        const nsCOMArray<sbILocalDatabaseResourcePropertyBag>& aBags,
+        PRBool* aStale)
+{
+  // UpdateIndex always gets called with mMonitor acquired!
+  nsresult rv;
+
+  *aStale = PR_FALSE;
+
+  PRUint32 const count = aMediaItemIDs.Length();
+  nsTArray<ItemState> states(count);
+  for (PRUint32 i = 0; i < count; i++) {
+    ItemState* state = states.AppendElement();
+    NS_ENSURE_TRUE(state, NS_ERROR_OUT_OF_MEMORY);
+
+    rv = GetItemState(aInfo, aMediaItemIDs[i], aBags[i], *state);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Rows without a value for the primary sort are ordered by the GUID
+    // array itself in ways the index can't reproduce.  Taking a row out of
+    // them is fine, putting one in is not.
+    if (state->isMember && state->value.IsEmpty()) {
+      *aStale = PR_TRUE;
+      return NS_OK;
+    }
+  }
+
+  // A single item moving within the sorted rows only shifts the rows
+  // between its old and its new position
+  if (count == 1 && states[0].found && states[0].isMember &&
+      IsNonNullPosition(aInfo, states[0].position)) {
+    PRUint32 position;
+    rv = FindPosition(aInfo, states[0], states[0].position, &position);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (position != states[0].position) {
+      rv = MoveRow(aInfo, states[0], position);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    return NS_OK;
+  }
+
+  // Otherwise take all the items out first so that the remaining rows stay
+  // sorted, then place the members again one at a time
+  for (PRUint32 i = 0; i < count; i++) {
+    if (!states[i].found) {
+      continue;
+    }
+
+    rv = RemoveRow(aInfo, states[i]);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    for (PRUint32 j = i + 1; j < count; j++) {
+      if (states[j].found && states[j].position > states[i].position) {
+        states[j].position--;
+      }
+    }
+  }
+
+  for (PRUint32 i = 0; i < count; i++) {
+    if (!states[i].isMember) {
+      continue;
+    }
+
+    PRUint32 position;
+    rv = FindPosition(aInfo, states[i], PR_UINT32_MAX, &position);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = InsertRow(aInfo, states[i], position);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::GetItemState(
+        const IndexInfo& aInfo,
+        PRUint32 aMediaItemID,
+        sbILocalDatabaseResourcePropertyBag* aBag,
+        ItemState& aState)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  aState.mediaItemID = aMediaItemID;
+  aState.found = PR_FALSE;
+  aState.position = 0;
+  aState.isMember = PR_FALSE;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowPositionSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aMediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (rowCount) {
+    PRInt64 position;
+    rv = result->GetRowCellAsInt64(0, 0, &position);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    aState.found = PR_TRUE;
+    aState.position = static_cast<PRUint32>(position);
+  }
+
+  if (!aBag) {
+    return NS_OK;
+  }
+
+  rv = sbLocalDatabaseGUIDArray::MatchesFilters(aInfo.filters,
+                                                mPropertyCache,
+                                                aBag,
+                                                &aState.isMember);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (aState.isMember) {
+    rv = aBag->GetSortablePropertyByID(aInfo.propertyID, aState.value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = mPropertyCache->CreateSecondarySortValue(aBag,
+                                                  aInfo.propertyID,
+                                                  aState.secondaryValue);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::FindPosition(const IndexInfo& aInfo,
+                                                const ItemState& aState,
+                                                PRUint32 aSkipPosition,
+                                                PRUint32* _retval)
+{
+  nsresult rv;
+
+  // Binary search the rows that have a value, leaving out the row at
+  // aSkipPosition.  The result is the position the item ends up at once
+  // it has been taken out and put back in.
+  PRBool skip = IsNonNullPosition(aInfo, aSkipPosition);
+  PRUint32 low = NonNullStart(aInfo);
+  PRUint32 high = low + aInfo.nonNullLength - (skip ? 1 : 0);
+
+  while (low < high) {
+    PRUint32 middle = low + (high - low) / 2;
+    PRUint32 position = skip && middle >= aSkipPosition ? middle + 1 : middle;
+
+    PRInt32 compare;
+    rv = CompareToRow(aInfo, aState, position, &compare);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (compare > 0) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+
+  *_retval = low;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::CompareToRow(const IndexInfo& aInfo,
+                                                const ItemState& aState,
+                                                PRUint32 aPosition,
+                                                PRInt32* _retval)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowValuesSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aInfo.propertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aPosition);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(rowCount == 1, NS_ERROR_UNEXPECTED);
+
+  nsString value;
+  rv = result->GetRowCell(0, 0, value);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsString secondaryValue;
+  rv = result->GetRowCell(0, 1, secondaryValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRInt64 mediaItemID;
+  rv = result->GetRowCellAsInt64(0, 2, &mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Same order as the range queries of the GUID array: the sortable value
+  // and the secondary sortable value in the database's collation, then the
+  // media item id, all in the direction of the sort.
+  PRInt32 compare;
+  rv = mDatabaseEngine->Collate(aState.value, value, &compare);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (compare == 0) {
+    rv = mDatabaseEngine->Collate(aState.secondaryValue,
+                                  secondaryValue,
+                                  &compare);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  if (compare == 0) {
+    PRUint32 otherID = static_cast<PRUint32>(mediaItemID);
+    compare = aState.mediaItemID < otherID ? -1 :
+              aState.mediaItemID > otherID ? 1 : 0;
+  }
+
+  *_retval = aInfo.ascending ? compare : -compare;
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::AddLengthUpdate(sbIDatabaseQuery* aQuery,
+                                                   const IndexInfo& aInfo)
+{
+  nsresult rv;
+
+  rv = aQuery->AddQuery(sbLocalDatabaseSQL::SortIndexLengthUpdate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aQuery->BindInt32Parameter(0, aInfo.length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aQuery->BindInt32Parameter(1, aInfo.nonNullLength);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aQuery->BindInt32Parameter(2, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::RemoveRow(IndexInfo& aInfo,
+                                             const ItemState& aState)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  if (IsNonNullPosition(aInfo, aState.position)) {
+    aInfo.nonNullLength--;
+  }
+  aInfo.length--;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowDelete());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aState.mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Close the gap
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsShift());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, -1);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aState.position + 1);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(3, aInfo.length + 1);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = AddLengthUpdate(query, aInfo);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::InsertRow(IndexInfo& aInfo,
+                                             const ItemState& aState,
+                                             PRUint32 aPosition)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Make room
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsShift());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, 1);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aPosition);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(3, aInfo.length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowInsert());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aPosition);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aState.mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Only rows with a value are ever inserted
+  aInfo.length++;
+  aInfo.nonNullLength++;
+
+  rv = AddLengthUpdate(query, aInfo);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseGUIDArraySortIndex::MoveRow(const IndexInfo& aInfo,
+                                           const ItemState& aState,
+                                           PRUint32 aPosition)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Shift the rows between the old and the new position towards the old one
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowsShift());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (aPosition < aState.position) {
+    rv = query->BindInt32Parameter(0, 1);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(2, aPosition);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(3, aState.position);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else {
+    rv = query->BindInt32Parameter(0, -1);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(2, aState.position + 1);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(3, aPosition + 1);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->BindInt32Parameter(1, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexRowPositionUpdate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aPosition);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aInfo.id);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aState.mediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+// sbILocalDatabaseGUIDArraySortIndex
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::GetIndex(const nsAString& aKey,
+                                            PRUint32* aLength,
+                                            PRUint32* aNonNullLength,
+                                            PRUint32* _retval)
+{
+  NS_ENSURE_ARG_POINTER(aLength);
+  NS_ENSURE_ARG_POINTER(aNonNullLength);
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsAutoMonitor mon(mMonitor);
+
+  *aLength = 0;
+  *aNonNullLength = 0;
+  *_retval = 0;
+
+  PRInt32 index = FindIndex(aKey);
+  if (index < 0) {
+    return NS_OK;
+  }
+
+  IndexInfo* info = mIndexes[index];
+  info->lastUsed = ++mUseCount;
+
+  *aLength = info->length;
+  *aNonNullLength = info->nonNullLength;
+  *_retval = info->id;
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::ShouldCreateIndex(PRUint32 aLength,
+                                                     PRBool* _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsAutoMonitor mon(mMonitor);
+
+  *_retval = mMaxIndexes > 0 && aLength > 0 && aLength >= mMinLength;
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::CreateIndex(const nsAString& aKey,
+                                               PRUint32 aPropertyID,
+                                               PRBool aAscending,
+                                               PRBool aNullsFirst,
+                                               PRUint32 aFilterCount,
+                                               const PRUnichar** aFilterProperties,
+                                               const PRUnichar** aFilterValues,
+                                               PRUint32 aNonNullLength,
+                                               PRUint32 aCount,
+                                               PRUint32* aMediaItemIDs,
+                                               PRUint32* _retval)
+{
+  NS_ENSURE_ARG(!aFilterCount || (aFilterProperties && aFilterValues));
+  NS_ENSURE_ARG(!aCount || aMediaItemIDs);
+  NS_ENSURE_ARG(aNonNullLength <= aCount);
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsAutoMonitor mon(mMonitor);
+
+  NS_ENSURE_TRUE(mMaxIndexes > 0, NS_ERROR_NOT_AVAILABLE);
+
+  // Replace whatever was stored for the key
+  PRInt32 existing = FindIndex(aKey);
+  if (existing >= 0) {
+    rv = RemoveIndexAt(existing);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Make room by dropping the least recently used index
+  while (mIndexes.Length() >= mMaxIndexes) {
+    PRUint32 oldest = 0;
+    for (PRUint32 i = 1; i < mIndexes.Length(); i++) {
+      if (mIndexes[i]->lastUsed < mIndexes[oldest]->lastUsed) {
+        oldest = i;
+      }
+    }
+    rv = RemoveIndexAt(oldest);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  nsAutoPtr<IndexInfo> info(new IndexInfo);
+  NS_ENSURE_TRUE(info, NS_ERROR_OUT_OF_MEMORY);
+
+  info->key = aKey;
+  info->propertyID = aPropertyID;
+  info->ascending = aAscending;
+  info->nullsFirst = aNullsFirst;
+  info->length = aCount;
+  info->nonNullLength = aNonNullLength;
+  info->lastUsed = ++mUseCount;
+
+  // Values of the same filter are passed one after the other
+  for (PRUint32 i = 0; i < aFilterCount; i++) {
+    nsDependentString property(aFilterProperties[i]);
+    PRUint32 filterCount = info->filters.Length();
+    if (!filterCount ||
+        !info->filters[filterCount - 1].property.Equals(property)) {
+      sbLocalDatabaseGUIDArray::FilterSpec* fs =
+        info->filters.AppendElement();
+      NS_ENSURE_TRUE(fs, NS_ERROR_OUT_OF_MEMORY);
+
+      fs->property = property;
+      fs->isSearch = PR_FALSE;
+
+      PRUint32 propertyID;
+      rv = mPropertyCache->GetPropertyDBID(property, &propertyID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      NS_ENSURE_TRUE(info->filterPropertyIDs.AppendElement(propertyID),
+                     NS_ERROR_OUT_OF_MEMORY);
+      filterCount++;
+    }
+
+    nsString* added = info->filters[filterCount - 1].values.AppendElement(
+                        nsDependentString(aFilterValues[i]));
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  // Add the index first so the database gives us its id
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexInsert());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindStringParameter(0, aKey);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aPropertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(2, aAscending ? 1 : 0);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(3, aNullsFirst ? 1 : 0);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(4, aCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(5, aNonNullLength);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  rv = query->ResetQuery();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SortIndexIDSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindStringParameter(0, aKey);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(rowCount == 1, NS_ERROR_UNEXPECTED);
+
+  PRInt64 id;
+  rv = result->GetRowCellAsInt64(0, 0, &id);
+  NS_ENSURE_SUCCESS(rv, rv);
+  info->id = static_cast<PRUint32>(id);
+
+  nsAutoPtr<IndexInfo>* added = mIndexes.AppendElement(info.forget());
+  NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+
+  // Now the filters and the rows, all in one transaction.  If that fails
+  // the index is dropped again.
+  rv = query->ResetQuery();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 const indexID = static_cast<PRUint32>(id);
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  if (NS_SUCCEEDED(rv)) {
+    nsCOMPtr<sbIDatabasePreparedStatement> filterInsert;
+    rv = query->PrepareQuery(sbLocalDatabaseSQL::SortIndexFilterInsert(),
+                             getter_AddRefs(filterInsert));
+    for (PRUint32 i = 0; NS_SUCCEEDED(rv) && i < aFilterCount; i++) {
+      rv = query->AddPreparedStatement(filterInsert);
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindInt32Parameter(0, indexID);
+      }
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindStringParameter(1,
+                                        nsDependentString(aFilterProperties[i]));
+      }
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindStringParameter(2,
+                                        nsDependentString(aFilterValues[i]));
+      }
+    }
+  }
+  if (NS_SUCCEEDED(rv)) {
+    nsCOMPtr<sbIDatabasePreparedStatement> rowInsert;
+    rv = query->PrepareQuery(sbLocalDatabaseSQL::SortIndexRowInsert(),
+                             getter_AddRefs(rowInsert));
+    for (PRUint32 i = 0; NS_SUCCEEDED(rv) && i < aCount; i++) {
+      rv = query->AddPreparedStatement(rowInsert);
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindInt32Parameter(0, indexID);
+      }
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindInt32Parameter(1, i);
+      }
+      if (NS_SUCCEEDED(rv)) {
+        rv = query->BindInt32Parameter(2, aMediaItemIDs[i]);
+      }
+    }
+  }
+  if (NS_SUCCEEDED(rv)) {
+    rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  }
+  if (NS_SUCCEEDED(rv)) {
+    rv = query->Execute(&dbOk);
+    if (NS_SUCCEEDED(rv) && dbOk != 0) {
+      rv = NS_ERROR_FAILURE;
+    }
+  }
+  if (NS_FAILED(rv)) {
+    nsresult SB_UNUSED_IN_RELEASE(rv2) = RemoveIndexAt(mIndexes.Length() - 1);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv2), "Failed to remove sort index");
+    return rv;
+  }
+
+  *_retval = indexID;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::RemoveIndex(const nsAString& aKey)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  // We don't care if it wasn't there
+  PRInt32 index = FindIndex(aKey);
+  if (index < 0) {
+    return NS_OK;
+  }
+
+  return RemoveIndexAt(index);
+}
+
+// sbIMediaListListener
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnItemAdded(sbIMediaList* aMediaList,
+                                               sbIMediaItem* aMediaItem,
+                                               PRUint32 aIndex,
+                                               PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsresult rv = ApplyItemChange(aMediaItem, PR_FALSE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnBeforeItemRemoved(sbIMediaList* aMediaList,
+                                                       sbIMediaItem* aMediaItem,
+                                                       PRUint32 aIndex,
+                                                       PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnAfterItemRemoved(sbIMediaList* aMediaList,
+                                                      sbIMediaItem* aMediaItem,
+                                                      PRUint32 aIndex,
+                                                      PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsresult rv = ApplyItemChange(aMediaItem, PR_TRUE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnItemUpdated(sbIMediaList* aMediaList,
+                                                 sbIMediaItem* aMediaItem,
+                                                 sbIPropertyArray* aProperties,
+                                                 PRBool* aNoMoreForBatch)
+{
+  // Property changes are reported by the property cache once written
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnItemMoved(sbIMediaList* aMediaList,
+                                               PRUint32 aFromIndex,
+                                               PRUint32 aToIndex,
+                                               PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnBeforeListCleared(sbIMediaList* aMediaList,
+                                                       PRBool aExcludeLists,
+                                                       PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_TRUE;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnListCleared(sbIMediaList* aMediaList,
+                                                 PRBool aExcludeLists,
+                                                 PRBool* aNoMoreForBatch)
+{
+  NS_ENSURE_ARG_POINTER(aNoMoreForBatch);
+  *aNoMoreForBatch = PR_FALSE;
+
+  nsresult rv = RemoveAllIndexes();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnBatchBegin(sbIMediaList* aMediaList)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  if (!mBatchDepth++) {
+    mBatchChanges = 0;
+  }
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseGUIDArraySortIndex::OnBatchEnd(sbIMediaList* aMediaList)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  if (mBatchDepth) {
+    mBatchDepth--;
+  }
+
+  return NS_OK;
+}
@@ -0,0 +1,203 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#ifndef __SBLOCALDATABASEGUIDARRAYSORTINDEX_H__
+#define __SBLOCALDATABASEGUIDARRAYSORTINDEX_H__
+
+#include <sbILocalDatabaseGUIDArray.h>
+#include <sbIMediaListListener.h>
+
+#include <nsAutoPtr.h>
+#include <nsCOMArray.h>
+#include <nsCOMPtr.h>
+#include <nsStringGlue.h>
+#include <nsTArray.h>
+#include <nsWeakReference.h>
+#include <prmon.h>
+
+#include <vector>
+
+#include "sbLocalDatabaseGUIDArray.h"
+
+class nsIURI;
+class sbIDatabaseEngine;
+class sbIDatabaseQuery;
+class sbILocalDatabaseResourcePropertyBag;
+class sbIMediaItem;
+class sbLocalDatabasePropertyCache;
+
+/**
+ * \brief Persistent sort orders for the GUID arrays of a library.
+ *
+ * Each index stores the position of every row of one GUID array
+ * configuration, so the array can read a window of rows with an indexed
+ * range read instead of having SQLite sort the whole library.  The indexes
+ * are kept up to date as items are added, removed or have their properties
+ * written; a change that can't be placed drops the index and the next array
+ * that needs it builds it again.
+ */
+class sbLocalDatabaseGUIDArraySortIndex :
+    public sbILocalDatabaseGUIDArraySortIndex,
+    public sbIMediaListListener,
+    public nsSupportsWeakReference
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBILOCALDATABASEGUIDARRAYSORTINDEX
+  NS_DECL_SBIMEDIALISTLISTENER
+
+  sbLocalDatabaseGUIDArraySortIndex();
+
+  nsresult Init(const nsAString& aDatabaseGUID,
+                nsIURI* aDatabaseLocation,
+                sbLocalDatabasePropertyCache* aPropertyCache);
+
+  /**
+   * \brief Called by the property cache once it has written properties.
+   *        aGUIDs and aPropertyIDs hold the changed item/property pairs.
+   */
+  nsresult ApplyPropertyChanges(const nsTArray<nsString>& aGUIDs,
+                                const nsTArray<PRUint32>& aPropertyIDs);
+
+  /**
+   * \brief Drop the indexes that depend on any of the given properties, for
+   *        when too many items changed to say which.
+   */
+  nsresult RemoveIndexesForProperties(const std::vector<PRUint32>& aPropertyIDs);
+
+  /**
+   * \brief Drop every index, e.g. when the collation changed.
+   */
+  nsresult RemoveAllIndexes();
+
+private:
+  ~sbLocalDatabaseGUIDArraySortIndex();
+
+  struct IndexInfo {
+    PRUint32 id;
+    nsString key;
+    PRUint32 propertyID;
+    PRBool ascending;
+    PRBool nullsFirst;
+    PRUint32 length;
+    PRUint32 nonNullLength;
+    nsTArray<sbLocalDatabaseGUIDArray::FilterSpec> filters;
+    nsTArray<PRUint32> filterPropertyIDs;
+    PRUint32 lastUsed;
+  };
+
+  // What an item looks like to an index
+  struct ItemState {
+    PRUint32 mediaItemID;
+    PRBool found;
+    PRUint32 position;
+    PRBool isMember;
+    nsString value;
+    nsString secondaryValue;
+  };
+
+  nsresult MakeQuery(sbIDatabaseQuery** _retval);
+
+  nsresult LoadIndexes();
+
+  PRInt32 FindIndex(const nsAString& aKey);
+
+  nsresult RemoveIndexAt(PRUint32 aIndex);
+
+  PRBool DependsOnProperty(const IndexInfo& aInfo, PRUint32 aPropertyID);
+
+  nsresult ApplyItemChange(sbIMediaItem* aMediaItem, PRBool aRemoved);
+
+  // aBags holds the bag of each item, or null for items that are gone
+  nsresult UpdateIndex(IndexInfo& aInfo,
+                       const nsTArray<PRUint32>& aMediaItemIDs,
+                       const nsCOMArray<sbILocalDatabaseResourcePropertyBag>& aBags,
+                       PRBool* aStale);
+
+  nsresult GetItemState(const IndexInfo& aInfo,
+                        PRUint32 aMediaItemID,
+                        sbILocalDatabaseResourcePropertyBag* aBag,
+                        ItemState& aState);
+
+  nsresult FindPosition(const IndexInfo& aInfo,
+                        const ItemState& aState,
+                        PRUint32 aSkipPosition,
+                        PRUint32* _retval);
+
+  nsresult CompareToRow(const IndexInfo& aInfo,
+                        const ItemState& aState,
+                        PRUint32 aPosition,
+                        PRInt32* _retval);
+
+  nsresult RemoveRow(IndexInfo& aInfo, const ItemState& aState);
+
+  nsresult InsertRow(IndexInfo& aInfo,
+                     const ItemState& aState,
+                     PRUint32 aPosition);
+
+  nsresult MoveRow(const IndexInfo& aInfo,
+                   const ItemState& aState,
+                   PRUint32 aPosition);
+
+  nsresult AddLengthUpdate(sbIDatabaseQuery* aQuery, const IndexInfo& aInfo);
+
+  PRUint32 NonNullStart(const IndexInfo& aInfo) {
+    return aInfo.nullsFirst ? aInfo.length - aInfo.nonNullLength : 0;
+  }
+
+  PRBool IsNonNullPosition(const IndexInfo& aInfo, PRUint32 aPosition) {
+    return aPosition >= NonNullStart(aInfo) &&
+           aPosition < NonNullStart(aInfo) + aInfo.nonNullLength;
+  }
+
+  // Returns PR_FALSE once a batch has changed too many items, in which case
+  // all the indexes have been dropped
+  PRBool CountBatchChanges(PRUint32 aCount);
+
+  // Protects everything below
+  PRMonitor* mMonitor;
+
+  nsString mDatabaseGUID;
+  nsCOMPtr<nsIURI> mDatabaseLocation;
+
+  nsRefPtr<sbLocalDatabasePropertyCache> mPropertyCache;
+  nsCOMPtr<sbIDatabaseEngine> mDatabaseEngine;
+
+  nsTArray<nsAutoPtr<IndexInfo> > mIndexes;
+
+  // Most indexes kept, and the least rows an array needs to get one
+  PRUint32 mMaxIndexes;
+  PRUint32 mMinLength;
+
+  // Incremented each time an index is used, for dropping the least recently
+  // used one
+  PRUint32 mUseCount;
+
+  // Library batches can change a lot of items, past a point the indexes are
+  // dropped rather than maintained
+  PRUint32 mBatchDepth;
+  PRUint32 mBatchChanges;
+};
+
+#endif /* __SBLOCALDATABASEGUIDARRAYSORTINDEX_H__ */
@@ -92,6 +92,10 @@
 #include "sbLocalDatabaseSchemaInfo.h"
 #include "sbLocalDatabaseSmartMediaListFactory.h"
 #include "sbLocalDatabaseGUIDArray.h"
+#include "sbLocalDatabaseGUIDArrayLengthCache.h"
+#include "sbLocalDatabaseGUIDArraySortIndex.h"
+#include "sbLocalDatabaseFilterSnapshot.h"
+#include "sbLocalDatabaseSearchIndex.h"
 #include "sbMediaListEnumSingleItemHelper.h"
 #include <sbStandardProperties.h>
 #include <sbSQLBuilderCID.h>
@@ -644,6 +648,37 @@ sbLocalDatabaseLibrary::Init(const nsAString& aDatabaseGuid,
   mLengthCache = new sbLocalDatabaseGUIDArrayLengthCache();
   NS_ENSURE_TRUE (mLengthCache, NS_ERROR_OUT_OF_MEMORY);
 
+  rv = mLengthCache->Init(propCache);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The sort indexes outlive the session, but their order is only good for
+  // the collation they were built with.
+  nsRefPtr<sbLocalDatabaseGUIDArraySortIndex>
+    sortIndex(new sbLocalDatabaseGUIDArraySortIndex());
+  NS_ENSURE_TRUE(sortIndex, NS_ERROR_OUT_OF_MEMORY);
+
+  rv = sortIndex->Init(aDatabaseGuid, mDatabaseLocation, propCache);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (needsReindexCollations) {
+    rv = sortIndex->RemoveAllIndexes();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  mSortIndex = sortIndex;
+
+  mFilterSnapshot = new sbLocalDatabaseFilterSnapshot();
+  NS_ENSURE_TRUE(mFilterSnapshot, NS_ERROR_OUT_OF_MEMORY);
+
+  rv = mFilterSnapshot->Init(aDatabaseGuid, mDatabaseLocation, propCache);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  mSearchIndex = new sbLocalDatabaseSearchIndex();
+  NS_ENSURE_TRUE(mSearchIndex, NS_ERROR_OUT_OF_MEMORY);
+
+  rv = mSearchIndex->Init(aDatabaseGuid, mDatabaseLocation);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   SetArray(new sbLocalDatabaseGUIDArray());
   NS_ENSURE_TRUE(GetArray(), NS_ERROR_OUT_OF_MEMORY);
 
@@ -681,6 +716,38 @@ sbLocalDatabaseLibrary::Init(const nsAString& aDatabaseGuid,
   rv = sbLocalDatabaseMediaListBase::Init(this, guid, PR_FALSE);
   NS_ENSURE_SUCCESS(rv, rv);
 
+  // Keep the sort indexes up to date as items come and go.  Property
+  // changes come from the property cache.
+  rv = AddListener(mSortIndex,
+                   PR_TRUE,
+                   sbIMediaList::LISTENER_FLAGS_ITEMADDED |
+                   sbIMediaList::LISTENER_FLAGS_AFTERITEMREMOVED |
+                   sbIMediaList::LISTENER_FLAGS_LISTCLEARED |
+                   sbIMediaList::LISTENER_FLAGS_BATCHBEGIN |
+                   sbIMediaList::LISTENER_FLAGS_BATCHEND,
+                   nsnull);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Same for the rows of the filter snapshot
+  rv = AddListener(mFilterSnapshot,
+                   PR_TRUE,
+                   sbIMediaList::LISTENER_FLAGS_ITEMADDED |
+                   sbIMediaList::LISTENER_FLAGS_AFTERITEMREMOVED |
+                   sbIMediaList::LISTENER_FLAGS_LISTCLEARED,
+                   nsnull);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The tracked lengths have to be counted before any view hears of a
+  // change and reads them, so the length cache listens ahead of the views.
+  rv = AddListener(mLengthCache,
+                   PR_TRUE,
+                   sbIMediaList::LISTENER_FLAGS_ITEMADDED |
+                   sbIMediaList::LISTENER_FLAGS_BEFOREITEMREMOVED |
+                   sbIMediaList::LISTENER_FLAGS_AFTERITEMREMOVED |
+                   sbIMediaList::LISTENER_FLAGS_LISTCLEARED,
+                   nsnull);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   // Initialize the media list factory table.
   success = mMediaListFactoryTable.Init();
   NS_ENSURE_TRUE(success, NS_ERROR_FAILURE);
@@ -835,36 +902,45 @@ sbLocalDatabaseLibrary::AddNewItemQuery(sbIDatabaseQuery* aQuery,
   TRACE(("LocalDatabaseLibrary[0x%.8x] - AddNewItemQuery(%d, %s)", this,
          aMediaItemTypeID, NS_LossyConvertUTF16toASCII(aURISpec).get()));
 
-  nsresult rv = aQuery->AddPreparedStatement(mCreateMediaItemPreparedStatement);
-  NS_ENSURE_SUCCESS(rv, rv);
-
   // Make a new GUID for the new media list.
-  nsCOMPtr<nsIUUIDGenerator> uuidGen =
-    do_GetService(NS_UUID_GENERATOR_CONTRACTID, &rv);
+  nsTArray<nsString> guids;
+  nsresult rv = GenerateGUIDs(1, guids);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsID id;
-  rv = uuidGen->GenerateUUIDInPlace(&id);
+  // Set created and updated timestamps.
+  nsAutoString createdTimeString;
+  GetNowString(createdTimeString);
+
+  rv = AddNewItemQuery(aQuery,
+                       aMediaItemTypeID,
+                       aURISpec,
+                       guids[0],
+                       createdTimeString);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  char guidChars[NSID_LENGTH];
-  id.ToProvidedString(guidChars);
+  _retval.Assign(guids[0]);
+  return NS_OK;
+}
 
-  nsString guid(NS_ConvertASCIItoUTF16(nsDependentCString(guidChars + 1,
-                                                          NSID_LENGTH - 3)));
+nsresult
+sbLocalDatabaseLibrary::AddNewItemQuery(sbIDatabaseQuery* aQuery,
+                                        const PRUint32 aMediaItemTypeID,
+                                        const nsAString& aURISpec,
+                                        const nsAString& aGUID,
+                                        const nsAString& aCreated)
+{
+  NS_ENSURE_ARG_POINTER(aQuery);
 
-  // ToString adds curly braces to the GUID which we don't want.
-  rv = aQuery->BindStringParameter(0, guid);
+  nsresult rv = aQuery->AddPreparedStatement(mCreateMediaItemPreparedStatement);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  // Set created and updated timestamps.
-  nsAutoString createdTimeString;
-  GetNowString(createdTimeString);
+  rv = aQuery->BindStringParameter(0, aGUID);
+  NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = aQuery->BindStringParameter(1, createdTimeString);
+  rv = aQuery->BindStringParameter(1, aCreated);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = aQuery->BindStringParameter(2, createdTimeString);
+  rv = aQuery->BindStringParameter(2, aCreated);
   NS_ENSURE_SUCCESS(rv, rv);
 
   // Set the new URI spec and media item type.
@@ -892,7 +968,7 @@ sbLocalDatabaseLibrary::AddNewItemQuery(sbIDatabaseQuery* aQuery,
     newSpec.AssignLiteral("songbird-medialist://");
     newSpec.Append(mGuid);
     newSpec.AppendLiteral("/");
-    newSpec.Append(guid);
+    newSpec.Append(aGUID);
 
     rv = aQuery->BindStringParameter(3, newSpec);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -910,7 +986,36 @@ sbLocalDatabaseLibrary::AddNewItemQuery(sbIDatabaseQuery* aQuery,
     NS_ENSURE_SUCCESS(rv, rv);
   }
 
-  _retval.Assign(guid);
+  return NS_OK;
+}
+
+/* static */ nsresult
+sbLocalDatabaseLibrary::GenerateGUIDs(PRUint32 aCount,
+                                      nsTArray<nsString>& _retval)
+{
+  nsresult rv;
+  nsCOMPtr<nsIUUIDGenerator> uuidGen =
+    do_GetService(NS_UUID_GENERATOR_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ENSURE_TRUE(_retval.SetCapacity(_retval.Length() + aCount),
+                 NS_ERROR_OUT_OF_MEMORY);
+
+  for (PRUint32 i = 0; i < aCount; i++) {
+    nsID id;
+    rv = uuidGen->GenerateUUIDInPlace(&id);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    char guidChars[NSID_LENGTH];
+    id.ToProvidedString(guidChars);
+
+    // ToString adds curly braces to the GUID which we don't want.
+    nsString* guid = _retval.AppendElement(
+      NS_ConvertASCIItoUTF16(nsDependentCString(guidChars + 1,
+                                                NSID_LENGTH - 3)));
+    NS_ENSURE_TRUE(guid, NS_ERROR_OUT_OF_MEMORY);
+  }
+
   return NS_OK;
 }
 
@@ -1977,6 +2082,11 @@ sbLocalDatabaseLibrary::Shutdown()
     LOG((LOG_SUBMESSAGE_SPACE "all timers have died"));
   }
 
+  // Don't leave the search index building against a closing database
+  if (mSearchIndex) {
+    mSearchIndex->Shutdown();
+  }
+
   // Explicitly release our property cache here so we make sure to write all
   // changes to disk (regardless of whether or not this library will be leaked)
   // to prevent data loss.
@@ -1999,6 +2109,36 @@ sbLocalDatabaseLibrary::GetLengthCache(sbILocalDatabaseGUIDArrayLengthCache** aL
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseLibrary::GetSortIndex(sbILocalDatabaseGUIDArraySortIndex** aSortIndex)
+{
+  NS_ENSURE_ARG_POINTER(aSortIndex);
+  NS_ENSURE_TRUE(mSortIndex, NS_ERROR_NOT_INITIALIZED);
+
+  NS_ADDREF(*aSortIndex = mSortIndex);
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseLibrary::GetFilterSnapshot(sbILocalDatabaseFilterSnapshot** aFilterSnapshot)
+{
+  NS_ENSURE_ARG_POINTER(aFilterSnapshot);
+  NS_ENSURE_TRUE(mFilterSnapshot, NS_ERROR_NOT_INITIALIZED);
+
+  NS_ADDREF(*aFilterSnapshot = mFilterSnapshot);
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseLibrary::GetSearchIndex(sbILocalDatabaseSearchIndex** aSearchIndex)
+{
+  NS_ENSURE_ARG_POINTER(aSearchIndex);
+  NS_ENSURE_TRUE(mSearchIndex, NS_ERROR_NOT_INITIALIZED);
+
+  NS_ADDREF(*aSearchIndex = mSearchIndex);
+  return NS_OK;
+}
+
 /**
  * See sbILocalDatabaseLibrary
  */
@@ -4810,23 +4950,28 @@ sbBatchCreateHelper::InitQuery(sbIDatabaseQuery* aQuery,
   // Iterate over all items in the URI array, creating media items.
   PRUint32 listLength = mURIArray->Count();
 
-  // Add a query to insert each new item and record the guids that were
-  // generated for the future inserts
+  // Make all the guids up front, and give every item of the batch the same
+  // creation time, so each row only costs a set of bound parameters on the
+  // shared insert statement
+  rv = sbLocalDatabaseLibrary::GenerateGUIDs(listLength, mGuids);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoString createdTimeString;
+  sbLocalDatabaseLibrary::GetNowString(createdTimeString);
+
+  nsAutoString uriSpec;
   for (PRUint32 i = 0; i < listLength; i++) {
-    nsAutoString uriSpec;
     mURIArray->StringAt(i, uriSpec);
 
-    nsAutoString guid;
     rv = mLibrary->AddNewItemQuery(aQuery,
                                    SB_MEDIAITEM_TYPEID,
                                    uriSpec,
-                                   guid);
+                                   mGuids[i],
+                                   createdTimeString);
     NS_ENSURE_SUCCESS(rv, rv);
-    TRACE(("sbBatchCreateHelper[0x%.8x] - InitQuery() -- added new itemQuery", this));
-
-    nsString* success = mGuids.AppendElement(guid);
-    NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
   }
+  TRACE(("sbBatchCreateHelper[0x%.8x] - InitQuery() -- added %d item queries",
+         this, listLength));
 
 
   rv = aQuery->AddQuery(NS_LITERAL_STRING("commit"));
@@ -4969,6 +5114,39 @@ sbLocalDatabaseLibrary::InitializeLibraryStatistics() {
   return NS_OK;
 }
 
+/**
+ * Copies the first column of each row of a query into a string array as the
+ * rows are read, instead of building a full result set first.
+ */
+class sbCollectValuesRowCallback : public sbIDatabaseRowCallback
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBIDATABASEROWCALLBACK
+
+  sbCollectValuesRowCallback(nsTArray<nsString> & aValues) :
+    mValues(aValues)
+  {
+  }
+
+private:
+  nsTArray<nsString> & mValues;
+};
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbCollectValuesRowCallback,
+                              sbIDatabaseRowCallback)
+
+NS_IMETHODIMP
+sbCollectValuesRowCallback::OnRow(sbIDatabaseResult *aRowResult)
+{
+  NS_ENSURE_ARG_POINTER(aRowResult);
+
+  nsString * const value = mValues.AppendElement();
+  NS_ENSURE_TRUE(value, NS_ERROR_OUT_OF_MEMORY);
+
+  return aRowResult->GetRowCell(0, 0, *value);
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseLibrary::CollectDistinctValues(const nsAString & aProperty,
                                               PRUint32 aCollectionMethod,
@@ -4999,35 +5177,32 @@ sbLocalDatabaseLibrary::CollectDistinctValues(const nsAString & aProperty,
       return NS_ERROR_INVALID_ARG;
   }
 
+  nsTArray<nsString> values;
+  nsRefPtr<sbCollectValuesRowCallback> rowCallback =
+    new sbCollectValuesRowCallback(values);
+  NS_ENSURE_TRUE(rowCallback, NS_ERROR_OUT_OF_MEMORY);
+
+  rv = query->SetRowCallback(rowCallback);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   PRInt32 dbOk = 0;
   rv = query->Execute(&dbOk);
+  query->SetRowCallback(nsnull);
   NS_ENSURE_SUCCESS(rv, rv);
   NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
 
-  nsCOMPtr<sbIDatabaseResult> result;
-  rv = query->GetResultObject(getter_AddRefs(result));
-  NS_ENSURE_TRUE(result, NS_ERROR_FAILURE);
-
-  PRUint32 rowCount = 0;
-  rv = result->GetRowCount(&rowCount);
-  NS_ENSURE_SUCCESS(rv, rv);
-
   nsCOMPtr<nsIMutableArray> array =
     do_CreateInstance("@mozilla.org/array;1", &rv);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  for (PRUint32 i=0; i<rowCount; i++) {
+  PRUint32 const valueCount = values.Length();
+  for (PRUint32 i=0; i<valueCount; i++) {
     // create a variant to hold this string value
     nsCOMPtr<nsIWritableVariant> variant =
       do_CreateInstance(NS_VARIANT_CONTRACTID, &rv);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    // get the value
-    nsString name;
-    rv = result->GetRowCell(i, 0, name);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    variant->SetAsAString(name);
+    variant->SetAsAString(values[i]);
     array->AppendElement(variant, PR_FALSE);
   }
 
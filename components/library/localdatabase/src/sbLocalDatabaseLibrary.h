@@ -62,8 +62,15 @@ class sbIBatchCreateMediaItemsListener;
 class sbILibraryFactory;
 class sbILocalDatabasePropertyCache;
 class sbILocalDatabaseGUIDArrayLengthCache;
+class sbLocalDatabaseGUIDArrayLengthCache;
+class sbILocalDatabaseGUIDArraySortIndex;
+class sbILocalDatabaseFilterSnapshot;
+class sbILocalDatabaseSearchIndex;
 class sbLibraryInsertingEnumerationListener;
 class sbLibraryRemovingEnumerationListener;
+class sbLocalDatabaseGUIDArraySortIndex;
+class sbLocalDatabaseFilterSnapshot;
+class sbLocalDatabaseSearchIndex;
 class sbLocalDatabaseMediaListView;
 class sbLocalDatabasePropertyCache;
 class nsIPrefBranch;
@@ -261,6 +268,12 @@ public:
 
   nsresult GetLengthCache(sbILocalDatabaseGUIDArrayLengthCache **aLengthCache);
 
+  nsresult GetSortIndex(sbILocalDatabaseGUIDArraySortIndex **aSortIndex);
+
+  nsresult GetFilterSnapshot(sbILocalDatabaseFilterSnapshot **aFilterSnapshot);
+
+  nsresult GetSearchIndex(sbILocalDatabaseSearchIndex **aSearchIndex);
+
 private:
   nsresult CreateQueries();
 
@@ -272,6 +285,22 @@ private:
                            const nsAString& aURISpecOrPrefix,
                            nsAString& _retval);
 
+  /**
+   * Adds the insert for a new item whose GUID and creation time were made
+   * ahead of time, for batches that make many items at once.
+   */
+  nsresult AddNewItemQuery(sbIDatabaseQuery* aQuery,
+                           const PRUint32 aMediaItemTypeID,
+                           const nsAString& aURISpecOrPrefix,
+                           const nsAString& aGUID,
+                           const nsAString& aCreated);
+
+  /**
+   * Makes aCount new item GUIDs with a single UUID generator lookup.
+   */
+  static nsresult GenerateGUIDs(PRUint32 aCount,
+                                nsTArray<nsString>& _retval);
+
   /**
    * Sets properties of a newly created media item without
    * sending notifications.
@@ -411,7 +440,18 @@ private:
 
   nsCOMPtr<sbILocalDatabasePropertyCache> mPropertyCache;
 
-  nsCOMPtr<sbILocalDatabaseGUIDArrayLengthCache> mLengthCache;
+  nsRefPtr<sbLocalDatabaseGUIDArrayLengthCache> mLengthCache;
+
+  // Persistent sort orders for the views of the library, also told about
+  // property changes by the property cache
+  nsRefPtr<sbLocalDatabaseGUIDArraySortIndex> mSortIndex;
+
+  // In memory copy of the filterable properties for the filter panes, also
+  // told about property changes by the property cache
+  nsRefPtr<sbLocalDatabaseFilterSnapshot> mFilterSnapshot;
+
+  // Word index for searches, told about written values by the property cache
+  nsRefPtr<sbLocalDatabaseSearchIndex> mSearchIndex;
 
   sbMediaListFactoryInfoTable mMediaListFactoryTable;
   sbMediaItemInfoTable mMediaItemTable;
@@ -27,19 +27,26 @@
 #include "sbLocalDatabaseMediaListListener.h"
 #include "sbLocalDatabaseMediaListBase.h"
 
+#include <sbILocalDatabaseMediaItem.h>
 #include <sbIMediaItem.h>
 #include <sbIMediaList.h>
 #include <sbIMediaListListener.h>
+#include <sbIPropertyArray.h>
 
 #include <nsIWeakReference.h>
 #include <nsIWeakReferenceUtils.h>
 
 #include <nsAutoLock.h>
 #include <nsHashKeys.h>
+#include <nsMemory.h>
 #include <nsThreadUtils.h>
 #include <nsServiceManagerUtils.h>
 
 #include <sbProxiedComponentManager.h>
+#include <sbTArrayStringEnumerator.h>
+
+#include <algorithm>
+#include <vector>
 
 #ifdef DEBUG
 #include <nsIXPConnect.h>
@@ -304,17 +311,43 @@ sbLocalDatabaseMediaListListener::ListenerCount()
 nsresult
 sbLocalDatabaseMediaListListener::SnapshotListenerArray(sbMediaListListenersArray& aArray,
                                                         PRUint32 aFlags,
-                                                        sbIPropertyArray* aProperties)
+                                                        sbIPropertyArray* aProperties,
+                                                        sbIMediaItem* aItem)
 {
+  nsresult rv;
+
+  // Batched changes are kept by media item id, items without one always go
+  // through the listeners one by one
+  PRUint32 mediaItemID = 0;
+  PRBool canCoalesce = PR_FALSE;
+  if (aItem) {
+    nsCOMPtr<sbILocalDatabaseMediaItem> item = do_QueryInterface(aItem, &rv);
+    if (NS_SUCCEEDED(rv)) {
+      rv = item->GetMediaItemId(&mediaItemID);
+      canCoalesce = NS_SUCCEEDED(rv);
+    }
+  }
+
   nsAutoLock lock(mListenerArrayLock);
 
+  canCoalesce = canCoalesce && mBatchDepth > 0;
+
   PRUint32 length = mListenerArray.Length();
   for (PRUint32 i = 0; i < length; i++) {
-    if (mListenerArray[i]->ShouldNotify(aFlags, aProperties)) {
+    sbListenerInfo* info = mListenerArray[i];
+    if (info->ShouldNotify(aFlags, aProperties)) {
+      if (canCoalesce && info->mBatchProxy) {
+        rv = info->AddChange(aFlags, mediaItemID, aProperties);
+        NS_ENSURE_SUCCESS(rv, rv);
+        continue;
+      }
+
       nsString debugAddress;
-      mListenerArray[i]->GetDebugAddress(debugAddress);
+#ifdef PR_LOGGING
+      info->GetDebugAddress(debugAddress);
+#endif
       ListenerAndDebugAddress* added =
-        aArray.AppendElement(ListenerAndDebugAddress(mListenerArray[i]->mProxy,
+        aArray.AppendElement(ListenerAndDebugAddress(info->mProxy,
                                                      debugAddress));
       NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
     }
@@ -323,6 +356,39 @@ sbLocalDatabaseMediaListListener::SnapshotListenerArray(sbMediaListListenersArra
   return NS_OK;
 }
 
+void
+sbLocalDatabaseMediaListListener::NotifyListenersItemsChanged(sbIMediaList* aList)
+{
+  nsCOMArray<sbILocalDatabaseMediaListBatchListener> listeners;
+  nsCOMArray<sbILocalDatabaseMediaListChanges> changes;
+  {
+    nsAutoLock lock(mListenerArrayLock);
+
+    PRUint32 length = mListenerArray.Length();
+    for (PRUint32 i = 0; i < length; i++) {
+      sbListenerInfo* info = mListenerArray[i];
+      if (info->mChanges) {
+        PRBool success = listeners.AppendObject(info->mBatchProxy);
+        SB_ENSURE_TRUE_VOID(success);
+        success = changes.AppendObject(info->mChanges);
+        SB_ENSURE_TRUE_VOID(success);
+        info->mChanges = nsnull;
+      }
+    }
+  }
+
+  TRACE(("LocalDatabaseMediaListListener[0x%.8x] - "
+         "NotifyListenersItemsChanged %d", this, listeners.Count()));
+
+  // Call the listeners without the lock so they may add or remove listeners
+  for (PRInt32 i = 0; i < listeners.Count(); i++) {
+    nsresult rv = listeners[i]->OnItemsChanged(aList, changes[i]);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv) ||
+                     rv == NS_SUCCESS_LOSS_OF_INSIGNIFICANT_DATA,
+                     "OnItemsChanged returned a failure code");
+  }
+}
+
 void
 sbLocalDatabaseMediaListListener::SweepListenerArray(sbStopNotifyArray& aStopNotifying)
 {
@@ -434,7 +500,16 @@ sbLocalDatabaseMediaListListener::SweepListenerArray(sbStopNotifyArray& aStopNot
   SB_NOTIFY_LISTENERS_HEAD                                                \
   nsresult rv = SnapshotListenerArray(snapshot,                           \
                                       sbIMediaList::flag,                 \
-                                      aProperties);                       \
+                                      aProperties,                        \
+                                      aItem);                             \
+  SB_NOTIFY_LISTENERS_TAIL(method, call, flag)
+
+#define SB_NOTIFY_LISTENERS_ITEM(method, call, flag)                      \
+  SB_NOTIFY_LISTENERS_HEAD                                                \
+  nsresult rv = SnapshotListenerArray(snapshot,                           \
+                                      sbIMediaList::flag,                 \
+                                      nsnull,                             \
+                                      aItem);                             \
   SB_NOTIFY_LISTENERS_TAIL(method, call, flag)
 
 /**
@@ -448,9 +523,9 @@ sbLocalDatabaseMediaListListener::NotifyListenersItemAdded(sbIMediaList* aList,
   SB_ENSURE_TRUE_VOID(aList);
   SB_ENSURE_TRUE_VOID(aItem);
 
-  SB_NOTIFY_LISTENERS(NotifyListenersItemAdded,
-                      OnItemAdded(aList, aItem, aIndex, &noMoreForBatch),
-                      LISTENER_FLAGS_ITEMADDED);
+  SB_NOTIFY_LISTENERS_ITEM(NotifyListenersItemAdded,
+                           OnItemAdded(aList, aItem, aIndex, &noMoreForBatch),
+                           LISTENER_FLAGS_ITEMADDED);
 }
 
 /**
@@ -465,6 +540,8 @@ sbLocalDatabaseMediaListListener::NotifyListenersBeforeItemRemoved(sbIMediaList*
   SB_ENSURE_TRUE_VOID(aList);
   SB_ENSURE_TRUE_VOID(aItem);
 
+  NotifyListenersItemsChanged(aList);
+
   SB_NOTIFY_LISTENERS(NotifyListenersBeforeItemRemoved,
                       OnBeforeItemRemoved(aList,
                                           aItem,
@@ -484,6 +561,8 @@ sbLocalDatabaseMediaListListener::NotifyListenersAfterItemRemoved(sbIMediaList*
   SB_ENSURE_TRUE_VOID(aList);
   SB_ENSURE_TRUE_VOID(aItem);
 
+  NotifyListenersItemsChanged(aList);
+
   SB_NOTIFY_LISTENERS(NotifyListenersAfterItemRemoved,
                       OnAfterItemRemoved(aList,
                                          aItem,
@@ -537,6 +616,8 @@ sbLocalDatabaseMediaListListener::NotifyListenersItemMoved(sbIMediaList* aList,
 {
   SB_ENSURE_TRUE_VOID(aList);
 
+  NotifyListenersItemsChanged(aList);
+
   SB_NOTIFY_LISTENERS(NotifyListenersItemMoved,
                       OnItemMoved(aList,
                                   aFromIndex,
@@ -555,6 +636,8 @@ sbLocalDatabaseMediaListListener::NotifyListenersBeforeListCleared
 {
   SB_ENSURE_TRUE_VOID(aList);
 
+  NotifyListenersItemsChanged(aList);
+
   SB_NOTIFY_LISTENERS(NotifyListenersBeforeListCleared,
                       OnBeforeListCleared(aList, aExcludeLists, &noMoreForBatch),
                       LISTENER_FLAGS_BEFORELISTCLEARED);
@@ -570,6 +653,8 @@ sbLocalDatabaseMediaListListener::NotifyListenersListCleared
 {
   SB_ENSURE_TRUE_VOID(aList);
 
+  NotifyListenersItemsChanged(aList);
+
   SB_NOTIFY_LISTENERS(NotifyListenersListCleared,
                       OnListCleared(aList, aExcludeLists, &noMoreForBatch),
                       LISTENER_FLAGS_LISTCLEARED);
@@ -607,6 +692,7 @@ sbLocalDatabaseMediaListListener::NotifyListenersBatchEnd(sbIMediaList* aList)
   SB_ENSURE_TRUE_VOID(aList);
 
   // Tell all of our listener infos that we have ended a batch
+  PRBool isOutermost;
   {
     nsAutoLock lock(mListenerArrayLock);
     
@@ -616,12 +702,18 @@ sbLocalDatabaseMediaListListener::NotifyListenersBatchEnd(sbIMediaList* aList)
     }
     
     mBatchDepth--;
+    isOutermost = mBatchDepth == 0;
     PRUint32 length = mListenerArray.Length();
     for (PRUint32 i = 0; i < length; i++) {
       mListenerArray[i]->EndBatch();
     }
   }
 
+  // Batch listeners hear about the changes before the batch ends for them
+  if (isOutermost) {
+    NotifyListenersItemsChanged(aList);
+  }
+
   SB_NOTIFY_LISTENERS(NotifyListenersBatchEnd,
                       OnBatchEnd(aList),
                       LISTENER_FLAGS_BATCHEND);
@@ -673,6 +765,9 @@ sbListenerInfo::Init(nsIProxyObjectManager *aProxyObjMgr,
                                        getter_AddRefs(mProxy));
   NS_ENSURE_SUCCESS(rv, rv);
 
+  rv = InitBatchListener(aProxyObjMgr, aListener, aListener);
+  NS_ENSURE_SUCCESS(rv, rv);
+
 #ifdef PR_LOGGING
   char buf[256];
   PRUint32 len = PR_snprintf(buf, sizeof(buf), "0x%.8x", aListener);
@@ -722,8 +817,13 @@ sbListenerInfo::Init(nsIProxyObjectManager *aProxyObjMgr,
                                        getter_AddRefs(mProxy));
   NS_ENSURE_SUCCESS(rv, rv);
 
-#ifdef PR_LOGGING
   nsCOMPtr<sbIMediaListListener> listener = do_QueryReferent(aWeakListener);
+  if (listener) {
+    rv = InitBatchListener(aProxyObjMgr, listener, wrapped);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+#ifdef PR_LOGGING
   char buf[256];
   PRUint32 len = PR_snprintf(buf, sizeof(buf), "0x%.8x",
                              listener ? listener.get() : 0);
@@ -733,12 +833,53 @@ sbListenerInfo::Init(nsIProxyObjectManager *aProxyObjMgr,
   return NS_OK;
 }
 
+nsresult
+sbListenerInfo::InitBatchListener(nsIProxyObjectManager* aProxyObjMgr,
+                                  sbIMediaListListener* aListener,
+                                  nsISupports* aTarget)
+{
+  // Most listeners don't take batched changes
+  nsCOMPtr<sbILocalDatabaseMediaListBatchListener> batchListener =
+    do_QueryInterface(aListener);
+  if (!batchListener) {
+    return NS_OK;
+  }
+
+  return do_GetProxyForObjectWithManager(aProxyObjMgr,
+                                         NS_PROXY_TO_CURRENT_THREAD,
+                                         NS_GET_IID(sbILocalDatabaseMediaListBatchListener),
+                                         aTarget,
+                                         NS_PROXY_SYNC | NS_PROXY_ALWAYS,
+                                         getter_AddRefs(mBatchProxy));
+}
+
 void
 sbListenerInfo::GetDebugAddress(nsAString& aDebugAddress)
 {
   aDebugAddress = mDebugAddress;
 }
 
+nsresult
+sbListenerInfo::AddChange(PRUint32 aFlag,
+                          PRUint32 aMediaItemID,
+                          sbIPropertyArray* aProperties)
+{
+  NS_ASSERTION(mBatchProxy, "Not a batch listener");
+
+  if (!mChanges) {
+    mChanges = new sbLocalDatabaseMediaListChanges();
+    NS_ENSURE_TRUE(mChanges, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  if (aFlag == sbIMediaList::LISTENER_FLAGS_ITEMADDED) {
+    return mChanges->AddItem(aMediaItemID);
+  }
+
+  NS_ASSERTION(aFlag == sbIMediaList::LISTENER_FLAGS_ITEMUPDATED,
+               "Only additions and updates are batched");
+  return mChanges->UpdateItem(aMediaItemID, aProperties);
+}
+
 PRBool
 sbListenerInfo::ShouldNotify(PRUint32 aFlag, sbIPropertyArray* aProperties)
 {
@@ -847,8 +988,152 @@ sbListenerInfo::InitPropertyFilter(sbIPropertyArray* aPropertyFilter)
   return NS_OK;
 }
 
-NS_IMPL_THREADSAFE_ISUPPORTS1(sbWeakMediaListListenerWrapper,
-                              sbIMediaListListener)
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbLocalDatabaseMediaListChanges,
+                              sbILocalDatabaseMediaListChanges)
+
+nsresult
+sbLocalDatabaseMediaListChanges::AddItem(PRUint32 aMediaItemID)
+{
+  return AddToRanges(mAddedRanges, aMediaItemID);
+}
+
+nsresult
+sbLocalDatabaseMediaListChanges::UpdateItem(PRUint32 aMediaItemID,
+                                            sbIPropertyArray* aProperties)
+{
+  nsresult rv = AddToRanges(mUpdatedRanges, aMediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (!aProperties) {
+    return NS_OK;
+  }
+
+  PRUint32 length;
+  rv = aProperties->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 i = 0; i < length; i++) {
+    nsCOMPtr<sbIProperty> property;
+    rv = aProperties->GetPropertyAt(i, getter_AddRefs(property));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString id;
+    rv = property->GetId(id);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Batches rarely touch more than a handful of properties
+    if (!mUpdatedProperties.Contains(id)) {
+      nsString* added = mUpdatedProperties.AppendElement(id);
+      NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
+  return NS_OK;
+}
+
+/* static */ nsresult
+sbLocalDatabaseMediaListChanges::AddToRanges(nsTArray<PRUint32>& aRanges,
+                                             PRUint32 aID)
+{
+  // Extend the last range when the id follows on from it, which is what
+  // happens when items are added or updated in order
+  PRUint32 const length = aRanges.Length();
+  if (length) {
+    PRUint32& last = aRanges[length - 1];
+    if (aID >= aRanges[length - 2] && aID <= last) {
+      return NS_OK;
+    }
+    if (aID == last + 1) {
+      last = aID;
+      return NS_OK;
+    }
+  }
+
+  PRUint32* added = aRanges.AppendElement(aID);
+  NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  added = aRanges.AppendElement(aID);
+  NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+
+  return NS_OK;
+}
+
+/* static */ nsresult
+sbLocalDatabaseMediaListChanges::GetRanges(const nsTArray<PRUint32>& aRanges,
+                                           PRUint32* aCount,
+                                           PRUint32** aResult)
+{
+  NS_ENSURE_ARG_POINTER(aCount);
+  NS_ENSURE_ARG_POINTER(aResult);
+
+  // Sort the ranges by their first id and merge the ones that touch
+  typedef std::pair<PRUint32, PRUint32> Range;
+  std::vector<Range> ranges;
+  ranges.reserve(aRanges.Length() / 2);
+  for (PRUint32 i = 0; i + 1 < aRanges.Length(); i += 2) {
+    ranges.push_back(Range(aRanges[i], aRanges[i + 1]));
+  }
+  std::sort(ranges.begin(), ranges.end());
+
+  std::vector<Range> merged;
+  for (std::vector<Range>::const_iterator it = ranges.begin();
+       it != ranges.end();
+       ++it) {
+    if (!merged.empty() && it->first <= merged.back().second + 1) {
+      merged.back().second = PR_MAX(merged.back().second, it->second);
+    }
+    else {
+      merged.push_back(*it);
+    }
+  }
+
+  *aCount = merged.size() * 2;
+  if (!*aCount) {
+    *aResult = nsnull;
+    return NS_OK;
+  }
+
+  *aResult =
+    static_cast<PRUint32*>(NS_Alloc(*aCount * sizeof(PRUint32)));
+  NS_ENSURE_TRUE(*aResult, NS_ERROR_OUT_OF_MEMORY);
+
+  for (PRUint32 i = 0; i < merged.size(); i++) {
+    (*aResult)[i * 2] = merged[i].first;
+    (*aResult)[i * 2 + 1] = merged[i].second;
+  }
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseMediaListChanges::GetAddedItemIDRanges(PRUint32* aCount,
+                                                      PRUint32** _retval)
+{
+  return GetRanges(mAddedRanges, aCount, _retval);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseMediaListChanges::GetUpdatedItemIDRanges(PRUint32* aCount,
+                                                        PRUint32** _retval)
+{
+  return GetRanges(mUpdatedRanges, aCount, _retval);
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseMediaListChanges::GetUpdatedProperties(nsIStringEnumerator** aUpdatedProperties)
+{
+  NS_ENSURE_ARG_POINTER(aUpdatedProperties);
+
+  nsCOMPtr<nsIStringEnumerator> properties =
+    new sbTArrayStringEnumerator(&mUpdatedProperties);
+  NS_ENSURE_TRUE(properties, NS_ERROR_OUT_OF_MEMORY);
+
+  properties.forget(aUpdatedProperties);
+  return NS_OK;
+}
+
+NS_IMPL_THREADSAFE_ISUPPORTS2(sbWeakMediaListListenerWrapper,
+                              sbIMediaListListener,
+                              sbILocalDatabaseMediaListBatchListener)
 
 sbWeakMediaListListenerWrapper::sbWeakMediaListListenerWrapper(nsIWeakReference* aWeakListener) :
   mWrappedWeak(aWeakListener)
@@ -971,3 +1256,15 @@ sbWeakMediaListListenerWrapper::OnBatchEnd(sbIMediaList* aMediaList)
 {
   SB_TRY_NOTIFY(OnBatchEnd(aMediaList))
 }
+
+NS_IMETHODIMP
+sbWeakMediaListListenerWrapper::OnItemsChanged(sbIMediaList* aMediaList,
+                                               sbILocalDatabaseMediaListChanges* aChanges)
+{
+  nsCOMPtr<sbILocalDatabaseMediaListBatchListener> listener =
+    do_QueryReferent(mWrappedWeak);
+  if (listener) {
+    return listener->OnItemsChanged(aMediaList, aChanges);
+  }
+  return NS_SUCCESS_LOSS_OF_INSIGNIFICANT_DATA;
+}
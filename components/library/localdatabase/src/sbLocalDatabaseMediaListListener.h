@@ -34,6 +34,7 @@
 #include <nsHashKeys.h>
 #include <nsTArray.h>
 #include <prlock.h>
+#include <sbILocalDatabaseMediaListBatchListener.h>
 #include <sbIMediaList.h>
 #include <sbIMediaListListener.h>
 #include <sbIPropertyArray.h>
@@ -45,6 +46,32 @@ class sbIMediaItem;
 class sbIMediaList;
 class sbLocalDatabaseMediaListBase;
 
+/**
+ * \brief Items added and updated during a batch, kept as ranges of media
+ *        item ids.  Items added in a batch usually get consecutive ids so the
+ *        ranges stay few.
+ */
+class sbLocalDatabaseMediaListChanges : public sbILocalDatabaseMediaListChanges
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBILOCALDATABASEMEDIALISTCHANGES
+
+  nsresult AddItem(PRUint32 aMediaItemID);
+  nsresult UpdateItem(PRUint32 aMediaItemID, sbIPropertyArray* aProperties);
+
+private:
+  static nsresult AddToRanges(nsTArray<PRUint32>& aRanges, PRUint32 aID);
+  static nsresult GetRanges(const nsTArray<PRUint32>& aRanges,
+                            PRUint32* aCount,
+                            PRUint32** aResult);
+
+  // First and last id of each range in turn
+  nsTArray<PRUint32> mAddedRanges;
+  nsTArray<PRUint32> mUpdatedRanges;
+  nsTArray<nsString> mUpdatedProperties;
+};
+
 class sbListenerInfo
 {
 friend class sbLocalDatabaseMediaListListener;
@@ -70,14 +97,27 @@ public:
   void SetShouldStopNotifying(PRUint32 aFlag);
   void GetDebugAddress(nsAString& mDebugAddress);
 
+  // Record an added or updated item for a listener that takes batched
+  // changes
+  nsresult AddChange(PRUint32 aFlag,
+                     PRUint32 aMediaItemID,
+                     sbIPropertyArray* aProperties);
+
 private:
 
   nsresult InitPropertyFilter(sbIPropertyArray* aPropertyFilter);
+  nsresult InitBatchListener(nsIProxyObjectManager* aProxyObjMgr,
+                             sbIMediaListListener* aListener,
+                             nsISupports* aTarget);
 
   PRBool mIsGone;
   nsCOMPtr<nsISupports> mRef;
   nsCOMPtr<nsIWeakReference> mWeak;
   nsCOMPtr<sbIMediaListListener> mProxy;
+  // Only set for listeners implementing sbILocalDatabaseMediaListBatchListener
+  nsCOMPtr<sbILocalDatabaseMediaListBatchListener> mBatchProxy;
+  // Changes not yet delivered to mBatchProxy
+  nsRefPtr<sbLocalDatabaseMediaListChanges> mChanges;
   PRUint32 mFlags;
   PRBool mHasPropertyFilter;
   nsTHashtable<nsStringHashKey> mPropertyFilter;
@@ -85,11 +125,14 @@ private:
   nsString mDebugAddress;
 };
 
-class sbWeakMediaListListenerWrapper : public sbIMediaListListener
+class sbWeakMediaListListenerWrapper :
+  public sbIMediaListListener,
+  public sbILocalDatabaseMediaListBatchListener
 {
 public:
   NS_DECL_ISUPPORTS
   NS_DECL_SBIMEDIALISTLISTENER
+  NS_DECL_SBILOCALDATABASEMEDIALISTBATCHLISTENER
 
   sbWeakMediaListListenerWrapper(nsIWeakReference* aWeakListener);
   ~sbWeakMediaListListenerWrapper();
@@ -196,11 +239,17 @@ protected:
 
 private:
 
+  // When aItem is given and a batch is running, the item is added to the
+  // change sets of the batch listeners instead of putting them in aArray
   nsresult SnapshotListenerArray(sbMediaListListenersArray& aArray,
                                  PRUint32 aFlags,
-                                 sbIPropertyArray* aPropertyFilter = nsnull);
+                                 sbIPropertyArray* aPropertyFilter = nsnull,
+                                 sbIMediaItem* aItem = nsnull);
   void SweepListenerArray(sbStopNotifyArray& aStopNotifying);
 
+  // Deliver the changes collected for batch listeners so far
+  void NotifyListenersItemsChanged(sbIMediaList* aList);
+
   nsTArray<sbListenerInfoAutoPtr> mListenerArray;
 
   PRLock* mListenerArrayLock;
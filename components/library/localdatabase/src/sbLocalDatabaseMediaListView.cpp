@@ -97,9 +97,10 @@ private:
 };
 
 
-NS_IMPL_ISUPPORTS7(sbLocalDatabaseMediaListView,
+NS_IMPL_ISUPPORTS8(sbLocalDatabaseMediaListView,
                    sbIMediaListView,
                    sbIMediaListListener,
+                   sbILocalDatabaseMediaListBatchListener,
                    sbIFilterableMediaListView,
                    sbISearchableMediaListView,
                    sbISortableMediaListView,
@@ -333,6 +334,27 @@ sbLocalDatabaseMediaListView::Init(sbIMediaListViewState* aState)
   rv = mArray->SetLengthCache(lengthCache);
   NS_ENSURE_SUCCESS(rv, rv);
 
+  nsCOMPtr<sbILocalDatabaseGUIDArraySortIndex> sortIndex;
+  rv = mLibrary->GetSortIndex(getter_AddRefs(sortIndex));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mArray->SetSortIndex(sortIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbILocalDatabaseFilterSnapshot> filterSnapshot;
+  rv = mLibrary->GetFilterSnapshot(getter_AddRefs(filterSnapshot));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mArray->SetFilterSnapshot(filterSnapshot);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbILocalDatabaseSearchIndex> searchIndex;
+  rv = mLibrary->GetSearchIndex(getter_AddRefs(searchIndex));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mArray->SetSearchIndex(searchIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   rv = mArray->SetFetchSize(DEFAULT_FETCH_SIZE);
   NS_ENSURE_SUCCESS(rv, rv);
 
@@ -1094,18 +1116,48 @@ sbLocalDatabaseMediaListView::HasCommonProperty(sbIPropertyArray* aBag,
 
 nsresult
 sbLocalDatabaseMediaListView::ShouldCauseInvalidation(sbIPropertyArray* aProperties,
-                                                      PRBool* aShouldCauseInvalidation)
+                                                      PRBool* aShouldCauseInvalidation,
+                                                      PRBool* aSortOnly)
 {
   NS_ASSERTION(aProperties, "aProperties is null");
   NS_ASSERTION(aShouldCauseInvalidation, "aShouldCauseInvalidation is null");
+  NS_ASSERTION(aSortOnly, "aSortOnly is null");
   nsresult rv;
 
   PRBool hasCommon;
   *aShouldCauseInvalidation = PR_TRUE;
+  *aSortOnly = PR_FALSE;
 
   // If one of the updated properties is involved in the current filter,
   // or search, we should invalidate
 
+  // Search filter
+  nsCOMPtr<sbILibraryConstraint> filter;
+  rv = GetFilterConstraint(getter_AddRefs(filter));
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (filter) {
+    rv = HasCommonProperty(aProperties, filter, &hasCommon);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (hasCommon) {
+      return NS_OK;
+    }
+  }
+
+  // Search search
+  nsCOMPtr<sbILibraryConstraint> search;
+  rv = GetSearchConstraint(getter_AddRefs(search));
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (search) {
+    rv = HasCommonProperty(aProperties, search, &hasCommon);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (hasCommon) {
+      return NS_OK;
+    }
+  }
+
+  // Past this point the item stays in the view and can only move
+  *aSortOnly = PR_TRUE;
+
   // Search sort
   nsCOMPtr<sbIPropertyArray> props;
   rv = GetCurrentSort(getter_AddRefs(props));
@@ -1144,31 +1196,8 @@ sbLocalDatabaseMediaListView::ShouldCauseInvalidation(sbIPropertyArray* aPropert
     }
   }
 
-  // Search filter
-  nsCOMPtr<sbILibraryConstraint> filter;
-  rv = GetFilterConstraint(getter_AddRefs(filter));
-  NS_ENSURE_SUCCESS(rv, rv);
-  if (filter) {
-    rv = HasCommonProperty(aProperties, filter, &hasCommon);
-    NS_ENSURE_SUCCESS(rv, rv);
-    if (hasCommon) {
-      return NS_OK;
-    }
-  }
-
-  // Search search
-  nsCOMPtr<sbILibraryConstraint> search;
-  rv = GetSearchConstraint(getter_AddRefs(search));
-  NS_ENSURE_SUCCESS(rv, rv);
-  if (search) {
-    rv = HasCommonProperty(aProperties, search, &hasCommon);
-    NS_ENSURE_SUCCESS(rv, rv);
-    if (hasCommon) {
-      return NS_OK;
-    }
-  }
-
   *aShouldCauseInvalidation = PR_FALSE;
+  *aSortOnly = PR_FALSE;
 
   return NS_OK;
 }
@@ -1567,8 +1596,16 @@ sbLocalDatabaseMediaListView::OnItemAdded(sbIMediaList* aMediaList,
     return NS_OK;
   }
 
-  // Invalidate the view array. Adding an item definitely invalidates length.
-  nsresult rv = Invalidate(PR_TRUE);
+  // Let the view array insert the item in place, it invalidates itself when
+  // it can't.
+  nsAutoString guid;
+  nsresult rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mArray->ApplyItemAdded(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mSelection->ConfigurationChanged();
   NS_ENSURE_SUCCESS(rv, rv);
 
   *aNoMoreForBatch = PR_FALSE;
@@ -1607,8 +1644,16 @@ sbLocalDatabaseMediaListView::OnAfterItemRemoved(sbIMediaList* aMediaList,
     return NS_OK;
   }
 
-  // Invalidate the view array. Removing items invalidates length.
-  nsresult rv = Invalidate(PR_TRUE);
+  // Let the view array remove the item in place, it invalidates itself when
+  // it can't.
+  nsAutoString guid;
+  nsresult rv = aMediaItem->GetGuid(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mArray->ApplyItemRemoved(guid);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = mSelection->ConfigurationChanged();
   NS_ENSURE_SUCCESS(rv, rv);
 
   *aNoMoreForBatch = PR_FALSE;
@@ -1638,6 +1683,7 @@ sbLocalDatabaseMediaListView::OnItemUpdated(sbIMediaList* aMediaList,
   // If we are in a batch, we don't need any more notifications since we always
   // invalidate when a batch ends
   PRBool shouldInvalidate;
+  PRBool sortOnly = PR_FALSE;
   if (mBatchHelper.IsActive()) {
     shouldInvalidate = PR_FALSE;
     mInvalidatePending = PR_TRUE;
@@ -1646,12 +1692,31 @@ sbLocalDatabaseMediaListView::OnItemUpdated(sbIMediaList* aMediaList,
   else {
     // If we are not in a batch, check to see if this update should cause an
     // invalidation
-    rv = ShouldCauseInvalidation(aProperties, &shouldInvalidate);
+    rv = ShouldCauseInvalidation(aProperties, &shouldInvalidate, &sortOnly);
     NS_ENSURE_SUCCESS(rv, rv);
     *aNoMoreForBatch = PR_FALSE;
   }
 
-  if (shouldInvalidate) {
+  if (shouldInvalidate && sortOnly) {
+    // Only the position of the item may have changed, let the view array
+    // move it in place.  It invalidates itself when it can't.
+    nsAutoString guid;
+    rv = aMediaItem->GetGuid(guid);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = mArray->ApplyItemUpdated(guid);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = mSelection->ConfigurationChanged();
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // The row may have stayed where it was
+    if (mTreeView) {
+      rv = mTreeView->InvalidateRowsByGuid(guid);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+  else if (shouldInvalidate) {
     // Invalidate the view array. Properties changed significantly.
     // We need to invalidate length as well in this case.
     nsresult rv = Invalidate(PR_TRUE);
@@ -1773,6 +1838,26 @@ sbLocalDatabaseMediaListView::OnBatchEnd(sbIMediaList* aMediaList)
   return NS_OK;
 }
 
+// sbILocalDatabaseMediaListBatchListener
+NS_IMETHODIMP
+sbLocalDatabaseMediaListView::OnItemsChanged(sbIMediaList* aMediaList,
+                                             sbILocalDatabaseMediaListChanges* aChanges)
+{
+  NS_ENSURE_ARG_POINTER(aMediaList);
+  NS_ENSURE_ARG_POINTER(aChanges);
+
+  // Batched changes come in before the batch ends, which invalidates anyway
+  if (mBatchHelper.IsActive()) {
+    mInvalidatePending = PR_TRUE;
+    return NS_OK;
+  }
+
+  nsresult rv = Invalidate(PR_TRUE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
 nsresult
 sbLocalDatabaseMediaListView::UpdateViewArrayConfiguration(PRBool aClearTreeSelection)
 {
@@ -38,6 +38,7 @@
 #include <nsTHashtable.h>
 #include <prlock.h>
 #include <sbIFilterableMediaListView.h>
+#include <sbILocalDatabaseMediaListBatchListener.h>
 #include <sbIMediaListListener.h>
 #include <sbIMediaListView.h>
 #include <sbIPropertyArray.h>
@@ -63,6 +64,7 @@ class sbLocalDatabaseMediaListViewSelection;
 class sbLocalDatabaseMediaListView : public sbSupportsWeakReference,
                                      public sbIMediaListView,
                                      public sbIMediaListListener,
+                                     public sbILocalDatabaseMediaListBatchListener,
                                      public sbIFilterableMediaListView,
                                      public sbISearchableMediaListView,
                                      public sbISortableMediaListView,
@@ -72,6 +74,7 @@ public:
   NS_DECL_ISUPPORTS
   NS_DECL_SBIMEDIALISTVIEW
   NS_DECL_SBIMEDIALISTLISTENER
+  NS_DECL_SBILOCALDATABASEMEDIALISTBATCHLISTENER
   NS_DECL_SBIFILTERABLEMEDIALISTVIEW
   NS_DECL_SBISEARCHABLEMEDIALISTVIEW
   NS_DECL_SBISORTABLEMEDIALISTVIEW
@@ -161,7 +164,8 @@ private:
                              PRBool* aHasCommonProperty);
 
   nsresult ShouldCauseInvalidation(sbIPropertyArray* aProperties,
-                                   PRBool* aShouldCauseInvalidation);
+                                   PRBool* aShouldCauseInvalidation,
+                                   PRBool* aSortOnly);
 
   nsresult UpdateListener(PRBool aRemoveListener);
 
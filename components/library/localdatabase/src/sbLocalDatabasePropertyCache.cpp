@@ -41,6 +41,7 @@
 #include <nsUnicharUtils.h>
 #include <nsXPCOM.h>
 #include <nsXPCOMCIDInternal.h>
+#include <pratom.h>
 #include <prlog.h>
 #include <nsThreadUtils.h>
 #include <nsIClassInfoImpl.h>
@@ -51,10 +52,14 @@
 #include <nsIPrefService.h>
 
 #include "sbDatabaseResultStringEnumerator.h"
+#include "sbLocalDatabaseFilterSnapshot.h"
 #include "sbLocalDatabaseGUIDArray.h"
+#include "sbLocalDatabaseGUIDArrayLengthCache.h"
+#include "sbLocalDatabaseGUIDArraySortIndex.h"
 #include "sbLocalDatabaseLibrary.h"
 #include "sbLocalDatabaseResourcePropertyBag.h"
 #include "sbLocalDatabaseSchemaInfo.h"
+#include "sbLocalDatabaseSearchIndex.h"
 #include <sbIJobProgressService.h>
 #include <sbTArrayStringEnumerator.h>
 #include <sbStringBundle.h>
@@ -66,6 +71,7 @@
 #include <sbIDatabaseQuery.h>
 #include <sbThreadPoolService.h>
 #include <sbDebugUtils.h>
+#include <sbMemoryUtils.h>
 
 /*
  * To log this module, set the following environment variable:
@@ -73,12 +79,44 @@
  */
 
 /**
- * \brief Number of milliseconds after the last write to force a cache write
+ * \brief Number of milliseconds after the last write to force a cache write.
+ * This is the longest the flush interval gets, and so bounds how long a
+ * change waits to be written.
  */
 #define SB_LOCALDATABASE_CACHE_FLUSH_DELAY (1000)
 
+/**
+ * \brief Shortest flush interval, in milliseconds, used while changes pile up
+ */
+#define SB_LOCALDATABASE_CACHE_MIN_FLUSH_DELAY (125)
+
+/**
+ * \brief Pref holding the most dirty bags written in one transaction. Bigger
+ * writes are split so readers get to the database in between.
+ */
+#define PREF_PROPERTYCACHE_WRITE_BATCH_SIZE "songbird.propertycache.writeBatchSize"
+#define DEFAULT_PROPERTYCACHE_WRITE_BATCH_SIZE (250)
+
+/**
+ * \brief Number of rows of one property written by a single statement
+ */
+#define PROPERTY_WRITE_BATCH_ROWS (32)
+
 #define CACHE_HASHTABLE_SIZE 500
 
+/**
+ * \brief Most item/property pairs remembered for GUID array invalidation;
+ * past this the arrays are simply invalidated
+ */
+#define MAX_DIRTY_ITEMS_FOR_INVALIDATION 1000
+
+/**
+ * \brief Pref holding the most memory, in kilobytes, the cached property
+ * bags of a library may use
+ */
+#define PREF_PROPERTYCACHE_MAX_SIZE "songbird.propertycache.maxSize"
+#define DEFAULT_PROPERTYCACHE_MAX_SIZE (16 * 1024)
+
 
 /**
  * \brief Number of milliseconds between sbIJobProgress notifications
@@ -90,15 +128,27 @@
 #define NS_FINAL_UI_STARTUP_OBSERVER_ID       "final-ui-startup"
 
 
-NS_IMPL_THREADSAFE_ISUPPORTS2(sbLocalDatabasePropertyCache,
+NS_IMPL_THREADSAFE_ISUPPORTS3(sbLocalDatabasePropertyCache,
                               sbILocalDatabasePropertyCache,
+                              sbILocalDatabasePropertyCacheStatistics,
                               nsIObserver)
 
 sbLocalDatabasePropertyCache::sbLocalDatabasePropertyCache()
 : mWritePendingCount(0),
   mDependentGUIDArrayMonitor(nsnull),
   mMonitor(nsnull),
-  mCache(sbLocalDatabasePropertyCache::CACHE_SIZE),
+  mWriteLock(nsnull),
+  mCache(sbLocalDatabasePropertyCache::CACHE_SIZE,
+         PRUint64(DEFAULT_PROPERTYCACHE_MAX_SIZE) * 1024),
+  mDirtyItemsOverflow(PR_FALSE),
+  mFlushInterval(SB_LOCALDATABASE_CACHE_FLUSH_DELAY),
+  mFlushPending(0),
+  mWriteBatchSize(DEFAULT_PROPERTYCACHE_WRITE_BATCH_SIZE),
+  mOldestDirtyTime(0),
+  mFlushCount(0),
+  mLastFlushDuration(0),
+  mLastFlushLatency(0),
+  mMaxFlushLatency(0),
   mLibrary(nsnull),
   mSortInvalidateJob(nsnull)
 {
@@ -117,6 +167,10 @@ sbLocalDatabasePropertyCache::~sbLocalDatabasePropertyCache()
     nsAutoMonitor::DestroyMonitor(mMonitor);
   }
 
+  if (mWriteLock) {
+    nsAutoLock::DestroyLock(mWriteLock);
+  }
+
   MOZ_COUNT_DTOR(sbLocalDatabasePropertyCache);
 }
 
@@ -155,12 +209,35 @@ sbLocalDatabasePropertyCache::Init(sbLocalDatabaseLibrary* aLibrary,
   mMonitor = nsAutoMonitor::NewMonitor("sbLocalDatabasePropertyCache::mMonitor");
   NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
 
+  mWriteLock = nsAutoLock::NewLock("sbLocalDatabasePropertyCache::mWriteLock");
+  NS_ENSURE_TRUE(mWriteLock, NS_ERROR_OUT_OF_MEMORY);
+
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_GetService("@mozilla.org/preferences-service;1", &rv);
+  if (NS_SUCCEEDED(rv)) {
+    PRInt32 maxSize;
+    rv = prefBranch->GetIntPref(PREF_PROPERTYCACHE_MAX_SIZE, &maxSize);
+    if (NS_SUCCEEDED(rv) && maxSize > 0) {
+      mCache.SetBudget(PRUint64(maxSize) * 1024);
+    }
+
+    PRInt32 writeBatchSize;
+    rv = prefBranch->GetIntPref(PREF_PROPERTYCACHE_WRITE_BATCH_SIZE,
+                                &writeBatchSize);
+    if (NS_SUCCEEDED(rv) && writeBatchSize > 0) {
+      mWriteBatchSize = writeBatchSize;
+    }
+  }
+
   rv = LoadProperties();
   NS_ENSURE_SUCCESS(rv, rv);
 
   PRBool success = mDirty.Init(CACHE_HASHTABLE_SIZE);
   NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
 
+  success = mGUIDToID.Init(CACHE_SIZE);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
   mThreadPoolService = do_GetService(SB_THREADPOOLSERVICE_CONTRACTID, &rv);
   NS_ENSURE_SUCCESS(rv, rv);
 
@@ -171,7 +248,7 @@ sbLocalDatabasePropertyCache::Init(sbLocalDatabaseLibrary* aLibrary,
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = mFlushTimer->Init(this,
-                         SB_LOCALDATABASE_CACHE_FLUSH_DELAY,
+                         mFlushInterval,
                          nsITimer::TYPE_REPEATING_SLACK);
   NS_ENSURE_SUCCESS(rv, rv);
 
@@ -236,6 +313,16 @@ sbLocalDatabasePropertyCache::Init(sbLocalDatabaseLibrary* aLibrary,
                            getter_AddRefs(mPropertiesInsertPreparedStatement));
   NS_ENSURE_SUCCESS(rv, rv);
 
+  rv = query->PrepareQuery(
+         sbLocalDatabaseSQL::PropertiesBatchDelete(PROPERTY_WRITE_BATCH_ROWS),
+         getter_AddRefs(mPropertiesBatchDeletePreparedStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->PrepareQuery(
+         sbLocalDatabaseSQL::PropertiesBatchInsert(PROPERTY_WRITE_BATCH_ROWS),
+         getter_AddRefs(mPropertiesBatchInsertPreparedStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
   // Put together the update queries for each property.
   // By preparing these queries in advance we avoid having to recompile them all the time.
   success = mMediaItemsUpdatePreparedStatements.Init(sStaticPropertyCount);
@@ -304,6 +391,8 @@ sbLocalDatabasePropertyCache::Shutdown()
   mMediaItemsFtsAllInsertPreparedStatement = nsnull;
   mPropertiesDeletePreparedStatement = nsnull;
   mPropertiesInsertPreparedStatement = nsnull;
+  mPropertiesBatchDeletePreparedStatement = nsnull;
+  mPropertiesBatchInsertPreparedStatement = nsnull;
 
   mMediaItemsUpdatePreparedStatements.Clear();
   mLibraryMediaItemUpdatePreparedStatements.Clear();
@@ -361,17 +450,29 @@ sbLocalDatabasePropertyCache::RetrievePrimaryProperties(sbIDatabaseQuery* query,
   // but filling in as we find the guids
   aMissesIDs.SetLength(rowCount);
 
+  // Map each guid to its position so placing a row doesn't have to search
+  // the guid list
+  nsDataHashtable<nsStringHashKey, PRUint32> guidIndexes;
+  PRBool success = guidIndexes.Init(length);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+  for (PRUint32 i = length; i-- > 0; ) {
+    nsString const & guid = aGuids[i];
+    if (!guid.IsEmpty()) {
+      success = guidIndexes.Put(guid, i);
+      NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+
   // Variables declared outside of loops to be a little more efficient
-  nsString mediaItemIdStr;
   nsString guid;
   nsString value;
   for (PRUint32 row = 0; row < rowCount; row++) {
 
-    rv = result->GetRowCell(row, 0, mediaItemIdStr);
+    PRInt64 mediaItemIdValue;
+    rv = result->GetRowCellAsInt64(row, 0, &mediaItemIdValue);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    PRUint32 mediaItemId = mediaItemIdStr.ToInteger(&rv);
-    NS_ENSURE_SUCCESS(rv, rv);
+    PRUint32 const mediaItemId = PRUint32(mediaItemIdValue);
 
     rv = result->GetRowCell(row, 1, guid);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -395,12 +496,13 @@ sbLocalDatabasePropertyCache::RetrievePrimaryProperties(sbIDatabaseQuery* query,
     }
 
     // Lookup where we should put this bag and it's ID
-    PRInt32 const index = aGuids.IndexOf(guid);
-    NS_ENSURE_TRUE(index >= 0, NS_ERROR_UNEXPECTED);
+    PRUint32 index;
+    success = guidIndexes.Get(guid, &index);
+    NS_ENSURE_TRUE(success, NS_ERROR_UNEXPECTED);
 
     aMissesIDs[index] = mediaItemId;
 
-    PRBool const success = aIDToBagMap.Put(mediaItemId, bag);
+    success = aIDToBagMap.Put(mediaItemId, bag);
     NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
 
     aBags.ReplaceObjectAt(bag, index);
@@ -410,6 +512,62 @@ sbLocalDatabasePropertyCache::RetrievePrimaryProperties(sbIDatabaseQuery* query,
   return NS_OK;
 }
 
+/**
+ * Fills the property bags from the rows of the secondary property query as
+ * they are read, so the resource_properties rows for a batch of items never
+ * have to be held in memory all at once. Runs on the database thread while
+ * the thread that owns the bags waits on the query.
+ */
+class sbSecondaryPropertyRowCallback : public sbIDatabaseRowCallback
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBIDATABASEROWCALLBACK
+
+  typedef nsInterfaceHashtable<nsUint32HashKey,
+                               sbLocalDatabaseResourcePropertyBag> IDToBagMap;
+
+  sbSecondaryPropertyRowCallback(IDToBagMap const & aBags) :
+    mBags(aBags)
+  {
+  }
+
+private:
+  IDToBagMap const & mBags;
+  nsString mValue;
+};
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbSecondaryPropertyRowCallback,
+                              sbIDatabaseRowCallback)
+
+NS_IMETHODIMP
+sbSecondaryPropertyRowCallback::OnRow(sbIDatabaseResult *aRowResult)
+{
+  NS_ENSURE_ARG_POINTER(aRowResult);
+
+  PRInt64 mediaItemId;
+  nsresult rv = aRowResult->GetRowCellAsInt64(0, 0, &mediaItemId);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
+  mBags.Get(PRUint32(mediaItemId), getter_AddRefs(bag));
+  NS_ENSURE_TRUE(bag, NS_ERROR_FAILURE);
+
+  PRInt64 propertyID;
+  rv = aRowResult->GetRowCellAsInt64(0, 1, &propertyID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = aRowResult->GetRowCell(0, 2, mValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The bags are not in the cache yet and the cache monitor is held by the
+  // thread waiting on this query, so don't take it.
+  rv = bag->PutValueUnlocked(PRUint32(propertyID), mValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
 nsresult
 sbLocalDatabasePropertyCache::RetrieveSecondaryProperties(sbIDatabaseQuery* query,
                                                           nsTArray<PRUint32> itemIDs,
@@ -430,51 +588,19 @@ sbLocalDatabasePropertyCache::RetrieveSecondaryProperties(sbIDatabaseQuery* quer
     NS_ENSURE_SUCCESS(rv, rv);
   }
 
-  PRInt32 dbOk;
-  rv = query->Execute(&dbOk);
-  NS_ENSURE_SUCCESS(rv, rv);
-  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+  // Add each property / object pair to its bag as the rows come in
+  nsRefPtr<sbSecondaryPropertyRowCallback> rowCallback =
+    new sbSecondaryPropertyRowCallback(bags);
+  NS_ENSURE_TRUE(rowCallback, NS_ERROR_OUT_OF_MEMORY);
 
-  nsCOMPtr<sbIDatabaseResult> result;
-  rv = query->GetResultObject(getter_AddRefs(result));
-  NS_ENSURE_TRUE(result, NS_ERROR_FAILURE);
-
-  PRUint32 rowCount;
-  rv = result->GetRowCount(&rowCount);
+  rv = query->SetRowCallback(rowCallback);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsString objSearchable;
-  nsString objSortable;
-  nsString obj;
-  nsString propertyIDStr;
-  nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
-  for (PRUint32 row = 0; row < rowCount; row++) {
-
-    nsString mediaItemIdStr;
-    rv = result->GetRowCell(row, 0, mediaItemIdStr);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    PRUint32 mediaItemId = mediaItemIdStr.ToInteger(&rv);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    bags.Get(mediaItemId, getter_AddRefs(bag));
-    NS_ENSURE_TRUE(bag, NS_ERROR_FAILURE);
-
-    // Add each property / object pair to the current bag
-    rv = result->GetRowCell(row, 1, propertyIDStr);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    PRUint32 propertyID = propertyIDStr.ToInteger(&rv);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    rv = result->GetRowCell(row, 2, obj);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    rv = bag->PutValue(propertyID, obj);
-
-    NS_ENSURE_SUCCESS(rv, rv);
-  }
+  PRInt32 dbOk;
+  rv = query->Execute(&dbOk);
   query->ResetQuery();
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
 
   return NS_OK;
 }
@@ -683,12 +809,28 @@ sbLocalDatabasePropertyCache::CacheProperties(const PRUnichar **aGUIDArray,
   NS_ASSERTION(mLibrary, "You didn't initialize!");
   nsresult rv;
 
-  // If we're asked to cache more than we can store, then just ignore since
-  // it would just do a lot of reads that would be throw away.
-  if (aGUIDArrayCount > CACHE_SIZE) {
-    NS_WARNING("Requested to cache more items than the cache can hold, ignoring request");
-    return NS_OK;
+  // Read the bags a chunk at a time so the monitor isn't held for the whole
+  // request. Stop once this call alone has filled the cache, anything more
+  // would only evict what was just read.
+  PRUint64 bytesRead = 0;
+  for (PRUint32 offset = 0;
+       offset < aGUIDArrayCount && bytesRead < mCache.Budget();
+       offset += CACHE_SIZE) {
+    PRUint32 const chunkCount = PR_MIN(CACHE_SIZE, aGUIDArrayCount - offset);
+    rv = CachePropertiesChunk(aGUIDArray + offset, chunkCount, bytesRead);
+    NS_ENSURE_SUCCESS(rv, rv);
   }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabasePropertyCache::CachePropertiesChunk(const PRUnichar **aGUIDArray,
+                                                   PRUint32 aGUIDArrayCount,
+                                                   PRUint64 & aBytesRead)
+{
+  nsresult rv;
+
   // First, collect all the guids that are not cached
   nsTArray<nsString> misses;
   PRBool cacheLibraryMediaItem = PR_FALSE;
@@ -704,7 +846,7 @@ sbLocalDatabasePropertyCache::CacheProperties(const PRUnichar **aGUIDArray,
 
       nsDependentString guid(aGUIDArray[i]);
 
-      if (mCache.Get(guid) == nsnull) {
+      if (GetCachedBag(guid) == nsnull) {
 
         if (guid.Equals(mLibraryResourceGUID)) {
           cacheLibraryMediaItem = PR_TRUE;
@@ -739,7 +881,7 @@ sbLocalDatabasePropertyCache::CacheProperties(const PRUnichar **aGUIDArray,
         bag->GetGuid(temp);
         NS_ASSERTION(misses[index].Equals(temp), "inserting an bag that doesn't match the guid");
 #endif
-        mCache.Put(misses[index], bag);
+        aBytesRead += PutCachedBag(bag);
       }
     }
 
@@ -750,6 +892,124 @@ sbLocalDatabasePropertyCache::CacheProperties(const PRUnichar **aGUIDArray,
   return NS_OK;
 }
 
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetHits(PRUint64 *aHits)
+{
+  NS_ENSURE_ARG_POINTER(aHits);
+  nsAutoMonitor mon(mMonitor);
+  *aHits = mCache.Hits();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetMisses(PRUint64 *aMisses)
+{
+  NS_ENSURE_ARG_POINTER(aMisses);
+  nsAutoMonitor mon(mMonitor);
+  *aMisses = mCache.Misses();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetEvictions(PRUint64 *aEvictions)
+{
+  NS_ENSURE_ARG_POINTER(aEvictions);
+  nsAutoMonitor mon(mMonitor);
+  *aEvictions = mCache.Evictions();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetCount(PRUint32 *aCount)
+{
+  NS_ENSURE_ARG_POINTER(aCount);
+  nsAutoMonitor mon(mMonitor);
+  *aCount = mCache.Count();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetBytes(PRUint64 *aBytes)
+{
+  NS_ENSURE_ARG_POINTER(aBytes);
+  nsAutoMonitor mon(mMonitor);
+  *aBytes = mCache.Cost();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetCapacity(PRUint64 *aCapacity)
+{
+  NS_ENSURE_ARG_POINTER(aCapacity);
+  nsAutoMonitor mon(mMonitor);
+  *aCapacity = mCache.Budget();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetPendingWrites(PRUint32 *aPendingWrites)
+{
+  NS_ENSURE_ARG_POINTER(aPendingWrites);
+  nsAutoMonitor mon(mMonitor);
+  *aPendingWrites = mDirty.Count();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetFlushes(PRUint64 *aFlushes)
+{
+  NS_ENSURE_ARG_POINTER(aFlushes);
+  nsAutoMonitor mon(mMonitor);
+  *aFlushes = mFlushCount;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetLastFlushDuration(PRUint32 *aLastFlushDuration)
+{
+  NS_ENSURE_ARG_POINTER(aLastFlushDuration);
+  nsAutoMonitor mon(mMonitor);
+  *aLastFlushDuration = mLastFlushDuration;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetLastFlushLatency(PRUint32 *aLastFlushLatency)
+{
+  NS_ENSURE_ARG_POINTER(aLastFlushLatency);
+  nsAutoMonitor mon(mMonitor);
+  *aLastFlushLatency = mLastFlushLatency;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetMaxFlushLatency(PRUint32 *aMaxFlushLatency)
+{
+  NS_ENSURE_ARG_POINTER(aMaxFlushLatency);
+  nsAutoMonitor mon(mMonitor);
+  *aMaxFlushLatency = mMaxFlushLatency;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetFlushInterval(PRUint32 *aFlushInterval)
+{
+  NS_ENSURE_ARG_POINTER(aFlushInterval);
+  nsAutoMonitor mon(mMonitor);
+  *aFlushInterval = mFlushInterval;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::ResetStatistics()
+{
+  nsAutoMonitor mon(mMonitor);
+  mCache.ResetStatistics();
+  mFlushCount = 0;
+  mMaxFlushLatency = 0;
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 sbLocalDatabasePropertyCache::GetProperties(const PRUnichar **aGUIDArray,
                                             PRUint32 aGUIDArrayCount,
@@ -789,9 +1049,13 @@ sbLocalDatabasePropertyCache::GetProperties(const PRUnichar **aGUIDArray,
     nsDependentString const guid(aGUIDArray[i]);
     sbLocalDatabaseResourcePropertyBag * bag = nsnull;
 
+    // Hash the guid once, everything after works on the media item id
+    PRUint32 mediaItemId;
+    PRBool const known = mGUIDToID.Get(guid, &mediaItemId);
+
     // If the bag has a pending write waiting we need to get it into the
     // database so that what is returned is consistent.
-    if (mDirty.Get(guid, nsnull)) {
+    if (known && IsDirty(mediaItemId, guid)) {
       // Write will acquire the lock as necessary. Write will 
       // also potentially have to call back into the property 
       // cache on the main thread to invalidate the GUID arrays.
@@ -804,7 +1068,12 @@ sbLocalDatabasePropertyCache::GetProperties(const PRUnichar **aGUIDArray,
       mon.Enter();
     }
 
-    bag = mCache.Get(guid);
+    if (known) {
+      bag = GetCachedBag(mediaItemId, guid);
+    }
+    else {
+      mCache.NoteMiss();
+    }
     if (bag) {
       // Bag is not addref from mCache, and propertyBagArray is straight
       // pointers
@@ -852,7 +1121,7 @@ sbLocalDatabasePropertyCache::GetProperties(const PRUnichar **aGUIDArray,
             bag->GetGuid(temp);
             NS_ASSERTION(temp.Equals(aGUIDArray[missIndex]), "inserting an bag that doesn't match the guid");
 #endif
-            mCache.Put(nsDependentString(aGUIDArray[missIndex]), bag);
+            PutCachedBag(bag);
           }
           NS_ADDREF(propertyBagArray[missIndex] = bag);
         }
@@ -879,6 +1148,63 @@ sbLocalDatabasePropertyCache::GetProperties(const PRUnichar **aGUIDArray,
   return NS_OK;
 }
 
+NS_IMETHODIMP
+sbLocalDatabasePropertyCache::GetCurrentProperties(const nsAString& aGUID,
+                                                   sbILocalDatabaseResourcePropertyBag** _retval)
+{
+  return GetCurrentProperties(aGUID, _retval, nsnull);
+}
+
+nsresult
+sbLocalDatabasePropertyCache::GetCurrentProperties(const nsAString& aGuid,
+                                                   sbILocalDatabaseResourcePropertyBag** _retval,
+                                                   PRBool* aIsDirty)
+{
+  NS_ASSERTION(mLibrary, "You didn't initialize!");
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  if (aIsDirty) {
+    *aIsDirty = PR_FALSE;
+  }
+
+  {
+    nsAutoMonitor mon(mMonitor);
+
+    PRUint32 mediaItemId;
+    if (mGUIDToID.Get(aGuid, &mediaItemId)) {
+      // A dirty bag already holds the values that are waiting to be written
+      nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
+      if (mDirty.Get(mediaItemId, getter_AddRefs(bag)) &&
+          bag->Guid().Equals(aGuid)) {
+        if (aIsDirty) {
+          *aIsDirty = PR_TRUE;
+        }
+      }
+      else {
+        bag = GetCachedBag(mediaItemId, aGuid);
+      }
+      if (bag) {
+        NS_ADDREF(*_retval = bag);
+        return NS_OK;
+      }
+    }
+  }
+
+  nsString guid(aGuid);
+  const PRUnichar* guidPtr = guid.get();
+  PRUint32 bagsCount = 0;
+  sbILocalDatabaseResourcePropertyBag** bags = nsnull;
+  nsresult rv = GetProperties(&guidPtr, 1, &bagsCount, &bags);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  sbAutoFreeXPCOMPointerArray<sbILocalDatabaseResourcePropertyBag>
+    autoBags(bagsCount, bags);
+  NS_ENSURE_TRUE(bagsCount == 1 && bags[0], NS_ERROR_NOT_AVAILABLE);
+
+  NS_ADDREF(*_retval = bags[0]);
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 sbLocalDatabasePropertyCache::SetProperties(const PRUnichar **aGUIDArray,
                                             PRUint32 aGUIDArrayCount,
@@ -902,7 +1228,7 @@ sbLocalDatabasePropertyCache::SetProperties(const PRUnichar **aGUIDArray,
       nsDependentString const guid(aGUIDArray[i]);
       nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
 
-      bag = mCache.Get(guid);
+      bag = GetCachedBag(guid);
       // If it's not cached we need to create a new bag
       if (!bag) {
         PRUint32 mediaItemId;
@@ -928,7 +1254,8 @@ sbLocalDatabasePropertyCache::SetProperties(const PRUnichar **aGUIDArray,
         bag->SetProperty(id, value);
       }
       NS_ENSURE_TRUE(bag, NS_ERROR_UNEXPECTED);
-      mDirty.Put(guid, bag);
+      mDirty.Put(bag->MediaItemId(), bag);
+      mGUIDToID.Put(guid, bag->MediaItemId());
     }
   }
 
@@ -940,6 +1267,176 @@ sbLocalDatabasePropertyCache::SetProperties(const PRUnichar **aGUIDArray,
   return rv;
 }
 
+/**
+ * Collects the resource_properties rows of a write by property, so the rows
+ * of one property go out in a few multi-row statements rather than one
+ * statement each
+ */
+class PropertyWriteBatch
+{
+public:
+  PropertyWriteBatch(sbLocalDatabasePropertyCache * aCache) :
+                       mCache(aCache) {}
+
+  nsresult AddDelete(PRUint32 aPropertyDBID, PRUint32 aMediaItemID);
+  nsresult AddInsert(PRUint32 aPropertyDBID,
+                     PRUint32 aMediaItemID,
+                     const nsAString & aValue,
+                     const nsAString & aSearchable,
+                     const nsAString & aSortable,
+                     const nsAString & aSecondarySortable);
+
+  /**
+   * Adds the statements writing the collected rows to aQuery and forgets
+   * the rows
+   */
+  nsresult AddStatements(sbIDatabaseQuery * aQuery);
+private:
+  struct Row {
+    PRUint32 mediaItemID;
+    nsString value;
+    nsString searchable;
+    nsString sortable;
+    nsString secondarySortable;
+  };
+  struct PropertyRows {
+    nsTArray<PRUint32> deletes;
+    nsTArray<Row> inserts;
+  };
+
+  // Non-owning reference
+  sbLocalDatabasePropertyCache * mCache;
+  std::map<PRUint32, PropertyRows> mProperties;
+};
+
+nsresult PropertyWriteBatch::AddDelete(PRUint32 aPropertyDBID,
+                                       PRUint32 aMediaItemID)
+{
+  PRUint32 * id = mProperties[aPropertyDBID].deletes.AppendElement(aMediaItemID);
+  NS_ENSURE_TRUE(id, NS_ERROR_OUT_OF_MEMORY);
+  return NS_OK;
+}
+
+nsresult PropertyWriteBatch::AddInsert(PRUint32 aPropertyDBID,
+                                       PRUint32 aMediaItemID,
+                                       const nsAString & aValue,
+                                       const nsAString & aSearchable,
+                                       const nsAString & aSortable,
+                                       const nsAString & aSecondarySortable)
+{
+  Row * row = mProperties[aPropertyDBID].inserts.AppendElement();
+  NS_ENSURE_TRUE(row, NS_ERROR_OUT_OF_MEMORY);
+
+  row->mediaItemID = aMediaItemID;
+  row->value = aValue;
+  row->searchable = aSearchable;
+  row->sortable = aSortable;
+  row->secondarySortable = aSecondarySortable;
+  return NS_OK;
+}
+
+nsresult PropertyWriteBatch::AddStatements(sbIDatabaseQuery * aQuery)
+{
+  nsresult rv;
+
+  std::map<PRUint32, PropertyRows>::const_iterator it = mProperties.begin();
+  for (; it != mProperties.end(); ++it) {
+    PRUint32 const propertyDBID = it->first;
+
+    // Full batches go through the multi-row statements, the rest one row at
+    // a time rather than preparing a statement for every row count.
+    nsTArray<PRUint32> const & deletes = it->second.deletes;
+    PRUint32 const deleteCount = deletes.Length();
+    PRUint32 i = 0;
+    for (; i + PROPERTY_WRITE_BATCH_ROWS <= deleteCount;
+         i += PROPERTY_WRITE_BATCH_ROWS) {
+      rv = aQuery->AddPreparedStatement(
+             mCache->mPropertiesBatchDeletePreparedStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(0, propertyDBID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      for (PRUint32 j = 0; j < PROPERTY_WRITE_BATCH_ROWS; ++j) {
+        rv = aQuery->BindInt32Parameter(1 + j, deletes[i + j]);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+    }
+    for (; i < deleteCount; ++i) {
+      rv = aQuery->AddPreparedStatement(
+             mCache->mPropertiesDeletePreparedStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(0, deletes[i]);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(1, propertyDBID);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
+    nsTArray<Row> const & inserts = it->second.inserts;
+    PRUint32 const insertCount = inserts.Length();
+    i = 0;
+    for (; i + PROPERTY_WRITE_BATCH_ROWS <= insertCount;
+         i += PROPERTY_WRITE_BATCH_ROWS) {
+      rv = aQuery->AddPreparedStatement(
+             mCache->mPropertiesBatchInsertPreparedStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(0, propertyDBID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      for (PRUint32 j = 0; j < PROPERTY_WRITE_BATCH_ROWS; ++j) {
+        Row const & row = inserts[i + j];
+        PRUint32 const param = 1 + j * 5;
+
+        rv = aQuery->BindInt32Parameter(param, row.mediaItemID);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = aQuery->BindStringParameter(param + 1, row.value);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = aQuery->BindStringParameter(param + 2, row.searchable);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = aQuery->BindStringParameter(param + 3, row.sortable);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = aQuery->BindStringParameter(param + 4, row.secondarySortable);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+    }
+    for (; i < insertCount; ++i) {
+      Row const & row = inserts[i];
+
+      rv = aQuery->AddPreparedStatement(
+             mCache->mPropertiesInsertPreparedStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(0, row.mediaItemID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindInt32Parameter(1, propertyDBID);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindStringParameter(2, row.value);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindStringParameter(3, row.searchable);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindStringParameter(4, row.sortable);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = aQuery->BindStringParameter(5, row.secondarySortable);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  mProperties.clear();
+  return NS_OK;
+}
+
 /**
  * Used to enumerate dirty properties and build the property queries
  */
@@ -949,11 +1446,13 @@ public:
   DirtyPropertyEnumerator(sbLocalDatabasePropertyCache * aCache,
                           sbLocalDatabaseResourcePropertyBag * aBag,
                           sbIDatabaseQuery * aQuery,
+                          PropertyWriteBatch * aWriteBatch,
                           PRUint32 aMediaItemID,
                           PRBool aIsLibrary) :
                             mCache(aCache),
                             mBag(aBag),
                             mQuery(aQuery),
+                            mWriteBatch(aWriteBatch),
                             mMediaItemID(aMediaItemID),
                             mIsLibrary(aIsLibrary) {}
   nsresult Process(PRUint32 aDirtyPropertyKey);
@@ -964,6 +1463,8 @@ private:
   sbLocalDatabaseResourcePropertyBag * mBag;
   // Non-owning reference
   sbIDatabaseQuery * mQuery;
+  // Non-owning reference
+  PropertyWriteBatch * mWriteBatch;
   PRUint32 mMediaItemID;
   PRBool mIsLibrary;
   nsTArray<nsString> mTopLevelSets;
@@ -1033,13 +1534,7 @@ nsresult DirtyPropertyEnumerator::Process(PRUint32 aDirtyPropertyKey)
   }
   else { //Regular properties all go in the same spot.
     if (value.IsVoid()) {
-      rv = mQuery->AddPreparedStatement(mCache->mPropertiesDeletePreparedStatement);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindInt32Parameter(0, mMediaItemID);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindInt32Parameter(1, aDirtyPropertyKey);
+      rv = mWriteBatch->AddDelete(aDirtyPropertyKey, mMediaItemID);
       NS_ENSURE_SUCCESS(rv, rv);
     }
     else {
@@ -1056,25 +1551,12 @@ nsresult DirtyPropertyEnumerator::Process(PRUint32 aDirtyPropertyKey)
                      aDirtyPropertyKey, secondarySortable);
       NS_ENSURE_SUCCESS(rv, rv);
 
-      rv = mQuery->AddPreparedStatement(mCache->mPropertiesInsertPreparedStatement);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindInt32Parameter(0, mMediaItemID);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindInt32Parameter(1, aDirtyPropertyKey);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindStringParameter(2, value);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindStringParameter(3, searchable);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindStringParameter(4, sortable);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      rv = mQuery->BindStringParameter(5, secondarySortable);
+      rv = mWriteBatch->AddInsert(aDirtyPropertyKey,
+                                  mMediaItemID,
+                                  value,
+                                  searchable,
+                                  sortable,
+                                  secondarySortable);
       NS_ENSURE_SUCCESS(rv, rv);
     }
   }
@@ -1100,19 +1582,19 @@ struct DirtyItems
 };
 
 PR_STATIC_CALLBACK(PLDHashOperator)
-EnumDirtyItems(nsAString const &aKey, sbLocalDatabaseResourcePropertyBag * aBag, void *aClosure)
+EnumDirtyItems(PRUint32 const &aKey, sbLocalDatabaseResourcePropertyBag * aBag, void *aClosure)
 {
   DirtyItems *dirtyItem = static_cast<DirtyItems *>(aClosure);
-  NS_ENSURE_TRUE(dirtyItem->mGUIDs.AppendElement(aKey),
+  NS_ENSURE_TRUE(dirtyItem->mGUIDs.AppendElement(aBag->Guid()),
+                 PL_DHASH_STOP);
+  NS_ENSURE_TRUE(dirtyItem->mIDs.AppendElement(aKey),
                  PL_DHASH_STOP);
-  nsresult rv = aBag->GetMediaItemId(dirtyItem->mIDs.AppendElement());
-  NS_ENSURE_SUCCESS(rv, PL_DHASH_STOP);
 
   return PL_DHASH_NEXT;
 }
 
 PR_STATIC_CALLBACK(PLDHashOperator)
-EnumDirtyItemsSetDirty(nsAString const & aKey, sbLocalDatabaseResourcePropertyBag * aBag, void *aClosure)
+EnumDirtyItemsSetDirty(PRUint32 const & aKey, sbLocalDatabaseResourcePropertyBag * aBag, void *aClosure)
 {
   aBag->ClearDirty();
   return PL_DHASH_NEXT;
@@ -1126,8 +1608,27 @@ sbLocalDatabasePropertyCache::Write()
   NS_ASSERTION(mLibrary, "You didn't initialize!");
   nsresult rv = NS_OK;
 
-  nsCOMPtr<sbIDatabaseQuery> query;
+  // One transaction per mWriteBatchSize dirty bags, so a big write doesn't
+  // keep readers out of the database for long
+  nsCOMArray<sbIDatabaseQuery> queries;
   PRUint32 dirtyItemCount;
+  PRIntervalTime oldestDirtyTime;
+
+  // The searchable values for the search index, which keeps its own words
+  nsRefPtr<sbLocalDatabaseSearchIndex> searchIndex;
+  if (mLibrary && mLibrary->mSearchIndex &&
+      mLibrary->mSearchIndex->IsEnabled()) {
+    searchIndex = mLibrary->mSearchIndex;
+  }
+  nsTArray<PRUint32> searchItemIDs;
+  nsTArray<PRUint32> searchValueItemIDs;
+  nsTArray<PRUint32> searchPropertyIDs;
+  nsTArray<nsString> searchValues;
+
+  // Writes run on the flush threads as well as on their callers, one at a
+  // time so they commit in the order they took the dirty bags
+  nsAutoLock writeLock(mWriteLock);
+
   { // find the new dirty properties
     DirtyItems dirtyItems;
 
@@ -1145,103 +1646,181 @@ sbLocalDatabasePropertyCache::Write()
     if (!dirtyItemCount)
       return NS_OK;
 
-    rv = MakeQuery(getter_AddRefs(query));
-    NS_ENSURE_SUCCESS(rv, rv);
+    oldestDirtyTime = mOldestDirtyTime;
 
-    rv = query->AddQuery(NS_LITERAL_STRING("begin"));
-    NS_ENSURE_SUCCESS(rv, rv);
+    PropertyWriteBatch writeBatch(this);
+    for (PRUint32 first = 0; first < dirtyItemCount; first += mWriteBatchSize) {
+      PRUint32 const last = PR_MIN(first + mWriteBatchSize, dirtyItemCount);
 
-    // Run through the list of dirty items and build the fts delete/insert
-    // queries
-    for (PRUint32 i = 0; i < dirtyItemCount; ++i) {
-      rv = query->AddPreparedStatement(mMediaItemsFtsAllDeletePreparedStatement);
+      nsCOMPtr<sbIDatabaseQuery> query;
+      rv = MakeQuery(getter_AddRefs(query));
       NS_ENSURE_SUCCESS(rv, rv);
-      rv = query->BindInt32Parameter(0, dirtyItems.mIDs[i]);
+
+      rv = query->AddQuery(NS_LITERAL_STRING("begin"));
       NS_ENSURE_SUCCESS(rv, rv);
-    }
 
-    //For each GUID, there's a property bag that needs to be processed as well.
-    for(PRUint32 i = 0; i < dirtyItemCount; ++i) {
-      nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
-      nsString const guid(dirtyItems.mGUIDs[i]);
-      if (mDirty.Get(guid, getter_AddRefs(bag))) {
+      // Run through the list of dirty items and build the fts delete/insert
+      // queries
+      for (PRUint32 i = first; i < last; ++i) {
+        rv = query->AddPreparedStatement(mMediaItemsFtsAllDeletePreparedStatement);
+        NS_ENSURE_SUCCESS(rv, rv);
+        rv = query->BindInt32Parameter(0, dirtyItems.mIDs[i]);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
 
+      //For each GUID, there's a property bag that needs to be processed as well.
+      for(PRUint32 i = first; i < last; ++i) {
+        nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
+        nsString const & guid = dirtyItems.mGUIDs[i];
         PRUint32 const mediaItemId = dirtyItems.mIDs[i];
+        if (mDirty.Get(mediaItemId, getter_AddRefs(bag))) {
 
-        PRBool const isLibrary = guid.Equals(mLibraryResourceGUID);
+          PRBool const isLibrary = guid.Equals(mLibraryResourceGUID);
 
-        DirtyPropertyEnumerator dirtyPropertyEnumerator(this,
-                                                        bag,
-                                                        query,
-                                                        mediaItemId,
-                                                        isLibrary);
-        PRUint32 dirtyPropsCount;
-        rv = bag->EnumerateDirty(EnumDirtyProps, (void *) &dirtyPropertyEnumerator, &dirtyPropsCount);
-        NS_ENSURE_SUCCESS(rv, rv);
+          if (searchIndex) {
+            NS_ENSURE_TRUE(searchItemIDs.AppendElement(mediaItemId),
+                           NS_ERROR_OUT_OF_MEMORY);
+          }
 
-        // Build a new FTS data table entry by concatenating all the user-viewable properties.
-        // NOTE: This includes both top-level and not-top-level properties!
-        // TODO: Look at top level properties to see if you want them searchable!
-        nsString newFTSData;
-        nsCOMPtr<nsIStringEnumerator> bagProperties;
-        rv = bag->GetIds(getter_AddRefs(bagProperties));
-        NS_ENSURE_SUCCESS(rv, rv);
-        PRBool hasMore;
-        while (NS_SUCCEEDED(bagProperties->HasMore(&hasMore)) && hasMore) {
-          nsAutoString propertyId;
-          rv = bagProperties->GetNext(propertyId);
+          DirtyPropertyEnumerator dirtyPropertyEnumerator(this,
+                                                          bag,
+                                                          query,
+                                                          &writeBatch,
+                                                          mediaItemId,
+                                                          isLibrary);
+          PRUint32 dirtyPropsCount;
+          rv = bag->EnumerateDirty(EnumDirtyProps, (void *) &dirtyPropertyEnumerator, &dirtyPropsCount);
           NS_ENSURE_SUCCESS(rv, rv);
 
-          PRBool hasProperty, isUserViewable;
-          rv = mPropertyManager->HasProperty(propertyId, &hasProperty);
+          // Build a new FTS data table entry by concatenating all the user-viewable properties.
+          // NOTE: This includes both top-level and not-top-level properties!
+          // TODO: Look at top level properties to see if you want them searchable!
+          nsString newFTSData;
+          nsCOMPtr<nsIStringEnumerator> bagProperties;
+          rv = bag->GetIds(getter_AddRefs(bagProperties));
           NS_ENSURE_SUCCESS(rv, rv);
-          if (!hasProperty) {
-            continue;
-          }
+          PRBool hasMore;
+          while (NS_SUCCEEDED(bagProperties->HasMore(&hasMore)) && hasMore) {
+            nsAutoString propertyId;
+            rv = bagProperties->GetNext(propertyId);
+            NS_ENSURE_SUCCESS(rv, rv);
 
-          nsCOMPtr<sbIPropertyInfo> propertyInfo;
-          rv = mPropertyManager->GetPropertyInfo(propertyId,
-                                                 getter_AddRefs(propertyInfo));
-          NS_ENSURE_SUCCESS(rv,rv);
-          rv = propertyInfo->GetUserViewable(&isUserViewable);
-          NS_ENSURE_SUCCESS(rv,rv);
+            PRBool hasProperty, isUserViewable;
+            rv = mPropertyManager->HasProperty(propertyId, &hasProperty);
+            NS_ENSURE_SUCCESS(rv, rv);
+            if (!hasProperty) {
+              continue;
+            }
+
+            nsCOMPtr<sbIPropertyInfo> propertyInfo;
+            rv = mPropertyManager->GetPropertyInfo(propertyId,
+                                                   getter_AddRefs(propertyInfo));
+            NS_ENSURE_SUCCESS(rv,rv);
+            rv = propertyInfo->GetUserViewable(&isUserViewable);
+            NS_ENSURE_SUCCESS(rv,rv);
+
+            if (isUserViewable) {
+              PRUint32 propertyDBID;
+              rv = GetPropertyDBID(propertyId, &propertyDBID);
+              NS_ENSURE_SUCCESS(rv, rv);
+              nsString propertySearchable;
+              rv = bag->GetSearchablePropertyByID(propertyDBID, propertySearchable);
+              NS_ENSURE_SUCCESS(rv, rv);
+              newFTSData.Append(propertySearchable);
+              newFTSData.AppendLiteral(" ");
+
+              // The search index only keeps the properties stored in
+              // resource_properties, which it is built from
+              if (searchIndex && !propertySearchable.IsEmpty() &&
+                  !SB_IsTopLevelProperty(propertyDBID)) {
+                NS_ENSURE_TRUE(searchValueItemIDs.AppendElement(mediaItemId),
+                               NS_ERROR_OUT_OF_MEMORY);
+                NS_ENSURE_TRUE(searchPropertyIDs.AppendElement(propertyDBID),
+                               NS_ERROR_OUT_OF_MEMORY);
+                NS_ENSURE_TRUE(searchValues.AppendElement(propertySearchable),
+                               NS_ERROR_OUT_OF_MEMORY);
+              }
+            }
+          }
 
-          if (isUserViewable) {
-            PRUint32 propertyDBID;
-            rv = GetPropertyDBID(propertyId, &propertyDBID);
+          if (!newFTSData.IsEmpty()) {
+            rv = query->AddPreparedStatement(mMediaItemsFtsAllInsertPreparedStatement);
+            NS_ENSURE_SUCCESS(rv, rv);
+            rv = query->BindInt32Parameter(0, dirtyItems.mIDs[i]);
             NS_ENSURE_SUCCESS(rv, rv);
-            nsString propertySearchable;
-            rv = bag->GetSearchablePropertyByID(propertyDBID, propertySearchable);
+            rv = query->BindStringParameter(1, newFTSData);
             NS_ENSURE_SUCCESS(rv, rv);
-            newFTSData.Append(propertySearchable);
-            newFTSData.AppendLiteral(" ");
           }
         }
+      }
 
-        if (!newFTSData.IsEmpty()) {
-          rv = query->AddPreparedStatement(mMediaItemsFtsAllInsertPreparedStatement);
-          NS_ENSURE_SUCCESS(rv, rv);
-          rv = query->BindInt32Parameter(0, dirtyItems.mIDs[i]);
-          NS_ENSURE_SUCCESS(rv, rv);
-          rv = query->BindStringParameter(1, newFTSData);
-          NS_ENSURE_SUCCESS(rv, rv);
-        }
+      // The regular properties of the whole chunk, grouped by property
+      rv = writeBatch.AddStatements(query);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = query->AddQuery(NS_LITERAL_STRING("commit"));
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      NS_ENSURE_TRUE(queries.AppendObject(query), NS_ERROR_OUT_OF_MEMORY);
+    }
+
+    mDirty.EnumerateRead(EnumDirtyItemsSetDirty, nsnull);
+
+    //Clear out dirty guid hashtable, keeping the bags alive long enough to
+    //drop the guids of those that aren't cached.
+    nsCOMArray<sbLocalDatabaseResourcePropertyBag> written(dirtyItemCount);
+    for (PRUint32 i = 0; i < dirtyItemCount; ++i) {
+      nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
+      if (mDirty.Get(dirtyItems.mIDs[i], getter_AddRefs(bag))) {
+        written.AppendObject(bag);
       }
     }
+    mDirty.Clear();
+    for (PRInt32 i = 0; i < written.Count(); ++i) {
+      // A cached bag is only costed when it is put in the cache, put it
+      // back so the properties it gained since count against the budget
+      sbLocalDatabaseResourcePropertyBag * const bag = written[i];
+      if (mCache.Peek(bag->MediaItemId()) == bag) {
+        PutCachedBag(bag);
+      }
+    }
+    for (PRInt32 i = 0; i < written.Count(); ++i) {
+      ReleaseGUID(written[i]);
+    }
+  }
 
-    rv = query->AddQuery(NS_LITERAL_STRING("commit"));
+  PRIntervalTime const writeStart = PR_IntervalNow();
+  for (PRInt32 i = 0; i < queries.Count(); ++i) {
+    PRInt32 dbOk;
+    rv = queries[i]->Execute(&dbOk);
     NS_ENSURE_SUCCESS(rv, rv);
+    NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+  }
 
-    mDirty.EnumerateRead(EnumDirtyItemsSetDirty, nsnull);
+  PRIntervalTime const now = PR_IntervalNow();
+  PRUint32 const duration = PR_IntervalToMilliseconds(now - writeStart);
+  {
+    nsAutoMonitor mon(mMonitor);
+    ++mFlushCount;
+    mLastFlushDuration = duration;
+    mLastFlushLatency = PR_IntervalToMilliseconds(now - oldestDirtyTime);
+    if (mLastFlushLatency > mMaxFlushLatency) {
+      mMaxFlushLatency = mLastFlushLatency;
+    }
+  }
 
-    //Clear out dirty guid hashtable.
-    mDirty.Clear();
+  LOG("property cache wrote %u items in %d transactions, %u ms",
+      dirtyItemCount, queries.Count(), duration);
+
+  if (searchIndex) {
+    rv = searchIndex->UpdateItems(searchItemIDs,
+                                  searchValueItemIDs,
+                                  searchPropertyIDs,
+                                  searchValues);
+    NS_ENSURE_SUCCESS(rv, rv);
   }
 
-  PRInt32 dbOk;
-  rv = query->Execute(&dbOk);
-  NS_ENSURE_SUCCESS(rv, rv);
-  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+  writeLock.unlock();
 
   if(!NS_IsMainThread()) {
     nsCOMPtr<nsIThread> mainThread;
@@ -1333,6 +1912,9 @@ sbLocalDatabasePropertyCache::Observe(nsISupports* aSubject,
     }
   } else if (strcmp(aTopic, NS_TIMER_CALLBACK_TOPIC) == 0) {
     if(SameCOMIdentity(aSubject, mFlushTimer)) {
+      rv = AdjustFlushInterval();
+      NS_ENSURE_SUCCESS(rv, rv);
+
       rv = DispatchFlush();
       NS_ENSURE_SUCCESS(rv, rv);
     }
@@ -1452,12 +2034,24 @@ sbLocalDatabasePropertyCache::RemoveDependentGUIDArray(
 nsresult
 sbLocalDatabasePropertyCache::DispatchFlush()
 {
+  // A flush that hasn't started yet will pick up anything changed since it
+  // was dispatched, so don't queue another one behind it
+  if (PR_AtomicSet(&mFlushPending, 1)) {
+    return NS_OK;
+  }
+
   nsCOMPtr<nsIRunnable> runnable =
     NS_NEW_RUNNABLE_METHOD(sbLocalDatabasePropertyCache, this, RunFlushThread);
-  NS_ENSURE_TRUE(runnable, NS_ERROR_FAILURE);
+  if (!runnable) {
+    PR_AtomicSet(&mFlushPending, 0);
+    return NS_ERROR_FAILURE;
+  }
 
   nsresult rv = mThreadPoolService->Dispatch(runnable, NS_DISPATCH_NORMAL);
-  NS_ENSURE_SUCCESS(rv, rv);
+  if (NS_FAILED(rv)) {
+    PR_AtomicSet(&mFlushPending, 0);
+    return rv;
+  }
 
   LOG("property cache flush operation dispatched");
 
@@ -1467,10 +2061,43 @@ sbLocalDatabasePropertyCache::DispatchFlush()
 void
 sbLocalDatabasePropertyCache::RunFlushThread()
 {
+  PR_AtomicSet(&mFlushPending, 0);
+
   nsresult SB_UNUSED_IN_RELEASE(rv) = Write();
   NS_ASSERTION(NS_SUCCEEDED(rv), "Failed to flush property cache; will retry");
 }
 
+nsresult
+sbLocalDatabasePropertyCache::AdjustFlushInterval()
+{
+  PRUint32 interval;
+  {
+    nsAutoMonitor mon(mMonitor);
+
+    PRUint32 const pending = mDirty.Count();
+    interval = mFlushInterval;
+
+    // More than a transaction's worth of changes came in since the last
+    // flush, write more often to keep each write short.  Once changes slow
+    // down go back to coalescing them over the full delay.
+    if (pending >= mWriteBatchSize) {
+      interval = PR_MAX(interval / 2, SB_LOCALDATABASE_CACHE_MIN_FLUSH_DELAY);
+    }
+    else if (pending < mWriteBatchSize / 4) {
+      interval = PR_MIN(interval * 2, SB_LOCALDATABASE_CACHE_FLUSH_DELAY);
+    }
+
+    if (interval == mFlushInterval) {
+      return NS_OK;
+    }
+    mFlushInterval = interval;
+  }
+
+  LOG("property cache flush interval now %u ms", interval);
+
+  return mFlushTimer->SetDelay(interval);
+}
+
 nsresult
 sbLocalDatabasePropertyCache::MakeQuery(sbIDatabaseQuery** _retval)
 {
@@ -1579,19 +2206,102 @@ sbLocalDatabasePropertyCache::LoadProperties()
   return NS_OK;
 }
 
+sbLocalDatabaseResourcePropertyBag *
+sbLocalDatabasePropertyCache::GetCachedBag(const nsAString &aGuid)
+{
+  PRUint32 mediaItemId;
+  if (!mGUIDToID.Get(aGuid, &mediaItemId)) {
+    mCache.NoteMiss();
+    return nsnull;
+  }
+
+  return GetCachedBag(mediaItemId, aGuid);
+}
+
+sbLocalDatabaseResourcePropertyBag *
+sbLocalDatabasePropertyCache::GetCachedBag(PRUint32 aMediaItemId,
+                                           const nsAString &aGuid)
+{
+  // Media item ids can be reused once an item is deleted, so make sure the
+  // bag really is for this guid.
+  sbLocalDatabaseResourcePropertyBag * const bag = mCache.Get(aMediaItemId);
+  if (bag && !bag->Guid().Equals(aGuid)) {
+    return nsnull;
+  }
+  return bag;
+}
+
+PRUint32
+sbLocalDatabasePropertyCache::PutCachedBag(sbLocalDatabaseResourcePropertyBag * aBag)
+{
+  PRUint32 const mediaItemId = aBag->MediaItemId();
+
+  // A bag for a deleted item may still sit under a reused id
+  nsRefPtr<sbLocalDatabaseResourcePropertyBag> replaced =
+    mCache.Peek(mediaItemId);
+
+  PRUint32 const size = aBag->GetEstimatedSize();
+  nsCOMArray<sbLocalDatabaseResourcePropertyBag> evicted;
+  mCache.Put(mediaItemId, aBag, size, &evicted);
+  mGUIDToID.Put(aBag->Guid(), mediaItemId);
+
+  if (replaced && replaced != aBag) {
+    ReleaseGUID(replaced);
+  }
+  for (PRInt32 i = 0; i < evicted.Count(); ++i) {
+    ReleaseGUID(evicted[i]);
+  }
+
+  return size;
+}
+
+PRBool
+sbLocalDatabasePropertyCache::IsDirty(PRUint32 aMediaItemId,
+                                      const nsAString &aGuid)
+{
+  nsRefPtr<sbLocalDatabaseResourcePropertyBag> bag;
+  return mDirty.Get(aMediaItemId, getter_AddRefs(bag)) &&
+         bag->Guid().Equals(aGuid);
+}
+
+void
+sbLocalDatabasePropertyCache::ReleaseGUID(sbLocalDatabaseResourcePropertyBag * aBag)
+{
+  nsString const & guid = aBag->Guid();
+
+  PRUint32 mediaItemId;
+  if (!mGUIDToID.Get(guid, &mediaItemId) ||
+      mediaItemId != aBag->MediaItemId()) {
+    return;
+  }
+
+  sbLocalDatabaseResourcePropertyBag * const cached = mCache.Peek(mediaItemId);
+  if (cached && cached->Guid().Equals(guid)) {
+    return;
+  }
+
+  nsRefPtr<sbLocalDatabaseResourcePropertyBag> dirty;
+  if (mDirty.Get(mediaItemId, getter_AddRefs(dirty)) &&
+      dirty->Guid().Equals(guid)) {
+    return;
+  }
+
+  mGUIDToID.Remove(guid);
+}
+
 nsresult
 sbLocalDatabasePropertyCache::AddDirty(const nsAString &aGuid,
                                        sbLocalDatabaseResourcePropertyBag * aBag)
 {
   nsresult rv;
   NS_ENSURE_ARG_POINTER(aBag);
-  nsAutoString guid(aGuid);
+  PRUint32 const mediaItemId = aBag->MediaItemId();
 
   nsAutoMonitor mon(mMonitor);
 
   // If another bag for the same guid is already in the dirty list, then we
   // risk losing information if we don't write out immediately.
-  if (mDirty.Get(guid, nsnull)) {
+  if (mDirty.Get(mediaItemId, nsnull)) {
     NS_WARNING("Property cache forcing Write() due to duplicate "
                "guids in the dirty bag list.  This should be a rare event.");
 
@@ -1607,15 +2317,44 @@ sbLocalDatabasePropertyCache::AddDirty(const nsAString &aGuid,
     mon.Enter();
   }
 
-  mDirty.Put(guid, aBag);
+  if (!mDirty.Count()) {
+    mOldestDirtyTime = PR_IntervalNow();
+  }
+
+  mDirty.Put(mediaItemId, aBag);
+  mGUIDToID.Put(aGuid, mediaItemId);
   ++mWritePendingCount;
 
+  // Don't wait for the timer once a transaction's worth of bags piled up,
+  // so writes stay short however fast items change
+  if (mDirty.Count() >= mWriteBatchSize && NS_FAILED(DispatchFlush())) {
+    NS_WARNING("Failed to dispatch a property cache flush, "
+               "leaving it to the flush timer");
+  }
+
   // Add dirty property ids for invalidation of guid arrays.
   std::set<PRUint32> dirtyPropIds;
   rv = aBag->GetDirtyForInvalidation(dirtyPropIds);
   NS_ENSURE_SUCCESS(rv, rv);
 
   mDirtyForInvalidation.insert(dirtyPropIds.begin(), dirtyPropIds.end());
+
+  if (!mDirtyItemsOverflow) {
+    if (mDirtyItemsForInvalidation.Length() + dirtyPropIds.size() >
+        MAX_DIRTY_ITEMS_FOR_INVALIDATION) {
+      mDirtyItemsForInvalidation.Clear();
+      mDirtyItemsOverflow = PR_TRUE;
+    }
+    else {
+      std::set<PRUint32>::const_iterator it = dirtyPropIds.begin();
+      for (; it != dirtyPropIds.end(); ++it) {
+        DirtyItemProperty* dirtyItem = mDirtyItemsForInvalidation.AppendElement();
+        NS_ENSURE_TRUE(dirtyItem, NS_ERROR_OUT_OF_MEMORY);
+        dirtyItem->guid = aGuid;
+        dirtyItem->propertyID = *it;
+      }
+    }
+  }
   
   // Invalidate uses a timer which enables the invalidation to occur
   // after 'AddDirty' stops being called. This will avoid constant 
@@ -1657,6 +2396,8 @@ sbLocalDatabasePropertyCache::InvalidateGUIDArrays()
   }
   
   std::vector<PRUint32>  dirtyPropIDs;
+  nsTArray<DirtyItemProperty> dirtyItems;
+  PRBool dirtyItemsOverflow;
 
   // Copy the data into a temporary set to avoid invalidating the guid arrays
   // with the property cache lock held.
@@ -1668,13 +2409,87 @@ sbLocalDatabasePropertyCache::InvalidateGUIDArrays()
               mDirtyForInvalidation.end(),
               insertIter);
     mDirtyForInvalidation.clear();
+
+    dirtyItems.SwapElements(mDirtyItemsForInvalidation);
+    dirtyItemsOverflow = mDirtyItemsOverflow;
+    mDirtyItemsOverflow = PR_FALSE;
+  }
+
+  // When we know which items changed, let the arrays move them in place
+  // instead of invalidating.
+  PRUint32 const dirtyItemCount = dirtyItems.Length();
+  nsTArray<const PRUnichar*> dirtyGUIDs;
+  nsTArray<PRUint32> dirtyItemPropIDs;
+  if (!dirtyItemsOverflow && dirtyItemCount) {
+    NS_ENSURE_TRUE(dirtyGUIDs.SetCapacity(dirtyItemCount),
+                   NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_TRUE(dirtyItemPropIDs.SetCapacity(dirtyItemCount),
+                   NS_ERROR_OUT_OF_MEMORY);
+    for (PRUint32 i = 0; i < dirtyItemCount; ++i) {
+      dirtyGUIDs.AppendElement(dirtyItems[i].guid.get());
+      dirtyItemPropIDs.AppendElement(dirtyItems[i].propertyID);
+    }
+  }
+
+  nsTArray<nsString> guids(dirtyGUIDs.Length());
+  for (PRUint32 i = 0; i < dirtyGUIDs.Length(); ++i) {
+    guids.AppendElement(dirtyItems[i].guid);
+  }
+
+  // The sort indexes go first so that arrays reading from them see the
+  // new order.
+  if (mLibrary && mLibrary->mSortIndex) {
+    nsresult SB_UNUSED_IN_RELEASE(rv);
+    if (dirtyGUIDs.Length()) {
+      rv = mLibrary->mSortIndex->ApplyPropertyChanges(guids, dirtyItemPropIDs);
+    }
+    else {
+      rv = mLibrary->mSortIndex->RemoveIndexesForProperties(dirtyPropIDs);
+    }
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "Failed to update sort indexes, they may be stale.");
+  }
+
+  // Same for the filter snapshot the filter panes read from
+  if (mLibrary && mLibrary->mFilterSnapshot) {
+    nsresult SB_UNUSED_IN_RELEASE(rv);
+    if (dirtyGUIDs.Length()) {
+      rv = mLibrary->mFilterSnapshot->ApplyPropertyChanges(guids,
+                                                           dirtyItemPropIDs);
+    }
+    else {
+      rv = mLibrary->mFilterSnapshot->RemoveColumnsForProperties(dirtyPropIDs);
+    }
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "Failed to update the filter snapshot, it may be stale.");
+  }
+
+  // Likewise the tracked lengths, so arrays count the rows again
+  if (mLibrary && mLibrary->mLengthCache) {
+    nsresult SB_UNUSED_IN_RELEASE(rv) = NS_OK;
+    if (dirtyGUIDs.Length()) {
+      rv = mLibrary->mLengthCache->ApplyPropertyChanges(guids,
+                                                        dirtyItemPropIDs);
+    }
+    else if (dirtyPropIDs.size()) {
+      rv = mLibrary->mLengthCache->InvalidateProperties(dirtyPropIDs);
+    }
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "Failed to invalidate cached lengths, they may be stale.");
   }
 
   PRInt32 const count = arrays.Count();
   for (PRInt32 index = 0; index < count; ++index) {
-    nsresult SB_UNUSED_IN_RELEASE(rv) = 
-      arrays[index]->MayInvalidate(&dirtyPropIDs[0],
-                                   dirtyPropIDs.size());
+    nsresult SB_UNUSED_IN_RELEASE(rv);
+    if (dirtyGUIDs.Length()) {
+      rv = arrays[index]->MayInvalidateItems(dirtyGUIDs.Elements(),
+                                             dirtyItemPropIDs.Elements(),
+                                             dirtyGUIDs.Length());
+    }
+    else {
+      rv = arrays[index]->MayInvalidate(&dirtyPropIDs[0],
+                                        dirtyPropIDs.size());
+    }
     NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
       "Failed to invalidate GUID array, GUIDs may be stale.");
   }
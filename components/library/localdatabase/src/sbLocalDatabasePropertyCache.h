@@ -46,11 +46,12 @@
 #include <sbIJobProgress.h>
 #include <sbIMediaListListener.h>
 #include <nsITimer.h>
+#include <prinrval.h>
 
 #include <sbWeakReference.h>
 
 #include "sbLocalDatabaseResourcePropertyBag.h"
-#include "sbFixedInterfaceCache.h"
+#include "sbClockInterfaceCache.h"
 #include "sbLocalDatabaseSQL.h"
 
 #include <map>
@@ -67,13 +68,17 @@ class sbLocalDatabaseSortInvalidateJob;
 class sbLocalDatabaseGUIDArray;
 
 class sbLocalDatabasePropertyCache: public sbILocalDatabasePropertyCache,
+                                    public sbILocalDatabasePropertyCacheStatistics,
                                     public nsIObserver
 {
 public:
   friend class sbLocalDatabaseResourcePropertyBag;
   friend class DirtyPropertyEnumerator;
+  friend class PropertyWriteBatch;
   /**
-   * The size of our property bag cache
+   * The number of bags the cache is initially sized for. This is also the
+   * most bags a single GetProperties call adds to the cache, and the
+   * number of bags CacheProperties reads at a time.
    */
   static PRUint32 const CACHE_SIZE = 1024;
   /**
@@ -83,9 +88,11 @@ public:
 
   NS_DECL_ISUPPORTS
   NS_DECL_SBILOCALDATABASEPROPERTYCACHE
+  NS_DECL_SBILOCALDATABASEPROPERTYCACHESTATISTICS
   NS_DECL_NSIOBSERVER
 
-  typedef sbFixedInterfaceCache<nsStringHashKey,
+  typedef sbClockInterfaceCache<nsUint32HashKey,
+                                PRUint32,
                                 sbLocalDatabaseResourcePropertyBag> InterfaceCache;
 
   sbLocalDatabasePropertyCache();
@@ -98,6 +105,14 @@ public:
 
   PRBool GetPropertyID(PRUint32 aPropertyDBID, nsAString& aPropertyID);
 
+  /**
+   * GetCurrentProperties, also telling whether the bag still has changes to
+   * write. Only falls back to GetProperties when the bag isn't loaded.
+   */
+  nsresult GetCurrentProperties(const nsAString& aGuid,
+                                sbILocalDatabaseResourcePropertyBag** _retval,
+                                PRBool* aIsDirty);
+
   void GetColumnForPropertyID(PRUint32 aPropertyID, nsAString &aColumn);
 
   // Called when mSortInvalidateJob completes
@@ -117,6 +132,33 @@ private:
   nsresult AddDirty(const nsAString &aGuid,
       sbLocalDatabaseResourcePropertyBag * aBag);
 
+  // The following must be called with mMonitor held.
+
+  /**
+   * Returns the cached bag for aGuid, or nsnull if it isn't cached. The bag
+   * is not addref'd.
+   */
+  sbLocalDatabaseResourcePropertyBag * GetCachedBag(const nsAString &aGuid);
+  sbLocalDatabaseResourcePropertyBag * GetCachedBag(PRUint32 aMediaItemId,
+                                                    const nsAString &aGuid);
+
+  /**
+   * Adds aBag to the cache and returns its estimated size
+   */
+  PRUint32 PutCachedBag(sbLocalDatabaseResourcePropertyBag * aBag);
+
+  /**
+   * Returns PR_TRUE if the bag for aMediaItemId and aGuid is waiting to be
+   * written
+   */
+  PRBool IsDirty(PRUint32 aMediaItemId, const nsAString &aGuid);
+
+  /**
+   * Drops the intern table entry of aBag unless the bag is still cached
+   * or dirty
+   */
+  void ReleaseGUID(sbLocalDatabaseResourcePropertyBag * aBag);
+
   nsresult InvalidateGUIDArrays();
 
   PRUint32 GetPropertyDBIDInternal(const nsAString& aPropertyID);
@@ -135,6 +177,14 @@ private:
 
   nsresult RetrieveLibraryProperties(sbLocalDatabaseResourcePropertyBag * aBag);
 
+  /**
+   * Reads the bags for up to CACHE_SIZE guids into the cache.
+   * \param aBytesRead Incremented by the estimated size of the bags read
+   */
+  nsresult CachePropertiesChunk(const PRUnichar **aGUIDArray,
+                                PRUint32 aGUIDArrayCount,
+                                PRUint64 & aBytesRead);
+
   /**
    * This retrieves a collection of property bags for the list of guids passed
    * to aGUIDs.
@@ -192,15 +242,35 @@ private:
   // Used to protect the cache and all of the resource property bags
   PRMonitor* mMonitor;
 
-  // Cache for GUID -> property bag
+  // Held by Write from taking the dirty bags until they are committed, so
+  // an older write can't commit over the values of a newer one.  Taken
+  // before mMonitor.
+  PRLock* mWriteLock;
+
+  // Cache for media item id -> property bag
   InterfaceCache mCache;
 
-  // Dirty GUIDs
-  nsInterfaceHashtable<nsStringHashKey, sbLocalDatabaseResourcePropertyBag> mDirty;
+  // Dirty bags by media item id
+  nsInterfaceHashtable<nsUint32HashKey, sbLocalDatabaseResourcePropertyBag> mDirty;
+
+  // Maps the guid of every cached or dirty bag to its media item id, so a
+  // guid is hashed once per lookup and everything else works on the id.
+  // The library item is media item id 0.
+  nsDataHashtable<nsStringHashKey, PRUint32> mGUIDToID;
 
   // Dirty Property IDs for use with invalidation of GUID arrays
   std::set<PRUint32> mDirtyForInvalidation;
 
+  // The same dirty property IDs paired with the guid of their item, so GUID
+  // arrays can move changed items in place.  Dropped in favour of the plain
+  // set above once too many changes pile up between invalidations.
+  struct DirtyItemProperty {
+    nsString guid;
+    PRUint32 propertyID;
+  };
+  nsTArray<DirtyItemProperty> mDirtyItemsForInvalidation;
+  PRBool mDirtyItemsOverflow;
+
   // flushing on a background thread
   struct FlushQueryData {
     nsCOMPtr<sbIDatabaseQuery> query;
@@ -209,6 +279,12 @@ private:
   nsresult DispatchFlush();
   void RunFlushThread();
 
+  /**
+   * Shortens the flush interval while changes pile up faster than they are
+   * written and lengthens it back once they slow down
+   */
+  nsresult AdjustFlushInterval();
+
   static
   nsresult ProcessQueries(nsTArray<FlushQueryData> & aQueries);
 
@@ -217,6 +293,21 @@ private:
 
   // Cache Flush Interval Timer
   nsCOMPtr<nsITimer> mFlushTimer;
+  PRUint32 mFlushInterval;
+
+  // Set while a flush is dispatched and hasn't started writing yet
+  PRInt32 mFlushPending;
+
+  // Most dirty bags written in one transaction
+  PRUint32 mWriteBatchSize;
+
+  // Write statistics, protected by mMonitor.  mOldestDirtyTime is when the
+  // first bag waiting to be written was changed.
+  PRIntervalTime mOldestDirtyTime;
+  PRUint64 mFlushCount;
+  PRUint32 mLastFlushDuration;
+  PRUint32 mLastFlushLatency;
+  PRUint32 mMaxFlushLatency;
   nsCOMPtr<nsIThreadPool> mThreadPoolService;
 
   // GUID Array Invalidation Timer
@@ -239,6 +330,8 @@ private:
   nsCOMPtr<sbIDatabasePreparedStatement> mMediaItemsFtsAllInsertPreparedStatement;
   nsCOMPtr<sbIDatabasePreparedStatement> mPropertiesDeletePreparedStatement;
   nsCOMPtr<sbIDatabasePreparedStatement> mPropertiesInsertPreparedStatement;
+  nsCOMPtr<sbIDatabasePreparedStatement> mPropertiesBatchDeletePreparedStatement;
+  nsCOMPtr<sbIDatabasePreparedStatement> mPropertiesBatchInsertPreparedStatement;
   
   // There's a separate update statement for each top level property.
   // This is because we have no efficient way to /not/ update a property
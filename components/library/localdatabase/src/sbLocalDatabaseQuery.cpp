@@ -26,6 +26,7 @@
 
 #include "sbLocalDatabaseQuery.h"
 #include "sbLocalDatabaseSchemaInfo.h"
+#include "sbLocalDatabaseSearchIndex.h"
 
 
 #include <sbIDatabaseQuery.h>
@@ -55,6 +56,7 @@
 #define PROPERTIES_TABLE         NS_LITERAL_STRING("resource_properties")
 #define PROPERTIES_FTS_TABLE     NS_LITERAL_STRING("resource_properties_fts")
 #define PROPERTIES_FTS_ALL_TABLE NS_LITERAL_STRING("resource_properties_fts_all")
+#define SEARCHINDEX_TABLE        NS_LITERAL_STRING("search_index")
 #define MEDIAITEMS_TABLE         NS_LITERAL_STRING("media_items")
 #define SIMPLEMEDIALISTS_TABLE   NS_LITERAL_STRING("simple_media_lists")
 #define PROPERTYIDS_TABLE        NS_LITERAL_STRING("properties")
@@ -78,6 +80,7 @@ sbLocalDatabaseQuery::sbLocalDatabaseQuery(const nsAString& aBaseTable,
                                            nsTArray<sbLocalDatabaseGUIDArray::SortSpec>* aSorts,
                                            PRBool aIsDistinct,
                                            PRBool aDistinctWithSortableValues,
+                                           PRBool aUseSearchIndex,
                                            sbILocalDatabasePropertyCache* aPropertyCache) :
   mBaseTable(aBaseTable),
   mBaseConstraintColumn(aBaseConstraintColumn),
@@ -87,6 +90,7 @@ sbLocalDatabaseQuery::sbLocalDatabaseQuery(const nsAString& aBaseTable,
   mSorts(aSorts),
   mIsDistinct(aIsDistinct),
   mDistinctWithSortableValues(aDistinctWithSortableValues),
+  mUseSearchIndex(aUseSearchIndex),
   mPropertyCache(aPropertyCache),
   mHasSearch(PR_FALSE)
 {
@@ -768,7 +772,11 @@ sbLocalDatabaseQuery::AddFilters()
     }
   }
 
-  if (searchIndex >= 0) {
+  if (searchIndex >= 0 && mUseSearchIndex) {
+    rv = AddSearchIndexCriteria();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else if (searchIndex >= 0) {
 
     // XXX Now that we are using sqlite FTS, we need to live with its
     // limitations, such as not being able to have more than one MATCH
@@ -923,6 +931,138 @@ sbLocalDatabaseQuery::AddFilters()
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseQuery::AddSearchIndexCriteria()
+{
+  nsresult rv;
+
+  // Every search filter has the same values (see
+  // sbLocalDatabaseMediaListView::SetSearchConstraint), so the values come
+  // from the first one and the properties from all of them.  Unlike the full
+  // text table the word index knows the property of each word, so the
+  // search can be limited to the given properties.
+  const sbLocalDatabaseGUIDArray::FilterSpec* search = nsnull;
+  PRBool isEverythingSearch = PR_FALSE;
+  nsTArray<PRInt32> propertyIDs;
+
+  PRUint32 len = mFilters->Length();
+  for (PRUint32 i = 0; i < len; i++) {
+    const sbLocalDatabaseGUIDArray::FilterSpec& fs = mFilters->ElementAt(i);
+    if (!fs.isSearch) {
+      continue;
+    }
+
+    if (!search) {
+      search = &fs;
+    }
+
+    if (fs.property.EqualsLiteral("*")) {
+      isEverythingSearch = PR_TRUE;
+    }
+    else {
+      NS_ENSURE_TRUE(propertyIDs.AppendElement(GetPropertyId(fs.property)),
+                     NS_ERROR_OUT_OF_MEMORY);
+    }
+  }
+  NS_ENSURE_STATE(search);
+
+  // Each word of each value has to be in the item, as with the MATCH string
+  // of the full text search.  The last word of a value may still be being
+  // typed so it matches the start of words, the ones before it whole words.
+  for (PRUint32 i = 0; i < search->values.Length(); i++) {
+    nsTArray<nsString> tokens;
+    rv = sbLocalDatabaseSearchIndex::GetSearchTokens(search->values[i], tokens);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    for (PRUint32 j = 0; j < tokens.Length(); j++) {
+      const nsString& token = tokens[j];
+
+      nsCOMPtr<sbISQLSelectBuilder> subquery =
+        do_CreateInstance(SB_SQLBUILDER_SELECT_CONTRACTID, &rv);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = subquery->SetBaseTableName(SEARCHINDEX_TABLE);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = subquery->AddColumn(EmptyString(), MEDIAITEMID_COLUMN);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      nsCOMPtr<sbISQLBuilderCriterion> criterion;
+      if (j + 1 < tokens.Length()) {
+        rv = subquery->CreateMatchCriterionString(EmptyString(),
+                                                  NS_LITERAL_STRING("token"),
+                                                  sbISQLSelectBuilder::MATCH_EQUALS,
+                                                  token,
+                                                  getter_AddRefs(criterion));
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = subquery->AddCriterion(criterion);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+      else {
+        // Words starting with the token sort between it and the token with
+        // its last character bumped
+        rv = subquery->CreateMatchCriterionString(EmptyString(),
+                                                  NS_LITERAL_STRING("token"),
+                                                  sbISQLSelectBuilder::MATCH_GREATEREQUAL,
+                                                  token,
+                                                  getter_AddRefs(criterion));
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        rv = subquery->AddCriterion(criterion);
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        PRUnichar last = token.CharAt(token.Length() - 1);
+        if (last < 0xFFFF) {
+          nsString upper(token);
+          upper.Cut(upper.Length() - 1, 1);
+          upper.Append(PRUnichar(last + 1));
+
+          rv = subquery->CreateMatchCriterionString(EmptyString(),
+                                                    NS_LITERAL_STRING("token"),
+                                                    sbISQLSelectBuilder::MATCH_LESS,
+                                                    upper,
+                                                    getter_AddRefs(criterion));
+          NS_ENSURE_SUCCESS(rv, rv);
+
+          rv = subquery->AddCriterion(criterion);
+          NS_ENSURE_SUCCESS(rv, rv);
+        }
+      }
+
+      if (!isEverythingSearch) {
+        nsCOMPtr<sbISQLBuilderCriterionIn> propertyCriterion;
+        rv = subquery->CreateMatchCriterionIn(EmptyString(),
+                                              NS_LITERAL_STRING("property_id"),
+                                              getter_AddRefs(propertyCriterion));
+        NS_ENSURE_SUCCESS(rv, rv);
+
+        for (PRUint32 k = 0; k < propertyIDs.Length(); k++) {
+          rv = propertyCriterion->AddLong(propertyIDs[k]);
+          NS_ENSURE_SUCCESS(rv, rv);
+        }
+
+        rv = subquery->AddCriterion(propertyCriterion);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+
+      nsCOMPtr<sbISQLBuilderCriterionIn> inCriterion;
+      rv = mBuilder->CreateMatchCriterionIn(MEDIAITEMS_ALIAS,
+                                            MEDIAITEMID_COLUMN,
+                                            getter_AddRefs(inCriterion));
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = inCriterion->AddSubquery(subquery);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = mBuilder->AddCriterion(inCriterion);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  return NS_OK;
+}
+
 nsresult
 sbLocalDatabaseQuery::AddRange()
 {
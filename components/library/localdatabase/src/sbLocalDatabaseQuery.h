@@ -50,6 +50,7 @@ public:
                          nsTArray<sbLocalDatabaseGUIDArray::SortSpec>* aSorts,
                          PRBool aIsDistinct,
                          PRBool aDistinctWithSortableValues,
+                         PRBool aUseSearchIndex,
                          sbILocalDatabasePropertyCache* aPropertyCache);
 
   nsresult GetFullCountQuery(nsAString& aQuery);
@@ -80,6 +81,7 @@ private:
   nsresult AddGuidColumns(PRBool aIsNull);
   nsresult AddBaseTable();
   nsresult AddFilters();
+  nsresult AddSearchIndexCriteria();
   nsresult AddRange();
   nsresult AddPrimarySort();
   nsresult AddNonNullPrimarySortConstraint();
@@ -103,6 +105,7 @@ private:
   nsTArray<sbLocalDatabaseGUIDArray::SortSpec>* mSorts;
   PRPackedBool mIsDistinct;
   PRPackedBool mDistinctWithSortableValues;
+  PRPackedBool mUseSearchIndex;
 
   nsCOMPtr<sbISQLSelectBuilder> mBuilder;
   PRBool mIsFullLibrary;
@@ -106,6 +106,28 @@ sbLocalDatabaseResourcePropertyBag::PropertyBagKeysToArray(const PRUint32& aProp
   }
 }
 
+/* static */ PLDHashOperator PR_CALLBACK
+sbLocalDatabaseResourcePropertyBag::AddPropertyDataSize(const PRUint32& aPropertyID,
+                                                        sbPropertyData* aPropertyData,
+                                                        void *aArg)
+{
+  PRUint32* size = static_cast<PRUint32*>(aArg);
+  *size += sizeof(PLDHashEntryHdr) + sizeof(PRUint32) +
+           sizeof(sbPropertyData) +
+           (aPropertyData->value.Length() +
+            aPropertyData->searchableValue.Length() +
+            aPropertyData->sortableValue.Length()) * sizeof(PRUnichar);
+  return PL_DHASH_NEXT;
+}
+
+PRUint32
+sbLocalDatabaseResourcePropertyBag::GetEstimatedSize()
+{
+  PRUint32 size = sizeof(*this) + mGuid.Length() * sizeof(PRUnichar);
+  mValueMap.EnumerateRead(AddPropertyDataSize, &size);
+  return size;
+}
+
 NS_IMETHODIMP
 sbLocalDatabaseResourcePropertyBag::GetGuid(nsAString &aGuid)
 {
@@ -404,6 +426,20 @@ sbLocalDatabaseResourcePropertyBag::PutValue(PRUint32 aPropertyID,
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseResourcePropertyBag::PutValueUnlocked(PRUint32 aPropertyID,
+                                                     const nsAString& aValue)
+{
+  nsAutoPtr<sbPropertyData> data(new sbPropertyData(aValue,
+                                                    EmptyString(),
+                                                    EmptyString()));
+  PRBool success = mValueMap.Put(aPropertyID, data);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+  data.forget();
+
+  return NS_OK;
+}
+
 PRBool
 sbLocalDatabaseResourcePropertyBag::IsPropertyDirty(PRUint32 aPropertyDBID)
 {
@@ -62,6 +62,21 @@ public:
   nsresult PutValue(PRUint32 aPropertyID,
                     const nsAString& aValue);
 
+  // Same as PutValue but without taking the property cache monitor. Only
+  // for bags that are still being loaded and not yet visible in the cache,
+  // e.g. from a database thread while the cache monitor is held by the
+  // thread waiting on the load.
+  nsresult PutValueUnlocked(PRUint32 aPropertyID,
+                            const nsAString& aValue);
+
+  // Inline versions of GetGuid and GetMediaItemId that don't copy
+  nsString const & Guid() const { return mGuid; }
+  PRUint32 MediaItemId() const { return mMediaItemId; }
+
+  // Rough estimate of the memory held by the bag, used as its cost in the
+  // property cache
+  PRUint32 GetEstimatedSize();
+
   PRBool IsPropertyDirty(PRUint32 aPropertyDBID);
   nsresult EnumerateDirty(nsTHashtable<nsUint32HashKey>::Enumerator aEnumFunc, void *aClosure, PRUint32 *aDirtyCount);
   nsresult ClearDirty();
@@ -72,6 +87,11 @@ public:
 
 private:
 
+  static PLDHashOperator PR_CALLBACK
+    AddPropertyDataSize(const PRUint32& aPropertyID,
+                        sbPropertyData* aData,
+                        void *aArg);
+
   static PLDHashOperator PR_CALLBACK
     PropertyBagKeysToArray(const PRUint32& aPropertyID,
                            sbPropertyData* aData,
@@ -162,3 +162,340 @@ nsString sbLocalDatabaseSQL::PropertiesDelete()
   return NS_LITERAL_STRING("DELETE FROM resource_properties WHERE media_item_id = ? AND property_id = ? ");
 }
 
+nsString sbLocalDatabaseSQL::PropertiesBatchInsert(PRUint32 aRowCount)
+{
+  // A compound select, as older sqlite versions don't take a multi-row
+  // VALUES list
+  nsString sql =
+    NS_LITERAL_STRING("INSERT OR REPLACE INTO resource_properties \
+                       (media_item_id, property_id, obj, obj_searchable, obj_sortable, obj_secondary_sortable) ");
+  for (PRUint32 i = 0; i < aRowCount; ++i) {
+    PRUint32 const param = 2 + i * 5;
+    sql.AppendLiteral(i ? " UNION ALL SELECT ?" : "SELECT ?");
+    sql.AppendInt(param);
+    sql.AppendLiteral(", ?1");
+    for (PRUint32 j = 1; j < 5; ++j) {
+      sql.AppendLiteral(", ?");
+      sql.AppendInt(param + j);
+    }
+  }
+  return sql;
+}
+
+nsString sbLocalDatabaseSQL::PropertiesBatchDelete(PRUint32 aCount)
+{
+  nsString sql =
+    NS_LITERAL_STRING("DELETE FROM resource_properties WHERE property_id = ?1 \
+                       AND media_item_id IN (");
+  for (PRUint32 i = 0; i < aCount; ++i) {
+    sql.AppendLiteral(i ? ", ?" : "?");
+    sql.AppendInt(2 + i);
+  }
+  sql.AppendLiteral(")");
+  return sql;
+}
+
+nsString sbLocalDatabaseSQL::DiffingItemsSelect(const nsAString& aColumns)
+{
+  nsString sql = NS_LITERAL_STRING("SELECT media_item_id, guid");
+  sql.Append(aColumns);
+  sql.AppendLiteral(" FROM media_items WHERE media_item_id > ?1 \
+                     ORDER BY media_item_id LIMIT ?2");
+  return sql;
+}
+
+nsString sbLocalDatabaseSQL::DiffingPropertiesSelect()
+{
+  return NS_LITERAL_STRING("SELECT _rp.media_item_id, _p.property_name, _rp.obj \
+                            FROM resource_properties AS _rp \
+                            JOIN properties AS _p \
+                            ON _p.property_id = _rp.property_id \
+                            WHERE _rp.media_item_id >= ?1 \
+                            AND _rp.media_item_id <= ?2 \
+                            ORDER BY _rp.media_item_id");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexesTableCreate()
+{
+  return NS_LITERAL_STRING("CREATE TABLE IF NOT EXISTS sort_indexes \
+                            (index_id integer primary key autoincrement, \
+                             sort_key text unique not null, \
+                             property_id integer not null, \
+                             ascending integer not null, \
+                             nulls_first integer not null, \
+                             length integer not null, \
+                             non_null_length integer not null)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexFiltersTableCreate()
+{
+  return NS_LITERAL_STRING("CREATE TABLE IF NOT EXISTS sort_index_filters \
+                            (index_id integer not null, \
+                             property_name text not null, \
+                             value text not null)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsTableCreate()
+{
+  return NS_LITERAL_STRING("CREATE TABLE IF NOT EXISTS sort_index_rows \
+                            (index_id integer not null, \
+                             position integer not null, \
+                             media_item_id integer not null)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsPositionIndexCreate()
+{
+  return NS_LITERAL_STRING("CREATE INDEX IF NOT EXISTS \
+                            idx_sort_index_rows_index_id_position \
+                            ON sort_index_rows (index_id, position)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsMediaItemIndexCreate()
+{
+  return NS_LITERAL_STRING("CREATE INDEX IF NOT EXISTS \
+                            idx_sort_index_rows_index_id_media_item_id \
+                            ON sort_index_rows (index_id, media_item_id)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexesSelect()
+{
+  return NS_LITERAL_STRING("SELECT index_id, sort_key, property_id, ascending, \
+                                   nulls_first, length, non_null_length \
+                            FROM sort_indexes");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexFiltersSelect()
+{
+  return NS_LITERAL_STRING("SELECT index_id, property_name, value \
+                            FROM sort_index_filters \
+                            ORDER BY index_id, rowid");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexInsert()
+{
+  return NS_LITERAL_STRING("INSERT INTO sort_indexes \
+                            (sort_key, property_id, ascending, nulls_first, \
+                             length, non_null_length) \
+                            VALUES (?, ?, ?, ?, ?, ?)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexIDSelect()
+{
+  return NS_LITERAL_STRING("SELECT index_id FROM sort_indexes \
+                            WHERE sort_key = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexFilterInsert()
+{
+  return NS_LITERAL_STRING("INSERT INTO sort_index_filters \
+                            (index_id, property_name, value) \
+                            VALUES (?, ?, ?)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowInsert()
+{
+  return NS_LITERAL_STRING("INSERT INTO sort_index_rows \
+                            (index_id, position, media_item_id) \
+                            VALUES (?, ?, ?)");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM sort_indexes WHERE index_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexFiltersDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM sort_index_filters WHERE index_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM sort_index_rows WHERE index_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexLengthUpdate()
+{
+  return NS_LITERAL_STRING("UPDATE sort_indexes \
+                            SET length = ?, non_null_length = ? \
+                            WHERE index_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowPositionSelect()
+{
+  return NS_LITERAL_STRING("SELECT position FROM sort_index_rows \
+                            WHERE index_id = ? AND media_item_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowValuesSelect()
+{
+  return NS_LITERAL_STRING("SELECT ifnull(_p.obj_sortable, ''), \
+                                   ifnull(_p.obj_secondary_sortable, ''), \
+                                   _si.media_item_id \
+                            FROM sort_index_rows AS _si \
+                            LEFT JOIN resource_properties AS _p \
+                            ON _p.media_item_id = _si.media_item_id \
+                            AND _p.property_id = ? \
+                            WHERE _si.index_id = ? AND _si.position = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM sort_index_rows \
+                            WHERE index_id = ? AND media_item_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsShift()
+{
+  return NS_LITERAL_STRING("UPDATE sort_index_rows \
+                            SET position = position + ? \
+                            WHERE index_id = ? \
+                            AND position >= ? AND position < ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowPositionUpdate()
+{
+  return NS_LITERAL_STRING("UPDATE sort_index_rows SET position = ? \
+                            WHERE index_id = ? AND media_item_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SortIndexRowsSelect(PRUint32 aIndexID,
+                                                 PRUint32 aPropertyID)
+{
+  // The limit and start position are numbered to match the parameters of
+  // the regular GUID array range queries.
+  nsString sql =
+    NS_LITERAL_STRING("SELECT _si.media_item_id, _mi.guid, \
+                              ifnull(_p.obj_sortable, ''), '', _mi.rowid \
+                       FROM sort_index_rows AS _si \
+                       JOIN media_items AS _mi \
+                       ON _mi.media_item_id = _si.media_item_id \
+                       LEFT JOIN resource_properties AS _p \
+                       ON _p.media_item_id = _si.media_item_id \
+                       AND _p.property_id = ");
+  sql.AppendInt(aPropertyID);
+  sql.AppendLiteral(" WHERE _si.index_id = ");
+  sql.AppendInt(aIndexID);
+  sql.AppendLiteral(" AND _si.position >= ?2 ORDER BY _si.position LIMIT ?1");
+  return sql;
+}
+
+nsString sbLocalDatabaseSQL::FilterSnapshotItemsSelect()
+{
+  return NS_LITERAL_STRING("SELECT media_item_id, \
+                                   media_list_type_id IS NOT NULL \
+                            FROM media_items ORDER BY media_item_id");
+}
+
+nsString sbLocalDatabaseSQL::FilterSnapshotColumnSelect()
+{
+  return NS_LITERAL_STRING("SELECT media_item_id, ifnull(obj_sortable, '') \
+                            FROM resource_properties \
+                            WHERE property_id = ? ORDER BY media_item_id");
+}
+
+nsString sbLocalDatabaseSQL::FilterSnapshotGUIDsSelect(
+                               const nsTArray<PRUint32>& aMediaItemIDs,
+                               PRUint32 aStart,
+                               PRUint32 aCount)
+{
+  nsString sql =
+    NS_LITERAL_STRING("SELECT media_item_id, guid FROM media_items \
+                       WHERE media_item_id IN (");
+  for (PRUint32 i = aStart; i < aStart + aCount; i++) {
+    if (i > aStart) {
+      sql.AppendLiteral(", ");
+    }
+    sql.AppendInt(aMediaItemIDs[i]);
+  }
+  sql.AppendLiteral(")");
+  return sql;
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexTableCreate()
+{
+  return NS_LITERAL_STRING("CREATE TABLE IF NOT EXISTS search_index \
+                            (token text not null, \
+                             property_id integer not null, \
+                             media_item_id integer not null)");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexTokenIndexCreate()
+{
+  return NS_LITERAL_STRING("CREATE INDEX IF NOT EXISTS \
+                            idx_search_index_token_property_id \
+                            ON search_index (token, property_id, media_item_id)");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexMediaItemIndexCreate()
+{
+  return NS_LITERAL_STRING("CREATE INDEX IF NOT EXISTS \
+                            idx_search_index_media_item_id \
+                            ON search_index (media_item_id)");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexDeleteTriggerCreate()
+{
+  return NS_LITERAL_STRING("CREATE TRIGGER IF NOT EXISTS \
+                            tgr_media_items_search_index_delete \
+                            BEFORE DELETE ON media_items \
+                            BEGIN \
+                              DELETE FROM search_index \
+                              WHERE media_item_id = OLD.media_item_id; \
+                            END");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexVersionSelect()
+{
+  return NS_LITERAL_STRING("SELECT value FROM library_metadata \
+                            WHERE name = 'search-index-version'");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexVersionUpdate()
+{
+  return NS_LITERAL_STRING("INSERT OR REPLACE INTO library_metadata \
+                            VALUES ('search-index-version', ?)");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexVersionDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM library_metadata \
+                            WHERE name = 'search-index-version'");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexPropertiesSelect()
+{
+  return NS_LITERAL_STRING("SELECT property_id, property_name FROM properties");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexMaxMediaItemIDSelect()
+{
+  return NS_LITERAL_STRING("SELECT ifnull(max(media_item_id), 0) \
+                            FROM media_items");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexValuesSelect()
+{
+  return NS_LITERAL_STRING("SELECT media_item_id, property_id, obj_searchable \
+                            FROM resource_properties \
+                            WHERE media_item_id >= ? AND media_item_id < ? \
+                            AND obj_searchable IS NOT NULL");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexRangeDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM search_index \
+                            WHERE media_item_id >= ? AND media_item_id < ?");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexItemDelete()
+{
+  return NS_LITERAL_STRING("DELETE FROM search_index WHERE media_item_id = ?");
+}
+
+nsString sbLocalDatabaseSQL::SearchIndexInsert()
+{
+  return NS_LITERAL_STRING("INSERT INTO search_index \
+                            (token, property_id, media_item_id) \
+                            VALUES (?, ?, ?)");
+}
@@ -82,6 +82,195 @@ public:
    * Removes a property given the item ID and property ID
    */
   static nsString PropertiesDelete();
+  /**
+   * Inserts aRowCount values of one property into the resource_properties
+   * table. ?1 is the property ID, followed by the media item ID, value,
+   * searchable, sortable and secondary sortable value of each row.
+   */
+  static nsString PropertiesBatchInsert(PRUint32 aRowCount);
+  /**
+   * Removes a property from aCount items. ?1 is the property ID, followed by
+   * the item IDs.
+   */
+  static nsString PropertiesBatchDelete(PRUint32 aCount);
+  /**
+   * Selects the media_item_id, guid and aColumns of up to ?2 media items
+   * after media item ?1, in media item id order. aColumns is a list of
+   * columns starting with a comma.
+   */
+  static nsString DiffingItemsSelect(const nsAString& aColumns);
+  /**
+   * Selects the media_item_id, property_name and obj of the properties of
+   * media items ?1 to ?2, in media item id order
+   */
+  static nsString DiffingPropertiesSelect();
+  /**
+   * Creates the table listing the stored sort indexes of GUID arrays
+   */
+  static nsString SortIndexesTableCreate();
+  /**
+   * Creates the table holding the filters of each sort index
+   */
+  static nsString SortIndexFiltersTableCreate();
+  /**
+   * Creates the table holding the position of each row of a sort index
+   */
+  static nsString SortIndexRowsTableCreate();
+  /**
+   * Indexes the rows of a sort index by position
+   */
+  static nsString SortIndexRowsPositionIndexCreate();
+  /**
+   * Indexes the rows of a sort index by media item
+   */
+  static nsString SortIndexRowsMediaItemIndexCreate();
+  /**
+   * Returns every sort index (index_id, sort_key, property_id, ascending,
+   * nulls_first, length, non_null_length)
+   */
+  static nsString SortIndexesSelect();
+  /**
+   * Returns the filters of every sort index (index_id, property_name, value)
+   */
+  static nsString SortIndexFiltersSelect();
+  /**
+   * Adds a sort index given its key, property id, direction, null placement,
+   * length and non null length
+   */
+  static nsString SortIndexInsert();
+  /**
+   * Returns the id of the sort index with the given key
+   */
+  static nsString SortIndexIDSelect();
+  /**
+   * Adds a filter value to a sort index given the index id, the property
+   * and the value
+   */
+  static nsString SortIndexFilterInsert();
+  /**
+   * Adds a row to a sort index given the index id, position and media item id
+   */
+  static nsString SortIndexRowInsert();
+  /**
+   * Removes a sort index given its id
+   */
+  static nsString SortIndexDelete();
+  /**
+   * Removes the filters of a sort index given its id
+   */
+  static nsString SortIndexFiltersDelete();
+  /**
+   * Removes the rows of a sort index given its id
+   */
+  static nsString SortIndexRowsDelete();
+  /**
+   * Sets the length and non null length of a sort index given its id
+   */
+  static nsString SortIndexLengthUpdate();
+  /**
+   * Returns the position of a media item in a sort index given the index id
+   * and the media item id
+   */
+  static nsString SortIndexRowPositionSelect();
+  /**
+   * Returns the sortable value, secondary sortable value and media item id
+   * of the row of a sort index given the sort property id, the index id and
+   * the position
+   */
+  static nsString SortIndexRowValuesSelect();
+  /**
+   * Removes a media item from a sort index given the index id and the media
+   * item id
+   */
+  static nsString SortIndexRowDelete();
+  /**
+   * Moves the rows of a sort index in a range of positions given the offset,
+   * the index id, and the first and past the last position of the range
+   */
+  static nsString SortIndexRowsShift();
+  /**
+   * Sets the position of a media item in a sort index given the position,
+   * the index id and the media item id
+   */
+  static nsString SortIndexRowPositionUpdate();
+  /**
+   * Returns a range of rows of a sort index in the form GUID arrays read them
+   * (media_item_id, guid, sortable value, ordinal, rowid). The parameters are
+   * the number of rows and the first position.
+   */
+  static nsString SortIndexRowsSelect(PRUint32 aIndexID,
+                                      PRUint32 aPropertyID);
+  /**
+   * Returns the id of every media item in ascending order, along with
+   * whether it is a list
+   */
+  static nsString FilterSnapshotItemsSelect();
+  /**
+   * Returns the sortable value of one property for every media item that has
+   * it, in ascending media item id order. The parameter is the property id.
+   */
+  static nsString FilterSnapshotColumnSelect();
+  /**
+   * Returns the media item id and guid of the given media items
+   */
+  static nsString FilterSnapshotGUIDsSelect(const nsTArray<PRUint32>& aMediaItemIDs,
+                                            PRUint32 aStart,
+                                            PRUint32 aCount);
+  /**
+   * Creates the table holding the words of the searchable values
+   */
+  static nsString SearchIndexTableCreate();
+  /**
+   * Indexes the search index by word, then property
+   */
+  static nsString SearchIndexTokenIndexCreate();
+  /**
+   * Indexes the search index by media item
+   */
+  static nsString SearchIndexMediaItemIndexCreate();
+  /**
+   * Drops the words of a media item from the search index when it is deleted
+   */
+  static nsString SearchIndexDeleteTriggerCreate();
+  /**
+   * Returns the version of the search index, if it was built
+   */
+  static nsString SearchIndexVersionSelect();
+  /**
+   * Sets the version of the search index once it is built
+   */
+  static nsString SearchIndexVersionUpdate();
+  /**
+   * Marks the search index as not built
+   */
+  static nsString SearchIndexVersionDelete();
+  /**
+   * Returns the id and name of every property
+   */
+  static nsString SearchIndexPropertiesSelect();
+  /**
+   * Returns the largest media item id
+   */
+  static nsString SearchIndexMaxMediaItemIDSelect();
+  /**
+   * Returns the media item id, property id and searchable value of the
+   * properties of the media items in a range of ids. The parameters are the
+   * first and past the last media item id.
+   */
+  static nsString SearchIndexValuesSelect();
+  /**
+   * Removes the words of the media items in a range of ids. The parameters
+   * are the first and past the last media item id.
+   */
+  static nsString SearchIndexRangeDelete();
+  /**
+   * Removes the words of a media item given its id
+   */
+  static nsString SearchIndexItemDelete();
+  /**
+   * Adds a word given the word, property id and media item id
+   */
+  static nsString SearchIndexInsert();
 
   // These are the number of "IN" bind variables for statements which use them.
   // They are tuned to optimize performance.
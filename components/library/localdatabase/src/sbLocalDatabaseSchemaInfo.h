@@ -38,6 +38,10 @@
 
 #define MAX_IN_LENGTH 5000
 
+// Ordinals in simple_media_lists are spaced this far apart so items can
+// usually be inserted between two others without touching any other row
+#define SB_ORDINAL_GAP 1024
+
 struct sbStaticProperty {
   const char* mPropertyID;
   const char* mColumn;
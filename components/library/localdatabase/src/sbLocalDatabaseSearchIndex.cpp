@@ -0,0 +1,641 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#include "sbLocalDatabaseSearchIndex.h"
+
+#include <nsAutoLock.h>
+#include <nsComponentManagerUtils.h>
+#include <nsIPrefBranch.h>
+#include <nsIThreadPool.h>
+#include <nsIURI.h>
+#include <nsServiceManagerUtils.h>
+#include <nsThreadUtils.h>
+#include <nsUnicharUtils.h>
+
+#include <DatabaseQuery.h>
+#include <sbIDatabasePreparedStatement.h>
+#include <sbIDatabaseQuery.h>
+#include <sbIDatabaseResult.h>
+#include <sbIPropertyInfo.h>
+#include <sbIPropertyManager.h>
+#include <sbIStringTransform.h>
+#include <sbPropertiesCID.h>
+#include <sbThreadPoolService.h>
+
+#include "sbLocalDatabaseSchemaInfo.h"
+#include "sbLocalDatabaseSQL.h"
+
+/**
+ * \brief Whether searches use the word index rather than the full text table
+ */
+#define PREF_SEARCHINDEX_ENABLED \
+  "songbird.library.localdatabase.searchIndex.enabled"
+#define DEFAULT_SEARCHINDEX_ENABLED PR_TRUE
+
+/**
+ * \brief Version of the words kept by the index, bump it when Tokenize
+ *        changes so that existing indexes get built again
+ */
+#define SEARCHINDEX_VERSION 1
+
+/**
+ * \brief Number of media item ids indexed by each transaction of a build
+ */
+#define SEARCHINDEX_BUILD_CHUNK 2000
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbLocalDatabaseSearchIndex,
+                              sbILocalDatabaseSearchIndex)
+
+sbLocalDatabaseSearchIndex::sbLocalDatabaseSearchIndex() :
+  mMonitor(nsnull),
+  mWriteLock(nsnull),
+  mEnabled(DEFAULT_SEARCHINDEX_ENABLED),
+  mReady(PR_FALSE),
+  mBuilding(PR_FALSE),
+  mShutdown(PR_FALSE)
+{
+}
+
+sbLocalDatabaseSearchIndex::~sbLocalDatabaseSearchIndex()
+{
+  if (mWriteLock) {
+    nsAutoLock::DestroyLock(mWriteLock);
+  }
+  if (mMonitor) {
+    nsAutoMonitor::DestroyMonitor(mMonitor);
+  }
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::Init(const nsAString& aDatabaseGUID,
+                                 nsIURI* aDatabaseLocation)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  mMonitor = nsAutoMonitor::NewMonitor("sbLocalDatabaseSearchIndex::mMonitor");
+  NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
+
+  mWriteLock = nsAutoLock::NewLock("sbLocalDatabaseSearchIndex::mWriteLock");
+  NS_ENSURE_TRUE(mWriteLock, NS_ERROR_OUT_OF_MEMORY);
+
+  mDatabaseGUID = aDatabaseGUID;
+  mDatabaseLocation = aDatabaseLocation;
+
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_GetService("@mozilla.org/preferences-service;1", &rv);
+  if (NS_SUCCEEDED(rv)) {
+    PRBool value;
+    rv = prefBranch->GetBoolPref(PREF_SEARCHINDEX_ENABLED, &value);
+    if (NS_SUCCEEDED(rv)) {
+      mEnabled = value;
+    }
+  }
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (!mEnabled) {
+    // Values written from now on won't be indexed, so the index has to be
+    // built again once it is turned back on.
+    rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexVersionDelete());
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->Execute(&dbOk);
+    NS_ENSURE_SUCCESS(rv, rv);
+    NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+    return NS_OK;
+  }
+
+  mThreadPoolService = do_GetService(SB_THREADPOOLSERVICE_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // The table is created on demand so that libraries of any schema version
+  // can use it without a migration.
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexTableCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexTokenIndexCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexMediaItemIndexCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexDeleteTriggerCreate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexVersionSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (rowCount) {
+    nsString version;
+    rv = result->GetRowCell(0, 0, version);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    mReady = version.ToInteger(&rv) == SEARCHINDEX_VERSION &&
+             NS_SUCCEEDED(rv);
+  }
+
+  rv = query->PrepareQuery(sbLocalDatabaseSQL::SearchIndexItemDelete(),
+                           getter_AddRefs(mItemDeletePreparedStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->PrepareQuery(sbLocalDatabaseSQL::SearchIndexInsert(),
+                           getter_AddRefs(mInsertPreparedStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+void
+sbLocalDatabaseSearchIndex::Shutdown()
+{
+  nsAutoMonitor mon(mMonitor);
+
+  mShutdown = PR_TRUE;
+  while (mBuilding) {
+    mon.Wait();
+  }
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::MakeQuery(sbIDatabaseQuery** _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  nsCOMPtr<sbIDatabaseQuery> query =
+    do_CreateInstance(SONGBIRD_DATABASEQUERY_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->SetDatabaseGUID(mDatabaseGUID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (mDatabaseLocation) {
+    rv = query->SetDatabaseLocation(mDatabaseLocation);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->SetAsyncQuery(PR_FALSE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ADDREF(*_retval = query);
+  return NS_OK;
+}
+
+// Words are runs of ASCII letters and digits, or of any other character
+// that isn't punctuation or a space, so accented and non latin words are
+// kept whole.
+static inline PRBool
+IsWordChar(PRUnichar aChar)
+{
+  if (aChar < 0x80) {
+    return (aChar >= 'a' && aChar <= 'z') ||
+           (aChar >= 'A' && aChar <= 'Z') ||
+           (aChar >= '0' && aChar <= '9');
+  }
+  if (aChar < 0xC0) {
+    // Latin-1 punctuation and symbols
+    return aChar == 0xAA || aChar == 0xB5 || aChar == 0xBA;
+  }
+  if (aChar == 0xD7 || aChar == 0xF7) {
+    return PR_FALSE;
+  }
+  // General punctuation, and CJK spaces and punctuation
+  return !(aChar >= 0x2000 && aChar <= 0x206F) &&
+         !(aChar >= 0x3000 && aChar <= 0x303F);
+}
+
+/* static */ void
+sbLocalDatabaseSearchIndex::Tokenize(const nsAString& aValue,
+                                     nsTArray<nsString>& aTokens)
+{
+  const PRUnichar* chars = aValue.BeginReading();
+  PRUint32 length = aValue.Length();
+
+  PRUint32 start = 0;
+  for (PRUint32 i = 0; i <= length; i++) {
+    if (i < length && IsWordChar(chars[i])) {
+      continue;
+    }
+    if (i > start) {
+      nsString token(Substring(aValue, start, i - start));
+      if (aTokens.IndexOf(token) == aTokens.NoIndex) {
+        aTokens.AppendElement(token);
+      }
+    }
+    start = i + 1;
+  }
+}
+
+/* static */ nsresult
+sbLocalDatabaseSearchIndex::GetSearchTokens(const nsAString& aTerm,
+                                            nsTArray<nsString>& aTokens)
+{
+  nsresult rv;
+
+  // Fold the term like sbTextPropertyInfo::MakeSearchable does the values
+  nsString term(aTerm);
+  ToLowerCase(term);
+
+  nsCOMPtr<sbIStringTransform> stringTransform =
+    do_CreateInstance(SB_STRINGTRANSFORM_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsString folded;
+  rv = stringTransform->NormalizeString(EmptyString(),
+                                        sbIStringTransform::TRANSFORM_IGNORE_NONSPACE,
+                                        term,
+                                        folded);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  Tokenize(folded, aTokens);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::AddTokenInserts(sbIDatabaseQuery* aQuery,
+                                            PRUint32 aMediaItemID,
+                                            PRUint32 aPropertyID,
+                                            const nsAString& aValue)
+{
+  nsresult rv;
+
+  nsTArray<nsString> tokens;
+  Tokenize(aValue, tokens);
+
+  for (PRUint32 i = 0; i < tokens.Length(); i++) {
+    rv = aQuery->AddPreparedStatement(mInsertPreparedStatement);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = aQuery->BindStringParameter(0, tokens[i]);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = aQuery->BindInt32Parameter(1, aPropertyID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = aQuery->BindInt32Parameter(2, aMediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::UpdateItems(const nsTArray<PRUint32>& aMediaItemIDs,
+                                        const nsTArray<PRUint32>& aValueItemIDs,
+                                        const nsTArray<PRUint32>& aPropertyIDs,
+                                        const nsTArray<nsString>& aValues)
+{
+  NS_ENSURE_TRUE(aValueItemIDs.Length() == aPropertyIDs.Length() &&
+                 aValueItemIDs.Length() == aValues.Length(),
+                 NS_ERROR_INVALID_ARG);
+
+  {
+    // Items written before the build starts are picked up by the build
+    nsAutoMonitor mon(mMonitor);
+    if (!mEnabled || (!mReady && !mBuilding)) {
+      return NS_OK;
+    }
+  }
+
+  if (!aMediaItemIDs.Length()) {
+    return NS_OK;
+  }
+
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsAutoLock lock(mWriteLock);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 i = 0; i < aMediaItemIDs.Length(); i++) {
+    rv = query->AddPreparedStatement(mItemDeletePreparedStatement);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = query->BindInt32Parameter(0, aMediaItemIDs[i]);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  for (PRUint32 i = 0; i < aValues.Length(); i++) {
+    rv = AddTokenInserts(query, aValueItemIDs[i], aPropertyIDs[i], aValues[i]);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::GetIndexedPropertyIDs(nsTArray<PRUint32>& aPropertyIDs)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIPropertyManager> propertyManager =
+    do_GetService(SB_PROPERTYMANAGER_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexPropertiesSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Index the same properties the property cache puts in the full text
+  // table
+  for (PRUint32 row = 0; row < rowCount; row++) {
+    nsString propertyName;
+    rv = result->GetRowCell(row, 1, propertyName);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRBool hasProperty;
+    rv = propertyManager->HasProperty(propertyName, &hasProperty);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (!hasProperty) {
+      continue;
+    }
+
+    nsCOMPtr<sbIPropertyInfo> propertyInfo;
+    rv = propertyManager->GetPropertyInfo(propertyName,
+                                          getter_AddRefs(propertyInfo));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRBool isUserViewable;
+    rv = propertyInfo->GetUserViewable(&isUserViewable);
+    NS_ENSURE_SUCCESS(rv, rv);
+    if (!isUserViewable) {
+      continue;
+    }
+
+    PRInt64 propertyID;
+    rv = result->GetRowCellAsInt64(row, 0, &propertyID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    NS_ENSURE_TRUE(aPropertyIDs.AppendElement(static_cast<PRUint32>(propertyID)),
+                   NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::IndexRange(const nsTArray<PRUint32>& aPropertyIDs,
+                                       PRUint32 aStart,
+                                       PRUint32 aEnd)
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  // Read and write the range in one go so that a property cache write that
+  // lands in between is indexed again after it
+  nsAutoLock lock(mWriteLock);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexValuesSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, aStart);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(1, aEnd);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIDatabaseQuery> insert;
+  rv = MakeQuery(getter_AddRefs(insert));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = insert->AddQuery(NS_LITERAL_STRING("BEGIN"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = insert->AddQuery(sbLocalDatabaseSQL::SearchIndexRangeDelete());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = insert->BindInt32Parameter(0, aStart);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = insert->BindInt32Parameter(1, aEnd);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 row = 0; row < rowCount; row++) {
+    PRInt64 propertyID;
+    rv = result->GetRowCellAsInt64(row, 1, &propertyID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (aPropertyIDs.IndexOf(static_cast<PRUint32>(propertyID)) ==
+        aPropertyIDs.NoIndex) {
+      continue;
+    }
+
+    PRInt64 mediaItemID;
+    rv = result->GetRowCellAsInt64(row, 0, &mediaItemID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString value;
+    rv = result->GetRowCell(row, 2, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = AddTokenInserts(insert,
+                         static_cast<PRUint32>(mediaItemID),
+                         static_cast<PRUint32>(propertyID),
+                         value);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = insert->AddQuery(NS_LITERAL_STRING("COMMIT"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = insert->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSearchIndex::Build()
+{
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsTArray<PRUint32> propertyIDs;
+  rv = GetIndexedPropertyIDs(propertyIDs);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexMaxMediaItemIDSelect());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRInt64 maxMediaItemID;
+  rv = result->GetRowCellAsInt64(0, 0, &maxMediaItemID);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Items added past the last range are indexed as their properties are
+  // written, since mBuilding is set
+  for (PRInt64 start = 0;
+       start <= maxMediaItemID;
+       start += SEARCHINDEX_BUILD_CHUNK) {
+    {
+      nsAutoMonitor mon(mMonitor);
+      if (mShutdown) {
+        return NS_ERROR_ABORT;
+      }
+    }
+
+    rv = IndexRange(propertyIDs,
+                    static_cast<PRUint32>(start),
+                    static_cast<PRUint32>(start + SEARCHINDEX_BUILD_CHUNK));
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = query->ResetQuery();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(sbLocalDatabaseSQL::SearchIndexVersionUpdate());
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->BindInt32Parameter(0, SEARCHINDEX_VERSION);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+void
+sbLocalDatabaseSearchIndex::RunBuild()
+{
+  nsresult rv = Build();
+
+  nsAutoMonitor mon(mMonitor);
+
+  mBuilding = PR_FALSE;
+  if (NS_SUCCEEDED(rv)) {
+    mReady = PR_TRUE;
+  }
+  else if (!mShutdown) {
+    // Keep using the full text table rather than trying again on every
+    // search
+    NS_WARNING("Failed to build the search index");
+    mEnabled = PR_FALSE;
+  }
+
+  mon.NotifyAll();
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseSearchIndex::EnsureIndex(PRBool* _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsAutoMonitor mon(mMonitor);
+
+  *_retval = mEnabled && mReady;
+  if (!mEnabled || mReady || mBuilding || mShutdown) {
+    return NS_OK;
+  }
+
+  nsCOMPtr<nsIRunnable> runnable =
+    NS_NEW_RUNNABLE_METHOD(sbLocalDatabaseSearchIndex, this, RunBuild);
+  NS_ENSURE_TRUE(runnable, NS_ERROR_OUT_OF_MEMORY);
+
+  mBuilding = PR_TRUE;
+
+  nsresult rv = mThreadPoolService->Dispatch(runnable, NS_DISPATCH_NORMAL);
+  if (NS_FAILED(rv)) {
+    mBuilding = PR_FALSE;
+    return rv;
+  }
+
+  return NS_OK;
+}
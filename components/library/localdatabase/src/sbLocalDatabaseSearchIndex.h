@@ -0,0 +1,147 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#ifndef __SBLOCALDATABASESEARCHINDEX_H__
+#define __SBLOCALDATABASESEARCHINDEX_H__
+
+#include <sbILocalDatabaseGUIDArray.h>
+
+#include <nsCOMPtr.h>
+#include <nsStringGlue.h>
+#include <nsTArray.h>
+#include <prlock.h>
+#include <prmon.h>
+
+class nsIThreadPool;
+class nsIURI;
+class sbIDatabasePreparedStatement;
+class sbIDatabaseQuery;
+
+/**
+ * \brief Word index over the searchable values of a library.
+ *
+ * Every word of the searchable value of each user viewable property is kept
+ * in a table along with the property and the item, so a search can find the
+ * items with a word that starts with a term, in any or in given properties,
+ * with one indexed range read per term instead of a full text MATCH.  The
+ * searchable values are already lower cased and have their diacritics
+ * stripped, and search terms are folded the same way.
+ *
+ * The index is built in the background the first time a search needs it and
+ * is then kept up to date by the property cache as it writes, while deleted
+ * items drop their words through a trigger.
+ */
+class sbLocalDatabaseSearchIndex : public sbILocalDatabaseSearchIndex
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBILOCALDATABASESEARCHINDEX
+
+  sbLocalDatabaseSearchIndex();
+
+  nsresult Init(const nsAString& aDatabaseGUID,
+                nsIURI* aDatabaseLocation);
+
+  /**
+   * \brief Stop building the index and wait for the build to return
+   */
+  void Shutdown();
+
+  /**
+   * \brief Whether the property cache should tell the index about the values
+   *        it writes
+   */
+  PRBool IsEnabled() { return mEnabled; }
+
+  /**
+   * \brief Called by the property cache once it has written properties.
+   *        aMediaItemIDs holds every written item, and aValueItemIDs,
+   *        aPropertyIDs and aValues the searchable value of each of their
+   *        user viewable properties.
+   */
+  nsresult UpdateItems(const nsTArray<PRUint32>& aMediaItemIDs,
+                       const nsTArray<PRUint32>& aValueItemIDs,
+                       const nsTArray<PRUint32>& aPropertyIDs,
+                       const nsTArray<nsString>& aValues);
+
+  /**
+   * \brief Split a searchable value into the distinct words the index keeps
+   */
+  static void Tokenize(const nsAString& aValue, nsTArray<nsString>& aTokens);
+
+  /**
+   * \brief Fold a search term like a searchable value, then split it into
+   *        words
+   */
+  static nsresult GetSearchTokens(const nsAString& aTerm,
+                                  nsTArray<nsString>& aTokens);
+
+private:
+  ~sbLocalDatabaseSearchIndex();
+
+  nsresult MakeQuery(sbIDatabaseQuery** _retval);
+
+  nsresult AddTokenInserts(sbIDatabaseQuery* aQuery,
+                           PRUint32 aMediaItemID,
+                           PRUint32 aPropertyID,
+                           const nsAString& aValue);
+
+  nsresult GetIndexedPropertyIDs(nsTArray<PRUint32>& aPropertyIDs);
+
+  nsresult IndexRange(const nsTArray<PRUint32>& aPropertyIDs,
+                      PRUint32 aStart,
+                      PRUint32 aEnd);
+
+  nsresult Build();
+
+  void RunBuild();
+
+  // Protects the state flags below
+  PRMonitor* mMonitor;
+
+  // Serializes the writes of the build with those of the property cache,
+  // and guards the prepared statements
+  PRLock* mWriteLock;
+
+  nsString mDatabaseGUID;
+  nsCOMPtr<nsIURI> mDatabaseLocation;
+
+  nsCOMPtr<nsIThreadPool> mThreadPoolService;
+
+  nsCOMPtr<sbIDatabasePreparedStatement> mItemDeletePreparedStatement;
+  nsCOMPtr<sbIDatabasePreparedStatement> mInsertPreparedStatement;
+
+  PRBool mEnabled;
+
+  // Whether the index covers the library
+  PRBool mReady;
+
+  // Whether the index is being built, during which written items are indexed
+  // too so that the ranges already built stay current
+  PRBool mBuilding;
+
+  PRBool mShutdown;
+};
+
+#endif /* __SBLOCALDATABASESEARCHINDEX_H__ */
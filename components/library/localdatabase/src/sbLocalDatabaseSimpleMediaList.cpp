@@ -31,6 +31,7 @@
 #include <nsIProgrammingLanguage.h>
 #include <nsISimpleEnumerator.h>
 #include <nsIURI.h>
+#include <sbIDatabasePreparedStatement.h>
 #include <sbIDatabaseQuery.h>
 #include <sbIDatabaseResult.h>
 #include <sbILibrary.h>
@@ -42,6 +43,7 @@
 #include "sbLocalDatabaseCID.h"
 #include "sbLocalDatabaseLibrary.h"
 #include "sbLocalDatabaseGUIDArray.h"
+#include "sbLocalDatabaseSchemaInfo.h"
 #include "sbMediaListEnumSingleItemHelper.h"
 
 #include <DatabaseQuery.h>
@@ -61,6 +63,9 @@
 #define DEFAULT_SORT_PROPERTY NS_LITERAL_STRING(SB_PROPERTY_ORDINAL)
 #define DEFAULT_FETCH_SIZE 1000
 
+// Highest ordinal handed out before the list is renumbered
+#define SB_ORDINAL_LIMIT (((PRInt64) 1) << 60)
+
 /**
  * To log this class, set the following environment variable:
  *   NSPR_LOG_MODULES=sbLocalDatabaseSimpleMediaList:5
@@ -183,19 +188,16 @@ public:
     sbLocalDatabaseSimpleMediaList* aLocalDatabaseSimpleMediaList,
     nsISimpleEnumerator* aMediaItems,
     nsISupports * aListener,
-    PRUint32 aStartingIndex,
-    const nsAString& aStartingOrdinal)
+    PRUint32 aStartingIndex)
     : mLocalDatabaseSimpleMediaList(aLocalDatabaseSimpleMediaList)
     , mListener(aListener)
     , mMediaItems(aMediaItems)
-    , mStartingIndex(aStartingIndex)
-    , mStartingOrdinal(aStartingOrdinal) {}
+    , mStartingIndex(aStartingIndex) {}
   NS_IMETHOD Run() {
     nsresult rv = 
       mLocalDatabaseSimpleMediaList->AddSomeAsyncInternal(mMediaItems, 
                                                           mListener,
-                                                          mStartingIndex,
-                                                          mStartingOrdinal);
+                                                          mStartingIndex);
     NS_ENSURE_SUCCESS(rv, rv);
     return NS_OK;
   }
@@ -205,7 +207,6 @@ private:
   nsCOMPtr<nsISupports>                    mListener;
   nsCOMPtr<nsISimpleEnumerator>            mMediaItems;
   PRUint32                                 mStartingIndex;
-  nsString                                 mStartingOrdinal;
 };
 
 NS_IMPL_THREADSAFE_ISUPPORTS1(sbLocalDatabaseSimpleMediaListAddSomeAsyncRunner,
@@ -550,7 +551,10 @@ sbSimpleMediaListInsertingEnumerationListener::OnEnumerationEnd(sbIMediaList* aM
   rv = query->AddQuery(NS_LITERAL_STRING("begin"));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsString ordinal = mStartingOrdinal;
+  // Make room for the new items in front of whatever is at mStartingIndex
+  PRInt64 ordinal, step;
+  rv = mFriendList->ReserveOrdinals(mStartingIndex, itemCount, &ordinal, &step);
+  NS_ENSURE_SUCCESS(rv, rv);
 
   // For each item, new or existing, go through and add the item to the media
   // list
@@ -594,12 +598,10 @@ sbSimpleMediaListInsertingEnumerationListener::OnEnumerationEnd(sbIMediaList* aM
     rv = query->BindInt32Parameter(0, mediaItemId);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    rv = query->BindStringParameter(1, ordinal);
+    rv = query->BindInt64Parameter(1, ordinal);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    // Increment the ordinal
-    rv = mFriendList->AddToLastPathSegment(ordinal, 1);
-    NS_ENSURE_SUCCESS(rv, rv);
+    ordinal += step;
   }
 
   rv = query->AddQuery(NS_LITERAL_STRING("commit"));
@@ -947,13 +949,8 @@ sbLocalDatabaseSimpleMediaList::AddItem(sbIMediaItem* aMediaItem,
   nsresult rv = GetLength(&startingIndex);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsString startingOrdinal;
-  rv = GetNextOrdinal(startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
   sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         startingIndex,
-                                                         startingOrdinal);
+                                                         startingIndex);
 
   PRUint16 stepResult;
   rv = listener.OnEnumerationBegin(nsnull, &stepResult);
@@ -985,13 +982,8 @@ sbLocalDatabaseSimpleMediaList::AddAll(sbIMediaList* aMediaList)
   nsresult rv = GetLength(&startingIndex);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsString startingOrdinal;
-  rv = GetNextOrdinal(startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
   sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         startingIndex,
-                                                         startingOrdinal);
+                                                         startingIndex);
   rv =
     aMediaList->EnumerateAllItems(&listener,
                                   sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
@@ -1010,20 +1002,8 @@ sbLocalDatabaseSimpleMediaList::InsertAllBefore(PRUint32 aIndex,
 
   sbAutoBatchHelper batchHelper(*this);
 
-  PRUint32 startingIndex;
-  nsresult rv = GetLength(&startingIndex);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  nsString startingOrdinal;
-  rv = GetBeforeOrdinal(aIndex, startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  startingOrdinal.AppendLiteral(".0");
-
-  sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         aIndex,
-                                                         startingOrdinal);
-  rv =
+  sbSimpleMediaListInsertingEnumerationListener listener(this, aIndex);
+  nsresult rv =
     aMediaList->EnumerateAllItems(&listener,
                                   sbIMediaList::ENUMERATIONTYPE_SNAPSHOT);
   NS_ENSURE_SUCCESS(rv, rv);
@@ -1051,10 +1031,6 @@ sbLocalDatabaseSimpleMediaList::AddMediaItems(
     nsresult rv = GetLength(&startingIndex);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsString startingOrdinal;
-    rv = GetNextOrdinal(startingOrdinal);
-    NS_ENSURE_SUCCESS(rv, rv);
-
     nsCOMPtr<nsIThread> target;
     rv = NS_GetMainThread(getter_AddRefs(target));
     NS_ENSURE_SUCCESS(rv, rv);
@@ -1070,7 +1046,7 @@ sbLocalDatabaseSimpleMediaList::AddMediaItems(
     }
     nsRefPtr<sbLocalDatabaseSimpleMediaListAddSomeAsyncRunner> runner =
       new sbLocalDatabaseSimpleMediaListAddSomeAsyncRunner(
-        this, aMediaItems, proxiedListener, startingIndex, startingOrdinal);
+        this, aMediaItems, proxiedListener, startingIndex);
     NS_ENSURE_TRUE(runner, NS_ERROR_OUT_OF_MEMORY);
 
     nsCOMPtr<nsIThreadPool> threadPoolService =
@@ -1089,13 +1065,8 @@ sbLocalDatabaseSimpleMediaList::AddMediaItems(
     nsresult rv = GetLength(&startingIndex);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsString startingOrdinal;
-    rv = GetNextOrdinal(startingOrdinal);
-    NS_ENSURE_SUCCESS(rv, rv);
-
     sbSimpleMediaListInsertingEnumerationListener listener(this,
                                                            startingIndex,
-                                                           startingOrdinal,
                                                            aListener);
 
     PRUint16 stepResult;
@@ -1126,8 +1097,7 @@ sbLocalDatabaseSimpleMediaList::AddMediaItems(
 nsresult
 sbLocalDatabaseSimpleMediaList::AddSomeAsyncInternal(nsISimpleEnumerator* aMediaItems,
                                                      nsISupports * aListener,
-                                                     PRUint32 aStartingIndex,
-                                                     nsAString& aStartingOrdinal)
+                                                     PRUint32 aStartingIndex)
 {
   NS_ENSURE_ARG_POINTER(aMediaItems);
   NS_ENSURE_ARG_POINTER(aListener);
@@ -1147,8 +1117,7 @@ sbLocalDatabaseSimpleMediaList::AddSomeAsyncInternal(nsISimpleEnumerator* aMedia
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
 
   sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         aStartingIndex,
-                                                         aStartingOrdinal);
+                                                         aStartingIndex);
 
   PRUint16 stepResult;
   rv = listener.OnEnumerationBegin(nsnull, &stepResult);
@@ -1211,16 +1180,10 @@ sbLocalDatabaseSimpleMediaList::InsertBefore(PRUint32 aIndex,
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
   SB_ENSURE_INDEX1(aIndex);
 
-  nsString startingOrdinal;
-  nsresult rv = GetBeforeOrdinal(aIndex, startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         aIndex,
-                                                         startingOrdinal);
+  sbSimpleMediaListInsertingEnumerationListener listener(this, aIndex);
 
   PRUint16 stepResult;
-  rv = listener.OnEnumerationBegin(nsnull, &stepResult);
+  nsresult rv = listener.OnEnumerationBegin(nsnull, &stepResult);
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = listener.OnEnumeratedItem(nsnull, aMediaItem, &stepResult);
@@ -1246,9 +1209,9 @@ sbLocalDatabaseSimpleMediaList::MoveBefore(PRUint32 aFromIndex,
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
   SB_ENSURE_INDEX2(aFromIndex, aToIndex);
 
-  // Get the ordinal of the space before the to index
-  nsAutoString ordinal;
-  rv = GetBeforeOrdinal(aToIndex, ordinal);
+  // Get an ordinal for the space before the to index
+  PRInt64 ordinal, step;
+  rv = ReserveOrdinals(aToIndex, 1, &ordinal, &step);
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = UpdateOrdinalByIndex(aFromIndex, ordinal);
@@ -1286,17 +1249,17 @@ sbLocalDatabaseSimpleMediaList::MoveLast(PRUint32 aIndex)
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
   SB_ENSURE_INDEX1(aIndex);
 
-  // Get the ordinal for the space after the last item in the list
-  nsAutoString ordinal;
-  rv = GetNextOrdinal(ordinal);
+  // Grab the length before the invalidation since it won't be changing
+  PRUint32 length;
+  rv = GetArray()->GetLength(&length);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = UpdateOrdinalByIndex(aIndex, ordinal);
+  // Get an ordinal for the space after the last item in the list
+  PRInt64 ordinal, step;
+  rv = ReserveOrdinals(length, 1, &ordinal, &step);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  // Grab the length before the invalidation since it won't be changing
-  PRUint32 length;
-  rv = GetArray()->GetLength(&length);
+  rv = UpdateOrdinalByIndex(aIndex, ordinal);
   NS_ENSURE_SUCCESS(rv, rv);
 
   // Invalidate the cached list. Moving items does not invalidate length.
@@ -1325,18 +1288,10 @@ sbLocalDatabaseSimpleMediaList::InsertSomeBefore(PRUint32 aIndex,
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
   SB_ENSURE_INDEX1(aIndex);
 
-  nsString startingOrdinal;
-  nsresult rv = GetBeforeOrdinal(aIndex, startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  startingOrdinal.AppendLiteral(".0");
-
-  sbSimpleMediaListInsertingEnumerationListener listener(this,
-                                                         aIndex,
-                                                         startingOrdinal);
+  sbSimpleMediaListInsertingEnumerationListener listener(this, aIndex);
 
   PRUint16 stepResult;
-  rv = listener.OnEnumerationBegin(nsnull, &stepResult);
+  nsresult rv = listener.OnEnumerationBegin(nsnull, &stepResult);
   NS_ENSURE_SUCCESS(rv, rv);
 
   sbAutoBatchHelper batchHelper(*this);
@@ -1372,12 +1327,6 @@ sbLocalDatabaseSimpleMediaList::InsertSomeBeforeAsync(
 
   nsresult rv;
 
-  nsString startingOrdinal;
-  rv = GetBeforeOrdinal(aIndex, startingOrdinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  startingOrdinal.AppendLiteral(".0");
-
   nsCOMPtr<nsIThread> target;
   rv = NS_GetMainThread(getter_AddRefs(target));
   NS_ENSURE_SUCCESS(rv, rv);
@@ -1392,7 +1341,7 @@ sbLocalDatabaseSimpleMediaList::InsertSomeBeforeAsync(
 
   nsRefPtr<sbLocalDatabaseSimpleMediaListAddSomeAsyncRunner> runner = 
     new sbLocalDatabaseSimpleMediaListAddSomeAsyncRunner(
-      this, aMediaItems, proxiedListener, aIndex, startingOrdinal);
+      this, aMediaItems, proxiedListener, aIndex);
   NS_ENSURE_TRUE(runner, NS_ERROR_OUT_OF_MEMORY);
 
   nsCOMPtr<nsIThreadPool> threadPoolService =
@@ -1417,15 +1366,9 @@ sbLocalDatabaseSimpleMediaList::MoveSomeBefore(PRUint32* aFromIndexArray,
   SB_MEDIALIST_LOCK_FULLARRAY_AND_ENSURE_MUTABLE();
   SB_ENSURE_INDEX1(aToIndex);
 
-  nsAutoString ordinal;
-  rv = GetBeforeOrdinal(aToIndex, ordinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  ordinal.AppendLiteral(".");
   rv = MoveSomeInternal(aFromIndexArray,
                         aFromIndexArrayCount,
-                        aToIndex,
-                        ordinal);
+                        aToIndex);
   NS_ENSURE_SUCCESS(rv, rv);
 
   return NS_OK;
@@ -1439,17 +1382,11 @@ sbLocalDatabaseSimpleMediaList::MoveSomeLast(PRUint32* aIndexArray,
 
   NS_ENSURE_ARG_POINTER(aIndexArray);
 
-  nsAutoString ordinal;
-  nsresult rv = GetNextOrdinal(ordinal);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  ordinal.AppendLiteral(".");
-
   PRUint32 length;
-  rv = GetArray()->GetLength(&length);
+  nsresult rv = GetArray()->GetLength(&length);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = MoveSomeInternal(aIndexArray, aIndexArrayCount, length, ordinal);
+  rv = MoveSomeInternal(aIndexArray, aIndexArrayCount, length);
   NS_ENSURE_SUCCESS(rv, rv);
 
   return NS_OK;
@@ -1919,7 +1856,7 @@ sbLocalDatabaseSimpleMediaList::ExecuteAggregateQuery(const nsAString& aQuery,
 
 nsresult
 sbLocalDatabaseSimpleMediaList::UpdateOrdinalByIndex(PRUint32 aIndex,
-                                                     const nsAString& aOrdinal)
+                                                     PRInt64 aOrdinal)
 {
   nsresult rv;
   PRInt32 dbOk;
@@ -1942,7 +1879,7 @@ sbLocalDatabaseSimpleMediaList::UpdateOrdinalByIndex(PRUint32 aIndex,
   rv = query->AddQuery(mUpdateListItemOrdinalQuery);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = query->BindStringParameter(0, aOrdinal);
+  rv = query->BindInt64Parameter(0, aOrdinal);
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = query->BindInt32Parameter(1, mediaItemId);
@@ -1961,8 +1898,7 @@ sbLocalDatabaseSimpleMediaList::UpdateOrdinalByIndex(PRUint32 aIndex,
 nsresult
 sbLocalDatabaseSimpleMediaList::MoveSomeInternal(PRUint32* aFromIndexArray,
                                                  PRUint32 aFromIndexArrayCount,
-                                                 PRUint32 aToIndex,
-                                                 const nsAString& aOrdinalRoot)
+                                                 PRUint32 aToIndex)
 {
   NS_ASSERTION(aFromIndexArray, "aFromIndexArray is null");
 
@@ -1975,19 +1911,22 @@ sbLocalDatabaseSimpleMediaList::MoveSomeInternal(PRUint32* aFromIndexArray,
     NS_ENSURE_ARG_MAX(aFromIndexArray[i], length - 1);
   }
 
+  sbAutoBatchHelper batchHelper(*this);
+
+  // Reserve the ordinals first, this may renumber the list and so change the
+  // ordinals of the items being moved
+  PRInt64 ordinal, step;
+  rv = ReserveOrdinals(aToIndex, aFromIndexArrayCount, &ordinal, &step);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   nsCOMPtr<sbIDatabaseQuery> query;
   rv = MakeStandardQuery(getter_AddRefs(query));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  sbAutoBatchHelper batchHelper(*this);
-
   rv = query->AddQuery(NS_LITERAL_STRING("begin"));
   NS_ENSURE_SUCCESS(rv, rv);
 
   for (PRUint32 i = 0; i < aFromIndexArrayCount; i++) {
-    nsAutoString ordinal(aOrdinalRoot);
-    ordinal.AppendInt(i);
-
     PRUint32 mediaItemId;
     rv = GetArray()->GetMediaItemIdByIndex(aFromIndexArray[i], &mediaItemId);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -1999,7 +1938,7 @@ sbLocalDatabaseSimpleMediaList::MoveSomeInternal(PRUint32* aFromIndexArray,
     rv = query->AddQuery(mUpdateListItemOrdinalQuery);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    rv = query->BindStringParameter(0, ordinal);
+    rv = query->BindInt64Parameter(0, ordinal);
     NS_ENSURE_SUCCESS(rv, rv);
 
     rv = query->BindInt32Parameter(1, mediaItemId);
@@ -2007,6 +1946,8 @@ sbLocalDatabaseSimpleMediaList::MoveSomeInternal(PRUint32* aFromIndexArray,
 
     rv = query->BindStringParameter(2, oldOrdinal);
     NS_ENSURE_SUCCESS(rv, rv);
+
+    ordinal += step;
   }
 
   rv = query->AddQuery(NS_LITERAL_STRING("commit"));
@@ -2075,146 +2016,213 @@ sbLocalDatabaseSimpleMediaList::MoveSomeInternal(PRUint32* aFromIndexArray,
 }
 
 nsresult
-sbLocalDatabaseSimpleMediaList::GetNextOrdinal(nsAString& aValue)
+sbLocalDatabaseSimpleMediaList::GetOrdinalValueByIndex(PRUint32 aIndex,
+                                                       PRUint32 aLength,
+                                                       PRInt64* _retval)
 {
-  nsresult rv;
+  NS_ASSERTION(aIndex < aLength, "Index out of range");
 
-  PRUint32 length;
-  rv = GetArray()->GetLength(&length);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  if (length == 0) {
-    aValue.AssignLiteral("0");
-    return NS_OK;
-  }
+  nsresult rv;
 
   PRBool cached;
-  rv = GetArray()->IsIndexCached(length - 1, &cached);
+  rv = GetArray()->IsIndexCached(aIndex, &cached);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  if (cached) {
-    rv = GetArray()->GetSortPropertyValueByIndex(length - 1, aValue);
+  // The ends of the list can be had without filling the array
+  nsAutoString value;
+  if (!cached && aIndex == 0) {
+    rv = ExecuteAggregateQuery(mGetFirstOrdinalQuery, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else if (!cached && aIndex == aLength - 1) {
+    rv = ExecuteAggregateQuery(mGetLastOrdinalQuery, value);
     NS_ENSURE_SUCCESS(rv, rv);
   }
   else {
-    rv = ExecuteAggregateQuery(mGetLastOrdinalQuery, aValue);
+    rv = GetArray()->GetSortPropertyValueByIndex(aIndex, value);
     NS_ENSURE_SUCCESS(rv, rv);
   }
 
-  rv = AddToLastPathSegment(aValue, 1);
+  *_retval = nsString_ToInt64(value, &rv);
   NS_ENSURE_SUCCESS(rv, rv);
 
   return NS_OK;
 }
 
 nsresult
-sbLocalDatabaseSimpleMediaList::GetBeforeOrdinal(PRUint32 aIndex,
-                                                 nsAString& aValue)
+sbLocalDatabaseSimpleMediaList::ReserveOrdinals(PRUint32 aIndex,
+                                                PRUint32 aCount,
+                                                PRInt64* aFirst,
+                                                PRInt64* aStep)
 {
+  NS_ENSURE_ARG_POINTER(aFirst);
+  NS_ENSURE_ARG_POINTER(aStep);
+  NS_ENSURE_ARG_MIN(aCount, 1);
+
   nsresult rv;
 
-  // If we want to insert before the first index, get the ordinal of the
-  // first index and trim off everything but the first path and subtract 1
-  if (aIndex == 0) {
-    PRBool cached;
-    rv = GetArray()->IsIndexCached(0, &cached);
+  PRUint32 length;
+  rv = GetArray()->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (aIndex > length) {
+    aIndex = length;
+  }
+
+  *aStep = SB_ORDINAL_GAP;
+
+  if (length == 0) {
+    *aFirst = 0;
+    return NS_OK;
+  }
+
+  // Appending and prepending only need to step away from the last or first
+  // ordinal, as long as that stays in range
+  PRInt64 limit = SB_ORDINAL_LIMIT - (PRInt64) aCount * SB_ORDINAL_GAP;
+  if (aIndex == length) {
+    PRInt64 last;
+    rv = GetOrdinalValueByIndex(length - 1, length, &last);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsAutoString ordinal;
-    if (cached) {
-      rv = GetArray()->GetSortPropertyValueByIndex(0, ordinal);
-      NS_ENSURE_SUCCESS(rv, rv);
-    }
-    else {
-      rv = ExecuteAggregateQuery(mGetFirstOrdinalQuery, ordinal);
-      NS_ENSURE_SUCCESS(rv, rv);
+    if (last < limit) {
+      *aFirst = last + SB_ORDINAL_GAP;
+      return NS_OK;
     }
+  }
+  else if (aIndex == 0) {
+    PRInt64 first;
+    rv = GetOrdinalValueByIndex(0, length, &first);
+    NS_ENSURE_SUCCESS(rv, rv);
 
-    // Trim off additional path segments, if any
-    PRUint32 pos = ordinal.FindChar('.');
-    if (pos >= 0) {
-      ordinal.SetLength(pos);
+    if (first > -limit) {
+      *aFirst = first - (PRInt64) aCount * SB_ORDINAL_GAP;
+      return NS_OK;
     }
-
-    PRInt32 value = ordinal.ToInteger(&rv) - 1;
+  }
+  else {
+    // Spread the new ordinals evenly over the gap between the neighbours
+    PRInt64 above, below;
+    rv = GetOrdinalValueByIndex(aIndex - 1, length, &above);
     NS_ENSURE_SUCCESS(rv, rv);
 
-    nsAutoString newOrdinal;
-    newOrdinal.AppendInt(value);
-    aValue = newOrdinal;
+    rv = GetOrdinalValueByIndex(aIndex, length, &below);
+    NS_ENSURE_SUCCESS(rv, rv);
 
-    return NS_OK;
+    if (below - above > (PRInt64) aCount) {
+      *aStep = (below - above) / (aCount + 1);
+      *aFirst = above + *aStep;
+      return NS_OK;
+    }
   }
 
-  // Find the ordinals before and after the place we want to insert
-  nsAutoString aboveOrdinal;
-  nsAutoString belowOrdinal;
+  // No room left, spread the whole list out again leaving aCount free slots
+  // at aIndex
+  rv = RenumberOrdinals(aIndex, aCount);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  *aFirst = (PRInt64) aIndex * SB_ORDINAL_GAP;
+  *aStep = SB_ORDINAL_GAP;
+
+  return NS_OK;
+}
 
-  rv = GetArray()->GetSortPropertyValueByIndex(aIndex - 1, aboveOrdinal);
+nsresult
+sbLocalDatabaseSimpleMediaList::RenumberOrdinals(PRUint32 aIndex,
+                                                 PRUint32 aCount)
+{
+  TRACE(("LocalDatabaseSimpleMediaList[0x%.8x] - RenumberOrdinals(%d, %d)",
+         this, aIndex, aCount));
+
+  nsresult rv;
+  PRInt32 dbOk;
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = MakeStandardQuery(getter_AddRefs(query));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = GetArray()->GetSortPropertyValueByIndex(aIndex, belowOrdinal);
+  rv = query->AddQuery(mGetOrdinalsQuery);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  PRUint32 aboveLevels = CountLevels(aboveOrdinal);
-  PRUint32 belowLevels = CountLevels(belowOrdinal);
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
 
-  // If the two paths are to the same level, create a new level on the
-  // below path to make a path that sorts between
-  if (aboveLevels == belowLevels) {
-    belowOrdinal.AppendLiteral(".0");
-    aValue = belowOrdinal;
-    return NS_OK;
-  }
+  nsCOMPtr<sbIDatabaseResult> result;
+  rv = query->GetResultObject(getter_AddRefs(result));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 rowCount;
+  rv = result->GetRowCount(&rowCount);
+  NS_ENSURE_SUCCESS(rv, rv);
 
-  // Otherwise if the below path is longer than the above path, decrement the
-  // last path segment of the below path
-  if (belowLevels > aboveLevels) {
-    rv = AddToLastPathSegment(belowOrdinal, -1);
+  nsTArray<PRInt64> rowids(rowCount);
+  PRInt64 lowest = 0;
+  for (PRUint32 i = 0; i < rowCount; i++) {
+    nsString value;
+    rv = result->GetRowCell(i, 0, value);
     NS_ENSURE_SUCCESS(rv, rv);
-    aValue = belowOrdinal;
-    return NS_OK;
+
+    PRInt64* success = rowids.AppendElement(nsString_ToInt64(value, &rv));
+    NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = result->GetRowCell(i, 1, value);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRInt64 ordinal = nsString_ToInt64(value, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    if (ordinal < lowest) {
+      lowest = ordinal;
+    }
   }
 
-  // If the above path is longer than the below, increment the last path
-  // segment of the above path
-  rv = AddToLastPathSegment(aboveOrdinal, 1);
+  rv = MakeStandardQuery(getter_AddRefs(query));
   NS_ENSURE_SUCCESS(rv, rv);
-  aValue = aboveOrdinal;
-  return NS_OK;
-}
 
-nsresult
-sbLocalDatabaseSimpleMediaList::AddToLastPathSegment(nsAString& aPath,
-                                                     PRInt32 aToAdd)
-{
-
-  PRUint32 startPos = aPath.RFindChar('.') + 1;
-  PRUint32 length = aPath.Length() - startPos;
+  nsCOMPtr<sbIDatabasePreparedStatement> updateStatement;
+  rv = query->PrepareQuery(mUpdateOrdinalByRowidQuery,
+                           getter_AddRefs(updateStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
 
-  nsresult rv;
-  PRInt32 value = Substring(aPath, startPos, length).ToInteger(&rv);
+  rv = query->AddQuery(NS_LITERAL_STRING("begin"));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  value += aToAdd;
+  // The new ordinals overlap the old ones, so first park every row below all
+  // of them to keep the (media_item_id, ordinal) index unique along the way
+  for (PRUint32 pass = 0; pass < 2; pass++) {
+    for (PRUint32 i = 0; i < rowCount; i++) {
+      PRInt64 ordinal;
+      if (pass == 0) {
+        ordinal = lowest - 1 - (PRInt64) i;
+      }
+      else {
+        ordinal = (PRInt64) (i < aIndex ? i : i + aCount) * SB_ORDINAL_GAP;
+      }
 
-  nsAutoString newValue;
-  newValue.AppendInt(value);
-  aPath.Replace(startPos, length, newValue);
+      rv = query->AddPreparedStatement(updateStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
 
-  return NS_OK;
-}
+      rv = query->BindInt64Parameter(0, ordinal);
+      NS_ENSURE_SUCCESS(rv, rv);
 
-PRUint32
-sbLocalDatabaseSimpleMediaList::CountLevels(const nsAString& aPath)
-{
-  PRUint32 count = 0;
-  PRInt32 foundpos = aPath.FindChar('.');
-  while(foundpos >= 0) {
-    count++;
-    foundpos = aPath.FindChar('.', foundpos + 1);
+      rv = query->BindInt64Parameter(1, rowids[i]);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
   }
-  return count;
+
+  rv = query->AddQuery(NS_LITERAL_STRING("commit"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  // Every cached ordinal is now stale, the order itself is unchanged
+  rv = GetArray()->Invalidate(PR_FALSE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
 }
 
 nsresult
@@ -2369,6 +2377,58 @@ sbLocalDatabaseSimpleMediaList::CreateQueries()
   rv = update->ToString(mUpdateListItemOrdinalQuery);
   NS_ENSURE_SUCCESS(rv, rv);
 
+  // Create the queries used to renumber the list, the first gets the rows
+  // of this list in order and the second sets the ordinal of one of them
+  nsCOMPtr<sbISQLSelectBuilder> ordinals =
+    do_CreateInstance(SB_SQLBUILDER_SELECT_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->SetBaseTableName(NS_LITERAL_STRING("simple_media_lists"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->AddColumn(EmptyString(), NS_LITERAL_STRING("rowid"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->AddColumn(EmptyString(), NS_LITERAL_STRING("ordinal"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->CreateMatchCriterionLong(EmptyString(),
+                                          NS_LITERAL_STRING("media_item_id"),
+                                          sbISQLSelectBuilder::MATCH_EQUALS,
+                                          mediaItemId,
+                                          getter_AddRefs(criterion));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->AddCriterion(criterion);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->AddOrder(EmptyString(), NS_LITERAL_STRING("ordinal"), PR_TRUE);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = ordinals->ToString(mGetOrdinalsQuery);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->Reset();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->SetTableName(NS_LITERAL_STRING("simple_media_lists"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->AddAssignmentParameter(NS_LITERAL_STRING("ordinal"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->CreateMatchCriterionParameter(EmptyString(),
+                                             NS_LITERAL_STRING("rowid"),
+                                             sbISQLSelectBuilder::MATCH_EQUALS,
+                                             getter_AddRefs(criterion));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->AddCriterion(criterion);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = update->ToString(mUpdateOrdinalByRowidQuery);
+  NS_ENSURE_SUCCESS(rv, rv);
+
   // Create first item delete query
   // delete from
   //   simple_media_lists
@@ -87,28 +87,37 @@ public:
 
   nsresult AddSomeAsyncInternal(nsISimpleEnumerator *aMediaItems,
                                 nsISupports *aListener,
-                                PRUint32 aStartingIndex,
-                                nsAString& aStartingOrdinal);
+                                PRUint32 aStartingIndex);
 
 private:
   nsresult UpdateLastModifiedTime();
 
   nsresult ExecuteAggregateQuery(const nsAString& aQuery, nsAString& aValue);
 
-  nsresult UpdateOrdinalByIndex(PRUint32 aIndex, const nsAString& aOrdinal);
+  nsresult UpdateOrdinalByIndex(PRUint32 aIndex, PRInt64 aOrdinal);
 
   nsresult MoveSomeInternal(PRUint32* aFromIndexArray,
                             PRUint32 aFromIndexArrayCount,
-                            PRUint32 aToIndex,
-                            const nsAString& aOrdinalRoot);
+                            PRUint32 aToIndex);
 
-  nsresult GetNextOrdinal(nsAString& aValue);
+  nsresult GetOrdinalValueByIndex(PRUint32 aIndex,
+                                  PRUint32 aLength,
+                                  PRInt64* _retval);
 
-  nsresult GetBeforeOrdinal(PRUint32 aIndex, nsAString& aValue);
-
-  nsresult AddToLastPathSegment(nsAString& aPath, PRInt32 aToAdd);
+  /**
+   * \brief Find aCount free ordinals for items to be placed before aIndex,
+   *        or after the last item when aIndex is the length of the list.
+   *        The ordinals are aFirst, aFirst + aStep and so on.  When the gap
+   *        at aIndex is used up the list is renumbered first.
+   */
+  nsresult ReserveOrdinals(PRUint32 aIndex,
+                           PRUint32 aCount,
+                           PRInt64* aFirst,
+                           PRInt64* aStep);
 
-  PRUint32 CountLevels(const nsAString& aPath);
+  // Evenly respace the ordinals of the list, leaving aCount free slots
+  // before aIndex
+  nsresult RenumberOrdinals(PRUint32 aIndex, PRUint32 aCount);
 
   nsresult CreateQueries();
 
@@ -141,6 +150,12 @@ private:
   // Get first ordinal
   nsString mGetFirstOrdinalQuery;
 
+  // Get the rowid and ordinal of every item in ordinal order
+  nsString mGetOrdinalsQuery;
+
+  // Set the ordinal of the row with the given rowid
+  nsString mUpdateOrdinalByRowidQuery;
+
   // Copy Listener
   nsCOMPtr<sbILocalDatabaseMediaListCopyListener> mCopyListener;
 
@@ -163,11 +178,9 @@ public:
 
   sbSimpleMediaListInsertingEnumerationListener(sbLocalDatabaseSimpleMediaList* aList,
                                                 PRUint32 aStartingIndex,
-                                                const nsAString& aStartingOrdinal,
                                                 nsISupports * aListener = nsnull)
   : mFriendList(aList),
-    mStartingIndex(aStartingIndex),
-    mStartingOrdinal(aStartingOrdinal)
+    mStartingIndex(aStartingIndex)
   {
     if (aListener) {
       mAsyncListener = do_QueryInterface(aListener);
@@ -183,7 +196,6 @@ private:
 
   sbLocalDatabaseSimpleMediaList* mFriendList;
   PRUint32 mStartingIndex;
-  nsString mStartingOrdinal;
   /**
    * This is list of media items we'll be adding to media list in the order
    * desired. There may be duplicates, some of these items may exist in a
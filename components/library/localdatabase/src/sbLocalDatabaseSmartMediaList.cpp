@@ -25,12 +25,14 @@
 #include "sbLocalDatabaseSmartMediaList.h"
 #include "sbLocalDatabaseCID.h"
 
+#include <sbIDatabasePreparedStatement.h>
 #include <sbIDatabaseQuery.h>
 #include <sbIDatabaseResult.h>
 #include <sbILibrary.h>
 #include <sbILocalDatabaseLibrary.h>
 #include <sbILocalDatabasePropertyCache.h>
 #include <sbILocalDatabaseMediaItem.h>
+#include <sbILocalDatabaseResourcePropertyBag.h>
 #include <sbILocalDatabaseSimpleMediaList.h>
 #include <sbIMediaItem.h>
 #include <sbIMediaList.h>
@@ -962,6 +964,50 @@ sbLocalDatabaseSmartMediaList::Rebuild()
       NS_ENSURE_SUCCESS(rv, rv);
     }
   }
+
+  rv = NotifyRebuilt();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbLocalDatabaseSmartMediaList::UpdateItems(PRUint32 aCount,
+                                           const PRUnichar** aGUIDs)
+{
+  TRACE(("sbLocalDatabaseSmartMediaList[0x%.8x] - UpdateItems(%d)",
+         this, aCount));
+  NS_ENSURE_ARG(aCount == 0 || aGUIDs);
+
+  nsresult rv;
+  PRBool updated;
+  {
+    nsAutoMonitor monitor(mConditionsMonitor);
+    nsAutoMonitor monitor2(mSourceMonitor);
+
+    rv = UpdateItemsInternal(aCount, aGUIDs, &updated);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Lists that can't be updated item by item get a full rebuild
+  if (!updated) {
+    rv = Rebuild();
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    return NS_OK;
+  }
+
+  rv = NotifyRebuilt();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSmartMediaList::NotifyRebuilt()
+{
+  nsresult rv;
+
   // Notify our inner list that its content changed
   nsCOMPtr<sbILocalDatabaseSimpleMediaList> ldsml =
     do_QueryInterface(mList, &rv);
@@ -977,6 +1023,346 @@ sbLocalDatabaseSmartMediaList::Rebuild()
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseSmartMediaList::UpdateItemsInternal(PRUint32 aCount,
+                                                   const PRUnichar** aGUIDs,
+                                                   PRBool* aUpdated)
+{
+  NS_ASSERTION(aUpdated, "aUpdated is null");
+
+  nsresult rv;
+
+  *aUpdated = PR_FALSE;
+
+  // Limits pick their items from the whole library, so a change to one item
+  // can push another in or out of the list
+  if (mMatchType == sbILocalDatabaseSmartMediaList::MATCH_TYPE_NONE ||
+      mLimitType != sbILocalDatabaseSmartMediaList::LIMIT_TYPE_NONE ||
+      mRandomSelection) {
+    return NS_OK;
+  }
+
+  nsTArray<ConditionMatch> matches;
+  nsTArray<PRUint32> propertyDBIDs;
+  PRBool canUpdate;
+  rv = GetItemConditionMatches(matches, propertyDBIDs, &canUpdate);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (!canUpdate) {
+    return NS_OK;
+  }
+
+  nsCOMPtr<sbILibrary> library = do_QueryInterface(mLocalDatabaseLibrary, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbILocalDatabaseMediaItem> ldmi = do_QueryInterface(mList, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 mediaItemId;
+  rv = ldmi->GetMediaItemId(&mediaItemId);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoString listId;
+  listId.AppendInt(mediaItemId);
+
+  // New members go after the last one, with the same gap the simple media
+  // list leaves when appending.  The insert does nothing if the item is
+  // already in the list.
+  nsAutoString insertSql;
+  insertSql.AssignLiteral("insert into simple_media_lists "
+                          "(media_item_id, member_media_item_id, ordinal) "
+                          "select ");
+  insertSql.Append(listId);
+  insertSql.AppendLiteral(", ?, (select ifnull(max(ordinal) + 1024, 0) "
+                          "from simple_media_lists where media_item_id = ");
+  insertSql.Append(listId);
+  insertSql.AppendLiteral(") where not exists (select 1 from "
+                          "simple_media_lists where media_item_id = ");
+  insertSql.Append(listId);
+  insertSql.AppendLiteral(" and member_media_item_id = ?)");
+
+  nsAutoString deleteSql;
+  deleteSql.AssignLiteral("delete from simple_media_lists "
+                          "where media_item_id = ");
+  deleteSql.Append(listId);
+  deleteSql.AppendLiteral(" and member_media_item_id = ?");
+
+  nsCOMPtr<sbIDatabaseQuery> query;
+  rv = mLocalDatabaseLibrary->CreateQuery(getter_AddRefs(query));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIDatabasePreparedStatement> insertStatement;
+  rv = query->PrepareQuery(insertSql, getter_AddRefs(insertStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIDatabasePreparedStatement> deleteStatement;
+  rv = query->PrepareQuery(deleteSql, getter_AddRefs(deleteStatement));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = query->AddQuery(NS_LITERAL_STRING("begin"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRBool matchAll =
+    mMatchType == sbILocalDatabaseSmartMediaList::MATCH_TYPE_ALL;
+  PRUint32 conditionCount = matches.Length();
+
+  for (PRUint32 i = 0; i < aCount; i++) {
+    nsDependentString guid(aGUIDs[i]);
+
+    // Removed items have already been taken out of the list by the library
+    nsCOMPtr<sbIMediaItem> item;
+    rv = library->GetMediaItem(guid, getter_AddRefs(item));
+    if (NS_FAILED(rv)) {
+      continue;
+    }
+
+    // Like the rebuild, only match media items and not lists
+    nsCOMPtr<sbIMediaList> itemList = do_QueryInterface(item);
+    if (itemList) {
+      continue;
+    }
+
+    nsCOMPtr<sbILocalDatabaseMediaItem> localItem =
+      do_QueryInterface(item, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRUint32 itemId;
+    rv = localItem->GetMediaItemId(&itemId);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsCOMPtr<sbILocalDatabaseResourcePropertyBag> bag;
+    rv = localItem->GetPropertyBag(getter_AddRefs(bag));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRBool isMember = matchAll;
+    for (PRUint32 j = 0; j < conditionCount; j++) {
+      // Conditions compare the same values as the sql does: the raw column
+      // for top level properties, the searchable value for the others
+      nsAutoString value;
+      if (matches[j].isTopLevel) {
+        rv = bag->GetPropertyByID(propertyDBIDs[j], value);
+      }
+      else {
+        rv = bag->GetSearchablePropertyByID(propertyDBIDs[j], value);
+      }
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      PRBool matched = EvaluateConditionMatch(matches[j], value);
+      if (matched != matchAll) {
+        isMember = matched;
+        break;
+      }
+    }
+
+    if (isMember) {
+      rv = query->AddPreparedStatement(insertStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = query->BindInt32Parameter(0, itemId);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = query->BindInt32Parameter(1, itemId);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+    else {
+      rv = query->AddPreparedStatement(deleteStatement);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = query->BindInt32Parameter(0, itemId);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  rv = query->AddQuery(NS_LITERAL_STRING("commit"));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRInt32 dbOk;
+  rv = query->Execute(&dbOk);
+  NS_ENSURE_SUCCESS(rv, rv);
+  NS_ENSURE_TRUE(dbOk == 0, NS_ERROR_FAILURE);
+
+  *aUpdated = PR_TRUE;
+
+  return NS_OK;
+}
+
+nsresult
+sbLocalDatabaseSmartMediaList::GetItemConditionMatches(nsTArray<ConditionMatch>& aMatches,
+                                                       nsTArray<PRUint32>& aPropertyDBIDs,
+                                                       PRBool* _retval)
+{
+  NS_ASSERTION(_retval, "_retval is null");
+
+  nsresult rv;
+
+  *_retval = PR_FALSE;
+
+  PRUint32 count = mConditions.Length();
+  for (PRUint32 i = 0; i < count; i++) {
+    sbRefPtrCondition& condition = mConditions[i];
+
+    // Playlist conditions depend on the content of other lists
+    if (condition->mPropertyID.EqualsLiteral(SB_DUMMYPROPERTY_SMARTMEDIALIST_PLAYLIST)) {
+      return NS_OK;
+    }
+
+    nsCOMPtr<sbIPropertyInfo> info;
+    rv = mPropMan->GetPropertyInfo(condition->mPropertyID,
+                                   getter_AddRefs(info));
+    if (NS_FAILED(rv)) {
+      return NS_OK;
+    }
+
+    ConditionMatch* match = aMatches.AppendElement();
+    NS_ENSURE_TRUE(match, NS_ERROR_OUT_OF_MEMORY);
+
+    rv = GetConditionMatch(condition, info, *match);
+    if (NS_FAILED(rv)) {
+      return NS_OK;
+    }
+
+    PRUint32 propertyDBID;
+    rv = mPropertyCache->GetPropertyDBID(condition->mPropertyID,
+                                         &propertyDBID);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    PRUint32* added = aPropertyDBIDs.AppendElement(propertyDBID);
+    NS_ENSURE_TRUE(added, NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  *_retval = PR_TRUE;
+
+  return NS_OK;
+}
+
+/**
+ * \brief Match a value against a LIKE pattern the way SQLite does: '%' and
+ *        '_' are wildcards, '\' escapes the next character and ASCII letters
+ *        match regardless of case.
+ */
+static PRBool
+SB_LikeMatch(const PRUnichar* aPattern,
+             const PRUnichar* aPatternEnd,
+             const PRUnichar* aValue,
+             const PRUnichar* aValueEnd)
+{
+  while (aPattern < aPatternEnd) {
+    PRUnichar p = *aPattern++;
+    if (p == '%') {
+      // Collapse runs of wildcards, then try every remaining suffix
+      while (aPattern < aPatternEnd && *aPattern == '%') {
+        aPattern++;
+      }
+      if (aPattern == aPatternEnd) {
+        return PR_TRUE;
+      }
+      for (; aValue <= aValueEnd; aValue++) {
+        if (SB_LikeMatch(aPattern, aPatternEnd, aValue, aValueEnd)) {
+          return PR_TRUE;
+        }
+      }
+      return PR_FALSE;
+    }
+
+    if (aValue == aValueEnd) {
+      return PR_FALSE;
+    }
+
+    PRUnichar v = *aValue++;
+    if (p == '_') {
+      continue;
+    }
+
+    if (p == '\\' && aPattern < aPatternEnd) {
+      p = *aPattern++;
+    }
+
+    if (p < 0x80 && v < 0x80) {
+      if (p >= 'A' && p <= 'Z') {
+        p += 'a' - 'A';
+      }
+      if (v >= 'A' && v <= 'Z') {
+        v += 'a' - 'A';
+      }
+    }
+
+    if (p != v) {
+      return PR_FALSE;
+    }
+  }
+
+  return aValue == aValueEnd;
+}
+
+PRInt32
+sbLocalDatabaseSmartMediaList::CompareConditionValues(const ConditionMatch& aMatch,
+                                                      const nsAString& aLeft,
+                                                      const nsAString& aRight)
+{
+  // Top level properties live in typed columns, SQLite compares those as
+  // numbers when both sides are numeric
+  if (aMatch.isTopLevel) {
+    nsAutoString left(aLeft);
+    nsAutoString right(aRight);
+    PRInt64 leftNumber, rightNumber;
+    if (NS_SUCCEEDED(ScanfInt64(left, &leftNumber)) &&
+        NS_SUCCEEDED(ScanfInt64(right, &rightNumber))) {
+      return leftNumber < rightNumber ? -1 : leftNumber > rightNumber ? 1 : 0;
+    }
+  }
+
+  return Compare(aLeft, aRight);
+}
+
+PRBool
+sbLocalDatabaseSmartMediaList::EvaluateConditionMatch(const ConditionMatch& aMatch,
+                                                      const nsAString& aValue)
+{
+  // A property that isn't set is null to the sql, which fails every
+  // comparison unless the condition also matches nulls
+  if (aValue.IsVoid()) {
+    return aMatch.needOrIsNull;
+  }
+
+  if (aMatch.isBetween) {
+    PRBool below = CompareConditionValues(aMatch, aValue, aMatch.value) < 0;
+    PRBool above =
+      CompareConditionValues(aMatch, aValue, aMatch.rightValue) > 0;
+    if (aMatch.invertRange) {
+      return below || above;
+    }
+    return !below && !above;
+  }
+
+  if (aMatch.matchType == sbISQLBuilder::MATCH_LIKE ||
+      aMatch.matchType == sbISQLBuilder::MATCH_NOTLIKE) {
+    PRBool like = SB_LikeMatch(aMatch.value.BeginReading(),
+                               aMatch.value.EndReading(),
+                               aValue.BeginReading(),
+                               aValue.EndReading());
+    return aMatch.matchType == sbISQLBuilder::MATCH_LIKE ? like : !like;
+  }
+
+  PRInt32 comparison = CompareConditionValues(aMatch, aValue, aMatch.value);
+  switch (aMatch.matchType) {
+    case sbISQLBuilder::MATCH_EQUALS:
+      return comparison == 0;
+    case sbISQLBuilder::MATCH_NOTEQUALS:
+      return comparison != 0;
+    case sbISQLBuilder::MATCH_GREATER:
+      return comparison > 0;
+    case sbISQLBuilder::MATCH_GREATEREQUAL:
+      return comparison >= 0;
+    case sbISQLBuilder::MATCH_LESS:
+      return comparison < 0;
+    case sbISQLBuilder::MATCH_LESSEQUAL:
+      return comparison <= 0;
+  }
+
+  NS_NOTREACHED("Unexpected match type");
+  return PR_FALSE;
+}
+
 nsresult
 sbLocalDatabaseSmartMediaList::RebuildMatchTypeAnyAll()
 {
@@ -1790,33 +2176,30 @@ sbLocalDatabaseSmartMediaList::StripTime(PRInt64 aDateTime) {
 }
 
 nsresult
-sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBuilder,
-                                                        sbRefPtrCondition& aCondition,
-                                                        sbIPropertyInfo* aInfo)
+sbLocalDatabaseSmartMediaList::GetConditionMatch(sbRefPtrCondition& aCondition,
+                                                 sbIPropertyInfo* aInfo,
+                                                 ConditionMatch& aMatch)
 {
-  NS_ENSURE_ARG_POINTER(aBuilder);
   NS_ENSURE_ARG_POINTER(aInfo);
 
-  NS_NAMED_LITERAL_STRING(kConditionAlias, "_c");
   NS_NAMED_LITERAL_STRING(kObjSearchable,  "obj_searchable");
   NS_NAMED_LITERAL_STRING(kMediaItem,      "media_item_id");
 
   nsresult rv;
 
   // Get some stuff about the property
-  PRBool isTopLevelProperty = SB_IsTopLevelProperty(aCondition->mPropertyID);
-  nsAutoString columnName;
+  aMatch.isTopLevel = SB_IsTopLevelProperty(aCondition->mPropertyID);
 
-  PRBool bNeedOrIsNull;
-  rv = GetConditionNeedsNull(aCondition, aInfo, bNeedOrIsNull);
+  rv = GetConditionNeedsNull(aCondition, aInfo, aMatch.needOrIsNull);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  if (isTopLevelProperty) {
-    rv = SB_GetTopLevelPropertyColumn(aCondition->mPropertyID, columnName);
+  if (aMatch.isTopLevel) {
+    rv = SB_GetTopLevelPropertyColumn(aCondition->mPropertyID,
+                                      aMatch.columnName);
     NS_ENSURE_SUCCESS(rv, rv);
   }
   else {
-    columnName.Assign(kObjSearchable);
+    aMatch.columnName.Assign(kObjSearchable);
   }
 
   nsCOMPtr<sbIPropertyOperator> opObj;
@@ -1860,9 +2243,9 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
     leftValue = aCondition->mLeftValue;
   }
 
-  PRBool bNumericCondition = PR_FALSE;
+  aMatch.isNumeric = PR_FALSE;
   if (aCondition->mPropertyID.EqualsLiteral(SB_DUMMYPROPERTY_SMARTMEDIALIST_PLAYLIST)) {
-    columnName.Assign(kMediaItem);
+    aMatch.columnName.Assign(kMediaItem);
     
     PRUint32 id;
     rv = MediaListGuidToDB(leftValue, id);
@@ -1871,10 +2254,10 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
     leftValue.Truncate();
     leftValue.AppendInt(id);
     
-    bNumericCondition = PR_TRUE;
+    aMatch.isNumeric = PR_TRUE;
   }
 
-  PRBool invertRange = PR_FALSE;
+  aMatch.invertRange = PR_FALSE;
   
   rightValue = aCondition->mRightValue;
   
@@ -1899,7 +2282,7 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
     SPrintfInt64(leftValue, StripTime(ScanfInt64d(leftValue)));
     SPrintfInt64(rightValue, StripTime(ScanfInt64d(leftValue))+(ONEDAY-ONE_MS));
     op = NS_LITERAL_STRING(SB_OPERATOR_BETWEEN);
-    invertRange = PR_TRUE;
+    aMatch.invertRange = PR_TRUE;
   } else if (op.EqualsLiteral(SB_OPERATOR_BEFOREDATE)) {
     // If we are matching date only (and not time), the date must be stripped of
     // its time component.
@@ -1943,69 +2326,19 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
     }
   }
 
-  // If this is a between operator, construct two conditions for it
-  if (op.EqualsLiteral(SB_OPERATOR_BETWEEN)) {
-    nsCOMPtr<sbISQLBuilderCriterion> left;
-    PRUint32 matchType;
-    if (invertRange)
-      matchType = sbISQLBuilder::MATCH_LESS;
-    else
-      matchType = sbISQLBuilder::MATCH_GREATEREQUAL;
-    rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
-                                              columnName,
-                                              matchType,
-                                              value,
-                                              getter_AddRefs(left));
-    NS_ENSURE_SUCCESS(rv, rv);
+  aMatch.value = value;
 
-    nsAutoString rvalue;
-    rv = aInfo->MakeSearchable(rightValue, rvalue);
+  // A between operator compares against both ends of the range
+  aMatch.isBetween = op.EqualsLiteral(SB_OPERATOR_BETWEEN);
+  if (aMatch.isBetween) {
+    rv = aInfo->MakeSearchable(rightValue, aMatch.rightValue);
     // MakeSearchable may fail if the value fails to validate, but since a smart
     // playlist may look for substrings instead of full valid values, it is not
     // fatal to fail to make searchable, when that fails we just use the value
     // that we were given as is.
     if (NS_FAILED(rv)) {
-      rvalue = rightValue;
-    }
-
-    nsCOMPtr<sbISQLBuilderCriterion> right;
-    if (invertRange)
-      matchType = sbISQLBuilder::MATCH_GREATER;
-    else
-      matchType = sbISQLBuilder::MATCH_LESSEQUAL;
-    rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
-                                              columnName,
-                                              matchType,
-                                              rvalue,
-                                              getter_AddRefs(right));
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    nsCOMPtr<sbISQLBuilderCriterion> criterion;
-    if (invertRange)
-      rv = aBuilder->CreateOrCriterion(left, right, getter_AddRefs(criterion));
-    else
-      rv = aBuilder->CreateAndCriterion(left, right, getter_AddRefs(criterion));
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    if (bNeedOrIsNull) {
-      nsCOMPtr<sbISQLBuilderCriterion> orIsNull;
-      rv = aBuilder->CreateMatchCriterionNull(kConditionAlias,
-                                              columnName,
-                                              sbISQLBuilder::MATCH_EQUALS,
-                                              getter_AddRefs(orIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      nsCOMPtr<sbISQLBuilderCriterion> criterionOrIsNull;
-      rv = aBuilder->CreateOrCriterion(criterion, 
-                                       orIsNull, 
-                                       getter_AddRefs(criterionOrIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
-      criterion = criterionOrIsNull;
+      aMatch.rightValue = rightValue;
     }
-
-    rv = aBuilder->AddCriterion(criterion);
-    NS_ENSURE_SUCCESS(rv, rv);
-
     return NS_OK;
   }
 
@@ -2049,44 +2382,7 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
   }
   
   if (matchType >= 0) {
-    nsCOMPtr<sbISQLBuilderCriterion> criterion;
-    if (bNumericCondition) {
-      PRInt64 numericValue;
-      rv = ScanfInt64(value, &numericValue);
-      NS_ENSURE_SUCCESS(rv, rv);
-      rv = aBuilder->CreateMatchCriterionLongLong(kConditionAlias,
-                                                  columnName,
-                                                  matchType,
-                                                  numericValue,
-                                                  getter_AddRefs(criterion));
-    } else {
-      rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
-                                                columnName,
-                                                matchType,
-                                                value,
-                                                getter_AddRefs(criterion));
-    }
-    NS_ENSURE_SUCCESS(rv, rv);
-    
-    if (bNeedOrIsNull) {
-      nsCOMPtr<sbISQLBuilderCriterion> orIsNull;
-      rv = aBuilder->CreateMatchCriterionNull(kConditionAlias,
-                                              columnName,
-                                              sbISQLBuilder::MATCH_EQUALS,
-                                              getter_AddRefs(orIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      nsCOMPtr<sbISQLBuilderCriterion> criterionOrIsNull;
-      rv = aBuilder->CreateOrCriterion(criterion, 
-                                       orIsNull, 
-                                       getter_AddRefs(criterionOrIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
-      criterion = criterionOrIsNull;
-    }
-
-    rv = aBuilder->AddCriterion(criterion);
-    NS_ENSURE_SUCCESS(rv, rv);
-
+    aMatch.matchType = matchType;
     return NS_OK;
   }
 
@@ -2097,65 +2393,128 @@ sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBu
       op.EqualsLiteral(SB_OPERATOR_NOTENDSWITH) ||
       op.EqualsLiteral(SB_OPERATOR_BEGINSWITH) ||
       op.EqualsLiteral(SB_OPERATOR_NOTBEGINSWITH)) {
-
-    nsAutoString like;
+    aMatch.value.Truncate();
     if (op.EqualsLiteral(SB_OPERATOR_CONTAINS) ||
         op.EqualsLiteral(SB_OPERATOR_NOTCONTAINS) ||
         op.EqualsLiteral(SB_OPERATOR_ENDSWITH) ||
         op.EqualsLiteral(SB_OPERATOR_NOTENDSWITH)) {
-      like.AppendLiteral("%");
+      aMatch.value.AppendLiteral("%");
     }
 
-    like.Append(value);
+    aMatch.value.Append(value);
 
     if (op.EqualsLiteral(SB_OPERATOR_CONTAINS) ||
         op.EqualsLiteral(SB_OPERATOR_NOTCONTAINS) ||
         op.EqualsLiteral(SB_OPERATOR_BEGINSWITH) ||
         op.EqualsLiteral(SB_OPERATOR_NOTBEGINSWITH)) {
-      like.AppendLiteral("%");
+      aMatch.value.AppendLiteral("%");
     }
 
-    nsCOMPtr<sbISQLBuilderCriterion> criterion;
-    PRUint32 match;
     if (op.EqualsLiteral(SB_OPERATOR_CONTAINS) ||
         op.EqualsLiteral(SB_OPERATOR_BEGINSWITH) ||
         op.EqualsLiteral(SB_OPERATOR_ENDSWITH)) {
-      match = sbISQLBuilder::MATCH_LIKE;
+      aMatch.matchType = sbISQLBuilder::MATCH_LIKE;
     } else {
-      match = sbISQLBuilder::MATCH_NOTLIKE;
+      aMatch.matchType = sbISQLBuilder::MATCH_NOTLIKE;
     }
-        
+    return NS_OK;
+  }
+
+  // If we get here, we don't know how to handle the supplied operator
+  return NS_ERROR_UNEXPECTED;
+}
+
+nsresult
+sbLocalDatabaseSmartMediaList::AddCriterionForCondition(sbISQLSelectBuilder* aBuilder,
+                                                        sbRefPtrCondition& aCondition,
+                                                        sbIPropertyInfo* aInfo)
+{
+  NS_ENSURE_ARG_POINTER(aBuilder);
+  NS_ENSURE_ARG_POINTER(aInfo);
+
+  NS_NAMED_LITERAL_STRING(kConditionAlias, "_c");
+
+  nsresult rv;
+
+  ConditionMatch match;
+  rv = GetConditionMatch(aCondition, aInfo, match);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbISQLBuilderCriterion> criterion;
+
+  // If this is a between operator, construct two conditions for it
+  if (match.isBetween) {
+    nsCOMPtr<sbISQLBuilderCriterion> left;
+    PRUint32 matchType;
+    if (match.invertRange)
+      matchType = sbISQLBuilder::MATCH_LESS;
+    else
+      matchType = sbISQLBuilder::MATCH_GREATEREQUAL;
     rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
-                                              columnName,
-                                              match,
-                                              like,
-                                              getter_AddRefs(criterion));
+                                              match.columnName,
+                                              matchType,
+                                              match.value,
+                                              getter_AddRefs(left));
     NS_ENSURE_SUCCESS(rv, rv);
 
-    if (bNeedOrIsNull) {
-      nsCOMPtr<sbISQLBuilderCriterion> orIsNull;
-      rv = aBuilder->CreateMatchCriterionNull(kConditionAlias,
-                                              columnName,
-                                              sbISQLBuilder::MATCH_EQUALS,
-                                              getter_AddRefs(orIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
+    nsCOMPtr<sbISQLBuilderCriterion> right;
+    if (match.invertRange)
+      matchType = sbISQLBuilder::MATCH_GREATER;
+    else
+      matchType = sbISQLBuilder::MATCH_LESSEQUAL;
+    rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
+                                              match.columnName,
+                                              matchType,
+                                              match.rightValue,
+                                              getter_AddRefs(right));
+    NS_ENSURE_SUCCESS(rv, rv);
 
-      nsCOMPtr<sbISQLBuilderCriterion> criterionOrIsNull;
-      rv = aBuilder->CreateOrCriterion(criterion, 
-                                       orIsNull, 
-                                       getter_AddRefs(criterionOrIsNull));
-      NS_ENSURE_SUCCESS(rv, rv);
-      criterion = criterionOrIsNull;
-    }
+    if (match.invertRange)
+      rv = aBuilder->CreateOrCriterion(left, right, getter_AddRefs(criterion));
+    else
+      rv = aBuilder->CreateAndCriterion(left, right, getter_AddRefs(criterion));
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else if (match.isNumeric) {
+    PRInt64 numericValue;
+    rv = ScanfInt64(match.value, &numericValue);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rv = aBuilder->CreateMatchCriterionLongLong(kConditionAlias,
+                                                match.columnName,
+                                                match.matchType,
+                                                numericValue,
+                                                getter_AddRefs(criterion));
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+  else {
+    rv = aBuilder->CreateMatchCriterionString(kConditionAlias,
+                                              match.columnName,
+                                              match.matchType,
+                                              match.value,
+                                              getter_AddRefs(criterion));
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
 
-    rv = aBuilder->AddCriterion(criterion);
+  if (match.needOrIsNull) {
+    nsCOMPtr<sbISQLBuilderCriterion> orIsNull;
+    rv = aBuilder->CreateMatchCriterionNull(kConditionAlias,
+                                            match.columnName,
+                                            sbISQLBuilder::MATCH_EQUALS,
+                                            getter_AddRefs(orIsNull));
     NS_ENSURE_SUCCESS(rv, rv);
 
-    return NS_OK;
+    nsCOMPtr<sbISQLBuilderCriterion> criterionOrIsNull;
+    rv = aBuilder->CreateOrCriterion(criterion, 
+                                     orIsNull, 
+                                     getter_AddRefs(criterionOrIsNull));
+    NS_ENSURE_SUCCESS(rv, rv);
+    criterion = criterionOrIsNull;
   }
 
-  // If we get here, we don't know how to handle the supplied operator
-  return NS_ERROR_UNEXPECTED;
+  rv = aBuilder->AddCriterion(criterion);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
 }
 
 nsresult sbLocalDatabaseSmartMediaList::MediaListGuidToDB(nsAString &val, PRUint32 &v) 
@@ -2560,7 +2919,12 @@ sbLocalDatabaseSmartMediaList::GetCopyToListQuery(const nsAString& aTempTableNam
   rv = select->AddColumn(EmptyString(), NS_LITERAL_STRING("media_item_id"));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  rv = select->AddColumn(EmptyString(), NS_LITERAL_STRING("count"));
+  // Space the ordinals out like the simple list does, so inserting between
+  // two of the copied items doesn't renumber the whole list
+  nsAutoString ordinal;
+  ordinal.AssignLiteral("count * ");
+  ordinal.AppendInt(SB_ORDINAL_GAP);
+  rv = select->AddColumn(EmptyString(), ordinal);
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = insert->SetSelect(select);
@@ -168,6 +168,43 @@ private:
 
   nsresult RebuildMatchTypeAnyAll();
 
+  nsresult NotifyRebuilt();
+
+  // How a condition compares a property value, shared by the sql built for
+  // a rebuild and the in-process evaluation done by UpdateItems
+  struct ConditionMatch {
+    nsString columnName;
+    PRBool isTopLevel;
+    PRBool isNumeric;
+    PRBool needOrIsNull;
+    PRBool isBetween;
+    PRBool invertRange;
+    PRUint32 matchType;
+    nsString value;
+    nsString rightValue;
+  };
+
+  nsresult GetConditionMatch(sbRefPtrCondition& aCondition,
+                             sbIPropertyInfo* aInfo,
+                             ConditionMatch& aMatch);
+
+  // Gets the match and property db id of every condition, returns
+  // PR_FALSE if the list can't be updated item by item
+  nsresult GetItemConditionMatches(nsTArray<ConditionMatch>& aMatches,
+                                   nsTArray<PRUint32>& aPropertyDBIDs,
+                                   PRBool* _retval);
+
+  PRBool EvaluateConditionMatch(const ConditionMatch& aMatch,
+                                const nsAString& aValue);
+
+  PRInt32 CompareConditionValues(const ConditionMatch& aMatch,
+                                 const nsAString& aLeft,
+                                 const nsAString& aRight);
+
+  nsresult UpdateItemsInternal(PRUint32 aCount,
+                               const PRUnichar** aGUIDs,
+                               PRBool* aUpdated);
+
   nsresult AddMediaItemsTempTable(const nsAutoString& tempTableName,
                                   sbMediaItemIdArray& aArray,
                                   PRUint32 aStart,
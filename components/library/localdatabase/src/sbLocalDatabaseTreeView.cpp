@@ -99,6 +99,15 @@ static PRLogModuleInfo* gLocalDatabaseTreeViewLog = nsnull;
 #define LOG(args)   /* nothing */
 #endif
 
+// How far ahead of the scroll rows are prefetched, and the bounds on that in
+// pages
+#define PREFETCH_LOOKAHEAD_MS 500
+#define PREFETCH_MIN_PAGES 1
+#define PREFETCH_MAX_PAGES 8
+
+// Gaps between scrolls longer than this start a new velocity measurement
+#define PREFETCH_SCROLL_IDLE_MS 1000
+
 #define PROGRESS_VALUE_UNSET -1
 #define PROGRESS_VALUE_COMPLETE 101
 
@@ -234,6 +243,11 @@ sbLocalDatabaseTreeView::sbLocalDatabaseTreeView() :
  mShouldPreventRebuild(PR_FALSE),
  mFirstCachedRow(NOT_SET),
  mLastCachedRow(NOT_SET),
+ mLastFirstVisibleRow(NOT_SET),
+ mLastScrollTime(0),
+ mScrollVelocity(0),
+ mFirstPrefetchedRow(NOT_SET),
+ mLastPrefetchedRow(NOT_SET),
  mPlayQueueIndex(0)
 {
 #ifdef PR_LOGGING
@@ -307,6 +321,7 @@ sbLocalDatabaseTreeView::Init(sbLocalDatabaseMediaListView* aMediaListView,
 
   mMediaListView = aMediaListView;
   mArray = aArray;
+  mAsyncArray = do_QueryInterface(mArray);
 
   // Determine the list type
   PRBool isDistinct;
@@ -718,15 +733,23 @@ sbLocalDatabaseTreeView::GetCellPropertyValue(PRInt32 aIndex,
       // Calculate the number of rows we're going process
       PRInt32 length = last - first + 1;
 
-      if (mFirstCachedRow != NOT_SET && mFirstCachedRow > first) {
-        // User scrolled up, make sure to cache at least a page
-        first = std::max(std::min(first, mFirstCachedRow - length + 1),
-                         0);
+      if (mAsyncArray) {
+        // The rows beyond the visible ones are read in the background, so
+        // only the visible rows are cached here
+        rv = PrefetchAhead(first, last);
+        NS_WARN_IF_FALSE(NS_SUCCEEDED(rv), "Prefetch failed");
       }
-      if (mLastCachedRow != NOT_SET && mLastCachedRow < last) {
-        // User scrolled down, make sure to cache at least a page
-        last = std::min(std::max(last, mLastCachedRow + length - 1),
-                        (PRInt32)mArrayLength + (mFakeAllRow ? 1 : 0) - 1);
+      else {
+        if (mFirstCachedRow != NOT_SET && mFirstCachedRow > first) {
+          // User scrolled up, make sure to cache at least a page
+          first = std::max(std::min(first, mFirstCachedRow - length + 1),
+                           0);
+        }
+        if (mLastCachedRow != NOT_SET && mLastCachedRow < last) {
+          // User scrolled down, make sure to cache at least a page
+          last = std::min(std::max(last, mLastCachedRow + length - 1),
+                          (PRInt32)mArrayLength + (mFakeAllRow ? 1 : 0) - 1);
+        }
       }
       length = last - first + 1;
 
@@ -1347,6 +1370,83 @@ sbLocalDatabaseTreeView::GetSelectedValues(nsIStringEnumerator** aValues)
   return NS_OK;
 }
 
+nsresult
+sbLocalDatabaseTreeView::PrefetchAhead(PRInt32 aFirstVisible,
+                                       PRInt32 aLastVisible)
+{
+  // Called while painting, so this only queues work on the array's thread
+
+  if (aFirstVisible == mLastFirstVisibleRow) {
+    // Not scrolled since the last cell
+    return NS_OK;
+  }
+
+  PRIntervalTime const now = PR_IntervalNow();
+  PRUint32 const elapsed = PR_IntervalToMilliseconds(now - mLastScrollTime);
+
+  if (mLastFirstVisibleRow == NOT_SET || elapsed > PREFETCH_SCROLL_IDLE_MS) {
+    // A new scroll, all we know is which way it goes
+    mScrollVelocity = mLastFirstVisibleRow == NOT_SET ? 0 :
+                      aFirstVisible > mLastFirstVisibleRow ? 1 : -1;
+  }
+  else {
+    PRInt32 const velocity = (aFirstVisible - mLastFirstVisibleRow) * 1000 /
+                             (PRInt32)PR_MAX(elapsed, 1);
+    if ((velocity > 0) == (mScrollVelocity > 0)) {
+      // Average so a single jump doesn't throw the window around
+      mScrollVelocity = (mScrollVelocity + velocity) / 2;
+    }
+    else {
+      mScrollVelocity = velocity;
+    }
+  }
+  mLastFirstVisibleRow = aFirstVisible;
+  mLastScrollTime = now;
+
+  if (!mScrollVelocity) {
+    return NS_OK;
+  }
+
+  // Prefetch as far as the scroll is expected to get in the lookahead time,
+  // at least a page so a slow scroll still finds the next page ready
+  PRInt32 const page = aLastVisible - aFirstVisible + 1;
+  PRInt32 ahead = PR_ABS(mScrollVelocity) * PREFETCH_LOOKAHEAD_MS / 1000;
+  ahead = PR_MAX(ahead, page * PREFETCH_MIN_PAGES);
+  ahead = PR_MIN(ahead, page * PREFETCH_MAX_PAGES);
+
+  PRInt32 const firstRow = mFakeAllRow ? 1 : 0;
+  PRInt32 const lastRow = (PRInt32)mArrayLength + firstRow - 1;
+
+  PRInt32 start;
+  PRInt32 end;
+  if (mScrollVelocity > 0) {
+    start = aLastVisible + 1;
+    end = PR_MIN(aLastVisible + ahead, lastRow);
+  }
+  else {
+    start = PR_MAX(aFirstVisible - ahead, firstRow);
+    end = aFirstVisible - 1;
+  }
+
+  if (start > end ||
+      (start >= mFirstPrefetchedRow && end <= mLastPrefetchedRow)) {
+    // Nothing left to read, or already asked for
+    return NS_OK;
+  }
+
+  TRACE(("sbLocalDatabaseTreeView[0x%.8x] - PrefetchAhead %d rows/s, %d-%d",
+         this, mScrollVelocity, start, end));
+
+  nsresult rv = mAsyncArray->PrefetchAsync(TreeToArray(start),
+                                           end - start + 1);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  mFirstPrefetchedRow = start;
+  mLastPrefetchedRow = end;
+
+  return NS_OK;
+}
+
 // sbILocalDatabaseGUIDArrayListener
 NS_IMETHODIMP
 sbLocalDatabaseTreeView::OnBeforeInvalidate(PRBool aInvalidateLength)
@@ -1354,6 +1454,9 @@ sbLocalDatabaseTreeView::OnBeforeInvalidate(PRBool aInvalidateLength)
   // array modified so reset everything
   mGuidWorkArray.Reset();
   mLastCachedRow = mFirstCachedRow = NOT_SET;
+  mFirstPrefetchedRow = mLastPrefetchedRow = NOT_SET;
+  mLastFirstVisibleRow = NOT_SET;
+  mScrollVelocity = 0;
 
   if (mManageSelection) {
     nsresult rv = SaveSelectionList();
@@ -36,6 +36,7 @@
 #include <nsIWeakReference.h>
 #include <nsIWeakReferenceUtils.h>
 
+#include <sbILocalDatabaseAsyncGUIDArray.h>
 #include <sbILocalDatabaseGUIDArray.h>
 #include <sbILocalDatabaseTreeView.h>
 #include <sbIMediacoreEventListener.h>
@@ -51,6 +52,7 @@
 #include <nsStringGlue.h>
 #include <nsTArray.h>
 #include <nsTObserverArray.h>
+#include <prinrval.h>
 
 #include <sbWeakReference.h>
 
@@ -161,6 +163,12 @@ private:
                                 nsITreeColumn *aTreeColumn,
                                 nsAString& _retval);
 
+  /**
+   * \brief Track how fast the visible rows move and ask the async array to
+   *        read the rows the scroll is heading for in the background.
+   */
+  nsresult PrefetchAhead(PRInt32 aFirstVisible, PRInt32 aLastVisible);
+
   nsresult SaveSelectionList();
 
   nsresult RestoreSelection();
@@ -306,6 +314,21 @@ private:
   PRInt32 mFirstCachedRow;
   PRInt32 mLastCachedRow;
 
+  // mArray as an async array when it is one, used to prefetch rows ahead
+  // of the scroll
+  nsCOMPtr<sbILocalDatabaseAsyncGUIDArray> mAsyncArray;
+
+  // First visible row and when it was seen, to measure the scroll speed
+  PRInt32 mLastFirstVisibleRow;
+  PRIntervalTime mLastScrollTime;
+
+  // Smoothed scroll speed in rows per second, negative when scrolling up
+  PRInt32 mScrollVelocity;
+
+  // Tree rows of the last prefetch requested
+  PRInt32 mFirstPrefetchedRow;
+  PRInt32 mLastPrefetchedRow;
+
   // Cached reference to play queue service
   nsCOMPtr<sbIPlayQueueService> mPlayQueueService;
 
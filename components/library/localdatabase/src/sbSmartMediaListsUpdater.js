@@ -59,6 +59,20 @@ SmartMediaListsUpdater.prototype = {
   
   // hash table of lists to update
   _updateQueue           : {},
+
+  // hash table of the items each queued list needs to look at, keyed by list
+  // guid. A null entry means the list needs a full rebuild.
+  _updateQueueItems      : {},
+
+  // hash table of the guids of items that have been added, changed or
+  // removed since the last check, or null if there were too many of them or
+  // we can't know which (e.g. changes made before the last shutdown)
+  _updatedItems          : {},
+  _updatedItemCount      : 0,
+
+  // Past this many changed items, rebuilding the lists is cheaper than
+  // looking at the items one by one
+  _maxUpdatedItems       : 1000,
   
   // hash table of lists to update condition to filter video items
   _updateVideoQueue      : {},
@@ -186,7 +200,7 @@ SmartMediaListsUpdater.prototype = {
       var mediaList = LibraryUtils.mainLibrary.getMediaItem(aListGuid);
       if (mediaList instanceof Ci.sbIMediaList &&
           mediaList.type == "smart") {
-        that._updateQueue[aListGuid] = mediaList;
+        that.queueList(mediaList, null);
       }
     }
     applyOnTableValues(this._dirtyListsTable, addToUpdateQueue);
@@ -195,6 +209,8 @@ SmartMediaListsUpdater.prototype = {
     // them to the _updatedProperties js table.
     function addToModifiedProperties(aPropertyID) {
       that._updatedProperties[aPropertyID] = true;
+      // we don't know which items these changes were made to
+      that._updatedItems = null;
     }
     applyOnTableValues(this._dirtyPropertiesTable, addToModifiedProperties);
 
@@ -279,14 +295,15 @@ SmartMediaListsUpdater.prototype = {
       // new item imported in library,
       // record the '*' property in the update table
       this.recordUpdateProperty('*');
+      this.recordUpdateItem(aMediaItem);
     } else {
       // record the fact that this playlist changed
       this.recordUpdateProperty(aMediaList.guid);
     }
-    // if we are in a batch, return true so we're not told about item
-    // additions in this batch anymore
+    // if we are in a batch and no longer tracking items, return true so
+    // we're not told about item additions in this batch anymore
     if (this._batchCount > 0) 
-      return true;
+      return !this._updatedItems;
     // if we are not in a batch, schedule an update check
     this.delayedUpdateCheck();
   },
@@ -304,14 +321,15 @@ SmartMediaListsUpdater.prototype = {
       // item removed from library,
       // record the '*' property in the update table
       this.recordUpdateProperty('*');
+      this.recordUpdateItem(aMediaItem);
     } else {
       // record the fact that this playlist changed
       this.recordUpdateProperty(aMediaList.guid);
     }
-    // if we are in a batch, return true so we're not told about item
-    // additions in this batch anymore
+    // if we are in a batch and no longer tracking items, return true so
+    // we're not told about item removals in this batch anymore
     if (this._batchCount > 0) 
-      return true;
+      return !this._updatedItems;
     // if we are not in a batch, schedule an update check
     this.delayedUpdateCheck();
   },
@@ -326,11 +344,14 @@ SmartMediaListsUpdater.prototype = {
       return true;
     
     // If we are in a batch, and the "update all" flag has been 
-    // added to the property list, then there is no need
-    // to keep tracking which properties are dirty.
+    // added to the property list and we have given up on tracking
+    // items, then there is no need to keep tracking which properties
+    // are dirty.
     // This can save a huge amount of time when importing and
     // scanning 10,000+ tracks.
-    if (this._batchCount > 0 && this._updatedProperties["*"]) {
+    if (this._batchCount > 0 &&
+        this._updatedProperties["*"] &&
+        !this._updatedItems) {
       return true;
     }
     
@@ -340,6 +361,7 @@ SmartMediaListsUpdater.prototype = {
       // record the property in the updated properties table
       this.recordUpdateProperty(property.id);
     }
+    this.recordUpdateItem(aMediaItem);
     // if we are in a batch, return false so that we keep receiving more
     // notifications about property changes, since these could be about
     // other properties than the ones we have been notified about in this
@@ -357,6 +379,9 @@ SmartMediaListsUpdater.prototype = {
   onListCleared: function(list, excludeLists) {
     // record the fact that this playlist changed
     this.recordUpdateProperty(list.guid);
+    // a cleared library loses all its items at once
+    if (list instanceof Ci.sbILibrary)
+      this._updatedItems = null;
     if (this._batchCount > 0) 
       return false;
     // if we are not in a batch, schedule an update check
@@ -387,6 +412,45 @@ SmartMediaListsUpdater.prototype = {
     }
   },
   
+  // --------------------------------------------------------------------------
+  // Add an item to the updated items table, or give up on tracking items
+  // once there are too many of them
+  // --------------------------------------------------------------------------
+  recordUpdateItem: function(aMediaItem) {
+    if (!this._updatedItems || aMediaItem.guid in this._updatedItems)
+      return;
+    if (++this._updatedItemCount > this._maxUpdatedItems) {
+      this._updatedItems = null;
+      return;
+    }
+    this._updatedItems[aMediaItem.guid] = true;
+  },
+
+  // --------------------------------------------------------------------------
+  // Add a list to the update queue. aItems is a table of the item guids the
+  // list needs to look at, or null if it needs a full rebuild.
+  // --------------------------------------------------------------------------
+  queueList: function(aMediaList, aItems) {
+    var guid = aMediaList.guid;
+    if (!(guid in this._updateQueue)) {
+      this._updateQueue[guid] = aMediaList;
+      this._updateQueueItems[guid] = aItems;
+      return;
+    }
+    // already queued, look at the items of both updates
+    var queuedItems = this._updateQueueItems[guid];
+    if (!queuedItems || !aItems) {
+      this._updateQueueItems[guid] = null;
+      return;
+    }
+    var items = {};
+    for (var itemGuid in queuedItems)
+      items[itemGuid] = true;
+    for (var itemGuid in aItems)
+      items[itemGuid] = true;
+    this._updateQueueItems[guid] = items;
+  },
+
   // --------------------------------------------------------------------------
   // Update the smart playlist condition.
   // --------------------------------------------------------------------------
@@ -548,13 +612,16 @@ SmartMediaListsUpdater.prototype = {
     // if no properties have been modified, no list need to be added to
     // the queue (this does not mean that the queue is empty).
     if (!this.emptyOfProperties(this._updatedProperties)) {
+      // the items these properties were changed on, if we know them
+      var items = this._updatedItems;
       // get all smart playlists
       var lists = this.getSmartPlaylists();
       // for all smart playlists...
       for each (var list in lists) {
-        // if the list is already in the update queue, continue with the
-        // next one
-        if (list.guid in this._updateQueue)
+        // if the list is already waiting for a full rebuild, continue with
+        // the next one
+        if (list.guid in this._updateQueue &&
+            !this._updateQueueItems[list.guid])
           continue;
         // fetch the interface we need
         list.QueryInterface(Ci.sbILocalDatabaseSmartMediaList);
@@ -567,7 +634,7 @@ SmartMediaListsUpdater.prototype = {
         if (list.limit != Ci.sbILocalDatabaseSmartMediaList.LIMIT_TYPE_NONE && 
             ("*" in this._updatedProperties ||
              list.selectPropertyID in this._updatedProperties)) {
-          this._updateQueue[list.guid] = list;
+          this.queueList(list, null);
           this.addListToDirtyTable(list);
         } else {
           // for all smart playlist conditions...
@@ -579,7 +646,7 @@ SmartMediaListsUpdater.prototype = {
             if ("*" in this._updatedProperties ||
                 condition.propertyID in this._updatedProperties ||
                 this.isPlaylistConditionMatch(condition.propertyID, condition.leftValue, this._updatedProperties)) {
-              this._updateQueue[list.guid] = list;
+              this.queueList(list, items);
               this.addListToDirtyTable(list);
               // and continue on with the next list
               break;
@@ -594,6 +661,8 @@ SmartMediaListsUpdater.prototype = {
       // scheduled for update before, or they have already been updated, in which
       // case they need to be updated again). 
       this._updatedProperties = {};
+      this._updatedItems = {};
+      this._updatedItemCount = 0;
       // empty the dirty properties table, since we're about to populate the
       // dirty lists table (they're no longer needed, since they only serve to
       // let us figure out which lists need updating on next startup in the case
@@ -625,14 +694,20 @@ SmartMediaListsUpdater.prototype = {
     // extract and remove the first list from the queue.
     // is there a better way to do this with a map ?
     var remaining = {};
+    var remainingItems = {};
     var list;
+    var items;
     for (var v in this._updateQueue) { 
-      if (!list)
+      if (!list) {
         list = this._updateQueue[v];
-      else
+        items = this._updateQueueItems[v];
+      } else {
         remaining[v] = this._updateQueue[v];
+        remainingItems[v] = this._updateQueueItems[v];
+      }
     }
     this._updateQueue = remaining;
+    this._updateQueueItems = remainingItems;
     
     // this should really not be happening, but test anyway
     if (!list) {
@@ -658,8 +733,16 @@ SmartMediaListsUpdater.prototype = {
     // code will not need any change if/when we use asynchronous updates instead
     list.addSmartMediaListListener(this);
     
-    // cause the rebuild
-    list.rebuild();
+    // cause the update. When we know which items changed, the list only
+    // needs to look at those, otherwise it is rebuilt from scratch
+    if (items) {
+      var guids = [];
+      for (var itemGuid in items)
+        guids.push(itemGuid);
+      list.updateItems(guids.length, guids);
+    } else {
+      list.rebuild();
+    }
   },
 
   // --------------------------------------------------------------------------
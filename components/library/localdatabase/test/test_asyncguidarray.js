@@ -185,6 +185,35 @@ function doTest(array) {
 
       return tester;
     break;
+
+    case "prefetchAsync":
+
+      // The second prefetch replaces the first, and neither notifies the
+      // listener, so the length is the first thing it hears
+      var listener = new ArrayListener();
+      array.addAsyncListener(listener);
+      array.prefetchAsync(0, 101);
+      array.prefetchAsync(50, 100);
+      array.getLengthAsync();
+
+      var tester = {};
+      tester.listener = listener;
+      tester.func = function() {
+        if (listener.gotLength) {
+          if (listener.rv == Cr.NS_OK && listener.length == 101 &&
+              !listener.gotGuid &&
+              array.getGuidByIndex(0) == "3E4FAFDA-AD99-11DB-9321-C22AB7121F49") {
+            return 1;
+          }
+          else {
+            return -1;
+          }
+        }
+        return 0;
+      };
+
+      return tester;
+    break;
   }
 
   // Shouldn't get here
@@ -273,7 +302,8 @@ TimerLoop.prototype.notify = function(timer)
 var phases = ["getLengthAsync",
               "getGuidByIndexAsync",
               "getSortPropertyValueByIndex",
-              "getMediaItemIdByIndex"];
+              "getMediaItemIdByIndex",
+              "prefetchAsync"];
 var currentPhase = 0;
 var currentTester = null;
 var failed = false;
@@ -0,0 +1,138 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that listeners taking batched changes get the items added and
+ *        updated during a batch in one call, and per item calls otherwise.
+ */
+
+Components.utils.import("resource://gre/modules/XPCOMUtils.jsm");
+
+var ALBUMNAME = "http://songbirdnest.com/data/1.0#albumName";
+
+function BatchListener() {
+  this.reset();
+}
+
+BatchListener.prototype = {
+  reset: function() {
+    this.added = 0;
+    this.updated = 0;
+    this.removed = 0;
+    this.changes = [];
+  },
+
+  onItemAdded: function(list, item, index) {
+    this.added++;
+    return false;
+  },
+  onBeforeItemRemoved: function(list, item, index) {
+    // Pending changes are delivered first
+    this.removed++;
+    return false;
+  },
+  onAfterItemRemoved: function(list, item, index) { return false; },
+  onItemUpdated: function(list, item, properties) {
+    this.updated++;
+    return false;
+  },
+  onItemMoved: function(list, fromIndex, toIndex) { return false; },
+  onBeforeListCleared: function(list, excludeLists) { return false; },
+  onListCleared: function(list, excludeLists) { return false; },
+  onBatchBegin: function(list) {},
+  onBatchEnd: function(list) {},
+
+  onItemsChanged: function(list, changes) {
+    var properties = [];
+    var enumerator = changes.updatedProperties;
+    while (enumerator.hasMore()) {
+      properties.push(enumerator.getNext());
+    }
+    this.changes.push({ added: changes.getAddedItemIDRanges({}),
+                        updated: changes.getUpdatedItemIDRanges({}),
+                        properties: properties,
+                        removedBefore: this.removed });
+  },
+
+  QueryInterface: XPCOMUtils.generateQI([Ci.sbIMediaListListener,
+                                         Ci.sbILocalDatabaseMediaListBatchListener])
+};
+
+function getID(item) {
+  return item.QueryInterface(Ci.sbILocalDatabaseMediaItem).mediaItemId;
+}
+
+function runTest () {
+
+  var library = createLibrary("test_batchednotifications", null, false);
+  var listener = new BatchListener();
+  library.addListener(listener, false);
+
+  // Outside a batch the listener is called per item
+  var item = library.createMediaItem(newURI("http://foo.com/single.mp3"));
+  item.setProperty(ALBUMNAME, "single");
+  assertEqual(listener.added, 1);
+  assertEqual(listener.updated, 1);
+  assertEqual(listener.changes.length, 0);
+
+  // In a batch the additions and updates come in one call
+  listener.reset();
+  var items = [];
+  library.runInBatchMode(function() {
+    for (var i = 0; i < 20; i++) {
+      items.push(library.createMediaItem(newURI("http://foo.com/" + i + ".mp3")));
+    }
+    items[3].setProperty(ALBUMNAME, "batch");
+    items[4].setProperty(ALBUMNAME, "batch");
+    item.setProperty(ALBUMNAME, "batch");
+  });
+  assertEqual(listener.added, 0);
+  assertEqual(listener.updated, 0);
+  assertEqual(listener.changes.length, 1);
+
+  var changes = listener.changes[0];
+  assertArraysEqual(changes.added, [getID(items[0]), getID(items[19])]);
+  assertArraysEqual(changes.updated, [getID(item), getID(item),
+                                      getID(items[3]), getID(items[4])]);
+  assertTrue(changes.properties.indexOf(ALBUMNAME) >= 0);
+
+  // A removal in the batch delivers what came before it first
+  listener.reset();
+  library.runInBatchMode(function() {
+    items[0].setProperty(ALBUMNAME, "before removal");
+    library.remove(items[1]);
+    items[2].setProperty(ALBUMNAME, "after removal");
+  });
+  assertEqual(listener.changes.length, 2);
+  assertEqual(listener.changes[0].removedBefore, 0);
+  assertArraysEqual(listener.changes[0].updated,
+                    [getID(items[0]), getID(items[0])]);
+  assertEqual(listener.changes[1].removedBefore, 1);
+  assertArraysEqual(listener.changes[1].updated,
+                    [getID(items[2]), getID(items[2])]);
+
+  library.removeListener(listener);
+}
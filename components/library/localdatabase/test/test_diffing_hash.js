@@ -0,0 +1,105 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+/**
+ * \brief Test that copies whose properties compare the same are skipped by
+ *        their property hash, like a device copy of a main library item,
+ *        and that copies that differ are still reported.
+ */
+
+function makeCopy(sourceItem, destinationLibrary, url, properties) {
+  var copy = destinationLibrary.createMediaItem(
+    newURI(url),
+    SBProperties.createArray(properties));
+  copy.setProperty(SBProperties.originItemGuid, sourceItem.guid);
+  copy.setProperty(SBProperties.originLibraryGuid, sourceItem.library.guid);
+  copy.setProperty(SBProperties.originURL, sourceItem.contentSrc.spec);
+  return copy;
+}
+
+function runTest () {
+  Components.utils.import("resource://app/jsmodules/sbProperties.jsm");
+
+  var diffingService =
+    Cc["@songbirdnest.com/Songbird/Library/DiffingService;1"]
+      .getService(Ci.sbILibraryDiffingService);
+
+  var sourceLibrary = createLibrary("test_diffing_hash_source", null, false);
+  var destinationLibrary =
+    createLibrary("test_diffing_hash_destination", null, false);
+
+  // Copied to the device, with the duration read back slightly differently
+  var same = sourceLibrary.createMediaItem(
+    newURI("file:///library/same.mp3"),
+    SBProperties.createArray([[SBProperties.trackName, "Same"],
+                              [SBProperties.duration, "200000000"]]));
+  makeCopy(same, destinationLibrary, "file:///device/same.mp3",
+           [[SBProperties.trackName, "Same"],
+            [SBProperties.duration, "200400000"]]);
+
+  // Copied, then moved in the main library
+  var moved = sourceLibrary.createMediaItem(
+    newURI("file:///library/moved.mp3"),
+    SBProperties.createArray([[SBProperties.trackName, "Moved"]]));
+  makeCopy(moved, destinationLibrary, "file:///device/moved.mp3",
+           [[SBProperties.trackName, "Moved"]]);
+  moved.contentSrc = newURI("file:///library/elsewhere/moved.mp3");
+
+  // Copied, with a duration more than a second longer in the main library
+  var longer = sourceLibrary.createMediaItem(
+    newURI("file:///library/longer.mp3"),
+    SBProperties.createArray([[SBProperties.trackName, "Longer"],
+                              [SBProperties.duration, "201500000"]]));
+  makeCopy(longer, destinationLibrary, "file:///device/longer.mp3",
+           [[SBProperties.trackName, "Longer"],
+            [SBProperties.duration, "200000000"]]);
+
+  var changeset = diffingService.createChangeset(sourceLibrary,
+                                                 destinationLibrary);
+
+  var modified = {};
+  var changesEnum = changeset.changes.enumerate();
+  while (changesEnum.hasMoreElements()) {
+    var change = changesEnum.getNext().QueryInterface(Ci.sbILibraryChange);
+    assertEqual(change.operation,
+                Ci.sbIChangeOperation.MODIFIED,
+                "Every item has a copy, nothing should be added or deleted");
+    modified[change.sourceItem.guid] = change;
+  }
+
+  assertFalse(same.guid in modified,
+              "The device copy compares the same and shouldn't be changed");
+  assertTrue(moved.guid in modified,
+             "The moved item should be reported");
+  assertTrue(longer.guid in modified,
+             "The longer item should be reported");
+
+  var propertyChanges = [];
+  var propertiesEnum = modified[moved.guid].properties.enumerate();
+  while (propertiesEnum.hasMoreElements()) {
+    propertyChanges.push(
+      propertiesEnum.getNext().QueryInterface(Ci.sbIPropertyChange).id);
+  }
+  assertEqual(propertyChanges.join(","), SBProperties.contentURL);
+}
@@ -0,0 +1,137 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that filter panes read from the in memory filter snapshot
+ *        list the same values as the ones read from the database, as items
+ *        are added, removed and changed.
+ */
+
+var ARTISTNAME = "http://songbirdnest.com/data/1.0#artistName";
+var ALBUMNAME = "http://songbirdnest.com/data/1.0#albumName";
+var GENRE = "http://songbirdnest.com/data/1.0#genre";
+
+var PREF_ENABLED = "songbird.library.localdatabase.filterSnapshot.enabled";
+
+function makeLibrary(databaseGUID, enabled) {
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setBoolPref(PREF_ENABLED, enabled);
+
+  var library = createLibrary(databaseGUID);
+  var cfs = library.createView().cascadeFilterSet;
+  cfs.appendFilter(GENRE, false);
+  cfs.appendFilter(ARTISTNAME, false);
+  cfs.appendFilter(ALBUMNAME, false);
+
+  return { library: library, cfs: cfs };
+}
+
+function getValues(cfs, index) {
+  var values = [];
+  var enumerator = cfs.getValues(index);
+  while (enumerator.hasMore()) {
+    values.push(enumerator.getNext());
+  }
+  return values;
+}
+
+function assertSameValues(snapshot, database) {
+  for (var i = 0; i < 3; i++) {
+    assertArraysEqual(getValues(snapshot.cfs, i), getValues(database.cfs, i));
+  }
+}
+
+function forBoth(snapshot, database, func) {
+  func(snapshot);
+  func(database);
+  assertSameValues(snapshot, database);
+}
+
+function writeProperties(test) {
+  test.library.QueryInterface(Ci.sbILocalDatabaseLibrary)
+              .propertyCache.write();
+}
+
+function runTest () {
+
+  var snapshot = makeLibrary("test_guidarray_filtersnapshot", true);
+  var database = makeLibrary("test_guidarray_filtersnapshot_db", false);
+
+  assertSameValues(snapshot, database);
+  assertEqual(snapshot.cfs.getValueCount(1), 8);
+
+  // Cascading filters
+  forBoth(snapshot, database, function(test) {
+    test.cfs.set(1, ["a-ha", "AC/DC"], 2);
+  });
+  assertEqual(snapshot.cfs.getValueCount(2), 2);
+
+  forBoth(snapshot, database, function(test) {
+    test.cfs.set(2, ["Back In Black"], 1);
+  });
+
+  // Changing a property moves the item to another value
+  forBoth(snapshot, database, function(test) {
+    var items = test.library.getItemsByProperty(ARTISTNAME, "AC/DC");
+    items.queryElementAt(0, Ci.sbIMediaItem)
+         .setProperty(ALBUMNAME, "Snapshot Album");
+    writeProperties(test);
+    test.cfs.set(1, ["a-ha", "AC/DC"], 2);
+  });
+  assertEqual(snapshot.cfs.getValueCount(2), 3);
+
+  // Adding an item with new values
+  forBoth(snapshot, database, function(test) {
+    var item = test.library.createMediaItem(
+                 newURI("http://foo/filtersnapshot.mp3"));
+    item.setProperty(ARTISTNAME, "AC/DC");
+    item.setProperty(ALBUMNAME, "Added Album");
+    writeProperties(test);
+    test.cfs.set(1, ["AC/DC"], 1);
+  });
+
+  // Removing every item of an artist drops its values
+  forBoth(snapshot, database, function(test) {
+    var items = test.library.getItemsByProperty(ARTISTNAME, "a-ha");
+    for (var i = items.length - 1; i >= 0; i--) {
+      test.library.remove(items.queryElementAt(i, Ci.sbIMediaItem));
+    }
+    test.cfs.set(1, [], 0);
+  });
+  assertEqual(snapshot.cfs.getValueCount(1), 7);
+
+  // Clearing the library empties the panes
+  forBoth(snapshot, database, function(test) {
+    test.library.clear();
+    test.cfs.set(1, [], 0);
+  });
+  assertEqual(snapshot.cfs.getValueCount(1), 0);
+
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.clearUserPref(PREF_ENABLED);
+}
@@ -0,0 +1,132 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that GUID arrays keep their cached rows up to date in place
+ *        when items are added, removed or change their sort key.
+ */
+
+var TRACKNAME = "http://songbirdnest.com/data/1.0#trackName";
+
+function makeSortedArray(library, aFetchSize) {
+  var array = makeArray(library);
+  array.baseTable = "media_items";
+  array.addSort(TRACKNAME, true);
+  array.fetchSize = aFetchSize;
+  return array;
+}
+
+function readAll(array) {
+  var guids = [];
+  for (var i = 0; i < array.length; i++) {
+    guids.push(array.getGuidByIndex(i));
+  }
+  return guids;
+}
+
+function assertSameAsFresh(library, array) {
+  var expected = readAll(makeSortedArray(library, 100));
+  assertEqual(array.length, expected.length);
+  for (var i = 0; i < expected.length; i++) {
+    assertEqual(array.getGuidByIndex(i), expected[i]);
+    assertEqual(array.getFirstIndexByGuid(expected[i]), i);
+  }
+}
+
+function runTest () {
+
+  var databaseGUID = "test_guidarray_incremental";
+  var library = createLibrary(databaseGUID, null, false);
+  library.clear();
+
+  var dbe = Cc["@songbirdnest.com/Songbird/DatabaseEngine;1"]
+              .getService(Ci.sbIDatabaseEngine);
+  assertTrue(dbe.collate("a", "b") < 0);
+  assertTrue(dbe.collate("b", "a") > 0);
+  assertEqual(dbe.collate("a", "a"), 0);
+
+  var names = ["delta", "alpha", "echo", "charlie", "bravo", "golf", "foxtrot"];
+  var items = [];
+  for (var i = 0; i < names.length; i++) {
+    var item = library.createMediaItem(newURI("http://foo/" + i + ".mp3"));
+    item.setProperty(TRACKNAME, names[i]);
+    items.push(item);
+  }
+  library.QueryInterface(Ci.sbILocalDatabaseLibrary).propertyCache.write();
+
+  // Fully cached array
+  var array = makeSortedArray(library, 100);
+  readAll(array);
+  assertTrue(array.isValid);
+
+  // Moving an item keeps the cache
+  items[1].setProperty(TRACKNAME, "hotel");
+  array.applyItemUpdated(items[1].guid);
+  assertTrue(array.isValid);
+  assertSameAsFresh(library, array);
+
+  items[5].setProperty(TRACKNAME, "aardvark");
+  array.applyItemUpdated(items[5].guid);
+  assertTrue(array.isValid);
+  assertSameAsFresh(library, array);
+
+  // Adding an item inserts it in place
+  var added = library.createMediaItem(newURI("http://foo/added.mp3"));
+  added.setProperty(TRACKNAME, "dingo");
+  array.applyItemAdded(added.guid);
+  assertTrue(array.isValid);
+  assertSameAsFresh(library, array);
+
+  // Removing an item removes it in place
+  var removedGuid = items[3].guid;
+  library.remove(items[3]);
+  array.applyItemRemoved(removedGuid);
+  assertTrue(array.isValid);
+  assertSameAsFresh(library, array);
+
+  // Changes reported by the property cache are applied in place too
+  items[0].setProperty(TRACKNAME, "zulu");
+  library.QueryInterface(Ci.sbILocalDatabaseLibrary).propertyCache.write();
+  assertTrue(array.isValid);
+  assertSameAsFresh(library, array);
+
+  // An array that only cached its first rows can't place an item past them
+  array = makeSortedArray(library, 2);
+  array.getGuidByIndex(0);
+  assertTrue(array.isValid);
+  items[2].setProperty(TRACKNAME, "yankee");
+  array.applyItemUpdated(items[2].guid);
+  assertFalse(array.isValid);
+  assertSameAsFresh(library, array);
+
+  // Arrays sorted on more than one property are always invalidated
+  array = makeSortedArray(library, 100);
+  array.addSort("http://songbirdnest.com/data/1.0#artistName", true);
+  readAll(array);
+  items[4].setProperty(TRACKNAME, "kilo");
+  array.applyItemUpdated(items[4].guid);
+  assertFalse(array.isValid);
+}
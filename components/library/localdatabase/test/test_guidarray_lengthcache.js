@@ -0,0 +1,97 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that the cached lengths of filtered library views are kept
+ *        right as items are added, removed and changed.
+ */
+
+function makeView(library, artists) {
+  var view = library.createView();
+  view.filterConstraint = LibraryUtils.createConstraint([
+    [
+      [SBProperties.artistName, artists]
+    ]
+  ]);
+  return view;
+}
+
+function runTest () {
+
+  Components.utils.import("resource://app/jsmodules/sbProperties.jsm");
+  Components.utils.import("resource://app/jsmodules/sbLibraryUtils.jsm");
+
+  var databaseGUID = "test_guidarray_lengthcache";
+  var library = createLibrary(databaseGUID);
+  var propertyCache =
+    library.QueryInterface(Ci.sbILocalDatabaseLibrary).propertyCache;
+
+  var acdc = makeView(library, ["AC/DC"]);
+  var both = makeView(library, ["AC/DC", "Accept"]);
+  var acdcLength = 10;
+  var bothLength = 25;
+  assertEqual(acdc.length, acdcLength);
+  assertEqual(both.length, bothLength);
+
+  // Adding items counts them into the views they match
+  var added = library.createMediaItem(
+    newURI("http://foo/lengthcache/1.mp3"),
+    SBProperties.createArray([[SBProperties.artistName, "AC/DC"]]));
+  var other = library.createMediaItem(
+    newURI("http://foo/lengthcache/2.mp3"),
+    SBProperties.createArray([[SBProperties.artistName, "Zebra"]]));
+
+  // The lengths are counted up before anything is written out
+  assertEqual(acdc.length, acdcLength + 1);
+  assertEqual(both.length, bothLength + 1);
+  assertEqual(makeView(library, ["AC/DC"]).length, acdcLength + 1);
+
+  // and stay right once it is
+  propertyCache.write();
+  assertEqual(acdc.length, acdcLength + 1);
+  assertEqual(both.length, bothLength + 1);
+  assertEqual(makeView(library, ["AC/DC"]).length, acdcLength + 1);
+
+  // Removing them counts them out
+  library.remove(added);
+  assertEqual(acdc.length, acdcLength);
+  assertEqual(makeView(library, ["AC/DC", "Accept"]).length, bothLength);
+
+  // Changing a filtered property
+  other.setProperty(SBProperties.artistName, "Accept");
+  propertyCache.write();
+  assertEqual(both.length, bothLength + 1);
+  assertEqual(acdc.length, acdcLength);
+  assertEqual(makeView(library, ["AC/DC", "Accept"]).length, bothLength + 1);
+
+  library.remove(other);
+  assertEqual(makeView(library, ["AC/DC", "Accept"]).length, bothLength);
+
+  // Clearing the library empties every view
+  library.clear();
+  assertEqual(makeView(library, ["AC/DC"]).length, 0);
+  assertEqual(acdc.length, 0);
+}
@@ -0,0 +1,141 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that library views read from the persistent sort index keep
+ *        the right order as items are added, removed and changed.
+ */
+
+var ARTISTNAME = "http://songbirdnest.com/data/1.0#artistName";
+
+function countSortIndexes(databaseGUID) {
+  var dbq = Cc["@songbirdnest.com/Songbird/DatabaseQuery;1"]
+              .createInstance(Ci.sbIDatabaseQuery);
+
+  dbq.setDatabaseGUID(databaseGUID);
+  dbq.addQuery("select count(1) from sort_indexes");
+  dbq.execute();
+
+  var dbr = dbq.getResultObject();
+  return parseInt(dbr.getRowCell(0, 0));
+}
+
+function makeView(library, aAscending) {
+  Components.utils.import("resource://app/jsmodules/sbProperties.jsm");
+
+  var view = library.createView();
+  view.setSort(SBProperties.createArray([
+    [ARTISTNAME, aAscending ? "a" : "d"]
+  ]));
+  return view;
+}
+
+function assertOrder(view, names, aAscending) {
+  var expected = names.concat().sort();
+  if (!aAscending) {
+    expected.reverse();
+  }
+
+  assertEqual(view.length, expected.length);
+  for (var i = 0; i < expected.length; i++) {
+    assertEqual(view.getItemByIndex(i).getProperty(ARTISTNAME), expected[i]);
+  }
+}
+
+function runTest () {
+
+  // Index every array, however short
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setIntPref("songbird.library.localdatabase.sortIndex.minLength", 1);
+
+  var databaseGUID = "test_guidarray_sortindex";
+  var library = createLibrary(databaseGUID, null, false);
+  library.clear();
+  assertEqual(countSortIndexes(databaseGUID), 0);
+
+  var names = ["delta", "alpha", "echo", "charlie", "bravo", "golf",
+               "foxtrot", "india", "hotel"];
+  var items = [];
+  for (var i = 0; i < names.length; i++) {
+    var item = library.createMediaItem(newURI("http://foo/" + i + ".mp3"));
+    item.setProperty(ARTISTNAME, names[i]);
+    items.push(item);
+  }
+  var propertyCache =
+    library.QueryInterface(Ci.sbILocalDatabaseLibrary).propertyCache;
+  propertyCache.write();
+
+  // The first view builds the index, the next one reads from it
+  var view = makeView(library, true);
+  assertOrder(view, names, true);
+  assertEqual(countSortIndexes(databaseGUID), 1);
+  assertOrder(makeView(library, true), names, true);
+
+  // Moving an item
+  items[1].setProperty(ARTISTNAME, "zulu");
+  names[1] = "zulu";
+  propertyCache.write();
+  assertOrder(view, names, true);
+  assertOrder(makeView(library, true), names, true);
+
+  // Several items at once
+  items[0].setProperty(ARTISTNAME, "aardvark");
+  names[0] = "aardvark";
+  items[5].setProperty(ARTISTNAME, "kilo");
+  names[5] = "kilo";
+  propertyCache.write();
+  assertOrder(makeView(library, true), names, true);
+
+  // Adding an item
+  var added = library.createMediaItem(newURI("http://foo/added.mp3"));
+  added.setProperty(ARTISTNAME, "juliet");
+  propertyCache.write();
+  items.push(added);
+  names.push("juliet");
+  assertOrder(makeView(library, true), names, true);
+
+  // Removing an item
+  library.remove(items[3]);
+  items.splice(3, 1);
+  names.splice(3, 1);
+  assertOrder(makeView(library, true), names, true);
+
+  // Descending views get their own index
+  view = makeView(library, false);
+  assertOrder(view, names, false);
+  assertEqual(countSortIndexes(databaseGUID), 2);
+
+  items[2].setProperty(ARTISTNAME, "able");
+  names[2] = "able";
+  propertyCache.write();
+  assertOrder(makeView(library, false), names, false);
+  assertOrder(makeView(library, true), names, true);
+
+  // Clearing the library drops the indexes
+  library.clear();
+  assertEqual(countSortIndexes(databaseGUID), 0);
+}
@@ -86,6 +86,17 @@ function runTest () {
   for (var i = 1; i < 101; i++) {
     assertEqual(libraryListener.added[i - 1].item.contentSrc.spec, "file:///foo/" + i + ".mp3");
   }
+
+  // The guids of a batch are made together, make sure they are all different
+  // and that the items share one creation time
+  var guids = {};
+  var created = added.queryElementAt(0, Ci.sbIMediaItem).created;
+  for (var i = 0; i < added.length; i++) {
+    var item = added.queryElementAt(i, Ci.sbIMediaItem);
+    assertFalse(item.guid in guids);
+    guids[item.guid] = true;
+    assertEqual(item.created, created);
+  }
   libraryListener.reset();
 
   // Do it again with duplcate URLs
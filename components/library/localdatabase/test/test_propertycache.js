@@ -30,8 +30,15 @@
 
 // note that this test will fail if resource_properties.txt ends with a final \n
 
+var PREF_WRITE_BATCH_SIZE = "songbird.propertycache.writeBatchSize";
+
 function runTest () {
 
+  // Small transactions, so the writes below are split up
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setIntPref(PREF_WRITE_BATCH_SIZE, 40);
+
   var databaseGUID = "test_propertycache";
   var library = createLibrary(databaseGUID);
 
@@ -75,4 +82,64 @@ function runTest () {
     }
   }
 
+  // Every guid has been read once, so asking again only hits the cache
+  var stats = cache.QueryInterface(Ci.sbILocalDatabasePropertyCacheStatistics);
+  assertTrue(stats.count > 0);
+  assertTrue(stats.bytes > 0);
+  assertTrue(stats.bytes <= stats.capacity);
+
+  stats.resetStatistics();
+  assertEqual(stats.hits, 0);
+  assertEqual(stats.misses, 0);
+
+  var guid;
+  for (guid in db) {
+    break;
+  }
+  cache.getProperties([guid], 1, {});
+  cache.getProperties([guid], 1, {});
+  assertEqual(stats.hits, 2);
+  assertEqual(stats.misses, 0);
+
+  // Prefetching stays within the memory budget
+  var allGuids = [];
+  for (guid in db) {
+    allGuids.push(guid);
+  }
+  cache.cacheProperties(allGuids, allGuids.length);
+  assertTrue(stats.bytes <= stats.capacity);
+
+  // Changes to many items are written in several transactions, with the
+  // rows of each property batched together
+  var COMMENT = "http://songbirdnest.com/data/1.0#comment";
+  var countSQL = "select count(*) from resource_properties \
+                  where property_id = (select property_id from properties \
+                                       where property_name = '" + COMMENT + "') \
+                  and obj = 'batched'";
+  var items = [];
+  for (var i = 0; i < 100; i++) {
+    items.push(library.getMediaItem(allGuids[i]));
+    items[i].setProperty(COMMENT, "batched");
+  }
+  cache.write();
+  assertEqual(stats.pendingWrites, 0);
+  assertTrue(stats.flushes > 0);
+  assertTrue(stats.lastFlushLatency >= stats.lastFlushDuration);
+  assertTrue(stats.maxFlushLatency >= stats.lastFlushLatency);
+  assertEqual(execQuery(databaseGUID, countSQL)[0][0], "100");
+
+  for (var i = 0; i < 70; i++) {
+    items[i].setProperty(COMMENT, null);
+  }
+  cache.write();
+  assertEqual(execQuery(databaseGUID, countSQL)[0][0], "30");
+
+  assertTrue(stats.flushInterval > 0);
+  assertTrue(stats.flushInterval <= 1000);
+
+  stats.resetStatistics();
+  assertEqual(stats.flushes, 0);
+  assertEqual(stats.maxFlushLatency, 0);
+
+  prefs.clearUserPref(PREF_WRITE_BATCH_SIZE);
 }
@@ -0,0 +1,116 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that searches through the word index find the same items as
+ *        the full text search, and that the index follows property changes.
+ */
+
+Components.utils.import("resource://app/jsmodules/sbProperties.jsm");
+
+var PREF_ENABLED = "songbird.library.localdatabase.searchIndex.enabled";
+
+function makeLibrary(databaseGUID, enabled) {
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setBoolPref(PREF_ENABLED, enabled);
+
+  return createLibrary(databaseGUID);
+}
+
+function search(library, property, values) {
+  var view = library.createView();
+  var cfs = view.cascadeFilterSet;
+  cfs.appendSearch([property], 1);
+  cfs.set(0, values, values.length);
+
+  var guids = [];
+  for (var i = 0; i < view.length; i++) {
+    guids.push(view.getItemByIndex(i).guid);
+  }
+  return guids;
+}
+
+function waitForIndex(databaseGUID) {
+  for (var i = 0; i < 100; i++) {
+    var rows = execQuery(databaseGUID,
+                         "select value from library_metadata " +
+                         "where name = 'search-index-version'");
+    if (rows.length) {
+      return;
+    }
+    sleep(100);
+  }
+  fail("The search index was not built");
+}
+
+function runTest () {
+
+  var indexed = makeLibrary("test_searchindex", true);
+  var fts = makeLibrary("test_searchindex_fts", false);
+
+  // The first search starts building the index
+  search(indexed, "*", ["house"]);
+  waitForIndex("test_searchindex");
+
+  // Everything searches match the start of words like the full text search
+  var terms = [["house"], ["hou"], ["rock"], ["merry-go"], ["big", "fat"]];
+  for (var i = 0; i < terms.length; i++) {
+    assertArraysEqual(search(indexed, "*", terms[i]),
+                      search(fts, "*", terms[i]));
+  }
+  assertTrue(search(indexed, "*", ["hou"]).length > 0);
+
+  // Words only match within the properties searched
+  var artistItems = indexed.getItemsByProperty(SBProperties.artistName,
+                                               "A House");
+  assertEqual(search(indexed, SBProperties.artistName, ["hou"]).length,
+              artistItems.length);
+  assertEqual(search(indexed, SBProperties.trackName, ["hou"]).length, 0);
+
+  // Diacritics and case are folded on both sides
+  var item = indexed.createMediaItem(newURI("http://foo/searchindex.mp3"));
+  item.setProperty(SBProperties.artistName, "Caf\u00e9 Tacuba");
+  assertTrue(search(indexed, "*", ["cafe"]).indexOf(item.guid) >= 0);
+  assertTrue(search(indexed, "*", ["CAF\u00c9"]).indexOf(item.guid) >= 0);
+  assertTrue(search(indexed, "*", ["tac"]).indexOf(item.guid) >= 0);
+
+  // Changed values drop their old words
+  item.setProperty(SBProperties.artistName, "Molotov");
+  assertEqual(search(indexed, "*", ["cafe"]).indexOf(item.guid), -1);
+  assertTrue(search(indexed, "*", ["molo"]).indexOf(item.guid) >= 0);
+
+  // Removed items leave the index
+  indexed.remove(item);
+  var rows = execQuery("test_searchindex",
+                       "select count(1) from search_index " +
+                       "where token = 'molotov'");
+  assertEqual(rows[0][0], "0");
+
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.clearUserPref(PREF_ENABLED);
+}
@@ -240,7 +240,7 @@ function runTest () {
   assertEqual(list.length, oldlength + 3 + (view.length * 3));
 
   // Test insertBefore.  These tests seem a bit random but they are testing
-  // all the code paths in sbLocalDatabaseSimpleMediaList::GetBeforeOrdinal
+  // all the code paths in sbLocalDatabaseSimpleMediaList::ReserveOrdinals
   library = createLibrary(databaseGUID);
   list = library.getMediaItem("7e8dcc95-7a1d-4bb3-9b14-d4906a9952cb");
   a = readList("data_sort_sml101_ordinal_asc.txt");
@@ -275,6 +275,15 @@ function runTest () {
   a.splice(a.length - 2, 0, item.guid);
   assertList(list, a);
 
+  // keep inserting at the same spot until the gap there runs out and the
+  // list has to be renumbered
+  for (var i = 0; i < 20; i++) {
+    item = library.getMediaItem(a[a.length - 1 - (i % 5)]);
+    list.insertBefore(1, item);
+    a.splice(1, 0, item.guid);
+  }
+  assertList(list, a);
+
   // test bad index
   try {
     list.insertBefore(list.length, item);
@@ -47,6 +47,7 @@ function runTest() {
   testMatchTypeNoneUsecLimit(library)
   testMatchTypeNoneBytesLimit(library);
   testMatchTypeNoneRandom(library);
+  testUpdateItems(library);
 }
 
 function testProperties(library) {
@@ -766,6 +767,93 @@ function testMatchTypeNoneRandom(library) {
   assertUnique(list);
 }
 
+function testUpdateItems(library) {
+
+  var albumProp = SB_NS + "albumName";
+  var artistProp = SB_NS + "artistName";
+  var contentLengthProp = SB_NS + "contentLength";
+
+  var list = library.createMediaList("smart");
+  list.matchType = Ci.sbILocalDatabaseSmartMediaList.MATCH_TYPE_ALL;
+  list.appendCondition(albumProp,
+                       getOperatorForProperty(albumProp, "="),
+                       "Back In Black",
+                       null,
+                       "unit");
+  list.appendCondition(contentLengthProp,
+                       getOperatorForProperty(contentLengthProp, "<"),
+                       "1000",
+                       null,
+                       "unit");
+  list.rebuild();
+  assertEqual(list.length, 6);
+
+  // Changing an item so it no longer matches takes it out of the list
+  var item = list.getItemByIndex(0);
+  var contentLength = item.getProperty(contentLengthProp);
+  item.setProperty(contentLengthProp, "5000");
+  list.updateItems(1, [item.guid]);
+  assertEqual(list.length, 5);
+  assertFalse(list.contains(item));
+
+  // and changing it back puts it in again
+  item.setProperty(contentLengthProp, contentLength);
+  list.updateItems(1, [item.guid]);
+  assertEqual(list.length, 6);
+  assertTrue(list.contains(item));
+  assertUnique(list);
+
+  // An item that didn't match before
+  var other = library.getItemsByProperty(artistProp, "a-ha")
+                     .queryElementAt(0, Ci.sbIMediaItem);
+  var album = other.getProperty(albumProp);
+  var otherContentLength = other.getProperty(contentLengthProp);
+  other.setProperty(albumProp, "Back In Black");
+  other.setProperty(contentLengthProp, "10");
+  list.updateItems(2, [item.guid, other.guid]);
+  assertEqual(list.length, 7);
+  assertTrue(list.contains(other));
+
+  // The result is the same as a rebuild
+  list.rebuild();
+  assertEqual(list.length, 7);
+  assertUnique(list);
+
+  other.setProperty(albumProp, album);
+  other.setProperty(contentLengthProp, otherContentLength);
+  list.updateItems(1, [other.guid]);
+  assertEqual(list.length, 6);
+
+  // Contains style conditions
+  var anyList = library.createMediaList("smart");
+  anyList.matchType = Ci.sbILocalDatabaseSmartMediaList.MATCH_TYPE_ANY;
+  anyList.appendCondition(artistProp,
+                          getOperatorForProperty(artistProp, "%?%"),
+                          "a-h",
+                          null,
+                          "unit");
+  anyList.rebuild();
+  var length = anyList.length;
+  assertTrue(length > 0);
+
+  var artist = item.getProperty(artistProp);
+  item.setProperty(artistProp, "Sha-Ha");
+  anyList.updateItems(1, [item.guid]);
+  assertEqual(anyList.length, length + 1);
+
+  item.setProperty(artistProp, artist);
+  anyList.updateItems(1, [item.guid]);
+  assertEqual(anyList.length, length);
+
+  // Lists with a limit are rebuilt
+  list.limitType = Ci.sbILocalDatabaseSmartMediaList.LIMIT_TYPE_ITEMS;
+  list.limit = 3;
+  list.selectPropertyID = contentLengthProp;
+  list.selectDirection = true;
+  list.updateItems(0, []);
+  assertEqual(list.length, 3);
+}
+
 function testSerialize(library) {
 
   var lastPlayTimeProp = SB_NS + "lastPlayTime";
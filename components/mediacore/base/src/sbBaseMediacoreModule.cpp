@@ -39,6 +39,7 @@
 #include "sbMediacoreFactoryWrapper.h"
 #include "sbMediacoreWrapper.h"
 #include "sbMediaInspector.h"
+#include "sbMediaInspectorService.h"
 
 NS_GENERIC_FACTORY_CONSTRUCTOR_INIT(sbMediacoreCapabilities, Init);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbMediacoreEqualizerBand);
@@ -49,6 +50,7 @@ NS_GENERIC_FACTORY_CONSTRUCTOR(sbMediaFormatContainer);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbMediaFormatVideo);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbMediaFormatAudio);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbMediaFormat);
+NS_GENERIC_FACTORY_CONSTRUCTOR_INIT(sbMediaInspectorService, Init);
 
 static nsModuleComponentInfo sbBaseMediacoreComponents[] =
 {
@@ -106,6 +108,12 @@ static nsModuleComponentInfo sbBaseMediacoreComponents[] =
     SB_MEDIAFORMAT_CONTRACTID,
     sbMediaFormatConstructor
   },
+  {
+    SB_MEDIAINSPECTORSERVICE_CLASSNAME,
+    SB_MEDIAINSPECTORSERVICE_CID,
+    SB_MEDIAINSPECTORSERVICE_CONTRACTID,
+    sbMediaInspectorServiceConstructor
+  },
 };
 
 NS_IMPL_NSGETMODULE(SongbirdBaseMediacore, sbBaseMediacoreComponents)
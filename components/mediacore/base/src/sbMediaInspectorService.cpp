@@ -0,0 +1,348 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#include "sbMediaInspectorService.h"
+
+// Mozilla includes
+#include <nsAlgorithm.h>
+#include <nsArrayUtils.h>
+#include <nsAutoLock.h>
+#include <nsAutoPtr.h>
+#include <nsComponentManagerUtils.h>
+#include <nsIFile.h>
+#include <nsIFileProtocolHandler.h>
+#include <nsIIOService.h>
+#include <nsIThread.h>
+#include <nsThreadUtils.h>
+#include <prinrval.h>
+#include <prsystem.h>
+
+// Songbird includes
+#include <sbIJobProgress.h>
+#include <sbIMediaItem.h>
+#include <sbProxiedComponentManager.h>
+#include <sbStandardProperties.h>
+
+// Each inspector runs a decoding pipeline, more than this doesn't help
+#define MAX_INSPECTORS 4
+
+// How often to check on running inspectors, in milliseconds
+#define INSPECT_POLL_INTERVAL 20
+
+// The cache is dropped once it gets this big
+#define MAX_CACHE_ENTRIES 5000
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbMediaInspectorService,
+                              sbIMediaInspectorService)
+
+sbMediaInspectorService::sbMediaInspectorService() :
+  mLock(nsnull),
+  mMaxInspectors(1)
+{
+}
+
+sbMediaInspectorService::~sbMediaInspectorService()
+{
+  if (mLock) {
+    nsAutoLock::DestroyLock(mLock);
+  }
+}
+
+nsresult
+sbMediaInspectorService::Init()
+{
+  nsresult rv;
+
+  mLock = nsAutoLock::NewLock("sbMediaInspectorService::mLock");
+  NS_ENSURE_TRUE(mLock, NS_ERROR_OUT_OF_MEMORY);
+
+  PRBool success = mCache.Init();
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
+  PRInt32 processors = PR_GetNumberOfProcessors();
+  mMaxInspectors = NS_MIN(NS_MAX(processors, 1), MAX_INSPECTORS);
+
+  // The file protocol handler must be used from the main thread, we may be
+  // created from anywhere.
+  nsCOMPtr<nsIIOService> ioService =
+    do_ProxiedGetService("@mozilla.org/network/io-service;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIProtocolHandler> fileHandler;
+  rv = ioService->GetProtocolHandler("file", getter_AddRefs(fileHandler));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  mFileProtocolHandler = do_QueryInterface(fileHandler, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+/* void inspectMediaItems (in nsIArray aMediaItems); */
+NS_IMETHODIMP
+sbMediaInspectorService::InspectMediaItems(nsIArray* aMediaItems)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItems);
+
+  nsresult rv;
+
+  PRUint32 length;
+  rv = aMediaItems->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Only the files that aren't known already need inspecting
+  nsTArray<nsString> uris;
+  nsTArray<FileStamp> stamps;
+  for (PRUint32 i = 0; i < length; i++) {
+    nsCOMPtr<sbIMediaItem> item = do_QueryElementAt(aMediaItems, i, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Use the string form, URI objects aren't threadsafe
+    nsString uri;
+    rv = item->GetProperty(NS_LITERAL_STRING(SB_PROPERTY_CONTENTURL), uri);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    FileStamp stamp;
+    rv = GetFileStamp(uri, stamp);
+    if (NS_FAILED(rv)) {
+      // Not a local file, so there is nowhere to keep the result
+      continue;
+    }
+
+    nsCOMPtr<sbIMediaFormat> format = GetCachedFormat(uri, stamp);
+    if (format) {
+      continue;
+    }
+
+    NS_ENSURE_TRUE(uris.AppendElement(uri), NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_TRUE(stamps.AppendElement(stamp), NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  return InspectURIs(uris, stamps);
+}
+
+/* sbIMediaFormat inspectMediaURI (in AString aURI); */
+NS_IMETHODIMP
+sbMediaInspectorService::InspectMediaURI(const nsAString& aURI,
+                                         sbIMediaFormat** _retval)
+{
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  FileStamp stamp;
+  nsresult stampResult = GetFileStamp(aURI, stamp);
+  if (NS_SUCCEEDED(stampResult)) {
+    nsCOMPtr<sbIMediaFormat> format = GetCachedFormat(aURI, stamp);
+    if (format) {
+      format.forget(_retval);
+      return NS_OK;
+    }
+  }
+
+  nsCOMPtr<sbIMediaInspector> inspector =
+    do_CreateInstance(SB_MEDIAINSPECTOR_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<sbIMediaFormat> format;
+  rv = inspector->InspectMediaURI(aURI, getter_AddRefs(format));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (NS_SUCCEEDED(stampResult)) {
+    CacheFormat(aURI, stamp, format);
+  }
+
+  format.forget(_retval);
+  return NS_OK;
+}
+
+/* sbIMediaFormat inspectMedia (in sbIMediaItem aMediaItem); */
+NS_IMETHODIMP
+sbMediaInspectorService::InspectMedia(sbIMediaItem* aMediaItem,
+                                      sbIMediaFormat** _retval)
+{
+  NS_ENSURE_ARG_POINTER(aMediaItem);
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsString uri;
+  nsresult rv =
+    aMediaItem->GetProperty(NS_LITERAL_STRING(SB_PROPERTY_CONTENTURL), uri);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return InspectMediaURI(uri, _retval);
+}
+
+nsresult
+sbMediaInspectorService::GetFileStamp(const nsAString& aURI,
+                                      FileStamp& aStamp)
+{
+  nsresult rv;
+
+  NS_ConvertUTF16toUTF8 spec(aURI);
+  if (!StringBeginsWith(spec, NS_LITERAL_CSTRING("file:"))) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  nsCOMPtr<nsIFile> file;
+  rv = mFileProtocolHandler->GetFileFromURLSpec(spec, getter_AddRefs(file));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = file->GetFileSize(&aStamp.fileSize);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = file->GetLastModifiedTime(&aStamp.lastModified);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+}
+
+already_AddRefed<sbIMediaFormat>
+sbMediaInspectorService::GetCachedFormat(const nsAString& aURI,
+                                         const FileStamp& aStamp)
+{
+  nsAutoLock lock(mLock);
+
+  CacheEntry* entry;
+  if (!mCache.Get(aURI, &entry) ||
+      entry->stamp.fileSize != aStamp.fileSize ||
+      entry->stamp.lastModified != aStamp.lastModified) {
+    return nsnull;
+  }
+
+  sbIMediaFormat* format = entry->format;
+  NS_ADDREF(format);
+  return format;
+}
+
+void
+sbMediaInspectorService::CacheFormat(const nsAString& aURI,
+                                     const FileStamp& aStamp,
+                                     sbIMediaFormat* aFormat)
+{
+  nsAutoLock lock(mLock);
+
+  if (mCache.Count() >= MAX_CACHE_ENTRIES) {
+    mCache.Clear();
+  }
+
+  nsAutoPtr<CacheEntry> entry(new CacheEntry);
+  if (!entry) {
+    return;
+  }
+  entry->stamp = aStamp;
+  entry->format = aFormat;
+
+  if (mCache.Put(aURI, entry)) {
+    entry.forget();
+  }
+}
+
+nsresult
+sbMediaInspectorService::InspectURIs(const nsTArray<nsString>& aURIs,
+                                     const nsTArray<FileStamp>& aStamps)
+{
+  NS_ENSURE_TRUE(aURIs.Length() == aStamps.Length(), NS_ERROR_INVALID_ARG);
+
+  nsresult rv;
+
+  if (aURIs.IsEmpty()) {
+    return NS_OK;
+  }
+
+  // Inspectors report back through the main thread, so if we are on it we
+  // have to keep it going while we wait.  As with the inspector's own
+  // synchronous methods, this is really meant for background threads.
+  PRBool isMainThread = NS_IsMainThread();
+  NS_ASSERTION(!isMainThread,
+               "sbMediaInspectorService is background-thread only");
+
+  nsCOMPtr<nsIThread> target;
+  if (isMainThread) {
+    rv = NS_GetMainThread(getter_AddRefs(target));
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  // Each running inspector and the index of the file it is inspecting.  An
+  // inspector still tears its pipeline down after it reports, so a fresh one
+  // is used for each file rather than handing it the next file right away.
+  nsTArray<nsCOMPtr<sbIMediaInspector> > inspectors;
+  nsTArray<PRUint32> indexes;
+
+  PRUint32 next = 0;
+  while (next < aURIs.Length() || !inspectors.IsEmpty()) {
+    // Start as many inspections as there are free slots
+    while (next < aURIs.Length() && inspectors.Length() < mMaxInspectors) {
+      PRUint32 index = next++;
+
+      nsCOMPtr<sbIMediaInspector> inspector =
+        do_CreateInstance(SB_MEDIAINSPECTOR_CONTRACTID, &rv);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      rv = inspector->InspectMediaURIAsync(aURIs[index]);
+      if (NS_FAILED(rv)) {
+        NS_WARNING("sbMediaInspectorService unable to start an inspection");
+        continue;
+      }
+
+      NS_ENSURE_TRUE(inspectors.AppendElement(inspector),
+                     NS_ERROR_OUT_OF_MEMORY);
+      NS_ENSURE_TRUE(indexes.AppendElement(index), NS_ERROR_OUT_OF_MEMORY);
+    }
+
+    if (isMainThread && target) {
+      PRBool processed;
+      rv = target->ProcessNextEvent(PR_FALSE, &processed);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
+    PR_Sleep(PR_MillisecondsToInterval(INSPECT_POLL_INTERVAL));
+
+    // Collect the inspections that are done
+    for (PRInt32 i = inspectors.Length() - 1; i >= 0; --i) {
+      nsCOMPtr<sbIJobProgress> progress = do_QueryInterface(inspectors[i], &rv);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      PRUint16 status;
+      rv = progress->GetStatus(&status);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      if (status == sbIJobProgress::STATUS_RUNNING) {
+        continue;
+      }
+
+      if (status == sbIJobProgress::STATUS_SUCCEEDED) {
+        nsCOMPtr<sbIMediaFormat> format;
+        rv = inspectors[i]->GetMediaFormat(getter_AddRefs(format));
+        if (NS_SUCCEEDED(rv) && format) {
+          CacheFormat(aURIs[indexes[i]], aStamps[indexes[i]], format);
+        }
+      }
+
+      inspectors.RemoveElementAt(i);
+      indexes.RemoveElementAt(i);
+    }
+  }
+
+  return NS_OK;
+}
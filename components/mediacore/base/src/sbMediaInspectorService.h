@@ -0,0 +1,102 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#ifndef SBMEDIAINSPECTORSERVICE_H_
+#define SBMEDIAINSPECTORSERVICE_H_
+
+// Mozilla includes
+#include <nsClassHashtable.h>
+#include <nsCOMPtr.h>
+#include <nsHashKeys.h>
+#include <nsStringAPI.h>
+#include <nsTArray.h>
+#include <prlock.h>
+
+// Songbird includes
+#include <sbIMediaInspector.h>
+
+class nsIFileProtocolHandler;
+
+/**
+ * \brief Runs several media inspectors side by side over a list of files, and
+ *        keeps the media format of each local file along with its size and
+ *        modification time so it isn't inspected again until it changes.
+ */
+class sbMediaInspectorService : public sbIMediaInspectorService
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBIMEDIAINSPECTORSERVICE
+
+  sbMediaInspectorService();
+
+  nsresult Init();
+
+private:
+  ~sbMediaInspectorService();
+
+  struct FileStamp {
+    PRInt64 fileSize;
+    PRInt64 lastModified;
+  };
+
+  struct CacheEntry {
+    FileStamp stamp;
+    nsCOMPtr<sbIMediaFormat> format;
+  };
+
+  /**
+   * Get the size and modification time of a local file. Fails for anything
+   * that isn't a local file, those aren't cached.
+   */
+  nsresult GetFileStamp(const nsAString& aURI, FileStamp& aStamp);
+
+  /**
+   * Returns the cached format of a file, or null if it isn't known or the
+   * file changed since.
+   */
+  already_AddRefed<sbIMediaFormat> GetCachedFormat(const nsAString& aURI,
+                                                   const FileStamp& aStamp);
+
+  void CacheFormat(const nsAString& aURI,
+                   const FileStamp& aStamp,
+                   sbIMediaFormat* aFormat);
+
+  /**
+   * Inspect the given files, up to mMaxInspectors at a time, caching the
+   * format of the ones that succeed.
+   */
+  nsresult InspectURIs(const nsTArray<nsString>& aURIs,
+                       const nsTArray<FileStamp>& aStamps);
+
+  // Protects mCache
+  PRLock* mLock;
+  nsClassHashtable<nsStringHashKey, CacheEntry> mCache;
+
+  nsCOMPtr<nsIFileProtocolHandler> mFileProtocolHandler;
+
+  PRUint32 mMaxInspectors;
+};
+
+#endif /* SBMEDIAINSPECTORSERVICE_H_ */
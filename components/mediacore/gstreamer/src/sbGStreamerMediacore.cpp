@@ -106,6 +106,13 @@
 #define EQUALIZER_BANDS \
   sbBaseMediacoreMultibandEqualizer::EQUALIZER_BANDS_10
 
+// How often the playback timer looks at prerolling and crossfades, in ms
+#define PLAYBACK_TIMER_INTERVAL   250
+#define CROSSFADE_TIMER_INTERVAL  50
+
+// Longest crossfade allowed, in ms
+#define MAX_CROSSFADE_DURATION    15000
+
 /**
  * To log this class, set the following environment variable in a debug build:
  *
@@ -190,7 +197,12 @@ sbGStreamerMediacore::sbGStreamerMediacore() :
     mCurrentAudioCaps(NULL),
     mAudioBinGhostPad(NULL),
     mHasVideo(PR_FALSE),
-    mHasAudio(PR_FALSE)
+    mHasAudio(PR_FALSE),
+    mPrerollEnabled(PR_FALSE),
+    mCrossfadeDuration(0),
+    mHasPrerolledTags(PR_FALSE),
+    mFadeStart(0),
+    mFadeLength(0)
 {
   mBaseEventTarget = new sbBaseMediacoreEventTarget(this);
   NS_WARN_IF_FALSE(mBaseEventTarget,
@@ -212,6 +224,10 @@ sbGStreamerMediacore::~sbGStreamerMediacore()
   for ( ; it < mAudioFilters.end(); ++it)
     gst_object_unref (*it);
 
+  it = mAddedAudioFilters.begin();
+  for ( ; it < mAddedAudioFilters.end(); ++it)
+    gst_object_unref (*it);
+
   if (mMonitor)
     nsAutoMonitor::DestroyMonitor(mMonitor);
 }
@@ -346,6 +362,37 @@ sbGStreamerMediacore::ReadPreferences()
   mAudioSinkBufferTime = audioSinkBufferTime;
   mStreamingBufferSize = streamingBufferSize;
 
+  const char *PREROLL_ENABLED_PREF =
+      "songbird.mediacore.gstreamer.preroll.enabled";
+  /* In milliseconds */
+  const char *CROSSFADE_DURATION_PREF =
+      "songbird.mediacore.crossfade.duration";
+
+  PRBool prerollEnabled = PR_TRUE;
+  rv = mPrefs->GetPrefType(PREROLL_ENABLED_PREF, &prefType);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (prefType == nsIPrefBranch::PREF_BOOL) {
+    rv = mPrefs->GetBoolPref(PREROLL_ENABLED_PREF, &prerollEnabled);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  PRInt32 crossfadeDuration = 0;
+  rv = mPrefs->GetPrefType(CROSSFADE_DURATION_PREF, &prefType);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (prefType == nsIPrefBranch::PREF_INT) {
+    rv = mPrefs->GetIntPref(CROSSFADE_DURATION_PREF, &crossfadeDuration);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  mPrerollEnabled = prerollEnabled;
+  // Crossfading plays the prerolled pipeline, so it needs prerolling on
+  mCrossfadeDuration = prerollEnabled ?
+    (PRUint32)SB_ClampDouble(crossfadeDuration, 0, MAX_CROSSFADE_DURATION) : 0;
+
+  if (!mPrerollEnabled) {
+    DestroySecondaryPipeline(mNextPipeline);
+  }
+
   const char *NORMALIZATION_ENABLED_PREF =
       "songbird.mediacore.normalization.enabled";
   const char *NORMALIZATION_MODE_PREF =
@@ -465,7 +512,8 @@ sbGStreamerMediacore::CreateVideoSink()
 }
 
 GstElement *
-sbGStreamerMediacore::CreateAudioSink()
+sbGStreamerMediacore::CreateAudioSink(const std::vector<GstElement*> &aFilters,
+                                      GstGhostPad **aGhostPad)
 {
   nsAutoMonitor lock(mMonitor);
 
@@ -498,8 +546,8 @@ sbGStreamerMediacore::CreateAudioSink()
   /* Add each filter, followed by an audioconvert. The first-added filter ends
    * last in the pipeline, so we iterate in reverse.
    */
-  std::vector<GstElement *>::const_reverse_iterator it = mAudioFilters.rbegin(),
-      end = mAudioFilters.rend();
+  std::vector<GstElement *>::const_reverse_iterator it = aFilters.rbegin(),
+      end = aFilters.rend();
   for ( ; it != end; ++it)
   {
     GstElement *audioconvert = gst_element_factory_make ("audioconvert", NULL);
@@ -527,7 +575,7 @@ sbGStreamerMediacore::CreateAudioSink()
   ghostpad = gst_ghost_pad_new ("sink", targetpad);
   gst_element_add_pad (sinkbin, ghostpad);
 
-  mAudioBinGhostPad = GST_GHOST_PAD (gst_object_ref (ghostpad));
+  *aGhostPad = GST_GHOST_PAD (gst_object_ref (ghostpad));
 
   gst_object_unref (targetpad);
 
@@ -763,7 +811,6 @@ nsresult
 sbGStreamerMediacore::CreatePlaybackPipeline()
 {
   nsresult rv;
-  gint flags;
 
   // destroy pipeline will acquire the monitor.
   rv = DestroyPipeline();
@@ -775,39 +822,57 @@ sbGStreamerMediacore::CreatePlaybackPipeline()
   if (!mPipeline)
     return NS_ERROR_FAILURE;
 
-  if (mPlatformInterface) {
-    GstElement *audiosink = CreateAudioSink();
+  GstElement *audiosink = NULL;
+  if (mPlatformInterface)
+    audiosink = CreateAudioSink(mAudioFilters, &mAudioBinGhostPad);
 
+  rv = ConfigurePlaybin(mPipeline, audiosink, PR_FALSE);
+  NS_ENSURE_SUCCESS (rv, rv);
+
+  ConnectPlaybinSignals(mPipeline);
+
+  return NS_OK;
+}
+
+nsresult
+sbGStreamerMediacore::ConfigurePlaybin(GstElement *aPlaybin,
+                                       GstElement *aAudioSink,
+                                       PRBool aAudioOnly)
+{
+  nsresult rv;
+  gint flags;
+
+  if (aAudioSink) {
     // Set audio sink
-    g_object_set(mPipeline, "audio-sink", audiosink, NULL);
+    g_object_set(aPlaybin, "audio-sink", aAudioSink, NULL);
 
     // Set audio sink buffer time based on pref
-    SetPropertyOnChild(audiosink, "buffer-time",
+    SetPropertyOnChild(aAudioSink, "buffer-time",
             (gint64)mAudioSinkBufferTime);
 
-    if (!mVideoDisabled) {
+    if (!mVideoDisabled && !aAudioOnly) {
       GstElement *videosink = CreateVideoSink();
-      g_object_set(mPipeline, "video-sink", videosink, NULL);
+      g_object_set(aPlaybin, "video-sink", videosink, NULL);
     }
   }
 
   // Configure what to output - we want audio only, unless video
   // is turned on
   flags = 0x2 | 0x10; // audio | soft-volume
-  if (!mVideoDisabled && mIsVideoSupported) {
+  if (!mVideoDisabled && mIsVideoSupported && !aAudioOnly) {
     // Enable video only if we're set up for it is turned off. Also enable
     // text (subtitles), which require a video window to display.
     flags |= 0x1 | 0x4; // video | text
   }
-  g_object_set (G_OBJECT(mPipeline), "flags", flags, NULL);
+  g_object_set (G_OBJECT(aPlaybin), "flags", flags, NULL);
 
-  GstBus *bus = gst_element_get_bus (mPipeline);
+  GstBus *bus = gst_element_get_bus (aPlaybin);
 
   // We want to receive state-changed messages when shutting down, so we
   // need to turn off bus auto-flushing
-  g_object_set(mPipeline, "auto-flush-bus", FALSE, NULL);
+  g_object_set(aPlaybin, "auto-flush-bus", FALSE, NULL);
 
-  rv = SetBufferingProperties(mPipeline);
+  rv = SetBufferingProperties(aPlaybin);
   NS_ENSURE_SUCCESS (rv, rv);
 
   // Handle GStreamer messages synchronously, either directly or
@@ -817,20 +882,597 @@ sbGStreamerMediacore::CreatePlaybackPipeline()
 
   g_object_unref ((GObject *)bus);
 
+  return NS_OK;
+}
+
+void
+sbGStreamerMediacore::ConnectPlaybinSignals(GstElement *aPlaybin)
+{
   // Handle about-to-finish signal emitted by playbin2
-  g_signal_connect (mPipeline, "about-to-finish",
+  g_signal_connect (aPlaybin, "about-to-finish",
           G_CALLBACK (aboutToFinishHandler), this);
   // Get notified when the current audio/video stream changes.
   // This will let us get information about the specific audio or video stream
   // being played.
-  g_signal_connect (mPipeline, "notify::current-video",
+  g_signal_connect (aPlaybin, "notify::current-video",
           G_CALLBACK (currentVideoSetHelper), this);
-  g_signal_connect (mPipeline, "notify::current-audio",
+  g_signal_connect (aPlaybin, "notify::current-audio",
           G_CALLBACK (currentAudioSetHelper), this);
+}
+
+// Copy the writable properties of aFrom to aTo, which must be of the same
+// type, along with those of their children for elements such as the
+// equalizer that keep settings on child objects.
+static void
+CopyObjectSettings(GObject *aFrom, GObject *aTo)
+{
+  guint count = 0;
+  GParamSpec **specs =
+    g_object_class_list_properties(G_OBJECT_GET_CLASS(aFrom), &count);
+
+  for (guint i = 0; i < count; i++) {
+    GParamSpec *spec = specs[i];
+    if ((spec->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE ||
+        (spec->flags & G_PARAM_CONSTRUCT_ONLY) ||
+        !strcmp(spec->name, "name"))
+      continue;
+
+    GValue value = {0};
+    g_value_init (&value, spec->value_type);
+    g_object_get_property (aFrom, spec->name, &value);
+    g_object_set_property (aTo, spec->name, &value);
+    g_value_unset (&value);
+  }
+
+  g_free (specs);
+
+  if (GST_IS_CHILD_PROXY(aFrom) && GST_IS_CHILD_PROXY(aTo)) {
+    guint children = gst_child_proxy_get_children_count(GST_CHILD_PROXY(aFrom));
+    for (guint i = 0; i < children; i++) {
+      GstObject *from = gst_child_proxy_get_child_by_index(
+              GST_CHILD_PROXY(aFrom), i);
+      GstObject *to = gst_child_proxy_get_child_by_index(
+              GST_CHILD_PROXY(aTo), i);
+      if (from && to)
+        CopyObjectSettings(G_OBJECT(from), G_OBJECT(to));
+      if (from)
+        gst_object_unref (from);
+      if (to)
+        gst_object_unref (to);
+    }
+  }
+}
+
+// Returns the top-level bin of the element that posted aMessage, or NULL.
+// The caller must unref the result.
+static GstObject *
+GetMessagePipeline(GstMessage *aMessage)
+{
+  GstObject *object = GST_MESSAGE_SRC(aMessage);
+  if (!object)
+    return NULL;
+
+  gst_object_ref (object);
+
+  GstObject *parent;
+  while ((parent = gst_object_get_parent (object)) != NULL) {
+    gst_object_unref (object);
+    object = parent;
+  }
+
+  return object;
+}
+
+nsresult
+sbGStreamerMediacore::PrerollNextItem()
+{
+  nsresult rv;
+
+  nsAutoMonitor lock(mMonitor);
+
+  // The prerolled pipeline needs its own audio sink and filters, which only
+  // exist when we have a platform interface
+  if (!mPrerollEnabled || !mPlatformInterface || !mPipeline || mHasVideo)
+    return NS_OK;
+
+  nsCOMPtr<sbIMediacoreSequencer> sequencer = mSequencer;
+  lock.Exit();
+
+  if (!sequencer)
+    return NS_OK;
+
+  nsCOMPtr<sbIMediaItem> item;
+  rv = sequencer->GetNextItem(getter_AddRefs(item));
+  if (NS_FAILED(rv) || !item) {
+    DestroySecondaryPipeline(mNextPipeline);
+    return NS_OK;
+  }
+
+  nsString contentURL;
+  rv = item->GetProperty(NS_LITERAL_STRING(SB_PROPERTY_CONTENTURL),
+          contentURL);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsString contentType;
+  rv = item->GetProperty(NS_LITERAL_STRING(SB_PROPERTY_CONTENTTYPE),
+          contentType);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Like gapless playback, only local files are prerolled; streams buffer
+  // and video needs the video window, both of which belong to the current
+  // pipeline.
+  if (!StringBeginsWith(contentURL, NS_LITERAL_STRING("file:")) ||
+      contentType.EqualsLiteral("video")) {
+    DestroySecondaryPipeline(mNextPipeline);
+    return NS_OK;
+  }
+
+  nsCString uri = NS_ConvertUTF16toUTF8(contentURL);
+
+  lock.Enter();
+  if ((mNextPipeline.pipeline && mNextPipeline.uri.Equals(uri)) ||
+      mPrerollFailedUri.Equals(uri)) {
+    return NS_OK;
+  }
+  lock.Exit();
+
+  DestroySecondaryPipeline(mNextPipeline);
+
+  nsCOMPtr<nsIURI> itemUri;
+  rv = item->GetContentSrc(getter_AddRefs(itemUri));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  lock.Enter();
+
+  SecondaryPipeline next;
+  next.pipeline = gst_element_factory_make ("playbin2", "next-player");
+  NS_ENSURE_TRUE(next.pipeline, NS_ERROR_FAILURE);
+
+  // The filters can only be in one pipeline at a time, so this one gets
+  // copies; they replace the originals if it's promoted.
+  std::vector<GstElement *>::const_iterator it = mAudioFilters.begin();
+  for ( ; it < mAudioFilters.end(); ++it)
+  {
+    GstElement *filter = gst_element_factory_create (
+            gst_element_get_factory (*it), NULL);
+    if (!filter) {
+      DestroySecondaryPipeline(next);
+      return NS_ERROR_FAILURE;
+    }
+
+    gst_object_ref (filter);
+    gst_object_sink (filter);
+    CopyObjectSettings(G_OBJECT(*it), G_OBJECT(filter));
+
+    next.audioFilters.push_back(filter);
+  }
+
+  GstElement *audiosink = CreateAudioSink(next.audioFilters,
+                                          &next.audioBinGhostPad);
+
+  rv = ConfigurePlaybin(next.pipeline, audiosink, PR_TRUE);
+  if (NS_FAILED(rv)) {
+    DestroySecondaryPipeline(next);
+    return rv;
+  }
+
+  LOG(("Prerolling \"%s\"", uri.BeginReading()));
+
+  g_object_set (G_OBJECT (next.pipeline), "uri", uri.BeginReading(), NULL);
+  next.uri = uri;
+  next.itemUri = itemUri;
+
+  mNextPipeline = next;
+  GstElement *pipeline = (GstElement *)gst_object_ref (next.pipeline);
+  lock.Exit();
+
+  // Opening, demuxing and decoding up to the first buffer happens now rather
+  // than when the item is played.
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  gst_object_unref (pipeline);
+
+  return NS_OK;
+}
+
+void
+sbGStreamerMediacore::PromoteNextPipeline(SecondaryPipeline &aPrevious)
+{
+  NS_ASSERTION(mNextPipeline.pipeline, "No prerolled pipeline to promote");
+
+  // Hand the current pipeline and its filters over to aPrevious
+  aPrevious.pipeline = mPipeline;
+  aPrevious.audioBinGhostPad = mAudioBinGhostPad;
+  aPrevious.audioFilters.swap(mAudioFilters);
+  aPrevious.uri = mCurrentUri;
+  aPrevious.itemUri = mUri;
+  if (aPrevious.pipeline) {
+    g_signal_handlers_disconnect_matched (aPrevious.pipeline,
+            G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, this);
+  }
+
+  mPipeline = mNextPipeline.pipeline;
+  mAudioBinGhostPad = mNextPipeline.audioBinGhostPad;
+  mAudioFilters.swap(mNextPipeline.audioFilters);
+  mCurrentUri = mNextPipeline.uri;
+  mUri = mNextPipeline.itemUri;
+
+  // The copies take over from the original filters, with any settings that
+  // changed since they were made.
+  for (PRUint32 i = 0;
+       i < mAudioFilters.size() && i < aPrevious.audioFilters.size();
+       i++)
+  {
+    GstElement *previous = aPrevious.audioFilters[i];
+    GstElement *filter = mAudioFilters[i];
+
+    CopyObjectSettings(G_OBJECT(previous), G_OBJECT(filter));
+
+    if (previous == mEqualizerElement) {
+      gst_object_ref (filter);
+      gst_object_unref (mEqualizerElement);
+      mEqualizerElement = filter;
+    }
+    if (previous == mReplaygainElement) {
+      gst_object_ref (filter);
+      gst_object_unref (mReplaygainElement);
+      mReplaygainElement = filter;
+    }
+  }
+
+  // Reset everything we know about the stream, as DestroyPipeline does
+  if (mTags) {
+    gst_tag_list_free (mTags);
+  }
+  mTags = mNextPipeline.tags;
+  mProperties = nsnull;
+  mHasPrerolledTags = PR_FALSE;
+  if (mTags) {
+    nsresult rv = ConvertTagListToPropertyArray(mTags,
+            getter_AddRefs(mProperties));
+    mHasPrerolledTags = NS_SUCCEEDED(rv);
+  }
+
+  if (mCurrentAudioCaps) {
+    gst_caps_unref (mCurrentAudioCaps);
+    mCurrentAudioCaps = NULL;
+  }
+
+  mStopped = PR_FALSE;
+  mBuffering = PR_FALSE;
+  mIsLive = PR_FALSE;
+  mMediacoreError = NULL;
+  mGaplessDisabled = PR_FALSE;
+  mPlayingGaplessly = PR_FALSE;
+  mAbortingPlayback = PR_FALSE;
+  mHasReachedPlaying = PR_FALSE;
+  mVideoSize = NULL;
+  mHasVideo = PR_FALSE;
+  mHasAudio = PR_FALSE;
+
+  mResourceIsLocal = PR_TRUE;
+  if (NS_FAILED(GetFileSize(mUri, &mResourceSize)))
+    mResourceSize = -1;
+
+  mNextPipeline.pipeline = NULL;
+  mNextPipeline.audioBinGhostPad = NULL;
+  mNextPipeline.tags = NULL;
+  mNextPipeline.uri.Truncate();
+  mNextPipeline.itemUri = nsnull;
+
+  ConnectPlaybinSignals(mPipeline);
+
+  // The audio stream was picked while prerolling, before we were listening
+  gint currentAudio = -1;
+  g_object_get (G_OBJECT (mPipeline), "current-audio", &currentAudio, NULL);
+  if (currentAudio >= 0)
+    currentAudioSetHelper(G_OBJECT (mPipeline), NULL, this);
+}
+
+nsresult
+sbGStreamerMediacore::SwapInNextPipeline()
+{
+  SecondaryPipeline previous;
+
+  nsAutoMonitor lock(mMonitor);
+  NS_ENSURE_STATE(mNextPipeline.pipeline);
+
+  LOG(("Playing prerolled \"%s\"", mNextPipeline.uri.BeginReading()));
+
+  PromoteNextPipeline(previous);
+  mTargetState = GST_STATE_NULL;
+
+  // Apply volume/mute to our new pipeline
+  g_object_set (G_OBJECT (mPipeline), "volume", mMute ? 0.0 : mVolume, NULL);
+  lock.Exit();
+
+  DestroySecondaryPipeline(previous);
 
   return NS_OK;
 }
 
+void
+sbGStreamerMediacore::DestroySecondaryPipeline(SecondaryPipeline &aPipeline)
+{
+  nsAutoMonitor lock(mMonitor);
+
+  GstElement *pipeline = aPipeline.pipeline;
+  GstGhostPad *ghostpad = aPipeline.audioBinGhostPad;
+  GstTagList *tags = aPipeline.tags;
+  std::vector<GstElement*> filters;
+  filters.swap(aPipeline.audioFilters);
+
+  aPipeline.pipeline = NULL;
+  aPipeline.audioBinGhostPad = NULL;
+  aPipeline.tags = NULL;
+  aPipeline.uri.Truncate();
+  aPipeline.itemUri = nsnull;
+  lock.Exit();
+
+  /* Do state-change with the lock dropped */
+  if (pipeline) {
+    g_signal_handlers_disconnect_matched (pipeline,
+            G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, this);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+  }
+
+  /* Work around bug in ghostpads (upstream #570910) by explicitly
+   * untargetting this ghostpad */
+  if (ghostpad) {
+    gst_ghost_pad_set_target (ghostpad, NULL);
+    gst_object_unref (ghostpad);
+  }
+
+  if (pipeline)
+    gst_object_unref (pipeline);
+
+  std::vector<GstElement *>::const_iterator it = filters.begin();
+  for ( ; it < filters.end(); ++it)
+    gst_object_unref (*it);
+
+  if (tags)
+    gst_tag_list_free (tags);
+}
+
+void
+sbGStreamerMediacore::HandleNextPipelineMessage(GstMessage *message)
+{
+  switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_TAG: {
+      // Keep the tags until the item plays
+      GstTagList *tagList;
+      gst_message_parse_tag (message, &tagList);
+
+      nsAutoMonitor lock(mMonitor);
+      if (mNextPipeline.tags) {
+        GstTagList *newTags = gst_tag_list_merge (mNextPipeline.tags,
+                tagList, GST_TAG_MERGE_REPLACE);
+        gst_tag_list_free (mNextPipeline.tags);
+        mNextPipeline.tags = newTags;
+      }
+      else
+        mNextPipeline.tags = gst_tag_list_copy (tagList);
+
+      gst_tag_list_free (tagList);
+      break;
+    }
+    case GST_MESSAGE_ELEMENT:
+      if (!gst_is_missing_plugin_message(message))
+        break;
+      // Fall through
+    case GST_MESSAGE_ERROR: {
+      // Give up on prerolling this item; it'll be opened the usual way when
+      // it plays, which reports the error properly.
+      nsAutoMonitor lock(mMonitor);
+      LOG(("Failed to preroll \"%s\"", mNextPipeline.uri.BeginReading()));
+      mPrerollFailedUri = mNextPipeline.uri;
+      lock.Exit();
+
+      DestroySecondaryPipeline(mNextPipeline);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void
+sbGStreamerMediacore::HandleOldPipelineMessage(GstMessage *message,
+                                               PRBool aIsFading)
+{
+  switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR: {
+      // The item is no longer the one playing, so only log the error
+      GError *gerror = NULL;
+      gchar *debugMessage = NULL;
+      gst_message_parse_error (message, &gerror, &debugMessage);
+
+      nsString error = NS_LITERAL_STRING("GStreamer error in the previous "
+                                         "item: ");
+      error.Append(NS_ConvertUTF8toUTF16(gerror->message));
+      error.Append(NS_LITERAL_STRING(" Additional information: "));
+      error.Append(NS_ConvertUTF8toUTF16(debugMessage));
+
+      g_error_free (gerror);
+      g_free (debugMessage);
+
+      sbErrorConsole::Error("Mediacore:GStreamer", error);
+
+      if (aIsFading) {
+        LOG(("Error while fading out, ending the crossfade"));
+        FinishCrossfade();
+      }
+      break;
+    }
+    case GST_MESSAGE_EOS:
+      // Nothing left to fade out
+      if (aIsFading) {
+        LOG(("Faded out item ended, ending the crossfade"));
+        FinishCrossfade();
+      }
+      break;
+    default:
+      TRACE(("Dropping message from another pipeline"));
+      break;
+  }
+}
+
+nsresult
+sbGStreamerMediacore::StartCrossfade()
+{
+  nsAutoMonitor lock(mMonitor);
+
+  if (!mCrossfadeDuration || !mPipeline || !mNextPipeline.pipeline ||
+      mFadingPipeline.pipeline || mHasVideo || mBuffering ||
+      mTargetState != GST_STATE_PLAYING)
+    return NS_OK;
+
+  GstState nextState;
+  gst_element_get_state (mNextPipeline.pipeline, &nextState, NULL, 0);
+  if (nextState != GST_STATE_PAUSED)
+    return NS_OK;
+
+  GstFormat format = GST_FORMAT_TIME;
+  gint64 position, duration;
+  if (!gst_element_query_position (mPipeline, &format, &position) ||
+      !gst_element_query_duration (mPipeline, &format, &duration) ||
+      (GstClockTime)duration == GST_CLOCK_TIME_NONE)
+    return NS_OK;
+
+  gint64 crossfade = (gint64)mCrossfadeDuration * GST_MSECOND;
+  gint64 remaining = duration - position;
+
+  // Tracks too short to fade over just end and start the next one
+  if (remaining > crossfade || duration < 2 * crossfade)
+    return NS_OK;
+
+  nsCOMPtr<sbIMediacoreSequencer> sequencer = mSequencer;
+  lock.Exit();
+
+  if (!sequencer)
+    return NS_OK;
+
+  // If the sequencer won't let us move on ourselves, the track ends normally
+  nsresult rv = sequencer->RequestHandleNextItem(this);
+  if (NS_FAILED(rv))
+    return NS_OK;
+
+  lock.Enter();
+  NS_ENSURE_STATE(mNextPipeline.pipeline);
+
+  LOG(("Crossfading to \"%s\"", mNextPipeline.uri.BeginReading()));
+
+  PromoteNextPipeline(mFadingPipeline);
+  g_object_set (G_OBJECT (mPipeline), "volume", 0.0, NULL);
+
+  mFadeStart = PR_IntervalNow();
+  mFadeLength = PR_MillisecondsToInterval(
+          (PRUint32)PR_MAX(remaining / GST_MSECOND, 1));
+  mTargetState = GST_STATE_PLAYING;
+
+  GstElement *pipeline = (GstElement *)gst_object_ref (mPipeline);
+  lock.Exit();
+
+  if (mPlaybackTimer)
+    mPlaybackTimer->SetDelay(CROSSFADE_TIMER_INTERVAL);
+
+  // Reaching PLAYING sends STREAM_START, which moves the sequencer on
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_object_unref (pipeline);
+
+  return NS_OK;
+}
+
+void
+sbGStreamerMediacore::UpdateCrossfade()
+{
+  nsAutoMonitor lock(mMonitor);
+
+  if (!mFadingPipeline.pipeline)
+    return;
+
+  double fraction = 1.0;
+  if (mFadeLength) {
+    fraction = (double)(PRIntervalTime)(PR_IntervalNow() - mFadeStart) /
+               (double)mFadeLength;
+  }
+
+  if (fraction >= 1.0) {
+    lock.Exit();
+    FinishCrossfade();
+    return;
+  }
+
+  double volume = mMute ? 0.0 : mVolume;
+  g_object_set (G_OBJECT (mFadingPipeline.pipeline),
+          "volume", volume * (1.0 - fraction), NULL);
+  if (mPipeline)
+    g_object_set (G_OBJECT (mPipeline), "volume", volume * fraction, NULL);
+}
+
+void
+sbGStreamerMediacore::FinishCrossfade()
+{
+  nsAutoMonitor lock(mMonitor);
+
+  if (!mFadingPipeline.pipeline)
+    return;
+
+  if (mPipeline) {
+    g_object_set (G_OBJECT (mPipeline),
+            "volume", mMute ? 0.0 : mVolume, NULL);
+  }
+  lock.Exit();
+
+  DestroySecondaryPipeline(mFadingPipeline);
+
+  if (mPlaybackTimer)
+    mPlaybackTimer->SetDelay(PLAYBACK_TIMER_INTERVAL);
+}
+
+void
+sbGStreamerMediacore::StartPlaybackTimer()
+{
+  nsresult rv;
+
+  if (!mPrerollEnabled)
+    return;
+
+  if (!mPlaybackTimer) {
+    mPlaybackTimer = do_CreateInstance(NS_TIMER_CONTRACTID, &rv);
+    NS_ENSURE_SUCCESS(rv, /* void */);
+  }
+  else {
+    mPlaybackTimer->Cancel();
+  }
+
+  rv = mPlaybackTimer->Init(this,
+                            mFadingPipeline.pipeline ?
+                              CROSSFADE_TIMER_INTERVAL :
+                              PLAYBACK_TIMER_INTERVAL,
+                            nsITimer::TYPE_REPEATING_SLACK);
+  NS_ENSURE_SUCCESS(rv, /* void */);
+}
+
+void
+sbGStreamerMediacore::OnPlaybackTimer()
+{
+  UpdateCrossfade();
+
+  nsAutoMonitor lock(mMonitor);
+  if (mTargetState != GST_STATE_PLAYING) {
+    if (!mFadingPipeline.pipeline && mPlaybackTimer)
+      mPlaybackTimer->Cancel();
+    return;
+  }
+  lock.Exit();
+
+  nsresult rv = PrerollNextItem();
+  NS_ENSURE_SUCCESS(rv, /* void */);
+
+  rv = StartCrossfade();
+  NS_ENSURE_SUCCESS(rv, /* void */);
+}
+
 PRBool sbGStreamerMediacore::HandleSynchronousMessage(GstMessage *aMessage)
 {
   GstMessageType msg_type;
@@ -894,6 +1536,12 @@ void sbGStreamerMediacore::HandleAboutToFinishSignal()
     return;
   }
 
+  // When crossfading, the prerolled pipeline takes over instead
+  if (mCrossfadeDuration && mNextPipeline.pipeline) {
+    LOG(("Ignoring about-to-finish signal, crossfading"));
+    return;
+  }
+
   nsCOMPtr<sbIMediacoreSequencer> sequencer = mSequencer;
   mon.Exit();
 
@@ -995,6 +1643,23 @@ void sbGStreamerMediacore::HandleStateChangedMessage(GstMessage *message)
       if (newstate == GST_STATE_PLAYING) {
         mHasReachedPlaying = PR_TRUE;
         DispatchMediacoreEvent (sbIMediacoreEvent::STREAM_START);
+
+        // Tags read while prerolling belong to the stream that just started
+        if (mHasPrerolledTags) {
+          mHasPrerolledTags = PR_FALSE;
+
+          nsresult rv;
+          nsCOMPtr<nsISupports> properties =
+            do_QueryInterface(mProperties, &rv);
+          if (NS_SUCCEEDED(rv)) {
+            nsCOMPtr<nsIVariant> propVariant =
+              sbNewVariant(properties).get();
+            DispatchMediacoreEvent (sbIMediacoreEvent::METADATA_CHANGE,
+                    propVariant);
+          }
+        }
+
+        StartPlaybackTimer();
       }
       else if (newstate == GST_STATE_PAUSED)
         DispatchMediacoreEvent (sbIMediacoreEvent::STREAM_PAUSE);
@@ -1454,6 +2119,31 @@ void sbGStreamerMediacore::HandleMessage (GstMessage *message)
 
   LOG(("Got message: %s", gst_message_type_get_name(msg_type)));
 
+  // Only messages from the current pipeline are about what's playing. The
+  // prerolled pipeline's are looked at separately, and anything else comes
+  // from a pipeline that's fading out or already gone.
+  GstObject *pipeline = GetMessagePipeline(message);
+  if (pipeline) {
+    nsAutoMonitor lock(mMonitor);
+    PRBool isCurrent = pipeline == GST_OBJECT_CAST(mPipeline);
+    PRBool isNext = mNextPipeline.pipeline &&
+                    pipeline == GST_OBJECT_CAST(mNextPipeline.pipeline);
+    PRBool isFading = mFadingPipeline.pipeline &&
+                      pipeline == GST_OBJECT_CAST(mFadingPipeline.pipeline);
+    lock.Exit();
+
+    gst_object_unref (pipeline);
+
+    if (isNext) {
+      HandleNextPipelineMessage(message);
+      return;
+    }
+    if (!isCurrent) {
+      HandleOldPipelineMessage(message, isFading);
+      return;
+    }
+  }
+
   switch (msg_type) {
     case GST_MESSAGE_STATE_CHANGED:
       HandleStateChangedMessage(message);
@@ -1673,6 +2363,14 @@ sbGStreamerMediacore::OnGetCapabilities()
 /*virtual*/ nsresult
 sbGStreamerMediacore::OnShutdown()
 {
+  if (mPlaybackTimer) {
+    mPlaybackTimer->Cancel();
+    mPlaybackTimer = nsnull;
+  }
+
+  DestroySecondaryPipeline(mNextPipeline);
+  DestroySecondaryPipeline(mFadingPipeline);
+
   nsAutoMonitor lock(mMonitor);
 
   if (mPipeline) {
@@ -1840,14 +2538,42 @@ sbGStreamerMediacore::OnSetUri(nsIURI *aURI)
   nsCAutoString spec;
   nsresult rv;
 
+  rv = aURI->GetSpec(spec);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // When the sequencer moves on to the item we're fading in, that pipeline
+  // is already the current one; leave the fade to finish on its own.
+  nsAutoMonitor lock(mMonitor);
+  PRBool fadingIn = mFadingPipeline.pipeline && mPipeline &&
+                    mCurrentUri.Equals(spec);
+  lock.Exit();
+
+  if (fadingIn) {
+    LOG(("\"%s\" is already fading in", spec.get()));
+    return NS_OK;
+  }
+
+  FinishCrossfade();
+
+  // If this is the item we prerolled, it only needs to be swapped in.
+  lock.Enter();
+  PRBool prerolled = mNextPipeline.pipeline &&
+                     mNextPipeline.uri.Equals(spec);
+  lock.Exit();
+
+  if (prerolled) {
+    rv = SwapInNextPipeline();
+    NS_ENSURE_SUCCESS (rv, rv);
+    return NS_OK;
+  }
+
+  DestroySecondaryPipeline(mNextPipeline);
+
   // createplaybackpipeline will acquire the monitor.
   rv = CreatePlaybackPipeline();
   NS_ENSURE_SUCCESS (rv,rv);
 
-  nsAutoMonitor lock(mMonitor);
-
-  rv = aURI->GetSpec(spec);
-  NS_ENSURE_SUCCESS(rv, rv);
+  lock.Enter();
 
   rv = GetFileSize (aURI, &mResourceSize);
   if (rv == NS_ERROR_NO_INTERFACE) {
@@ -1958,6 +2684,9 @@ sbGStreamerMediacore::OnSeek(PRUint64 aPosition, PRUint32 aFlags)
   gboolean ret;
   GstSeekFlags flags;
 
+  // Stop fading out the previous item; the seek is within the new one.
+  FinishCrossfade();
+
   nsAutoMonitor lock(mMonitor);
 
   // Incoming position is in milliseconds, convert to GstClockTime (nanoseconds)
@@ -2042,6 +2771,10 @@ sbGStreamerMediacore::OnPlay()
 
   mTargetState = GST_STATE_PLAYING;
 
+  // The item fading in is already playing
+  if (curstate == GST_STATE_PLAYING && mFadingPipeline.pipeline)
+    return NS_OK;
+
   if (curstate == GST_STATE_PAUSED && !mBuffering) {
     // If we're already paused, then go directly to PLAYING, unless
     // we're still waiting for buffering to complete.
@@ -2099,6 +2832,8 @@ sbGStreamerMediacore::OnPause()
 {
   GstStateChangeReturn ret;
 
+  FinishCrossfade();
+
   nsAutoMonitor lock(mMonitor);
 
   NS_ENSURE_STATE(mPipeline);
@@ -2114,6 +2849,9 @@ sbGStreamerMediacore::OnPause()
 /*virtual*/ nsresult
 sbGStreamerMediacore::OnStop()
 {
+  FinishCrossfade();
+  DestroySecondaryPipeline(mNextPipeline);
+
   nsAutoMonitor lock(mMonitor);
   mTargetState = GST_STATE_NULL;
   mStopped = PR_TRUE;
@@ -2412,6 +3150,9 @@ sbGStreamerMediacore::Observe(nsISupports *aSubject,
     nsresult rv = ReadPreferences();
     NS_ENSURE_SUCCESS(rv, rv);
   }
+  else if (!strcmp(NS_TIMER_CALLBACK_TOPIC, aTopic)) {
+    OnPlaybackTimer();
+  }
 
   return NS_OK;
 }
@@ -2422,10 +3163,16 @@ sbGStreamerMediacore::Observe(nsISupports *aSubject,
 nsresult
 sbGStreamerMediacore::AddAudioFilter(GstElement *aElement)
 {
-  // Hold a reference to the element
+  // The prerolled pipeline has copies of the old set of filters
+  DestroySecondaryPipeline(mNextPipeline);
+
+  // Hold a reference to the element, once for the filter in use and once
+  // for the element as it was added
+  gst_object_ref (aElement);
   gst_object_ref (aElement);
 
   mAudioFilters.push_back(aElement);
+  mAddedAudioFilters.push_back(aElement);
 
   return NS_OK;
 }
@@ -2433,10 +3180,25 @@ sbGStreamerMediacore::AddAudioFilter(GstElement *aElement)
 nsresult
 sbGStreamerMediacore::RemoveAudioFilter(GstElement *aElement)
 {
-  mAudioFilters.erase(
-          std::remove(mAudioFilters.begin(), mAudioFilters.end(), aElement));
-
-  gst_object_unref (aElement);
+  DestroySecondaryPipeline(mNextPipeline);
+
+  // Callers may pass the element they added, or the copy in use as we do
+  // for our own filters
+  std::vector<GstElement *>::iterator it = std::find(
+          mAddedAudioFilters.begin(), mAddedAudioFilters.end(), aElement);
+  PRUint32 index = it - mAddedAudioFilters.begin();
+  if (it == mAddedAudioFilters.end()) {
+    it = std::find(mAudioFilters.begin(), mAudioFilters.end(), aElement);
+    NS_ENSURE_TRUE(it != mAudioFilters.end(), NS_ERROR_INVALID_ARG);
+    index = it - mAudioFilters.begin();
+  }
+  NS_ENSURE_TRUE(index < mAudioFilters.size() &&
+                 index < mAddedAudioFilters.size(), NS_ERROR_UNEXPECTED);
+
+  gst_object_unref (mAudioFilters[index]);
+  gst_object_unref (mAddedAudioFilters[index]);
+  mAudioFilters.erase(mAudioFilters.begin() + index);
+  mAddedAudioFilters.erase(mAddedAudioFilters.begin() + index);
 
   return NS_OK;
 }
@@ -33,6 +33,7 @@
 #include <nsIDOMXULElement.h>
 #include <nsIObserver.h>
 #include <nsIPrefBranch2.h>
+#include <nsITimer.h>
 
 #include <nsAutoPtr.h>
 #include <nsCOMPtr.h>
@@ -132,8 +133,48 @@ public:
 protected:
   virtual ~sbGStreamerMediacore();
 
+  // A playbin2 other than mPipeline: the next item prerolled ahead of time,
+  // or the previous item fading out during a crossfade. Each one has its own
+  // copies of the audio filters.
+  struct SecondaryPipeline {
+    SecondaryPipeline() :
+      pipeline(NULL),
+      audioBinGhostPad(NULL),
+      tags(NULL)
+    {
+    }
+
+    GstElement *pipeline;
+    GstGhostPad *audioBinGhostPad;
+    std::vector<GstElement*> audioFilters;
+    GstTagList *tags;
+    nsCString uri;
+    nsCOMPtr<nsIURI> itemUri;
+  };
+
   nsresult DestroyPipeline();
   nsresult CreatePlaybackPipeline();
+  nsresult ConfigurePlaybin(GstElement *aPlaybin, GstElement *aAudioSink,
+                            PRBool aAudioOnly);
+  void ConnectPlaybinSignals(GstElement *aPlaybin);
+
+  // Preroll the next item of the sequencer into mNextPipeline, if it isn't
+  // already.
+  nsresult PrerollNextItem();
+  // Make mNextPipeline the current pipeline, handing the current one to
+  // aPrevious. Must be called with mMonitor held.
+  void PromoteNextPipeline(SecondaryPipeline &aPrevious);
+  nsresult SwapInNextPipeline();
+  void DestroySecondaryPipeline(SecondaryPipeline &aPipeline);
+  void HandleNextPipelineMessage(GstMessage *message);
+  // Messages from the pipeline fading out, or from one that's already gone
+  void HandleOldPipelineMessage(GstMessage *message, PRBool aIsFading);
+
+  nsresult StartCrossfade();
+  void UpdateCrossfade();
+  void FinishCrossfade();
+  void StartPlaybackTimer();
+  void OnPlaybackTimer();
 
   void DispatchMediacoreEvent (unsigned long type,
           nsIVariant *aData = NULL, sbIMediacoreError *aError = NULL);
@@ -152,7 +193,8 @@ protected:
 
   GstElement *CreateSinkFromPrefs(const char *aSinkDescription);
   GstElement *CreateVideoSink();
-  GstElement *CreateAudioSink();
+  GstElement *CreateAudioSink(const std::vector<GstElement*> &aFilters,
+                              GstGhostPad **aGhostPad);
 
   nsresult InitPreferences();
   nsresult ReadPreferences();
@@ -193,6 +235,9 @@ protected:
   nsCOMPtr<nsIPrefBranch2> mPrefs;
 
   std::vector<GstElement*> mAudioFilters;
+  // The elements the filters were added as, in the same order. Once a
+  // prerolled pipeline is promoted mAudioFilters holds copies of them.
+  std::vector<GstElement*> mAddedAudioFilters;
 
   GstElement *mReplaygainElement;
   GstElement *mEqualizerElement;
@@ -259,6 +304,24 @@ protected:
 
   PRBool mHasVideo;          // True if we're playing video currently.
   PRBool mHasAudio;          // True if we're playing audio currently.
+
+  PRBool mPrerollEnabled;    // Whether the next item is prerolled while the
+                             // current one plays.
+  PRUint32 mCrossfadeDuration; // Crossfade length in ms, 0 when disabled.
+
+  SecondaryPipeline mNextPipeline;   // The prerolled next item, if any.
+  SecondaryPipeline mFadingPipeline; // The previous item, while fading out.
+  nsCString mPrerollFailedUri;       // Last URI that failed to preroll, so
+                                     // we don't keep trying it.
+
+  PRBool mHasPrerolledTags;  // mTags came from a prerolled pipeline and are
+                             // sent once the stream starts.
+
+  PRIntervalTime mFadeStart;
+  PRIntervalTime mFadeLength;
+
+  // Drives prerolling and crossfades while playing
+  nsCOMPtr<nsITimer> mPlaybackTimer;
 };
 
 #endif /* __SB_GSTREAMERMEDIACORE_H__ */
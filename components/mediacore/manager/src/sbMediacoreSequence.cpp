@@ -0,0 +1,372 @@
+/* vim: set sw=2 :miv */
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+#include "sbMediacoreSequence.h"
+
+#include <nsArrayEnumerator.h>
+#include <nsComponentManagerUtils.h>
+#include <nsISupportsPrimitives.h>
+
+#include <prtime.h>
+
+#include <algorithm>
+
+#define NOT_IN_SEQUENCE PR_UINT32_MAX
+
+sbMediacoreSequence::sbMediacoreSequence()
+: mOrder(eForward)
+, mLength(0)
+, mFrontPosition(0)
+, mHalfBits(0)
+, mHalfMask(0)
+{
+  for(PRUint32 i = 0; i < ROUNDS; ++i) {
+    mKeys[i] = 0;
+  }
+}
+
+void
+sbMediacoreSequence::SetForward(PRUint32 aLength)
+{
+  Clear();
+  mOrder = eForward;
+  mLength = aLength;
+}
+
+void
+sbMediacoreSequence::SetReverse(PRUint32 aLength)
+{
+  Clear();
+  mOrder = eReverse;
+  mLength = aLength;
+}
+
+void
+sbMediacoreSequence::SetShuffle(PRUint32 aLength)
+{
+  Clear();
+  mOrder = eShuffle;
+  mLength = aLength;
+
+  // The network works on an even number of bits covering every view index,
+  // so at most a quarter of its values are above the view and get walked
+  // past
+  PRUint32 bits = 0;
+  while(bits < 32 && (aLength - 1) >> bits) {
+    ++bits;
+  }
+  mHalfBits = PR_MAX((bits + 1) / 2, 1);
+  mHalfMask = (1 << mHalfBits) - 1;
+
+  // Derive the round keys from the time, splitmix style
+  static PRUint64 sCounter = 0;
+  PRUint64 state = (PRUint64)PR_Now() + (++sCounter * 0x9E3779B97F4A7C15ULL);
+  for(PRUint32 i = 0; i < ROUNDS; ++i) {
+    state += 0x9E3779B97F4A7C15ULL;
+    PRUint64 z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    mKeys[i] = (PRUint32)(z ^ (z >> 31));
+  }
+}
+
+nsresult
+sbMediacoreSequence::SetCustom(const PRUint32* aSequence, PRUint32 aLength)
+{
+  NS_ENSURE_TRUE(aSequence || !aLength, NS_ERROR_INVALID_ARG);
+
+  Clear();
+  mOrder = eCustom;
+  mLength = aLength;
+
+  mCustomOrder.assign(aSequence, aSequence + aLength);
+
+  PRUint32 maxViewIndex = 0;
+  for(PRUint32 i = 0; i < aLength; ++i) {
+    maxViewIndex = PR_MAX(maxViewIndex, aSequence[i]);
+  }
+  if(aLength) {
+    mCustomPositions.assign(maxViewIndex + 1, NOT_IN_SEQUENCE);
+  }
+
+  // Generators may repeat a view index, the last position wins as it did
+  // when this was a map
+  for(PRUint32 i = 0; i < aLength; ++i) {
+    mCustomPositions[aSequence[i]] = i;
+  }
+
+  return NS_OK;
+}
+
+void
+sbMediacoreSequence::Clear()
+{
+  mOrder = eForward;
+  mLength = 0;
+  mFrontPosition = 0;
+  mCustomOrder.clear();
+  mCustomPositions.clear();
+}
+
+PRUint32
+sbMediacoreSequence::operator[](PRUint32 aPosition) const
+{
+  NS_ASSERTION(aPosition < mLength, "Position out of range");
+
+  if(mFrontPosition) {
+    if(aPosition == 0) {
+      aPosition = mFrontPosition;
+    }
+    else if(aPosition == mFrontPosition) {
+      aPosition = 0;
+    }
+  }
+
+  return ViewIndexAt(aPosition);
+}
+
+PRBool
+sbMediacoreSequence::PositionOf(PRUint32 aViewIndex, PRUint32* aPosition) const
+{
+  NS_ENSURE_TRUE(aPosition, PR_FALSE);
+
+  PRUint32 position;
+  if(!BasePositionOf(aViewIndex, &position)) {
+    return PR_FALSE;
+  }
+
+  if(mFrontPosition) {
+    if(position == 0) {
+      position = mFrontPosition;
+    }
+    else if(position == mFrontPosition) {
+      position = 0;
+    }
+  }
+
+  *aPosition = position;
+  return PR_TRUE;
+}
+
+void
+sbMediacoreSequence::MoveToFront(PRUint32 aPosition)
+{
+  NS_ASSERTION(aPosition < mLength, "Position out of range");
+
+  if(mOrder == eCustom) {
+    std::swap(mCustomOrder[0], mCustomOrder[aPosition]);
+    mCustomPositions[mCustomOrder[0]] = 0;
+    mCustomPositions[mCustomOrder[aPosition]] = aPosition;
+    return;
+  }
+
+  NS_ASSERTION(!mFrontPosition, "Only one item can be moved to the front");
+  mFrontPosition = aPosition;
+}
+
+PRUint32
+sbMediacoreSequence::ViewIndexAt(PRUint32 aPosition) const
+{
+  switch(mOrder) {
+    case eForward:
+      return aPosition;
+
+    case eReverse:
+      return mLength - 1 - aPosition;
+
+    case eShuffle:
+    {
+      // Cycle walk: values the network maps past the view are fed back in
+      // until one lands inside it
+      PRUint32 value = aPosition;
+      do {
+        value = Encrypt(value);
+      } while(value >= mLength);
+      return value;
+    }
+
+    case eCustom:
+      return mCustomOrder[aPosition];
+  }
+
+  NS_NOTREACHED("Invalid order");
+  return 0;
+}
+
+PRBool
+sbMediacoreSequence::BasePositionOf(PRUint32 aViewIndex,
+                                    PRUint32* aPosition) const
+{
+  if(mOrder == eCustom) {
+    if(aViewIndex >= mCustomPositions.size() ||
+       mCustomPositions[aViewIndex] == NOT_IN_SEQUENCE) {
+      return PR_FALSE;
+    }
+    *aPosition = mCustomPositions[aViewIndex];
+    return PR_TRUE;
+  }
+
+  if(aViewIndex >= mLength) {
+    return PR_FALSE;
+  }
+
+  switch(mOrder) {
+    case eForward:
+      *aPosition = aViewIndex;
+    break;
+
+    case eReverse:
+      *aPosition = mLength - 1 - aViewIndex;
+    break;
+
+    case eShuffle:
+    {
+      PRUint32 value = aViewIndex;
+      do {
+        value = Decrypt(value);
+      } while(value >= mLength);
+      *aPosition = value;
+    }
+    break;
+
+    default:
+      NS_NOTREACHED("Invalid order");
+      return PR_FALSE;
+  }
+
+  return PR_TRUE;
+}
+
+PRUint32
+sbMediacoreSequence::Round(PRUint32 aValue, PRUint32 aRound) const
+{
+  PRUint32 hash = (aValue + mKeys[aRound]) * 0x9E3779B1;
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6B;
+  hash ^= hash >> 13;
+  hash *= 0xC2B2AE35;
+  hash ^= hash >> 16;
+  return hash & mHalfMask;
+}
+
+PRUint32
+sbMediacoreSequence::Encrypt(PRUint32 aValue) const
+{
+  PRUint32 left = aValue >> mHalfBits;
+  PRUint32 right = aValue & mHalfMask;
+  for(PRUint32 i = 0; i < ROUNDS; ++i) {
+    PRUint32 next = left ^ Round(right, i);
+    left = right;
+    right = next;
+  }
+  return (left << mHalfBits) | right;
+}
+
+PRUint32
+sbMediacoreSequence::Decrypt(PRUint32 aValue) const
+{
+  PRUint32 left = aValue >> mHalfBits;
+  PRUint32 right = aValue & mHalfMask;
+  for(PRUint32 i = ROUNDS; i > 0; --i) {
+    PRUint32 previous = right ^ Round(left, i - 1);
+    right = left;
+    left = previous;
+  }
+  return (left << mHalfBits) | right;
+}
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbMediacoreSequenceArray, nsIArray)
+
+sbMediacoreSequenceArray::sbMediacoreSequenceArray(
+                            const sbMediacoreSequence& aSequence)
+: mSequence(aSequence)
+{
+  MOZ_COUNT_CTOR(sbMediacoreSequenceArray);
+}
+
+sbMediacoreSequenceArray::~sbMediacoreSequenceArray()
+{
+  MOZ_COUNT_DTOR(sbMediacoreSequenceArray);
+}
+
+NS_IMETHODIMP
+sbMediacoreSequenceArray::GetLength(PRUint32 *aLength)
+{
+  NS_ENSURE_ARG_POINTER(aLength);
+  *aLength = mSequence.size();
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbMediacoreSequenceArray::QueryElementAt(PRUint32 aIndex,
+                                         const nsIID & aIID,
+                                         void **aResult)
+{
+  NS_ENSURE_ARG_POINTER(aResult);
+  NS_ENSURE_ARG(aIndex < mSequence.size());
+
+  nsresult rv;
+  nsCOMPtr<nsISupportsPRUint32> index =
+    do_CreateInstance("@mozilla.org/supports-PRUint32;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = index->SetData(mSequence[aIndex]);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return index->QueryInterface(aIID, aResult);
+}
+
+NS_IMETHODIMP
+sbMediacoreSequenceArray::IndexOf(PRUint32 aStartIndex,
+                                  nsISupports *aElement,
+                                  PRUint32 *_retval)
+{
+  NS_ENSURE_ARG_POINTER(aElement);
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+  nsCOMPtr<nsISupportsPRUint32> index = do_QueryInterface(aElement, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 viewIndex;
+  rv = index->GetData(&viewIndex);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRUint32 position;
+  if(!mSequence.PositionOf(viewIndex, &position) || position < aStartIndex) {
+    return NS_ERROR_FAILURE;
+  }
+
+  *_retval = position;
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+sbMediacoreSequenceArray::Enumerate(nsISimpleEnumerator **_retval)
+{
+  return NS_NewArrayEnumerator(_retval, this);
+}
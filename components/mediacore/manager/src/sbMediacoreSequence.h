@@ -0,0 +1,142 @@
+/* vim: set sw=2 :miv */
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+#ifndef __SB_MEDIACORESEQUENCE_H__
+#define __SB_MEDIACORESEQUENCE_H__
+
+#include <nsIArray.h>
+
+#include <nsStringGlue.h>
+
+#include <vector>
+
+/**
+ * \brief The order in which the sequencer plays the items of a view.
+ *
+ * Forward, reverse and shuffled orders are worked out from the position or
+ * view index when asked for, so building one takes no time and a few words
+ * of memory whatever the length of the view.  A shuffled order is a keyed
+ * permutation of the view indexes that can be run backwards to find the
+ * position of a view index.  Orders made by a custom generator are kept as
+ * arrays.
+ */
+class sbMediacoreSequence
+{
+public:
+  sbMediacoreSequence();
+
+  void SetForward(PRUint32 aLength);
+  void SetReverse(PRUint32 aLength);
+
+  /**
+   * \brief Shuffle aLength view indexes with a new random key.
+   */
+  void SetShuffle(PRUint32 aLength);
+
+  /**
+   * \brief Use the order made by a custom generator.
+   */
+  nsresult SetCustom(const PRUint32* aSequence, PRUint32 aLength);
+
+  void Clear();
+
+  PRUint32 size() const { return mLength; }
+  PRBool empty() const { return mLength == 0; }
+
+  /**
+   * \brief View index at aPosition, which must be below size().
+   */
+  PRUint32 operator[](PRUint32 aPosition) const;
+
+  /**
+   * \brief Find the position of aViewIndex.  Returns PR_FALSE, leaving
+   *        aPosition alone, when the view index isn't in the sequence.
+   */
+  PRBool PositionOf(PRUint32 aViewIndex, PRUint32* aPosition) const;
+
+  /**
+   * \brief Exchange the view index at aPosition with the first one.
+   */
+  void MoveToFront(PRUint32 aPosition);
+
+private:
+  enum Order {
+    eForward,
+    eReverse,
+    eShuffle,
+    eCustom
+  };
+
+  // Feistel network over 2 * mHalfBits bits, its inverse, and the round
+  // function
+  PRUint32 Encrypt(PRUint32 aValue) const;
+  PRUint32 Decrypt(PRUint32 aValue) const;
+  PRUint32 Round(PRUint32 aValue, PRUint32 aRound) const;
+
+  // Position to view index and back before MoveToFront is applied
+  PRUint32 ViewIndexAt(PRUint32 aPosition) const;
+  PRBool BasePositionOf(PRUint32 aViewIndex, PRUint32* aPosition) const;
+
+  static const PRUint32 ROUNDS = 4;
+
+  Order mOrder;
+  PRUint32 mLength;
+
+  // Position swapped with the first one, 0 when there is none
+  PRUint32 mFrontPosition;
+
+  // eShuffle
+  PRUint32 mHalfBits;
+  PRUint32 mHalfMask;
+  PRUint32 mKeys[ROUNDS];
+
+  // eCustom, the view index at each position and the position of each view
+  // index, or NOT_IN_SEQUENCE
+  std::vector<PRUint32> mCustomOrder;
+  std::vector<PRUint32> mCustomPositions;
+};
+
+/**
+ * \brief Read only nsIArray of nsISupportsPRUint32 over a copy of a
+ *        sequence, so handing out the current sequence doesn't create an
+ *        object per item up front.
+ */
+class sbMediacoreSequenceArray : public nsIArray
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_NSIARRAY
+
+  sbMediacoreSequenceArray(const sbMediacoreSequence& aSequence);
+
+private:
+  ~sbMediacoreSequenceArray();
+
+  const sbMediacoreSequence mSequence;
+};
+
+#endif /* __SB_MEDIACORESEQUENCE_H__ */
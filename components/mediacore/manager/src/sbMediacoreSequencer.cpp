@@ -85,7 +85,6 @@
 #include <sbVariantUtils.h>
 
 #include "sbMediacoreDataRemotes.h"
-#include "sbMediacoreShuffleSequenceGenerator.h"
 
 // Time in ms between dataremote updates
 #define MEDIACORE_UPDATE_NOTIFICATION_DELAY 500
@@ -248,16 +247,6 @@ sbMediacoreSequencer::Init()
   rv = BindDataRemotes();
   NS_ENSURE_SUCCESS(rv, rv);
 
-  nsRefPtr<sbMediacoreShuffleSequenceGenerator> generator;
-  NS_NEWXPCOM(generator, sbMediacoreShuffleSequenceGenerator);
-  NS_ENSURE_TRUE(generator, NS_ERROR_OUT_OF_MEMORY);
-
-  rv = generator->Init();
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  mShuffleGenerator = do_QueryInterface(generator, &rv);
-  NS_ENSURE_SUCCESS(rv, rv);
-
   PRBool shuffle = PR_FALSE;
   rv = mDataRemotePlaylistShuffle->GetBoolValue(&shuffle);
   NS_ENSURE_SUCCESS(rv, rv);
@@ -1431,15 +1420,13 @@ sbMediacoreSequencer::RecalculateSequence(PRInt64 *aViewPosition /*= nsnull*/)
     return NS_OK;
   }
 
-  mSequence.clear();
-  mViewIndexToSequenceIndex.clear();
+  mSequence.Clear();
 
   PRUint32 length = 0;
   nsresult rv = mView->GetLength(&length);
   NS_ENSURE_SUCCESS(rv, rv);
 
   mPosition = 0;
-  mSequence.reserve(length);
 
   // ensure view position is inside the bounds of the view.
   if(aViewPosition &&
@@ -1448,68 +1435,29 @@ sbMediacoreSequencer::RecalculateSequence(PRInt64 *aViewPosition /*= nsnull*/)
     *aViewPosition = 0;
   }
 
+  PRBool const hasViewPosition =
+    aViewPosition && *aViewPosition != sbIMediacoreSequencer::AUTO_PICK_INDEX;
+
+  // Forward, reverse and shuffle sequences are computed as they are read, so
+  // setting them up doesn't depend on the length of the view
   switch(mMode) {
     case sbIMediacoreSequencer::MODE_FORWARD:
-    {
-      // Generate forward sequence
-      for(PRUint32 i = 0; i < length; ++i) {
-        mSequence.push_back(i);
-        mViewIndexToSequenceIndex[i] = i;
-      }
-
-      if(aViewPosition &&
-         *aViewPosition != sbIMediacoreSequencer::AUTO_PICK_INDEX) {
-        mPosition = (PRUint32)(*aViewPosition);
-      }
-    }
+      mSequence.SetForward(length);
     break;
     case sbIMediacoreSequencer::MODE_REVERSE:
-    {
-      // Generate reverse sequence
-      PRUint32 j = 0;
-      for(PRUint32 i = length - 1; i >= 0; --i, ++j) {
-        mSequence.push_back(i);
-        mViewIndexToSequenceIndex[j] = j;
-      }
-
-      if(aViewPosition &&
-         *aViewPosition != sbIMediacoreSequencer::AUTO_PICK_INDEX) {
-        mPosition = (PRUint32)(length - *aViewPosition);
-      }
-    }
+      mSequence.SetReverse(length);
     break;
     case sbIMediacoreSequencer::MODE_SHUFFLE:
     {
-      NS_ENSURE_TRUE(mShuffleGenerator, NS_ERROR_UNEXPECTED);
-
-      PRUint32 sequenceLength = 0;
-      PRUint32 *sequence = nsnull;
-
-      rv = mShuffleGenerator->OnGenerateSequence(mView,
-                                                 &sequenceLength,
-                                                 &sequence);
-      NS_ENSURE_SUCCESS(rv, rv);
-
-      for(PRUint32 i = 0; i < sequenceLength; ++i) {
-        mSequence.push_back(sequence[i]);
-        mViewIndexToSequenceIndex[sequence[i]] = i;
-
-        if(aViewPosition &&
-           *aViewPosition != sbIMediacoreSequencer::AUTO_PICK_INDEX &&
-           *aViewPosition == sequence[i]) {
-          // Swap the first position item with the item that was selected by the
-          // user to play first.
-          PRUint32 viewIndex = mSequence[0];
-          mSequence[0] = mSequence[i];
-          mSequence[i] = viewIndex;
-
-          PRUint32 sequenceIndex = mViewIndexToSequenceIndex[viewIndex];
-          mViewIndexToSequenceIndex[viewIndex] = mViewIndexToSequenceIndex[mSequence[0]];
-          mViewIndexToSequenceIndex[mSequence[0]] = sequenceIndex;
-        }
+      mSequence.SetShuffle(length);
+
+      // Swap the first position item with the item that was selected by the
+      // user to play first.
+      PRUint32 position;
+      if(hasViewPosition &&
+         mSequence.PositionOf((PRUint32)(*aViewPosition), &position)) {
+        mSequence.MoveToFront(position);
       }
-
-      NS_Free(sequence);
     }
     break;
     case sbIMediacoreSequencer::MODE_CUSTOM:
@@ -1524,23 +1472,18 @@ sbMediacoreSequencer::RecalculateSequence(PRInt64 *aViewPosition /*= nsnull*/)
                                                 &sequence);
       NS_ENSURE_SUCCESS(rv, rv);
 
-      for(PRUint32 i = 0; i < sequenceLength; ++i) {
-        mSequence.push_back(sequence[i]);
-        mViewIndexToSequenceIndex[sequence[i]] = i;
-
-        if(aViewPosition &&
-           *aViewPosition != sbIMediacoreSequencer::AUTO_PICK_INDEX &&
-           *aViewPosition == sequence[i]) {
-          // Match the sequence position to the item that is selected
-          mPosition = i;
-        }
-      }
-
+      rv = mSequence.SetCustom(sequence, sequenceLength);
       NS_Free(sequence);
+      NS_ENSURE_SUCCESS(rv, rv);
     }
     break;
   }
 
+  // Match the sequence position to the item that is selected
+  if(hasViewPosition && mMode != sbIMediacoreSequencer::MODE_SHUFFLE) {
+    mSequence.PositionOf((PRUint32)(*aViewPosition), &mPosition);
+  }
+
   if(mSequence.size()) {
     mViewPosition = mSequence[mPosition];
   }
@@ -1571,7 +1514,7 @@ sbMediacoreSequencer::RecalculateSequence(PRInt64 *aViewPosition /*= nsnull*/)
 }
 
 nsresult
-sbMediacoreSequencer::GetItem(const sequence_t &aSequence,
+sbMediacoreSequencer::GetItem(const sbMediacoreSequence &aSequence,
                               PRUint32 aPosition,
                               sbIMediaItem **aItem)
 {
@@ -2045,10 +1988,9 @@ sbMediacoreSequencer::SetViewWithViewPosition(sbIMediaListView *aView,
   else if(aViewPosition &&
           *aViewPosition >= 0 &&
           mViewPosition != *aViewPosition &&
-          mViewIndexToSequenceIndex.size() > *aViewPosition) {
+          mSequence.PositionOf((PRUint32)(*aViewPosition), &mPosition)) {
     // We check to see if the view position is different than the current view
     // position before setting the new view position.
-    mPosition = mViewIndexToSequenceIndex[(PRUint32)(*aViewPosition)];
     mViewPosition = mSequence[mPosition];
   }
 
@@ -2665,23 +2607,11 @@ sbMediacoreSequencer::GetCurrentSequence(nsIArray * *aCurrentSequence)
   NS_ENSURE_TRUE(mMonitor, NS_ERROR_NOT_INITIALIZED);
   NS_ENSURE_ARG_POINTER(aCurrentSequence);
 
-  nsresult rv = NS_ERROR_UNEXPECTED;
-  nsCOMPtr<nsIMutableArray> array =
-    do_CreateInstance("@songbirdnest.com/moz/xpcom/threadsafe-array;1", &rv);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  sequence_t::const_iterator it = mSequence.begin();
-  for(; it != mSequence.end(); ++it) {
-    nsCOMPtr<nsISupportsPRUint32> index =
-      do_CreateInstance("@mozilla.org/supports-PRUint32;1", &rv);
-    NS_ENSURE_SUCCESS(rv, rv);
-
-    rv = index->SetData((*it));
-    NS_ENSURE_SUCCESS(rv, rv);
+  nsAutoMonitor mon(mMonitor);
 
-    rv = array->AppendElement(index, PR_FALSE);
-    NS_ENSURE_SUCCESS(rv, rv);
-  }
+  // The array reads its elements from a copy of the sequence when asked
+  nsCOMPtr<nsIArray> array = new sbMediacoreSequenceArray(mSequence);
+  NS_ENSURE_TRUE(array, NS_ERROR_OUT_OF_MEMORY);
 
   NS_ADDREF(*aCurrentSequence = array);
 
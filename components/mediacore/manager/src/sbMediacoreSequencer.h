@@ -49,8 +49,7 @@
 #include <sbIPropertyManager.h>
 #include <sbIMediaItemController.h>
 
-#include <vector>
-#include <map>
+#include "sbMediacoreSequence.h"
 
 class nsAutoMonitor;
 
@@ -77,9 +76,6 @@ public:
 
   sbMediacoreSequencer();
 
-  typedef std::vector<PRUint32> sequence_t;
-  typedef std::map<PRUint32, PRUint32> sequencemap_t;
-
   nsresult Init();
 
   // Sequence Processor (timer driven)
@@ -125,7 +121,7 @@ public:
   nsresult RecalculateSequence(PRInt64 *aViewPosition = nsnull);
 
   // Fetching of items, item manipulation.
-  nsresult GetItem(const sequence_t &aSequence,
+  nsresult GetItem(const sbMediacoreSequence &aSequence,
                    PRUint32 aPosition,
                    sbIMediaItem **aItem);
 
@@ -215,13 +211,11 @@ protected:
   PRUint32                       mRepeatMode;
 
   nsCOMPtr<sbIMediaListView>     mView;
-  sequence_t                     mSequence;
-  sequencemap_t                  mViewIndexToSequenceIndex;
+  sbMediacoreSequence            mSequence;
   PRUint32                       mPosition;
   PRUint32                       mViewPosition;
 
   nsCOMPtr<sbIMediacoreSequenceGenerator> mCustomGenerator;
-  nsCOMPtr<sbIMediacoreSequenceGenerator> mShuffleGenerator;
 
   nsCOMPtr<nsIWeakReference> mMediacoreManager;
 
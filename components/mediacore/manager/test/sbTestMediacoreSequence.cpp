@@ -0,0 +1,200 @@
+/* vim: set sw=2 :miv */
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+#include "sbTestMediacoreSequence.h"
+
+#include <sbMediacoreSequence.h>
+
+#include <nsMemory.h>
+
+#include <vector>
+
+// Lengths around the edges of the shuffle network: empty, tiny, odd, and
+// either side of powers of two where the network gains a bit
+static const PRUint32 sLengths[] = {
+  0, 1, 2, 3, 7, 15, 16, 17, 255, 256, 257, 1023, 1024, 1025, 65537
+};
+
+// Each shuffle uses new keys, try a few of them
+static const PRUint32 SHUFFLE_TRIES = 4;
+
+NS_IMPL_ISUPPORTS1(sbTestMediacoreSequence, nsIRunnable)
+
+/* void run (); */
+NS_IMETHODIMP
+sbTestMediacoreSequence::Run()
+{
+  nsresult rv;
+
+  for(PRUint32 i = 0; i < NS_ARRAY_LENGTH(sLengths); ++i) {
+    PRUint32 const length = sLengths[i];
+
+    // Positions to move to the front, the duplicates don't matter
+    PRUint32 positions[] = { 0, 1, length / 2, length - 1 };
+
+    sbMediacoreSequence sequence;
+
+    sequence.SetForward(length);
+    rv = CheckBijection(sequence, length);
+    NS_ENSURE_SUCCESS(rv, rv);
+    for(PRUint32 position = 0; position < length; ++position) {
+      NS_ENSURE_TRUE(sequence[position] == position, NS_ERROR_FAILURE);
+    }
+
+    sequence.SetReverse(length);
+    rv = CheckBijection(sequence, length);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    for(PRUint32 j = 0; j < NS_ARRAY_LENGTH(positions); ++j) {
+      if(positions[j] >= length) {
+        continue;
+      }
+
+      rv = CheckReverseStart(length, positions[j]);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+
+    for(PRUint32 tries = 0; tries < SHUFFLE_TRIES; ++tries) {
+      sequence.SetShuffle(length);
+      rv = CheckBijection(sequence, length);
+      NS_ENSURE_SUCCESS(rv, rv);
+
+      for(PRUint32 j = 0; j < NS_ARRAY_LENGTH(positions); ++j) {
+        if(positions[j] >= length) {
+          continue;
+        }
+
+        rv = CheckMoveToFront(sequence, positions[j]);
+        NS_ENSURE_SUCCESS(rv, rv);
+      }
+    }
+
+    // A custom order, here every other view index then the rest
+    std::vector<PRUint32> custom;
+    for(PRUint32 viewIndex = 0; viewIndex < length; viewIndex += 2) {
+      custom.push_back(viewIndex);
+    }
+    for(PRUint32 viewIndex = 1; viewIndex < length; viewIndex += 2) {
+      custom.push_back(viewIndex);
+    }
+
+    rv = sequence.SetCustom(length ? &custom[0] : nsnull, length);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rv = CheckBijection(sequence, length);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    for(PRUint32 j = 0; j < NS_ARRAY_LENGTH(positions); ++j) {
+      if(positions[j] >= length) {
+        continue;
+      }
+
+      rv = CheckMoveToFront(sequence, positions[j]);
+      NS_ENSURE_SUCCESS(rv, rv);
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbTestMediacoreSequence::CheckBijection(const sbMediacoreSequence& aSequence,
+                                        PRUint32 aLength)
+{
+  NS_ENSURE_TRUE(aSequence.size() == aLength, NS_ERROR_FAILURE);
+  NS_ENSURE_TRUE(aSequence.empty() == !aLength, NS_ERROR_FAILURE);
+
+  // aLength distinct view indexes all below aLength cover [0, aLength)
+  std::vector<PRBool> seen(aLength, PR_FALSE);
+  for(PRUint32 position = 0; position < aLength; ++position) {
+    PRUint32 const viewIndex = aSequence[position];
+    NS_ENSURE_TRUE(viewIndex < aLength, NS_ERROR_FAILURE);
+    NS_ENSURE_TRUE(!seen[viewIndex], NS_ERROR_FAILURE);
+    seen[viewIndex] = PR_TRUE;
+
+    PRUint32 found = PR_UINT32_MAX;
+    NS_ENSURE_TRUE(aSequence.PositionOf(viewIndex, &found), NS_ERROR_FAILURE);
+    NS_ENSURE_TRUE(found == position, NS_ERROR_FAILURE);
+  }
+
+  // View indexes past the end aren't in the sequence
+  PRUint32 found = PR_UINT32_MAX;
+  NS_ENSURE_FALSE(aSequence.PositionOf(aLength, &found), NS_ERROR_FAILURE);
+  NS_ENSURE_TRUE(found == PR_UINT32_MAX, NS_ERROR_FAILURE);
+
+  return NS_OK;
+}
+
+nsresult
+sbTestMediacoreSequence::CheckMoveToFront(const sbMediacoreSequence& aSequence,
+                                          PRUint32 aPosition)
+{
+  PRUint32 const length = aSequence.size();
+
+  std::vector<PRUint32> before(length);
+  for(PRUint32 position = 0; position < length; ++position) {
+    before[position] = aSequence[position];
+  }
+
+  // What the sequencer does to play a picked item first in shuffle mode
+  sbMediacoreSequence moved(aSequence);
+  moved.MoveToFront(aPosition);
+
+  nsresult rv = CheckBijection(moved, length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  NS_ENSURE_TRUE(moved[0] == before[aPosition], NS_ERROR_FAILURE);
+  NS_ENSURE_TRUE(moved[aPosition] == before[0], NS_ERROR_FAILURE);
+  for(PRUint32 position = 1; position < length; ++position) {
+    if(position != aPosition) {
+      NS_ENSURE_TRUE(moved[position] == before[position], NS_ERROR_FAILURE);
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbTestMediacoreSequence::CheckReverseStart(PRUint32 aLength,
+                                           PRUint32 aViewIndex)
+{
+  sbMediacoreSequence sequence;
+  sequence.SetReverse(aLength);
+
+  // The sequencer starts playing at the position of the requested item
+  PRUint32 start;
+  NS_ENSURE_TRUE(sequence.PositionOf(aViewIndex, &start), NS_ERROR_FAILURE);
+  NS_ENSURE_TRUE(sequence[start] == aViewIndex, NS_ERROR_FAILURE);
+
+  // and goes down to the first item of the view from there
+  NS_ENSURE_TRUE(start + aViewIndex + 1 == aLength, NS_ERROR_FAILURE);
+  for(PRUint32 position = start; position < aLength; ++position) {
+    NS_ENSURE_TRUE(sequence[position] == aViewIndex - (position - start),
+                   NS_ERROR_FAILURE);
+  }
+
+  return NS_OK;
+}
@@ -0,0 +1,74 @@
+/* vim: set sw=2 :miv */
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+#ifndef sbTestMediacoreSequence_h
+#define sbTestMediacoreSequence_h
+
+#include <nsIRunnable.h>
+
+class sbMediacoreSequence;
+
+/*
+ * Runs the checks of sbMediacoreSequence, run() fails when one of them does
+ */
+class sbTestMediacoreSequence : public nsIRunnable
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_NSIRUNNABLE
+
+private:
+  // Every position maps to a distinct view index below aLength, and
+  // PositionOf maps each of them back
+  nsresult CheckBijection(const sbMediacoreSequence& aSequence,
+                          PRUint32 aLength);
+
+  // MoveToFront(aPosition) on a copy of aSequence swaps exactly the first
+  // position with aPosition
+  nsresult CheckMoveToFront(const sbMediacoreSequence& aSequence,
+                            PRUint32 aPosition);
+
+  // Playing in reverse from aViewIndex goes down from it
+  nsresult CheckReverseStart(PRUint32 aLength, PRUint32 aViewIndex);
+};
+
+#define SB_TEST_MEDIACORE_SEQUENCE_DESCRIPTION                   \
+  "Songbird Test Mediacore Sequence"
+#define SB_TEST_MEDIACORE_SEQUENCE_CONTRACTID                    \
+  "@songbirdnest.com/mediacore/sbTestMediacoreSequence;1"
+#define SB_TEST_MEDIACORE_SEQUENCE_CLASSNAME                     \
+  "sbTestMediacoreSequence"
+
+#define SB_TEST_MEDIACORE_SEQUENCE_CID                     \
+{ /* 34169770-c2d1-4664-a0ad-dc018fa1fc43 */               \
+  0x34169770,                                              \
+  0xc2d1,                                                  \
+  0x4664,                                                  \
+  { 0xa0, 0xad, 0xdc, 0x01, 0x8f, 0xa1, 0xfc, 0x43 }       \
+}
+
+#endif
@@ -35,6 +35,12 @@
 #include <nscore.h>
 #include <nsThreadUtils.h>
 #include <nsComponentManagerUtils.h>
+#include <nsServiceManagerUtils.h>
+#include <nsIFile.h>
+#include <nsIFileProtocolHandler.h>
+#include <nsIIOService.h>
+#include <nsILocalFile.h>
+#include <nsIProtocolHandler.h>
 
 #include "sbBackgroundThreadMetadataProcessor.h"
 #include "sbFileMetadataService.h"
@@ -53,6 +59,16 @@ extern PRLogModuleInfo* gMetadataLog;
 #define LOG(args)   /* nothing */
 #endif
 
+// How often to check whether a blocked job item can proceed
+#define BLOCKED_ITEM_POLL_INTERVAL  20
+
+// How much of the beginning and of the end of a file to read ahead of the
+// handler.  ID3v2, FLAC, Ogg and most MP4 tags are at the beginning, ID3v1
+// and APE tags at the end.
+#define PREFETCH_HEAD_SIZE          (256 * 1024)
+#define PREFETCH_TAIL_SIZE          (64 * 1024)
+#define PREFETCH_BUFFER_SIZE        (64 * 1024)
+
 // GLOBALS ====================================================================
 // CLASSES ====================================================================
 
@@ -97,6 +113,22 @@ nsresult sbBackgroundThreadMetadataProcessor::Start()
     NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
   }
 
+  // The file protocol handler must be obtained on the main thread
+  if (!mFileProtocolHandler) {
+    nsCOMPtr<nsIIOService> ioService =
+      do_GetService("@mozilla.org/network/io-service;1", &rv);
+    if (NS_SUCCEEDED(rv)) {
+      nsCOMPtr<nsIProtocolHandler> fileHandler;
+      rv = ioService->GetProtocolHandler("file", getter_AddRefs(fileHandler));
+      if (NS_SUCCEEDED(rv)) {
+        mFileProtocolHandler = do_QueryInterface(fileHandler, &rv);
+      }
+    }
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "sbBackgroundThreadMetadataProcessor::Start unable to get the file "
+      "protocol handler, files will not be prefetched");
+  }
+
   nsAutoMonitor monitor(mMonitor);
 
   if (!mThread) {
@@ -229,8 +261,13 @@ NS_IMETHODIMP sbBackgroundThreadMetadataProcessor::Run()
           break;
       }
 
-      // Wait a bit and check again.
-      PR_Sleep(PR_MillisecondsToInterval(20));
+      // Wait a bit and check again, unless we are asked to stop.
+      nsAutoMonitor monitor(mMonitor);
+      if (mShouldShutdown) {
+        skipItem = PR_TRUE;
+        break;
+      }
+      monitor.Wait(PR_MillisecondsToInterval(BLOCKED_ITEM_POLL_INTERVAL));
     }
     if (skipItem)
       continue;
@@ -243,6 +280,18 @@ NS_IMETHODIMP sbBackgroundThreadMetadataProcessor::Run()
         continue;
     }
 
+    // Keep too many processors from working on the same device at once.
+    // On failure, just go ahead.
+    nsCString device;
+    rv = mJobManager->AcquireDeviceSlot(item, device);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "sbBackgroundThreadMetadataProcessor::Run unable to acquire a slot "
+      "for the device of the job item.");
+
+    rv = PrefetchFile(item);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+      "sbBackgroundThreadMetadataProcessor::Run unable to prefetch file.");
+
     PRBool async = PR_FALSE;
     PRInt32 operationRetVal;
     if (jobType == sbMetadataJob::TYPE_WRITE) {
@@ -311,6 +360,8 @@ NS_IMETHODIMP sbBackgroundThreadMetadataProcessor::Run()
 
       TRACE(("sbBackgroundThreadMetadataProcessor - item processed"));
     }
+
+    mJobManager->ReleaseDeviceSlot(device);
     
     // And finally give back the item
     mJobManager->PutProcessedJobItem(item);
@@ -320,3 +371,61 @@ NS_IMETHODIMP sbBackgroundThreadMetadataProcessor::Run()
   return NS_OK;
 }
 
+nsresult
+sbBackgroundThreadMetadataProcessor::PrefetchFile(sbMetadataJobItem* aJobItem)
+{
+  NS_ENSURE_ARG_POINTER(aJobItem);
+  nsresult rv;
+
+  if (!mFileProtocolHandler)
+    return NS_OK;
+
+  nsCString url;
+  rv = aJobItem->GetURL(url);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Only local files are read ahead
+  if (!StringBeginsWith(url, NS_LITERAL_CSTRING("file:")))
+    return NS_OK;
+
+  nsCOMPtr<nsIFile> file;
+  rv = mFileProtocolHandler->GetFileFromURLSpec(url, getter_AddRefs(file));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsILocalFile> localFile = do_QueryInterface(file, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  PRFileDesc* fd;
+  rv = localFile->OpenNSPRFileDesc(PR_RDONLY, 0, &fd);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoArrayPtr<char> buffer(new char[PREFETCH_BUFFER_SIZE]);
+  if (!buffer) {
+    PR_Close(fd);
+    return NS_ERROR_OUT_OF_MEMORY;
+  }
+
+  // The data is thrown away, we only want it in the OS cache
+  PRInt32 headRead = 0;
+  while (headRead < PREFETCH_HEAD_SIZE && !mShouldShutdown) {
+    PRInt32 count = PR_Read(fd, buffer, PREFETCH_BUFFER_SIZE);
+    if (count <= 0)
+      break;
+    headRead += count;
+  }
+
+  PRInt64 size = PR_Available64(fd) + headRead;
+  if (size > PREFETCH_HEAD_SIZE + PREFETCH_TAIL_SIZE &&
+      PR_Seek64(fd, size - PREFETCH_TAIL_SIZE, PR_SEEK_SET) != -1) {
+    PRInt32 tailRead = 0;
+    while (tailRead < PREFETCH_TAIL_SIZE && !mShouldShutdown) {
+      PRInt32 count = PR_Read(fd, buffer, PREFETCH_BUFFER_SIZE);
+      if (count <= 0)
+        break;
+      tailRead += count;
+    }
+  }
+
+  PR_Close(fd);
+  return NS_OK;
+}
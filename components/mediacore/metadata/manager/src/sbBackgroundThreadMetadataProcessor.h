@@ -43,6 +43,7 @@
 
 // CLASSES ====================================================================
 
+class nsIFileProtocolHandler;
 class sbFileMetadataService;
 class sbMetadataJobItem;
 
@@ -50,6 +51,11 @@ class sbMetadataJobItem;
  * \class sbBackgroundThreadMetadataProcessor
  * Used by sbFileMetadataService to process sbMetadataJobItem handlers
  * on a background thread.
+ *
+ * sbFileMetadataService runs several of these at once.  Handlers may
+ * serialize their own work (TagLib is not thread safe), so before running a
+ * handler each processor reads the parts of the file that hold its tags,
+ * letting the file I/O of several items overlap.
  */
 class sbBackgroundThreadMetadataProcessor : public nsIRunnable
 {
@@ -75,12 +81,21 @@ public:
   nsresult Stop();
 
 protected:
+
+  /**
+   * Read the beginning and the end of the local file of aJobItem, where
+   * tags are kept, so that the handler finds them in the OS cache.
+   */
+  nsresult PrefetchFile(sbMetadataJobItem* aJobItem);
   
   // The job manager that owns this processor
   nsRefPtr<sbFileMetadataService>         mJobManager;
   
   // Thread to call nsIRunnable.Run()  
   nsCOMPtr<nsIThread>                     mThread;
+
+  // Used to find the local file of a job item
+  nsCOMPtr<nsIFileProtocolHandler>        mFileProtocolHandler;
     
   // Flag to indicate that the thread should stop processing
   PRBool                                  mShouldShutdown;
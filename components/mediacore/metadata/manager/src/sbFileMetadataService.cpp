@@ -74,6 +74,15 @@ extern PRLogModuleInfo* gMetadataLog;
 // Controls how often we send sbIJobProgress notifications
 #define TIMER_PERIOD  33
 
+// Number of background processors, defaults to the number of cores
+#define PREF_BACKGROUND_THREAD_COUNT "songbird.metadata.backgroundThreadCount"
+#define MAX_BACKGROUND_THREAD_COUNT  8
+
+// How many background processors may work on files from the same device at
+// once, 0 for no limit
+#define PREF_MAX_THREADS_PER_DEVICE    "songbird.metadata.maxThreadsPerDevice"
+#define DEFAULT_MAX_THREADS_PER_DEVICE 2
+
 // GLOBALS ====================================================================
 
 // CLASSES ====================================================================
@@ -84,6 +93,9 @@ NS_IMPL_THREADSAFE_ISUPPORTS3( sbFileMetadataService, \
 
 sbFileMetadataService::sbFileMetadataService() : 
   mMainThreadProcessor(nsnull),
+  mBackgroundThreadCount(0),
+  mMaxThreadsPerDevice(DEFAULT_MAX_THREADS_PER_DEVICE),
+  mDeviceMonitor(nsnull),
   mInitialized(PR_FALSE),
   mRunning(PR_FALSE),
   mNotificationTimer(nsnull),
@@ -102,6 +114,9 @@ sbFileMetadataService::~sbFileMetadataService()
   if (mJobLock) {
     nsAutoLock::DestroyLock(mJobLock); 
   }
+  if (mDeviceMonitor) {
+    nsAutoMonitor::DestroyMonitor(mDeviceMonitor);
+  }
 }
 
 nsresult sbFileMetadataService::Init()
@@ -117,6 +132,13 @@ nsresult sbFileMetadataService::Init()
       "sbFileMetadataService job items lock");
   NS_ENSURE_TRUE(mJobLock, NS_ERROR_OUT_OF_MEMORY);
 
+  mDeviceMonitor = nsAutoMonitor::NewMonitor(
+      "sbFileMetadataService device slots monitor");
+  NS_ENSURE_TRUE(mDeviceMonitor, NS_ERROR_OUT_OF_MEMORY);
+
+  PRBool success = mDeviceThreadCounts.Init();
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
   // Get the mediacore manager.
   mMediacoreManager = do_GetService(SB_MEDIACOREMANAGER_CONTRACTID, &rv);
   NS_ENSURE_SUCCESS(rv, rv);
@@ -157,14 +179,14 @@ nsresult sbFileMetadataService::Shutdown()
   }
 
   // Must not lock mJobLock before calling stop, as
-  // the background thread may be in the middle of something
+  // the background threads may be in the middle of something
   // that will involve mJobLock
-  if (mBackgroundThreadProcessor) {
-    rv = mBackgroundThreadProcessor->Stop();
+  for (PRUint32 i = 0; i < mBackgroundThreadProcessors.Length(); i++) {
+    rv = mBackgroundThreadProcessors[i]->Stop();
     NS_ASSERTION(NS_SUCCEEDED(rv), 
       "Failed to stop background thread metadata processor");
-    mBackgroundThreadProcessor = nsnull;
   }
+  mBackgroundThreadProcessors.Clear();
 
   nsAutoLock lock(mJobLock);
 
@@ -260,7 +282,7 @@ sbFileMetadataService::ProxiedRestartProcessors(PRUint16 aProcessorsToRestart)
   }
   else {
     NS_ENSURE_STATE(mMainThreadProcessor);
-    NS_ENSURE_STATE(mBackgroundThreadProcessor);
+    NS_ENSURE_STATE(mBackgroundThreadProcessors.Length());
 
     if (aProcessorsToRestart & sbIFileMetadataService::MAIN_THREAD_PROCESSOR) {
       rv = mMainThreadProcessor->Start();
@@ -268,11 +290,13 @@ sbFileMetadataService::ProxiedRestartProcessors(PRUint16 aProcessorsToRestart)
     }
 
     if (aProcessorsToRestart & sbIFileMetadataService::BACKGROUND_THREAD_PROCESSOR) {
-      nsCOMPtr<nsIRunnable> event =
-        NS_NEW_RUNNABLE_METHOD(sbBackgroundThreadMetadataProcessor,
-                               mBackgroundThreadProcessor.get(),
-                               Start);
-      NS_DispatchToCurrentThread(event);
+      for (PRUint32 i = 0; i < mBackgroundThreadProcessors.Length(); i++) {
+        nsCOMPtr<nsIRunnable> event =
+          NS_NEW_RUNNABLE_METHOD(sbBackgroundThreadMetadataProcessor,
+                                 mBackgroundThreadProcessors[i].get(),
+                                 Start);
+        NS_DispatchToCurrentThread(event);
+      }
     }
   }
 
@@ -402,13 +426,9 @@ sbFileMetadataService::StartJob(nsIArray* aMediaItemsArray,
   rv = mMainThreadProcessor->Start();
   NS_ENSURE_SUCCESS(rv, rv);
 
-  // Start background thread metadata processor
+  // Start background thread metadata processors
   // (will continue if already started)
-  if (!mBackgroundThreadProcessor) {
-    mBackgroundThreadProcessor = new sbBackgroundThreadMetadataProcessor(this);
-  }
-  NS_ENSURE_TRUE(mBackgroundThreadProcessor, NS_ERROR_OUT_OF_MEMORY);  
-  rv = mBackgroundThreadProcessor->Start();
+  rv = StartBackgroundThreadProcessors();
   NS_ENSURE_SUCCESS(rv, rv);
 
   rv = CallQueryInterface(job.get(), _retval);
@@ -418,6 +438,54 @@ sbFileMetadataService::StartJob(nsIArray* aMediaItemsArray,
 }
 
 
+nsresult sbFileMetadataService::StartBackgroundThreadProcessors()
+{
+  TRACE(("%s[%.8x]", __FUNCTION__, this));
+  NS_ASSERTION(NS_IsMainThread(), 
+    "sbFileMetadataService::StartBackgroundThreadProcessors is main thread only!");
+  nsresult rv;
+
+  if (!mBackgroundThreadCount) {
+    mBackgroundThreadCount = PR_GetNumberOfProcessors();
+
+    nsCOMPtr<nsIPrefBranch> prefService =
+      do_GetService("@mozilla.org/preferences-service;1", &rv);
+    if (NS_SUCCEEDED(rv)) {
+      PRInt32 value;
+      rv = prefService->GetIntPref(PREF_BACKGROUND_THREAD_COUNT, &value);
+      if (NS_SUCCEEDED(rv)) {
+        mBackgroundThreadCount = value;
+      }
+      rv = prefService->GetIntPref(PREF_MAX_THREADS_PER_DEVICE, &value);
+      if (NS_SUCCEEDED(rv) && value >= 0) {
+        mMaxThreadsPerDevice = value;
+      }
+    }
+
+    if ((PRInt32)mBackgroundThreadCount < 1) {
+      mBackgroundThreadCount = 1;
+    } else if (mBackgroundThreadCount > MAX_BACKGROUND_THREAD_COUNT) {
+      mBackgroundThreadCount = MAX_BACKGROUND_THREAD_COUNT;
+    }
+  }
+
+  while (mBackgroundThreadProcessors.Length() < mBackgroundThreadCount) {
+    nsRefPtr<sbBackgroundThreadMetadataProcessor> processor =
+      new sbBackgroundThreadMetadataProcessor(this);
+    NS_ENSURE_TRUE(processor, NS_ERROR_OUT_OF_MEMORY);
+    NS_ENSURE_TRUE(mBackgroundThreadProcessors.AppendElement(processor),
+                   NS_ERROR_OUT_OF_MEMORY);
+  }
+
+  for (PRUint32 i = 0; i < mBackgroundThreadProcessors.Length(); i++) {
+    rv = mBackgroundThreadProcessors[i]->Start();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+
 nsresult sbFileMetadataService::GetQueuedJobItem(PRBool aMainThreadOnly,
                                                 sbMetadataJobItem** aJobItem)
 {
@@ -581,6 +649,116 @@ sbFileMetadataService::GetJobItemIsBlocked(sbMetadataJobItem* aJobItem,
 }
 
 
+nsresult
+sbFileMetadataService::AcquireDeviceSlot(sbMetadataJobItem* aJobItem,
+                                         nsACString&        aDevice)
+{
+  NS_ENSURE_ARG_POINTER(aJobItem);
+  nsresult rv;
+
+  aDevice.Truncate();
+  if (!mMaxThreadsPerDevice)
+    return NS_OK;
+
+  nsCString url;
+  rv = aJobItem->GetURL(url);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCString device;
+  GetDeviceKey(url, device);
+  if (device.IsEmpty())
+    return NS_OK;
+
+  nsAutoMonitor monitor(mDeviceMonitor);
+
+  // Slots are only held while a handler runs, so this won't wait for long
+  PRUint32 count;
+  while (1) {
+    count = 0;
+    mDeviceThreadCounts.Get(device, &count);
+    if (count < mMaxThreadsPerDevice)
+      break;
+    monitor.Wait();
+  }
+
+  PRBool success = mDeviceThreadCounts.Put(device, count + 1);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
+  aDevice.Assign(device);
+  return NS_OK;
+}
+
+void
+sbFileMetadataService::ReleaseDeviceSlot(const nsACString& aDevice)
+{
+  if (aDevice.IsEmpty())
+    return;
+
+  nsAutoMonitor monitor(mDeviceMonitor);
+
+  PRUint32 count = 0;
+  if (mDeviceThreadCounts.Get(aDevice, &count) && count > 1) {
+    mDeviceThreadCounts.Put(aDevice, count - 1);
+  } else {
+    mDeviceThreadCounts.Remove(aDevice);
+  }
+
+  monitor.NotifyAll();
+}
+
+/* static */ void
+sbFileMetadataService::GetDeviceKey(const nsACString& aURL,
+                                    nsACString&       aDevice)
+{
+  aDevice.Truncate();
+
+  NS_NAMED_LITERAL_CSTRING(fileScheme, "file://");
+  if (!StringBeginsWith(aURL, fileScheme))
+    return;
+
+  nsCString path(Substring(aURL, fileScheme.Length()));
+
+  // UNC path, the device is the share: file://server/share/...
+  if (path.IsEmpty() || path.CharAt(0) != '/') {
+    PRInt32 slash = path.FindChar('/');
+    if (slash > 0) {
+      slash = path.FindChar('/', slash + 1);
+    }
+    aDevice.AssignLiteral("//");
+    aDevice.Append(slash > 0 ? Substring(path, 0, slash) : path);
+    return;
+  }
+
+  // Windows drive: file:///C:/...
+  if (path.Length() >= 3 &&
+      (path.CharAt(2) == ':' || path.CharAt(2) == '|')) {
+    char drive = path.CharAt(1);
+    if (drive >= 'a' && drive <= 'z') {
+      drive -= 'a' - 'A';
+    }
+    aDevice.Assign(drive);
+    aDevice.Append(':');
+    return;
+  }
+
+  // Removable and network volumes are usually mounted one level under one of
+  // these, anything else is taken to be on the system disk
+  static const char* const MOUNT_ROOTS[] = {
+    "/Volumes/", "/media/", "/mnt/", "/net/"
+  };
+  for (PRUint32 i = 0; i < NS_ARRAY_LENGTH(MOUNT_ROOTS); i++) {
+    nsDependentCString root(MOUNT_ROOTS[i]);
+    if (StringBeginsWith(path, root)) {
+      PRInt32 slash = path.FindChar('/', root.Length());
+      aDevice.Assign(slash > 0 ? Substring(path, 0, slash) : path);
+      return;
+    }
+  }
+
+  aDevice.AssignLiteral("/");
+}
+
+
 // nsIObserver
 NS_IMETHODIMP
 sbFileMetadataService::Observe(nsISupports *aSubject, 
@@ -33,6 +33,7 @@
 // INCLUDES ===================================================================
 #include <nscore.h>
 #include <prlock.h>
+#include <prmon.h>
 #include <nsStringGlue.h>
 #include <nsITimer.h>
 #include <nsCOMPtr.h>
@@ -40,6 +41,7 @@
 #include <nsIStringBundle.h>
 #include <nsTArray.h>
 #include <nsAutoPtr.h>
+#include <nsDataHashtable.h>
 
 #include <sbIDataRemote.h>
 #include <sbIMediacoreManager.h>
@@ -86,9 +88,9 @@ class sbMetadataCrashTracker;
  *     sbMetadataJobs, which are representations of user read/write requests.
  *   - sbMetadataJob keeps sbMetadataJobItems in a waiting list, and is
  *     responsible for managing sbIJobProgress requests.
- *   - sbFileMetadataService owns two job processors, 
- *     sbBackgroundThreadMetadataProcessor and sbMainThreadMetadataProcessor,
- *     which pull sbMetadataJobItems from waiting jobs, run the associated
+ *   - sbFileMetadataService owns a sbMainThreadMetadataProcessor and a
+ *     pool of sbBackgroundThreadMetadataProcessors, which pull
+ *     sbMetadataJobItems from waiting jobs, run the associated
  *     sbIMetadataJobHandlers, and then give the items back. 
  *   - When sbMetadataJobItems are returned to a sbMetadataJob, they are 
  *     handled by reading the found properties (if needed) and tracking 
@@ -180,6 +182,27 @@ public:
   nsresult GetJobItemIsBlocked(sbMetadataJobItem* aJobItem,
                                PRBool*            aJobItemIsBlocked);
 
+  /**
+   * Wait until fewer than the allowed number of background processors are
+   * working on files from the device holding the file of aJobItem, then
+   * count one more.  Each call must be balanced by a call to
+   * ReleaseDeviceSlot with the returned device.
+   *
+   * May be called off of the main thread.
+   *
+   * \param aJobItem The job item about to be processed
+   * \param aDevice The device of the file, empty if it isn't throttled
+   */
+  nsresult AcquireDeviceSlot(sbMetadataJobItem* aJobItem,
+                             nsACString&        aDevice);
+
+  /**
+   * Give back the slot taken by AcquireDeviceSlot.
+   *
+   * May be called off of the main thread.
+   */
+  void ReleaseDeviceSlot(const nsACString& aDevice);
+
 
 protected:
   
@@ -239,14 +262,37 @@ protected:
    * is to be called while mJobArray is locked.
    */
   nsresult UpdateDataRemotes(PRInt64 aJobCount);
+
+  /**
+   * Start the background processors, creating them as needed.
+   * *** MAIN THREAD ONLY ***
+   */
+  nsresult StartBackgroundThreadProcessors();
+
+  /**
+   * Get the key identifying the device holding the file at aURL: the drive,
+   * share or mount point it is under.  Empty for non local files.
+   */
+  static void GetDeviceKey(const nsACString& aURL, nsACString& aDevice);
   
   // Legacy dataremote used to indicate metadata status
   nsCOMPtr<sbIDataRemote>                  mDataCurrentMetadataJobs;
   
   // Job processors
   nsRefPtr<sbMainThreadMetadataProcessor>  mMainThreadProcessor;
-  nsRefPtr<sbBackgroundThreadMetadataProcessor>  
-                                           mBackgroundThreadProcessor;
+  nsTArray<nsRefPtr<sbBackgroundThreadMetadataProcessor> >
+                                           mBackgroundThreadProcessors;
+
+  // Number of background processors to run, and how many of them may work
+  // on files from the same device at once
+  PRUint32                                 mBackgroundThreadCount;
+  PRUint32                                 mMaxThreadsPerDevice;
+
+  // Protects mDeviceThreadCounts, notified when a device slot is released
+  PRMonitor*                               mDeviceMonitor;
+
+  // Number of background processors working on each device
+  nsDataHashtable<nsCStringHashKey, PRUint32> mDeviceThreadCounts;
 
   PRBool                                   mInitialized;
   PRBool                                   mRunning;
@@ -76,6 +76,12 @@ var gFileMetadataService = null;
 var gServer;
 
 function runTest () {
+
+  // Read with several background threads, at most one per device
+  var prefs = Cc["@mozilla.org/preferences-service;1"]
+                .getService(Ci.nsIPrefBranch);
+  prefs.setIntPref("songbird.metadata.backgroundThreadCount", 4);
+  prefs.setIntPref("songbird.metadata.maxThreadsPerDevice", 1);
    
   var gTestLibrary = createNewLibrary( "test_metadatajob" );
   var gTestMediaItems = Components.classes["@songbirdnest.com/moz/xpcom/threadsafe-array;1"]
@@ -196,6 +202,11 @@ function jobFinished() {
     
   } finally {
    gServer.stop(function() {});
+
+   var prefs = Cc["@mozilla.org/preferences-service;1"]
+                 .getService(Ci.nsIPrefBranch);
+   prefs.clearUserPref("songbird.metadata.backgroundThreadCount");
+   prefs.clearUserPref("songbird.metadata.maxThreadsPerDevice");
   }
   
   testFinished(); 
@@ -0,0 +1,611 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#include "sbTranscodeCache.h"
+
+#include <nsAlgorithm.h>
+#include <nsAutoLock.h>
+#include <nsArrayUtils.h>
+#include <nsComponentManagerUtils.h>
+#include <nsDirectoryServiceDefs.h>
+#include <nsICryptoHash.h>
+#include <nsIPrefBranch.h>
+#include <nsIPrefService.h>
+#include <nsIProperties.h>
+#include <nsISimpleEnumerator.h>
+#include <nsILocalFile.h>
+#include <nsIVariant.h>
+#include <nsXPCOMCID.h>
+#include <prprf.h>
+#include <prtime.h>
+
+#include <sbITranscodeProfile.h>
+#include <sbProxiedComponentManager.h>
+
+#define TRANSCODE_CACHE_DIR "transcodeCache"
+
+#define PREF_TRANSCODE_CACHE_SIZE "songbird.transcode.cache.size_mb"
+#define DEFAULT_TRANSCODE_CACHE_SIZE 1024
+
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbTranscodeCache, sbITranscodeCache)
+
+sbTranscodeCache::sbTranscodeCache() :
+  mLock(nsnull),
+  mMaxSize(0),
+  mSize(0),
+  mHits(0),
+  mMisses(0)
+{
+}
+
+sbTranscodeCache::~sbTranscodeCache()
+{
+  if (mLock) {
+    nsAutoLock::DestroyLock(mLock);
+  }
+}
+
+nsresult
+sbTranscodeCache::Init()
+{
+  nsresult rv;
+
+  mLock = nsAutoLock::NewLock("sbTranscodeCache::mLock");
+  NS_ENSURE_TRUE(mLock, NS_ERROR_OUT_OF_MEMORY);
+
+  PRBool success = mEntries.Init();
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+
+  PRInt32 maxSize = DEFAULT_TRANSCODE_CACHE_SIZE;
+  nsCOMPtr<nsIPrefBranch> prefBranch =
+    do_ProxiedGetService(NS_PREFSERVICE_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  PRInt32 value;
+  rv = prefBranch->GetIntPref(PREF_TRANSCODE_CACHE_SIZE, &value);
+  if (NS_SUCCEEDED(rv)) {
+    maxSize = value;
+  }
+  mMaxSize = static_cast<PRInt64>(NS_MAX(maxSize, 0)) * 1024 * 1024;
+
+  // The directory service only works on the main thread, so only its path
+  // is taken from it and the directory used is a local file of our own.
+  nsCOMPtr<nsIProperties> directoryService =
+    do_ProxiedGetService(NS_DIRECTORY_SERVICE_CONTRACTID, &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsCOMPtr<nsIFile> profileDir;
+  rv = directoryService->Get(NS_APP_USER_PROFILE_LOCAL_50_DIR,
+                             NS_GET_IID(nsIFile),
+                             getter_AddRefs(profileDir));
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsString profilePath;
+  rv = profileDir->GetPath(profilePath);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsILocalFile> cacheDir =
+    do_CreateInstance("@mozilla.org/file/local;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = cacheDir->InitWithPath(profilePath);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = cacheDir->Append(NS_LITERAL_STRING(TRANSCODE_CACHE_DIR));
+  NS_ENSURE_SUCCESS(rv, rv);
+  mCacheDir = cacheDir;
+
+  PRBool exists;
+  rv = mCacheDir->Exists(&exists);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (!exists) {
+    rv = mCacheDir->Create(nsIFile::DIRECTORY_TYPE, 0755);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  rv = LoadEntries();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoLock lock(mLock);
+  Evict(mMaxSize);
+
+  return NS_OK;
+}
+
+nsresult
+sbTranscodeCache::LoadEntries()
+{
+  nsresult rv;
+
+  nsCOMPtr<nsISimpleEnumerator> files;
+  rv = mCacheDir->GetDirectoryEntries(getter_AddRefs(files));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoLock lock(mLock);
+
+  PRBool hasMore;
+  while (NS_SUCCEEDED(files->HasMoreElements(&hasMore)) && hasMore) {
+    nsCOMPtr<nsISupports> supports;
+    rv = files->GetNext(getter_AddRefs(supports));
+    NS_ENSURE_SUCCESS(rv, rv);
+    nsCOMPtr<nsIFile> file = do_QueryInterface(supports, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    // Outputs are named <key>.<extension>, anything else is a copy that
+    // didn't finish and is removed.
+    nsString leafName;
+    rv = file->GetLeafName(leafName);
+    NS_ENSURE_SUCCESS(rv, rv);
+    PRInt32 dot = leafName.FindChar('.');
+    if (dot <= 0 || leafName.Find(NS_LITERAL_STRING(".part")) >= 0) {
+      file->Remove(PR_FALSE);
+      continue;
+    }
+
+    nsAutoPtr<Entry> entry(new Entry);
+    NS_ENSURE_TRUE(entry, NS_ERROR_OUT_OF_MEMORY);
+    entry->file = file;
+    rv = file->GetFileSize(&entry->size);
+    NS_ENSURE_SUCCESS(rv, rv);
+    rv = file->GetLastModifiedTime(&entry->lastUsed);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    mSize += entry->size;
+    PRBool success = mEntries.Put(
+      NS_ConvertUTF16toUTF8(Substring(leafName, 0, dot)), entry);
+    NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+    entry.forget();
+  }
+
+  return NS_OK;
+}
+
+static nsresult
+AppendNameValue(const nsAString& aName,
+                nsIVariant* aValue,
+                nsACString& aKey)
+{
+  nsString value;
+  if (aValue) {
+    nsresult rv = aValue->GetAsAString(value);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  aKey.Append(NS_ConvertUTF16toUTF8(aName));
+  aKey.Append('=');
+  aKey.Append(NS_ConvertUTF16toUTF8(value));
+  aKey.Append('\n');
+
+  return NS_OK;
+}
+
+static nsresult
+AppendProperties(nsIArray* aProperties, nsACString& aKey)
+{
+  if (!aProperties) {
+    return NS_OK;
+  }
+
+  nsresult rv;
+
+  PRUint32 length;
+  rv = aProperties->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 i = 0; i < length; i++) {
+    nsCOMPtr<sbITranscodeProfileProperty> property =
+      do_QueryElementAt(aProperties, i, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString name;
+    rv = property->GetPropertyName(name);
+    NS_ENSURE_SUCCESS(rv, rv);
+    nsCOMPtr<nsIVariant> value;
+    rv = property->GetValue(getter_AddRefs(value));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = AppendNameValue(name, value, aKey);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+static nsresult
+AppendAttributes(nsIArray* aAttributes, nsACString& aKey)
+{
+  if (!aAttributes) {
+    return NS_OK;
+  }
+
+  nsresult rv;
+
+  PRUint32 length;
+  rv = aAttributes->GetLength(&length);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 i = 0; i < length; i++) {
+    nsCOMPtr<sbITranscodeProfileAttribute> attribute =
+      do_QueryElementAt(aAttributes, i, &rv);
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    nsString name;
+    rv = attribute->GetName(name);
+    NS_ENSURE_SUCCESS(rv, rv);
+    nsCOMPtr<nsIVariant> value;
+    rv = attribute->GetValue(getter_AddRefs(value));
+    NS_ENSURE_SUCCESS(rv, rv);
+
+    rv = AppendNameValue(name, value, aKey);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  return NS_OK;
+}
+
+nsresult
+sbTranscodeCache::GetKey(nsIFile* aSource,
+                         sbITranscodeProfile* aProfile,
+                         const nsAString& aContext,
+                         nsACString& aKey)
+{
+  nsresult rv;
+
+  // The source file, as it is now
+  nsString path;
+  rv = aSource->GetPath(path);
+  NS_ENSURE_SUCCESS(rv, rv);
+  PRInt64 fileSize;
+  rv = aSource->GetFileSize(&fileSize);
+  NS_ENSURE_SUCCESS(rv, rv);
+  PRInt64 lastModified;
+  rv = aSource->GetLastModifiedTime(&lastModified);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCString key;
+  key.Append(NS_ConvertUTF16toUTF8(path));
+  char buffer[64];
+  PR_snprintf(buffer, sizeof(buffer), "\n%lld\n%lld\n", fileSize, lastModified);
+  key.Append(buffer);
+
+  // The profile and the values of its properties
+  nsString value;
+  rv = aProfile->GetId(value);
+  NS_ENSURE_SUCCESS(rv, rv);
+  key.Append(NS_ConvertUTF16toUTF8(value));
+  key.Append('\n');
+
+  PRUint32 type;
+  rv = aProfile->GetType(&type);
+  NS_ENSURE_SUCCESS(rv, rv);
+  PR_snprintf(buffer, sizeof(buffer), "%u\n", type);
+  key.Append(buffer);
+
+  nsCString extension;
+  rv = aProfile->GetFileExtension(extension);
+  NS_ENSURE_SUCCESS(rv, rv);
+  key.Append(extension);
+  key.Append('\n');
+
+  rv = aProfile->GetContainerFormat(value);
+  NS_ENSURE_SUCCESS(rv, rv);
+  key.Append(NS_ConvertUTF16toUTF8(value));
+  key.Append('\n');
+  rv = aProfile->GetAudioCodec(value);
+  NS_ENSURE_SUCCESS(rv, rv);
+  key.Append(NS_ConvertUTF16toUTF8(value));
+  key.Append('\n');
+  rv = aProfile->GetVideoCodec(value);
+  NS_ENSURE_SUCCESS(rv, rv);
+  key.Append(NS_ConvertUTF16toUTF8(value));
+  key.Append('\n');
+
+  nsCOMPtr<nsIArray> array;
+  rv = aProfile->GetContainerProperties(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendProperties(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = aProfile->GetAudioProperties(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendProperties(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = aProfile->GetVideoProperties(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendProperties(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = aProfile->GetContainerAttributes(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendAttributes(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = aProfile->GetAudioAttributes(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendAttributes(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = aProfile->GetVideoAttributes(getter_AddRefs(array));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = AppendAttributes(array, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Whatever else the caller says went into the output
+  key.Append(NS_ConvertUTF16toUTF8(aContext));
+
+  nsCString hashValue;
+  nsCOMPtr<nsICryptoHash> cryptoHash =
+    do_CreateInstance("@mozilla.org/security/hash;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = cryptoHash->Init(nsICryptoHash::SHA1);
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = cryptoHash->Update(reinterpret_cast<const PRUint8*>(key.BeginReading()),
+                          key.Length());
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = cryptoHash->Finish(PR_FALSE, hashValue);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  aKey.Truncate();
+  const PRUint8* hashData =
+    reinterpret_cast<const PRUint8*>(hashValue.BeginReading());
+  for (PRUint32 i = 0; i < hashValue.Length(); i++) {
+    char hexValue[3];
+    PR_snprintf(hexValue, 3, "%02x", hashData[i]);
+    aKey.Append(hexValue);
+  }
+
+  return NS_OK;
+}
+
+/* nsIFile getCachedOutput (in nsIFile aSource,
+                            in sbITranscodeProfile aProfile,
+                            in AString aContext); */
+NS_IMETHODIMP
+sbTranscodeCache::GetCachedOutput(nsIFile* aSource,
+                                  sbITranscodeProfile* aProfile,
+                                  const nsAString& aContext,
+                                  nsIFile** _retval)
+{
+  NS_ENSURE_ARG_POINTER(aSource);
+  NS_ENSURE_ARG_POINTER(aProfile);
+  NS_ENSURE_ARG_POINTER(_retval);
+
+  nsresult rv;
+
+  *_retval = nsnull;
+
+  if (!mMaxSize) {
+    return NS_OK;
+  }
+
+  nsCString key;
+  rv = GetKey(aSource, aProfile, aContext, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoLock lock(mLock);
+
+  Entry* entry;
+  PRBool exists = PR_FALSE;
+  if (mEntries.Get(key, &entry)) {
+    rv = entry->file->Exists(&exists);
+    if (NS_FAILED(rv) || !exists) {
+      mSize -= entry->size;
+      mEntries.Remove(key);
+    }
+  }
+
+  if (!exists) {
+    mMisses++;
+    return NS_OK;
+  }
+
+  mHits++;
+
+  // Record the use in the file so it survives a restart
+  entry->lastUsed = PR_Now() / PR_USEC_PER_MSEC;
+  entry->file->SetLastModifiedTime(entry->lastUsed);
+
+  return entry->file->Clone(_retval);
+}
+
+/* void addOutput (in nsIFile aSource,
+                   in sbITranscodeProfile aProfile,
+                   in AString aContext,
+                   in nsIFile aOutput); */
+NS_IMETHODIMP
+sbTranscodeCache::AddOutput(nsIFile* aSource,
+                            sbITranscodeProfile* aProfile,
+                            const nsAString& aContext,
+                            nsIFile* aOutput)
+{
+  NS_ENSURE_ARG_POINTER(aSource);
+  NS_ENSURE_ARG_POINTER(aProfile);
+  NS_ENSURE_ARG_POINTER(aOutput);
+
+  nsresult rv;
+
+  if (!mMaxSize) {
+    return NS_OK;
+  }
+
+  PRInt64 size;
+  rv = aOutput->GetFileSize(&size);
+  NS_ENSURE_SUCCESS(rv, rv);
+  if (size > mMaxSize) {
+    return NS_OK;
+  }
+
+  nsCString key;
+  rv = GetKey(aSource, aProfile, aContext, key);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Keep the extension of the output, it is what the transcoder chose
+  nsString outputName;
+  rv = aOutput->GetLeafName(outputName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  nsString leafName = NS_ConvertUTF8toUTF16(key);
+  PRInt32 dot = outputName.RFindChar('.');
+  if (dot >= 0) {
+    leafName.Append(Substring(outputName, dot));
+  }
+  else {
+    leafName.AppendLiteral(".out");
+  }
+
+  // Copy under a temporary name first so a copy that doesn't finish is
+  // never taken for an output.
+  nsString partName(leafName);
+  partName.AppendLiteral(".part");
+
+  nsCOMPtr<nsIFile> partFile;
+  rv = mCacheDir->Clone(getter_AddRefs(partFile));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = partFile->Append(partName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  partFile->Remove(PR_FALSE);
+
+  rv = aOutput->CopyTo(mCacheDir, partName);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsAutoLock lock(mLock);
+
+  Entry* entry;
+  if (mEntries.Get(key, &entry)) {
+    mSize -= entry->size;
+    entry->file->Remove(PR_FALSE);
+    mEntries.Remove(key);
+  }
+
+  rv = partFile->MoveTo(nsnull, leafName);
+  if (NS_FAILED(rv)) {
+    partFile->Remove(PR_FALSE);
+    return rv;
+  }
+
+  nsAutoPtr<Entry> newEntry(new Entry);
+  NS_ENSURE_TRUE(newEntry, NS_ERROR_OUT_OF_MEMORY);
+  rv = mCacheDir->Clone(getter_AddRefs(newEntry->file));
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = newEntry->file->Append(leafName);
+  NS_ENSURE_SUCCESS(rv, rv);
+  newEntry->size = size;
+  newEntry->lastUsed = PR_Now() / PR_USEC_PER_MSEC;
+  newEntry->file->SetLastModifiedTime(newEntry->lastUsed);
+
+  // Make room for the new output before counting it
+  Evict(mMaxSize - size);
+
+  PRBool success = mEntries.Put(key, newEntry);
+  NS_ENSURE_TRUE(success, NS_ERROR_OUT_OF_MEMORY);
+  newEntry.forget();
+  mSize += size;
+
+  return NS_OK;
+}
+
+/* void clear (); */
+NS_IMETHODIMP
+sbTranscodeCache::Clear()
+{
+  nsAutoLock lock(mLock);
+
+  mEntries.Enumerate(RemoveEntry, nsnull);
+  mSize = 0;
+  mHits = 0;
+  mMisses = 0;
+
+  return NS_OK;
+}
+
+/* readonly attribute unsigned long hits; */
+NS_IMETHODIMP
+sbTranscodeCache::GetHits(PRUint32* aHits)
+{
+  NS_ENSURE_ARG_POINTER(aHits);
+  nsAutoLock lock(mLock);
+  *aHits = mHits;
+  return NS_OK;
+}
+
+/* readonly attribute unsigned long misses; */
+NS_IMETHODIMP
+sbTranscodeCache::GetMisses(PRUint32* aMisses)
+{
+  NS_ENSURE_ARG_POINTER(aMisses);
+  nsAutoLock lock(mLock);
+  *aMisses = mMisses;
+  return NS_OK;
+}
+
+/* readonly attribute long long size; */
+NS_IMETHODIMP
+sbTranscodeCache::GetSize(PRInt64* aSize)
+{
+  NS_ENSURE_ARG_POINTER(aSize);
+  nsAutoLock lock(mLock);
+  *aSize = mSize;
+  return NS_OK;
+}
+
+struct sbTranscodeCacheOldest
+{
+  nsCString key;
+  PRInt64 lastUsed;
+  PRBool found;
+};
+
+void
+sbTranscodeCache::Evict(PRInt64 aMaxSize)
+{
+  while (mSize > NS_MAX(aMaxSize, static_cast<PRInt64>(0))) {
+    sbTranscodeCacheOldest oldest;
+    oldest.found = PR_FALSE;
+    mEntries.EnumerateRead(FindOldest, &oldest);
+    if (!oldest.found) {
+      break;
+    }
+
+    Entry* entry;
+    if (mEntries.Get(oldest.key, &entry)) {
+      entry->file->Remove(PR_FALSE);
+      mSize -= entry->size;
+      mEntries.Remove(oldest.key);
+    }
+  }
+}
+
+/* static */ PLDHashOperator
+sbTranscodeCache::FindOldest(const nsACString& aKey,
+                             Entry* aEntry,
+                             void* aClosure)
+{
+  sbTranscodeCacheOldest* oldest =
+    static_cast<sbTranscodeCacheOldest*>(aClosure);
+  if (!oldest->found || aEntry->lastUsed < oldest->lastUsed) {
+    oldest->key = aKey;
+    oldest->lastUsed = aEntry->lastUsed;
+    oldest->found = PR_TRUE;
+  }
+  return PL_DHASH_NEXT;
+}
+
+/* static */ PLDHashOperator
+sbTranscodeCache::RemoveEntry(const nsACString& aKey,
+                              nsAutoPtr<Entry>& aEntry,
+                              void* aClosure)
+{
+  aEntry->file->Remove(PR_FALSE);
+  return PL_DHASH_REMOVE;
+}
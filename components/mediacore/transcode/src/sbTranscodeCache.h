@@ -0,0 +1,107 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+#ifndef SBTRANSCODECACHE_H_
+#define SBTRANSCODECACHE_H_
+
+#include <sbITranscodeCache.h>
+
+#include <nsAutoPtr.h>
+#include <nsClassHashtable.h>
+#include <nsCOMPtr.h>
+#include <nsHashKeys.h>
+#include <nsIFile.h>
+#include <nsStringGlue.h>
+#include <prlock.h>
+
+class sbITranscodeProfile;
+
+/**
+ * \brief Cache of transcoded files in the profile's local directory.
+ *
+ * Each output is stored under the hex SHA-1 of its key with the output's own
+ * extension, so the index is rebuilt from the directory listing at start up.
+ * The modification time of a cached file records when it was last used.
+ */
+class sbTranscodeCache : public sbITranscodeCache
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_SBITRANSCODECACHE
+
+  sbTranscodeCache();
+
+  nsresult Init();
+
+private:
+  ~sbTranscodeCache();
+
+  struct Entry {
+    nsCOMPtr<nsIFile> file;
+    PRInt64 size;
+    PRInt64 lastUsed;
+  };
+
+  /**
+   * Build the hashed key of an output from its source, profile and context
+   */
+  nsresult GetKey(nsIFile* aSource,
+                  sbITranscodeProfile* aProfile,
+                  const nsAString& aContext,
+                  nsACString& aKey);
+
+  /**
+   * Load the entries already in the cache directory
+   */
+  nsresult LoadEntries();
+
+  /**
+   * Remove the least recently used entries until the cache fits aMaxSize.
+   * mLock must be held.
+   */
+  void Evict(PRInt64 aMaxSize);
+
+  static PLDHashOperator FindOldest(const nsACString& aKey,
+                                    Entry* aEntry,
+                                    void* aClosure);
+
+  static PLDHashOperator RemoveEntry(const nsACString& aKey,
+                                     nsAutoPtr<Entry>& aEntry,
+                                     void* aClosure);
+
+  // Protects everything below
+  PRLock* mLock;
+
+  nsCOMPtr<nsIFile> mCacheDir;
+  nsClassHashtable<nsCStringHashKey, Entry> mEntries;
+
+  // Size limit, in bytes, 0 if the cache is off
+  PRInt64 mMaxSize;
+  PRInt64 mSize;
+
+  PRUint32 mHits;
+  PRUint32 mMisses;
+};
+
+#endif /* SBTRANSCODECACHE_H_ */
@@ -32,6 +32,7 @@
 #include <nsIGenericFactory.h>
 #include "sbTranscodeManager.h"
 #include "sbTranscodeAlbumArt.h"
+#include "sbTranscodeCache.h"
 #include "sbTranscodeError.h"
 #include "sbTranscodeProfile.h"
 #include "sbTranscodeProfileLoader.h"
@@ -40,6 +41,7 @@
 NS_GENERIC_FACTORY_SINGLETON_CONSTRUCTOR(sbTranscodeManager,
         sbTranscodeManager::GetSingleton)
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbTranscodeAlbumArt);
+NS_GENERIC_FACTORY_CONSTRUCTOR_INIT(sbTranscodeCache, Init);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbTranscodeError);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbTranscodeProfile);
 NS_GENERIC_FACTORY_CONSTRUCTOR(sbTranscodeProfileLoader);
@@ -59,6 +61,12 @@ static nsModuleComponentInfo components[] =
     SONGBIRD_TRANSCODEALBUMART_CONTRACTID,
     sbTranscodeAlbumArtConstructor
   },
+  {
+    SONGBIRD_TRANSCODECACHE_CLASSNAME,
+    SONGBIRD_TRANSCODECACHE_CID,
+    SONGBIRD_TRANSCODECACHE_CONTRACTID,
+    sbTranscodeCacheConstructor
+  },
   {
     SONGBIRD_TRANSCODEERROR_CLASSNAME,
     SONGBIRD_TRANSCODEERROR_CID,
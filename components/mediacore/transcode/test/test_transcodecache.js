@@ -0,0 +1,93 @@
+/*
+ *=BEGIN SONGBIRD GPL
+ *
+ * This file is part of the Songbird web player.
+ *
+ * Copyright(c) 2005-2011 POTI, Inc.
+ * http://www.songbirdnest.com
+ *
+ * This file may be licensed under the terms of of the
+ * GNU General Public License Version 2 (the ``GPL'').
+ *
+ * Software distributed under the License is distributed
+ * on an ``AS IS'' basis, WITHOUT WARRANTY OF ANY KIND, either
+ * express or implied. See the GPL for the specific language
+ * governing rights and limitations.
+ *
+ * You should have received a copy of the GPL along with this
+ * program. If not, go to http://www.gnu.org/licenses/gpl.html
+ * or write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ *=END SONGBIRD GPL
+ */
+
+/**
+ * \brief Test that the transcode cache finds outputs by source and profile,
+ *        counts hits and misses, and misses once the source changes.
+ */
+
+function makeFile(aDir, aName, aContents) {
+  var file = aDir.clone();
+  file.append(aName);
+  file.createUnique(Ci.nsIFile.NORMAL_FILE_TYPE, 0644);
+  var stream = Cc["@mozilla.org/network/file-output-stream;1"]
+                 .createInstance(Ci.nsIFileOutputStream);
+  stream.init(file, -1, -1, 0);
+  stream.write(aContents, aContents.length);
+  stream.close();
+  return file;
+}
+
+function makeProfile(aId) {
+  var profile = Cc["@songbirdnest.com/Songbird/Transcode/Profile;1"]
+                  .createInstance(Ci.sbITranscodeProfile);
+  profile.id = aId;
+  profile.type = Ci.sbITranscodeProfile.TRANSCODE_TYPE_AUDIO;
+  profile.fileExtension = "mp3";
+  profile.containerFormat = "audio/mpeg";
+  profile.audioCodec = "audio/mpeg";
+  return profile;
+}
+
+function runTest() {
+  var cache = Cc["@songbirdnest.com/Songbird/Mediacore/TranscodeCache;1"]
+                .getService(Ci.sbITranscodeCache);
+  cache.clear();
+
+  var tempDir = Cc["@mozilla.org/file/directory_service;1"]
+                  .getService(Ci.nsIProperties)
+                  .get("TmpD", Ci.nsIFile);
+  var source = makeFile(tempDir, "transcode_cache_source.flac", "source");
+  var output = makeFile(tempDir, "transcode_cache_output.mp3", "output");
+  var profile = makeProfile("test_mp3");
+  var otherProfile = makeProfile("test_other_mp3");
+
+  assertEqual(cache.getCachedOutput(source, profile, "device"), null);
+  assertEqual(cache.misses, 1);
+
+  cache.addOutput(source, profile, "device", output);
+  assertEqual(cache.size, output.fileSize);
+
+  var cached = cache.getCachedOutput(source, profile, "device");
+  assertTrue(cached, "expected a cached output");
+  assertTrue(/\.mp3$/.test(cached.leafName), "cached output lost its extension");
+  assertFilesEqual(output, cached);
+  assertEqual(cache.hits, 1);
+
+  // Another profile or context is another output
+  assertEqual(cache.getCachedOutput(source, otherProfile, "device"), null);
+  assertEqual(cache.getCachedOutput(source, profile, "other device"), null);
+
+  // So is a source that changed since
+  source.lastModifiedTime = source.lastModifiedTime - 10000;
+  assertEqual(cache.getCachedOutput(source, profile, "device"), null);
+  assertEqual(cache.misses, 4);
+
+  cache.clear();
+  assertEqual(cache.size, 0);
+  assertEqual(cache.hits, 0);
+
+  source.remove(false);
+  output.remove(false);
+}
@@ -53,6 +53,21 @@
 #include <sbLockUtils.h>
 #include <sbDebugUtils.h>
 
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+// Number of threads walking a directory tree
+#define FILESCAN_WALKER_THREADS       4
+
+// Threads stop reading directories while this many files wait to be taken
+#define FILESCAN_WALKER_MAX_PENDING   10000
+
+// How often the scanning thread checks for cancellation while waiting
+#define FILESCAN_WALKER_POLL_INTERVAL 100
+#endif
 
 /**
  * To log this module, set the following environment variable:
@@ -815,6 +830,29 @@ sbFileScan::ScanDirectory(sbIFileScanQuery *pQuery)
     pCallback->OnFileScanStart();
   }
 
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+  if(bFlag)
+  {
+    rv = ScanDirectoryNative(pQuery,
+                             pFile,
+                             pCallback,
+                             pLibraryUtils,
+                             bWantLibraryContentURIs,
+                             bSearchHidden,
+                             bRecurse);
+    NS_WARN_IF_FALSE(NS_SUCCEEDED(rv),
+        "WARNING: Could not walk the current directory!");
+
+    if(pCallback)
+    {
+      pCallback->OnFileScanEnd();
+    }
+
+    NS_IF_RELEASE(pCallback);
+    return rv;
+  }
+#endif
+
   if(bFlag)
   {
     sbIDirectoryEnumerator * pDirEntries;
@@ -982,3 +1020,295 @@ sbFileScan::ScanDirectory(sbIFileScanQuery *pQuery)
 
   return NS_OK;
 } //ScanDirectory
+
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+
+//-----------------------------------------------------------------------------
+nsresult
+sbFileScan::ScanDirectoryNative(sbIFileScanQuery *pQuery,
+                                nsILocalFile *pDirectory,
+                                sbIFileScanCallback *pCallback,
+                                sbILibraryUtils *pLibraryUtils,
+                                PRBool bWantLibraryContentURIs,
+                                PRBool bSearchHidden,
+                                PRBool bRecurse)
+{
+  nsresult rv;
+
+  nsCString directory;
+  rv = pDirectory->GetNativePath(directory);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsRefPtr<sbFileScanWalker> walker =
+    new sbFileScanWalker(bSearchHidden, bRecurse);
+  NS_ENSURE_TRUE(walker, NS_ERROR_OUT_OF_MEMORY);
+
+  rv = walker->Init(directory);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIThreadPool> threadPool =
+    do_CreateInstance("@mozilla.org/thread-pool;1", &rv);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = threadPool->SetThreadLimit(FILESCAN_WALKER_THREADS);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  for (PRUint32 i = 0; i < FILESCAN_WALKER_THREADS; i++) {
+    rv = threadPool->Dispatch(walker, NS_DISPATCH_NORMAL);
+    if (NS_FAILED(rv)) {
+      walker->Cancel();
+      threadPool->Shutdown();
+      return rv;
+    }
+  }
+
+  PRInt32 nFoundCount = 0;
+  nsTArray<nsCString> files;
+  PRIntervalTime timeout =
+    PR_MillisecondsToInterval(FILESCAN_WALKER_POLL_INTERVAL);
+
+  while (walker->GetFiles(files, timeout)) {
+    PRBool cancel = PR_FALSE;
+    pQuery->IsCancelled(&cancel);
+    if (cancel || m_ThreadShouldShutdown) {
+      break;
+    }
+
+    for (PRUint32 i = 0; i < files.Length(); i++) {
+      nsCOMPtr<nsILocalFile> pEntry;
+      rv = NS_NewNativeLocalFile(files[i], PR_FALSE, getter_AddRefs(pEntry));
+      if (NS_FAILED(rv)) {
+        continue;
+      }
+
+      // Get a library content URI for the file.
+      nsCOMPtr<nsIURI> pURI;
+      if (bWantLibraryContentURIs) {
+        rv = pLibraryUtils->GetFileContentURI(pEntry, getter_AddRefs(pURI));
+      } else {
+        rv = NS_NewFileURI(getter_AddRefs(pURI), pEntry);
+      }
+
+      // Get the file URI spec.
+      nsCAutoString spec;
+      if (NS_SUCCEEDED(rv)) {
+        rv = pURI->GetSpec(spec);
+        LOG("sbFileScan::ScanDirectoryNative found spec: %s\n", spec.get());
+      }
+
+      // Add the file path to the query.
+      if (NS_SUCCEEDED(rv)) {
+        nsString strPath = NS_ConvertUTF8toUTF16(spec);
+        pQuery->AddFilePath(strPath);
+        nFoundCount += 1;
+
+        if (pCallback) {
+          pCallback->OnFileScanFile(strPath, nFoundCount);
+        }
+      }
+    }
+    files.Clear();
+  }
+
+  walker->Cancel();
+  rv = threadPool->Shutdown();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return NS_OK;
+} //ScanDirectoryNative
+
+//*****************************************************************************
+//  sbFileScanWalker Class
+//*****************************************************************************
+NS_IMPL_THREADSAFE_ISUPPORTS1(sbFileScanWalker, nsIRunnable)
+
+//-----------------------------------------------------------------------------
+sbFileScanWalker::sbFileScanWalker(PRBool aSearchHidden, PRBool aRecurse)
+: mSearchHidden(aSearchHidden)
+, mRecurse(aRecurse)
+, mMonitor(nsnull)
+, mBusyThreads(0)
+, mCancelled(PR_FALSE)
+{
+  MOZ_COUNT_CTOR(sbFileScanWalker);
+} //ctor
+
+//-----------------------------------------------------------------------------
+sbFileScanWalker::~sbFileScanWalker()
+{
+  MOZ_COUNT_DTOR(sbFileScanWalker);
+  if (mMonitor) {
+    nsAutoMonitor::DestroyMonitor(mMonitor);
+  }
+} //dtor
+
+//-----------------------------------------------------------------------------
+nsresult
+sbFileScanWalker::Init(const nsACString& aDirectory)
+{
+  mMonitor = nsAutoMonitor::NewMonitor("sbFileScanWalker::mMonitor");
+  NS_ENSURE_TRUE(mMonitor, NS_ERROR_OUT_OF_MEMORY);
+
+  NS_ENSURE_TRUE(mDirectories.AppendElement(aDirectory),
+                 NS_ERROR_OUT_OF_MEMORY);
+  return NS_OK;
+} //Init
+
+//-----------------------------------------------------------------------------
+NS_IMETHODIMP
+sbFileScanWalker::Run()
+{
+  nsTArray<nsCString> files;
+  nsTArray<nsCString> directories;
+
+  while (PR_TRUE) {
+    nsCString directory;
+    {
+      nsAutoMonitor mon(mMonitor);
+
+      // Wait for a directory to read, or for room for the files found
+      while (!mCancelled &&
+             (mFiles.Length() >= FILESCAN_WALKER_MAX_PENDING ||
+              (mDirectories.IsEmpty() && mBusyThreads))) {
+        mon.Wait();
+      }
+      if (IsDone()) {
+        mon.NotifyAll();
+        break;
+      }
+
+      // Take the most recently found directory, this keeps the walk close to
+      // depth first
+      PRUint32 last = mDirectories.Length() - 1;
+      directory = mDirectories[last];
+      mDirectories.RemoveElementAt(last);
+      mBusyThreads++;
+    }
+
+    ReadDirectory(directory, files, directories);
+
+    {
+      nsAutoMonitor mon(mMonitor);
+      mFiles.AppendElements(files);
+      mDirectories.AppendElements(directories);
+      mBusyThreads--;
+      mon.NotifyAll();
+    }
+
+    files.Clear();
+    directories.Clear();
+  }
+
+  return NS_OK;
+} //Run
+
+//-----------------------------------------------------------------------------
+void
+sbFileScanWalker::ReadDirectory(const nsCString& aDirectory,
+                                nsTArray<nsCString>& aFiles,
+                                nsTArray<nsCString>& aDirectories)
+{
+  DIR* dir = opendir(aDirectory.get());
+  if (!dir) {
+    LOG("sbFileScanWalker::ReadDirectory unable to open %s\n",
+        aDirectory.get());
+    return;
+  }
+
+  // A link back to an ancestor, or to a directory found elsewhere, leads to
+  // files that were or will be found under the directory's other path
+  struct stat dirSt;
+  if (!fstat(dirfd(dir), &dirSt)) {
+    nsAutoMonitor mon(mMonitor);
+    std::pair<dev_t, ino_t> id(dirSt.st_dev, dirSt.st_ino);
+    if (!mReadDirectories.insert(id).second) {
+      closedir(dir);
+      return;
+    }
+  }
+
+  struct dirent* entry;
+  while (!mCancelled && (entry = readdir(dir))) {
+    const char* name = entry->d_name;
+
+    // Skip "." and "..", and hidden entries unless asked for them
+    if (name[0] == '.') {
+      if (!name[1] || (name[1] == '.' && !name[2]) || !mSearchHidden) {
+        continue;
+      }
+    }
+
+    nsCString path(aDirectory);
+    if (!StringEndsWith(path, NS_LITERAL_CSTRING("/"))) {
+      path.Append('/');
+    }
+    path.Append(name);
+
+    PRBool isFile = PR_FALSE;
+    PRBool isDirectory = PR_FALSE;
+    switch (entry->d_type) {
+      case DT_REG:
+        isFile = PR_TRUE;
+        break;
+      case DT_DIR:
+        isDirectory = PR_TRUE;
+        break;
+      case DT_LNK:
+      case DT_UNKNOWN: {
+        // Follow links and ask for the type when the file system didn't
+        // give it
+        struct stat st;
+        if (stat(path.get(), &st)) {
+          break;
+        }
+        isFile = S_ISREG(st.st_mode);
+        isDirectory = S_ISDIR(st.st_mode);
+        break;
+      }
+      default:
+        // Devices, sockets and pipes are special files, skip them
+        break;
+    }
+
+    if (isFile) {
+      aFiles.AppendElement(path);
+    } else if (isDirectory && mRecurse) {
+      aDirectories.AppendElement(path);
+    }
+  }
+
+  closedir(dir);
+} //ReadDirectory
+
+//-----------------------------------------------------------------------------
+PRBool
+sbFileScanWalker::GetFiles(nsTArray<nsCString>& aFiles,
+                           PRIntervalTime aTimeout)
+{
+  nsAutoMonitor mon(mMonitor);
+
+  if (mFiles.IsEmpty() && !IsDone()) {
+    mon.Wait(aTimeout);
+  }
+
+  if (mFiles.IsEmpty()) {
+    return !IsDone();
+  }
+
+  aFiles.SwapElements(mFiles);
+
+  // Let the threads waiting for room go on
+  mon.NotifyAll();
+  return PR_TRUE;
+} //GetFiles
+
+//-----------------------------------------------------------------------------
+void
+sbFileScanWalker::Cancel()
+{
+  nsAutoMonitor mon(mMonitor);
+  mCancelled = PR_TRUE;
+  mon.NotifyAll();
+} //Cancel
+
+#endif
@@ -56,6 +56,12 @@
 #include <prmon.h>
 #include <nsIThread.h>
 #include <nsIRunnable.h>
+#include <nsTArray.h>
+
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+#include <sys/types.h>
+#include <set>
+#endif
 
 // DEFINES ====================================================================
 #define SONGBIRD_FILESCAN_CONTRACTID                     \
@@ -133,6 +139,81 @@ protected:
 };
 
 class sbIDirectoryEnumerator;
+class sbILibraryUtils;
+
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+
+/**
+ * \class sbFileScanWalker
+ * \brief Walks a directory tree with several threads at once.
+ *
+ * Directories are read with readdir, using the entry type it returns so
+ * that only symbolic links and entries of unknown type need a stat call.
+ * Subdirectories go into a queue shared by all the threads, and the paths
+ * of the files found are handed to the scanning thread in batches, so that
+ * nothing but the scanning thread touches XPCOM.
+ *
+ * The same walker is dispatched once to each thread of a thread pool.
+ */
+class sbFileScanWalker : public nsIRunnable
+{
+public:
+  NS_DECL_ISUPPORTS
+  NS_DECL_NSIRUNNABLE
+
+  sbFileScanWalker(PRBool aSearchHidden, PRBool aRecurse);
+
+  nsresult Init(const nsACString& aDirectory);
+
+  /**
+   * Wait for the paths of more files, at most aTimeout.
+   * \param aFiles Gets the native paths of the files found since the last
+   *               call
+   * \return PR_FALSE once the walk is over and all the paths were taken
+   */
+  PRBool GetFiles(nsTArray<nsCString>& aFiles, PRIntervalTime aTimeout);
+
+  /**
+   * Stop the walk, the threads return as soon as they are done with the
+   * directory they are reading.
+   */
+  void Cancel();
+
+private:
+  ~sbFileScanWalker();
+
+  void ReadDirectory(const nsCString& aDirectory,
+                     nsTArray<nsCString>& aFiles,
+                     nsTArray<nsCString>& aDirectories);
+
+  PRBool IsDone() {
+    return mCancelled || (mDirectories.IsEmpty() && !mBusyThreads);
+  }
+
+  PRBool mSearchHidden;
+  PRBool mRecurse;
+
+  // Protects everything below
+  PRMonitor* mMonitor;
+
+  // Directories waiting to be read
+  nsTArray<nsCString> mDirectories;
+
+  // Files found and not taken yet
+  nsTArray<nsCString> mFiles;
+
+  // Number of threads reading a directory
+  PRUint32 mBusyThreads;
+
+  PRBool mCancelled;
+
+  // Device and inode of the directories read, so a directory reached again
+  // through a symbolic link isn't read twice and links can't make the walk
+  // loop
+  std::set<std::pair<dev_t, ino_t> > mReadDirectories;
+};
+
+#endif
 
 /**
  * \class sbFileScan
@@ -163,6 +244,19 @@ protected:
   //
   nsresult ScanDirectory(sbIFileScanQuery *pQuery);
 
+#if defined(XP_UNIX) && !defined(XP_MACOSX)
+  //
+  // @brief Recursive part of ScanDirectory, done with a sbFileScanWalker.
+  //
+  nsresult ScanDirectoryNative(sbIFileScanQuery *pQuery,
+                               nsILocalFile *pDirectory,
+                               sbIFileScanCallback *pCallback,
+                               sbILibraryUtils *pLibraryUtils,
+                               PRBool bWantLibraryContentURIs,
+                               PRBool bSearchHidden,
+                               PRBool bRecurse);
+#endif
+
   // Typedefs
   typedef std::deque<sbIFileScanQuery *>      queryqueue_t;
   typedef std::deque<sbIDirectoryEnumerator *>   dirstack_t;
@@ -0,0 +1,144 @@
+/*
+//
+// BEGIN SONGBIRD GPL
+//
+// This file is part of the Songbird web player.
+//
+// Copyright(c) 2005-2008 POTI, Inc.
+// http://songbirdnest.com
+//
+// This file may be licensed under the terms of of the
+// GNU General Public License Version 2 (the "GPL").
+//
+// Software distributed under the License is distributed
+// on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, either
+// express or implied. See the GPL for the specific language
+// governing rights and limitations.
+//
+// You should have received a copy of the GPL along with this
+// program. If not, go to http://www.gnu.org/licenses/gpl.html
+// or write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+// END SONGBIRD GPL
+//
+*/
+
+/**
+ * \brief Test that a scan walks a tree with symbolic links looping back to
+ *        an ancestor and dangling ones, reporting every file exactly once.
+ */
+
+// Files of the fixture tree, relative to its root
+var gFiles = [
+  "a.mp3",
+  "sub/b.mp3",
+  "sub/deeper/c.mp3",
+  "sub/deeper/deepest/d.mp3",
+  "other/e.mp3"
+];
+
+// Symbolic links of the fixture tree, [path, target]
+var gLinks = [
+  // back to the root of the scan
+  ["sub/deeper/loop", "../.."],
+  // back to the parent directory
+  ["sub/deeper/deepest/up", ".."],
+  // dangling, to a file and to a directory
+  ["sub/dangling.mp3", "missing.mp3"],
+  ["other/dangling", "missing"]
+];
+
+// How long the scan gets to finish
+const SCAN_TIMEOUT = 30000;
+
+function runTest () {
+  // The native walk following links only runs on Linux
+  if (getPlatform() != "Linux") {
+    skip("symbolic links are only tested on Linux");
+  }
+
+  var root = Cc["@mozilla.org/file/directory_service;1"]
+               .getService(Ci.nsIProperties)
+               .get("TmpD", Ci.nsIFile);
+  root.append("songbird_filescan_tests.tmp");
+  root.createUnique(Ci.nsIFile.DIRECTORY_TYPE, 0777);
+
+  try {
+    var expected = {};
+    for each (let path in gFiles) {
+      let file = getChild(root, path);
+      file.create(Ci.nsIFile.NORMAL_FILE_TYPE, 0644);
+      expected[newFileURI(file).spec] = false;
+    }
+
+    for each (let link in gLinks) {
+      makeLink(getChild(root, link[0]), link[1]);
+    }
+
+    var scan = Cc["@songbirdnest.com/Songbird/FileScan;1"]
+                 .createInstance(Ci.sbIFileScan);
+    var query = Cc["@songbirdnest.com/Songbird/FileScanQuery;1"]
+                  .createInstance(Ci.sbIFileScanQuery);
+    query.setDirectory(root.path);
+    query.setRecurse(true);
+    query.addFileExtension("mp3");
+    query.wantLibraryContentURIs = false;
+
+    scan.submitQuery(query);
+
+    // A walk going around the loops would never finish
+    var start = Date.now();
+    while (query.isScanning()) {
+      assertTrue(Date.now() - start < SCAN_TIMEOUT,
+                 "the scan didn't finish");
+      sleep(100, true);
+    }
+    scan.finalize();
+
+    var count = query.getFileCount();
+    for (let i = 0; i < count; i++) {
+      let spec = query.getFilePath(i);
+      log("found " + spec);
+      assertTrue(spec in expected, "unexpected file " + spec);
+      assertFalse(expected[spec], "file reported twice " + spec);
+      expected[spec] = true;
+    }
+    assertEqual(gFiles.length, count);
+  }
+  finally {
+    // Remove the links first, a recursive remove would follow them
+    for each (let link in gLinks) {
+      let file = getChild(root, link[0]);
+      try {
+        if (file.isSymlink()) {
+          file.remove(false);
+        }
+      }
+      catch (e) {
+        // never made
+      }
+    }
+    root.remove(true);
+  }
+}
+
+function getChild(aRoot, aPath) {
+  var file = aRoot.clone();
+  for each (let part in aPath.split("/")) {
+    file.append(part);
+  }
+  return file;
+}
+
+function makeLink(aLink, aTarget) {
+  var ln = Cc["@mozilla.org/file/local;1"].createInstance(Ci.nsILocalFile);
+  ln.initWithPath("/bin/ln");
+
+  var process = Cc["@mozilla.org/process/util;1"]
+                  .createInstance(Ci.nsIProcess);
+  process.init(ln);
+  var args = ["-s", aTarget, aLink.path];
+  process.run(true, args, args.length);
+  assertEqual(0, process.exitValue, "couldn't link " + aLink.path);
+}
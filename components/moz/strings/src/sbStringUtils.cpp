@@ -76,9 +76,10 @@ nsString_ToInt64(const nsAString& str, nsresult* rv)
   }
 
 #ifdef DEBUG
-  nsString check;
-  AppendInt(check, result);
-  NS_ASSERTION(check.Equals(str), "Conversion failed");
+  // AppendInt is unsigned, format by hand so negative values check out too
+  char buf[32];
+  PR_snprintf(buf, sizeof(buf), "%lld", result);
+  NS_ASSERTION(NS_ConvertASCIItoUTF16(buf).Equals(str), "Conversion failed");
 #endif
 
   if (rv) {